@@ -1,91 +1,66 @@
 #include "sax-example.h"
 
-static void parse_element(mpack_reader_t* reader, int depth,
-        const sax_callbacks_t* callbacks, void* context);
-
 bool parse_messagepack(const char* data, size_t length,
         const sax_callbacks_t* callbacks, void* context)
 {
     mpack_reader_t reader;
     mpack_reader_init_data(&reader, data, length);
-    parse_element(&reader, 0, callbacks, context);
-    return mpack_ok == mpack_reader_destroy(&reader);
-}
-
-static void parse_element(mpack_reader_t* reader, int depth,
-        const sax_callbacks_t* callbacks, void* context)
-{
-    if (depth >= 32) { // critical check!
-        mpack_reader_flag_error(reader, mpack_error_too_big);
-        return;
-    }
 
-    mpack_tag_t tag = mpack_read_tag(reader);
-    if (mpack_reader_error(reader) != mpack_ok)
-        return;
-
-    switch (mpack_tag_type(&tag)) {
-        case mpack_type_nil:
-            callbacks->nil_element(context, depth);
-            break;
-        case mpack_type_bool:
-            callbacks->bool_element(context, depth, mpack_tag_bool_value(&tag));
-            break;
-        case mpack_type_int:
-            callbacks->int_element(context, depth, mpack_tag_int_value(&tag));
-            break;
-        case mpack_type_uint:
-            callbacks->uint_element(context, depth, mpack_tag_uint_value(&tag));
-            break;
-
-        case mpack_type_str: {
-            uint32_t length = mpack_tag_str_length(&tag);
-            const char* data = mpack_read_bytes_inplace(reader, length);
-            callbacks->string_element(context, depth, data, length);
-            mpack_done_str(reader);
-            break;
+    // The event parser is not recursive. The maximum depth is the size of
+    // the stack we give it; deeper data flags mpack_error_too_big.
+    mpack_event_frame_t stack[32];
+    mpack_event_parser_t parser;
+    mpack_event_parser_init(&parser, &reader, stack, sizeof(stack) / sizeof(*stack));
+
+    mpack_event_t event;
+    while (mpack_event_next(&parser, &event)) {
+        int depth = (int)event.depth;
+        const mpack_tag_t* tag = &event.tag;
+
+        switch (event.type) {
+            case mpack_event_start_map:
+                callbacks->start_map(context, depth, tag->v.n);
+                continue;
+            case mpack_event_start_array:
+                callbacks->start_array(context, depth, tag->v.n);
+                continue;
+            case mpack_event_finish_map:
+                callbacks->finish_map(context, depth);
+                continue;
+            case mpack_event_finish_array:
+                callbacks->finish_array(context, depth);
+                continue;
+            case mpack_event_value:
+                break;
         }
 
-        case mpack_type_bin: {
-            uint32_t length = mpack_tag_bin_length(&tag);
-            const char* data = mpack_read_bytes_inplace(reader, length);
-            callbacks->bin_element(context, depth, data, length);
-            mpack_done_bin(reader);
-            break;
+        switch (tag->type) {
+            case mpack_type_nil:
+                callbacks->nil_element(context, depth);
+                break;
+            case mpack_type_bool:
+                callbacks->bool_element(context, depth, tag->v.b);
+                break;
+            case mpack_type_int:
+                callbacks->int_element(context, depth, tag->v.i);
+                break;
+            case mpack_type_uint:
+                callbacks->uint_element(context, depth, tag->v.u);
+                break;
+            case mpack_type_str:
+                callbacks->string_element(context, depth, event.data, tag->v.l);
+                break;
+            case mpack_type_bin:
+                callbacks->bin_element(context, depth, event.data, tag->v.l);
+                break;
+            default:
+                fprintf(stderr, "Error: type %s not implemented by this example SAX parser.\n",
+                        mpack_type_to_string(tag->type));
+                exit(1);
         }
-
-        case mpack_type_array: {
-            uint32_t count = mpack_tag_array_count(&tag);
-            callbacks->start_array(context, depth, count);
-            while (count-- > 0) {
-                parse_element(reader, depth + 1, callbacks, context);
-                if (mpack_reader_error(reader) != mpack_ok) // critical check!
-                    break;
-            }
-            callbacks->finish_array(context, depth);
-            mpack_done_array(reader);
-            break;
-        }
-
-        case mpack_type_map: {
-            uint32_t count = mpack_tag_map_count(&tag);
-            callbacks->start_map(context, depth, count);
-            while (count-- > 0) {
-                parse_element(reader, depth + 1, callbacks, context);
-                parse_element(reader, depth + 1, callbacks, context);
-                if (mpack_reader_error(reader) != mpack_ok) // critical check!
-                    break;
-            }
-            callbacks->finish_map(context, depth);
-            mpack_done_map(reader);
-            break;
-        }
-
-        default:
-            fprintf(stderr, "Error: type %s not implemented by this example SAX parser.\n",
-                    mpack_type_to_string(mpack_tag_type(&tag)));
-            exit(1);
     }
+
+    return mpack_ok == mpack_reader_destroy(&reader);
 }
 
 #define SAX_EXAMPLE_TEST 1
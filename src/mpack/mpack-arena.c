@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define MPACK_INTERNAL 1
+
+#include "mpack-arena.h"
+
+MPACK_SILENCE_WARNINGS_BEGIN
+
+#ifdef MPACK_MALLOC
+
+// Blocks are aligned for the most strictly aligned of the types MPack stores
+// in allocated memory.
+typedef union mpack_arena_align_t {
+    void* p;
+    size_t s;
+    uint64_t u;
+    #if MPACK_DOUBLE
+    double d;
+    #endif
+} mpack_arena_align_t;
+
+#ifdef MPACK_ALIGNOF
+    #define MPACK_ARENA_ALIGNMENT MPACK_ALIGNOF(mpack_arena_align_t)
+#else
+    #define MPACK_ARENA_ALIGNMENT sizeof(mpack_arena_align_t)
+#endif
+
+MPACK_STATIC_INLINE size_t mpack_arena_align(size_t size) {
+    return (size + (MPACK_ARENA_ALIGNMENT - 1)) & ~(size_t)(MPACK_ARENA_ALIGNMENT - 1);
+}
+
+// The size of a chunk header, padded so that the data that follows it is
+// aligned.
+#define MPACK_ARENA_HEADER_SIZE (mpack_arena_align(sizeof(mpack_arena_chunk_t)))
+
+MPACK_STATIC_INLINE size_t mpack_arena_left(mpack_arena_t* arena) {
+    return (arena->position == NULL) ? 0 : (size_t)(arena->end - arena->position);
+}
+
+static void* mpack_arena_allocator_alloc(void* context, size_t size) {
+    return mpack_arena_alloc((mpack_arena_t*)context, size);
+}
+
+static void* mpack_arena_allocator_realloc(void* context, void* ptr, size_t used_size, size_t new_size) {
+    mpack_arena_t* arena = (mpack_arena_t*)context;
+
+    // the most recent block can be resized in place if it fits
+    if (ptr != NULL && (char*)ptr == arena->last) {
+        size_t aligned = mpack_arena_align(new_size);
+        if (aligned >= new_size && aligned <= (size_t)(arena->end - arena->last)) {
+            arena->used = arena->used - (size_t)(arena->position - arena->last) + aligned;
+            arena->position = arena->last + aligned;
+            return ptr;
+        }
+    }
+
+    void* new_ptr = mpack_arena_alloc(arena, new_size);
+    if (new_ptr != NULL && ptr != NULL)
+        mpack_memcpy(new_ptr, ptr, (used_size < new_size) ? used_size : new_size);
+    return new_ptr;
+}
+
+void mpack_arena_init(mpack_arena_t* arena, size_t chunk_size, const mpack_allocator_t* backing) {
+    mpack_assert(chunk_size >= MPACK_ARENA_HEADER_SIZE * 8, "chunk size %i is too small!", (int)chunk_size);
+    mpack_memset(arena, 0, sizeof(*arena));
+    arena->allocator.alloc_fn = &mpack_arena_allocator_alloc;
+    arena->allocator.realloc_fn = &mpack_arena_allocator_realloc;
+    arena->allocator.free_fn = NULL;
+    arena->allocator.context = arena;
+    arena->backing = backing;
+    arena->chunk_size = chunk_size;
+}
+
+static void mpack_arena_free_chunks(mpack_arena_t* arena, mpack_arena_chunk_t* chunk) {
+    while (chunk != NULL) {
+        mpack_arena_chunk_t* next = chunk->next;
+        mpack_allocator_free(arena->backing, chunk);
+        chunk = next;
+    }
+}
+
+void mpack_arena_destroy(mpack_arena_t* arena) {
+    mpack_arena_free_chunks(arena, arena->chunks);
+    mpack_arena_free_chunks(arena, arena->large);
+    arena->chunks = NULL;
+    arena->large = NULL;
+    arena->position = NULL;
+    arena->end = NULL;
+    arena->last = NULL;
+    arena->used = 0;
+}
+
+void mpack_arena_reset(mpack_arena_t* arena) {
+    mpack_arena_free_chunks(arena, arena->large);
+    arena->large = NULL;
+    arena->last = NULL;
+    arena->used = 0;
+
+    mpack_arena_chunk_t* chunk = arena->chunks;
+    if (chunk == NULL)
+        return;
+    mpack_arena_free_chunks(arena, chunk->next);
+    chunk->next = NULL;
+    arena->position = (char*)chunk + MPACK_ARENA_HEADER_SIZE;
+    arena->end = (char*)chunk + arena->chunk_size;
+}
+
+// Gives an allocation that is too large for a regular chunk its own chunk.
+// This doesn't disturb the free space of the current chunk.
+static void* mpack_arena_alloc_large(mpack_arena_t* arena, size_t aligned) {
+    if (aligned > SIZE_MAX - MPACK_ARENA_HEADER_SIZE)
+        return NULL;
+    mpack_arena_chunk_t* chunk = (mpack_arena_chunk_t*)mpack_allocator_alloc(arena->backing,
+            MPACK_ARENA_HEADER_SIZE + aligned);
+    if (chunk == NULL)
+        return NULL;
+    mpack_log("arena %p allocated large chunk %p of size %i\n", (void*)arena, (void*)chunk, (int)aligned);
+    chunk->next = arena->large;
+    arena->large = chunk;
+    arena->used += aligned;
+    return (char*)chunk + MPACK_ARENA_HEADER_SIZE;
+}
+
+void* mpack_arena_alloc(mpack_arena_t* arena, size_t size) {
+    size_t aligned = mpack_arena_align(size);
+    if (aligned < size)
+        return NULL;
+
+    if (aligned > mpack_arena_left(arena)) {
+        if (aligned > (arena->chunk_size - MPACK_ARENA_HEADER_SIZE) / 4)
+            return mpack_arena_alloc_large(arena, aligned);
+
+        mpack_arena_chunk_t* chunk = (mpack_arena_chunk_t*)mpack_allocator_alloc(arena->backing,
+                arena->chunk_size);
+        if (chunk == NULL)
+            return NULL;
+        mpack_log("arena %p allocated chunk %p\n", (void*)arena, (void*)chunk);
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->position = (char*)chunk + MPACK_ARENA_HEADER_SIZE;
+        arena->end = (char*)chunk + arena->chunk_size;
+    }
+
+    char* p = arena->position;
+    arena->position += aligned;
+    arena->last = p;
+    arena->used += aligned;
+    return p;
+}
+
+#endif
+
+MPACK_SILENCE_WARNINGS_END
@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file
+ *
+ * Declares the MPack arena allocator.
+ */
+
+#ifndef MPACK_ARENA_H
+#define MPACK_ARENA_H 1
+
+#include "mpack-common.h"
+
+MPACK_SILENCE_WARNINGS_BEGIN
+MPACK_EXTERN_C_BEGIN
+
+#ifdef MPACK_MALLOC
+
+/**
+ * @defgroup arena Arena Allocator
+ *
+ * An arena is a bump allocator for request-scoped data. Memory is carved out
+ * of large chunks, individual blocks are never freed, and everything
+ * allocated from the arena is released at once with mpack_arena_reset().
+ *
+ * An arena provides a @ref mpack_allocator_t that can be attached to any
+ * number of readers, writers, trees and documents (see
+ * mpack_arena_allocator()). For
+ * example, to decode a request with a tree and free the tree's pages and
+ * every string it allocated in one step:
+ *
+ * @code{.c}
+ * mpack_tree_init_data(&tree, data, length);
+ * mpack_tree_set_allocator(&tree, mpack_arena_allocator(&arena));
+ * mpack_tree_parse(&tree);
+ * char* name = mpack_node_cstr_alloc(mpack_node_map_cstr(root, "name"), 256);
+ * // ...
+ * mpack_tree_destroy(&tree);
+ * mpack_arena_reset(&arena);
+ * @endcode
+ *
+ * Chunks are allocated from a backing allocator, which defaults to @ref
+ * MPACK_MALLOC. To back an arena with huge pages, pass a backing allocator
+ * that maps huge pages along with a chunk size that is a multiple of the
+ * huge page size.
+ *
+ * An arena is not thread-safe. Use one arena per thread or per request.
+ *
+ * This requires @ref MPACK_MALLOC.
+ *
+ * @{
+ */
+
+/**
+ * A bump allocator that frees all of its allocations at once.
+ *
+ * @see mpack_arena_init()
+ */
+typedef struct mpack_arena_t mpack_arena_t;
+
+/* Hide internals from documentation */
+/** @cond */
+
+typedef struct mpack_arena_chunk_t mpack_arena_chunk_t;
+
+struct mpack_arena_chunk_t {
+    mpack_arena_chunk_t* next; /* The next chunk */
+};
+
+struct mpack_arena_t {
+    mpack_allocator_t allocator;      /* Allocator that allocates from this arena */
+    const mpack_allocator_t* backing; /* Allocator for chunks, or NULL */
+    size_t chunk_size;                /* The size of regular chunks */
+    mpack_arena_chunk_t* chunks;      /* Regular chunks, the current one first */
+    mpack_arena_chunk_t* large;       /* Chunks for allocations too large for regular chunks */
+    char* position;                   /* The free space in the current chunk */
+    char* end;
+    char* last;                       /* The most recent allocation, which can grow in place */
+    size_t used;                      /* Bytes allocated since the last reset */
+};
+
+/** @endcond */
+
+/**
+ * Initializes an empty arena. Nothing is allocated until the first
+ * allocation is made.
+ *
+ * @param arena The arena to initialize.
+ * @param chunk_size The size of the chunks to allocate from the backing
+ *     allocator. Allocations larger than a quarter of this size are given
+ *     their own chunk.
+ * @param backing The allocator from which to allocate chunks, or NULL to
+ *     use @ref MPACK_MALLOC.
+ */
+void mpack_arena_init(mpack_arena_t* arena, size_t chunk_size, const mpack_allocator_t* backing);
+
+/**
+ * Frees all memory of the arena, including its chunks.
+ */
+void mpack_arena_destroy(mpack_arena_t* arena);
+
+/**
+ * Releases all allocations made from the arena at once.
+ *
+ * The first chunk is kept to serve subsequent allocations; all other chunks
+ * are returned to the backing allocator.
+ */
+void mpack_arena_reset(mpack_arena_t* arena);
+
+/**
+ * Allocates a block from the arena, returning NULL if a new chunk is needed
+ * and cannot be allocated.
+ *
+ * Blocks are aligned suitably for any type used by MPack. They remain valid
+ * until the arena is reset or destroyed.
+ */
+void* mpack_arena_alloc(mpack_arena_t* arena, size_t size);
+
+/**
+ * Returns an allocator that allocates from the arena.
+ *
+ * Attach it to a reader, writer, tree or document with
+ * mpack_reader_set_allocator(), mpack_writer_set_allocator(),
+ * mpack_tree_set_allocator(), mpack_doc_set_allocator() or
+ * mpack_writer_init_growable_allocator(). Freeing a block with this allocator
+ * does nothing, and growing the most recent block extends it in place when
+ * there is room.
+ *
+ * The arena must not be reset while any instance using it may still access
+ * memory it allocated.
+ */
+MPACK_INLINE const mpack_allocator_t* mpack_arena_allocator(mpack_arena_t* arena) {
+    return &arena->allocator;
+}
+
+/**
+ * Returns the number of bytes allocated from the arena since it was
+ * initialized or last reset, including alignment padding.
+ */
+MPACK_INLINE size_t mpack_arena_used(const mpack_arena_t* arena) {
+    return arena->used;
+}
+
+/**
+ * @}
+ */
+
+#endif
+
+MPACK_EXTERN_C_END
+MPACK_SILENCE_WARNINGS_END
+
+#endif
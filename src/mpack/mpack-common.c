@@ -356,6 +356,24 @@ void mpack_tag_debug_describe(mpack_tag_t tag, char* buffer, size_t buffer_size)
 
 
 
+#ifdef MPACK_MALLOC
+void* mpack_allocator_realloc(const mpack_allocator_t* allocator, void* ptr, size_t used_size, size_t new_size) {
+    if (allocator == NULL)
+        return mpack_realloc(ptr, used_size, new_size);
+    if (allocator->realloc_fn != NULL)
+        return allocator->realloc_fn(allocator->context, ptr, used_size, new_size);
+
+    void* new_ptr = allocator->alloc_fn(allocator->context, new_size);
+    if (new_ptr == NULL)
+        return NULL;
+    if (ptr != NULL) {
+        mpack_memcpy(new_ptr, ptr, used_size);
+        mpack_allocator_free(allocator, ptr);
+    }
+    return new_ptr;
+}
+#endif
+
 #if MPACK_READ_TRACKING || MPACK_WRITE_TRACKING
 
 #ifndef MPACK_TRACKING_INITIAL_CAPACITY
@@ -704,6 +722,251 @@ bool mpack_str_check_no_null(const char* str, size_t bytes) {
     return true;
 }
 
+/*
+ * Hashing
+ *
+ * This is XXH64. Long inputs are hashed in four independent lanes of 8-byte
+ * words so that the compiler can interleave (or vectorize) the
+ * multiplications. Words are loaded as little-endian so that hashes are the
+ * same on all platforms.
+ */
+
+#define MPACK_HASH_PRIME1 MPACK_UINT64_C(0x9E3779B185EBCA87)
+#define MPACK_HASH_PRIME2 MPACK_UINT64_C(0xC2B2AE3D27D4EB4F)
+#define MPACK_HASH_PRIME3 MPACK_UINT64_C(0x165667B19E3779F9)
+#define MPACK_HASH_PRIME4 MPACK_UINT64_C(0x85EBCA77C2B2AE63)
+#define MPACK_HASH_PRIME5 MPACK_UINT64_C(0x27D4EB2F165667C5)
+
+MPACK_STATIC_INLINE uint64_t mpack_hash_rotl(uint64_t x, unsigned r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+MPACK_STATIC_INLINE uint64_t mpack_hash_load_le64(const char* p) {
+    const uint8_t* u = (const uint8_t*)p;
+    return  (uint64_t)u[0]        | ((uint64_t)u[1] << 8)  |
+           ((uint64_t)u[2] << 16) | ((uint64_t)u[3] << 24) |
+           ((uint64_t)u[4] << 32) | ((uint64_t)u[5] << 40) |
+           ((uint64_t)u[6] << 48) | ((uint64_t)u[7] << 56);
+}
+
+MPACK_STATIC_INLINE uint64_t mpack_hash_load_le32(const char* p) {
+    const uint8_t* u = (const uint8_t*)p;
+    return (uint64_t)u[0] | ((uint64_t)u[1] << 8) | ((uint64_t)u[2] << 16) | ((uint64_t)u[3] << 24);
+}
+
+MPACK_STATIC_INLINE uint64_t mpack_hash_round(uint64_t acc, uint64_t input) {
+    acc += input * MPACK_HASH_PRIME2;
+    return mpack_hash_rotl(acc, 31) * MPACK_HASH_PRIME1;
+}
+
+MPACK_STATIC_INLINE uint64_t mpack_hash_merge(uint64_t acc, uint64_t lane) {
+    acc ^= mpack_hash_round(0, lane);
+    return acc * MPACK_HASH_PRIME1 + MPACK_HASH_PRIME4;
+}
+
+MPACK_STATIC_INLINE uint64_t mpack_hash_avalanche(uint64_t h) {
+    h ^= h >> 33;
+    h *= MPACK_HASH_PRIME2;
+    h ^= h >> 29;
+    h *= MPACK_HASH_PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+// Hashes as many whole 32-byte stripes as possible, returning the number of
+// bytes consumed.
+static size_t mpack_hash_stripes(uint64_t* lanes, const char* data, size_t length) {
+    uint64_t v1 = lanes[0], v2 = lanes[1], v3 = lanes[2], v4 = lanes[3];
+    const char* p = data;
+    const char* end = data + (length & ~(size_t)31);
+    while (p != end) {
+        v1 = mpack_hash_round(v1, mpack_hash_load_le64(p));
+        v2 = mpack_hash_round(v2, mpack_hash_load_le64(p + 8));
+        v3 = mpack_hash_round(v3, mpack_hash_load_le64(p + 16));
+        v4 = mpack_hash_round(v4, mpack_hash_load_le64(p + 24));
+        p += 32;
+    }
+    lanes[0] = v1; lanes[1] = v2; lanes[2] = v3; lanes[3] = v4;
+    return (size_t)(p - data);
+}
+
+void mpack_hasher_init(mpack_hasher_t* hasher, uint64_t seed) {
+    hasher->lanes[0] = seed + MPACK_HASH_PRIME1 + MPACK_HASH_PRIME2;
+    hasher->lanes[1] = seed + MPACK_HASH_PRIME2;
+    hasher->lanes[2] = seed;
+    hasher->lanes[3] = seed - MPACK_HASH_PRIME1;
+    hasher->seed = seed;
+    hasher->total = 0;
+    hasher->tail_length = 0;
+}
+
+void mpack_hasher_update(mpack_hasher_t* hasher, const char* data, size_t length) {
+    hasher->total += length;
+
+    // fill up a pending stripe first
+    if (hasher->tail_length > 0) {
+        size_t step = sizeof(hasher->tail) - hasher->tail_length;
+        if (step > length)
+            step = length;
+        mpack_memcpy(hasher->tail + hasher->tail_length, data, step);
+        hasher->tail_length += step;
+        data += step;
+        length -= step;
+        if (hasher->tail_length < sizeof(hasher->tail))
+            return;
+        mpack_hash_stripes(hasher->lanes, hasher->tail, sizeof(hasher->tail));
+        hasher->tail_length = 0;
+    }
+
+    size_t used = mpack_hash_stripes(hasher->lanes, data, length);
+    if (used < length)
+        mpack_memcpy(hasher->tail, data + used, length - used);
+    hasher->tail_length = length - used;
+}
+
+void mpack_hasher_update_u64(mpack_hasher_t* hasher, uint64_t value) {
+    char bytes[8];
+    size_t i;
+    for (i = 0; i < sizeof(bytes); ++i)
+        bytes[i] = (char)(uint8_t)(value >> (i * 8));
+    mpack_hasher_update(hasher, bytes, sizeof(bytes));
+}
+
+uint64_t mpack_hasher_finish(mpack_hasher_t* hasher) {
+    uint64_t h;
+    if (hasher->total >= sizeof(hasher->tail)) {
+        const uint64_t* lanes = hasher->lanes;
+        h = mpack_hash_rotl(lanes[0], 1) + mpack_hash_rotl(lanes[1], 7) +
+            mpack_hash_rotl(lanes[2], 12) + mpack_hash_rotl(lanes[3], 18);
+        h = mpack_hash_merge(h, lanes[0]);
+        h = mpack_hash_merge(h, lanes[1]);
+        h = mpack_hash_merge(h, lanes[2]);
+        h = mpack_hash_merge(h, lanes[3]);
+    } else {
+        h = hasher->seed + MPACK_HASH_PRIME5;
+    }
+    h += hasher->total;
+
+    const char* p = hasher->tail;
+    size_t left = hasher->tail_length;
+    for (; left >= 8; p += 8, left -= 8) {
+        h ^= mpack_hash_round(0, mpack_hash_load_le64(p));
+        h = mpack_hash_rotl(h, 27) * MPACK_HASH_PRIME1 + MPACK_HASH_PRIME4;
+    }
+    if (left >= 4) {
+        h ^= mpack_hash_load_le32(p) * MPACK_HASH_PRIME1;
+        h = mpack_hash_rotl(h, 23) * MPACK_HASH_PRIME2 + MPACK_HASH_PRIME3;
+        p += 4;
+        left -= 4;
+    }
+    for (; left > 0; ++p, --left) {
+        h ^= (uint64_t)(uint8_t)*p * MPACK_HASH_PRIME5;
+        h = mpack_hash_rotl(h, 11) * MPACK_HASH_PRIME1;
+    }
+
+    return mpack_hash_avalanche(h);
+}
+
+uint64_t mpack_hash_data(const char* data, size_t length, uint64_t seed) {
+    mpack_hasher_t hasher;
+    mpack_hasher_init(&hasher, seed);
+    mpack_hasher_update(&hasher, data, length);
+    return mpack_hasher_finish(&hasher);
+}
+
+// Type codes for structural hashing. Signed and unsigned ints share codes by
+// sign rather than by type, and floats are widened to doubles when possible.
+enum {
+    mpack_hash_code_nil,
+    mpack_hash_code_bool,
+    mpack_hash_code_negative,
+    mpack_hash_code_nonnegative,
+    mpack_hash_code_double,
+    mpack_hash_code_float,
+    mpack_hash_code_str,
+    mpack_hash_code_bin,
+    mpack_hash_code_ext,
+    mpack_hash_code_array,
+    mpack_hash_code_map
+};
+
+MPACK_STATIC_INLINE void mpack_hasher_code(mpack_hasher_t* hasher, int code, uint64_t value) {
+    char byte = (char)code;
+    mpack_hasher_update(hasher, &byte, 1);
+    mpack_hasher_update_u64(hasher, value);
+}
+
+void mpack_hasher_tag(mpack_hasher_t* hasher, mpack_tag_t tag) {
+    switch (tag.type) {
+        case mpack_type_missing:
+        case mpack_type_nil:
+            mpack_hasher_code(hasher, mpack_hash_code_nil, 0);
+            return;
+        case mpack_type_bool:
+            mpack_hasher_code(hasher, mpack_hash_code_bool, tag.v.b ? 1 : 0);
+            return;
+        case mpack_type_int:
+            if (tag.v.i < 0) {
+                mpack_hasher_code(hasher, mpack_hash_code_negative, (uint64_t)tag.v.i);
+                return;
+            }
+            mpack_hasher_code(hasher, mpack_hash_code_nonnegative, (uint64_t)tag.v.i);
+            return;
+        case mpack_type_uint:
+            mpack_hasher_code(hasher, mpack_hash_code_nonnegative, tag.v.u);
+            return;
+
+        case mpack_type_float: {
+            #if MPACK_FLOAT && MPACK_DOUBLE
+            char bytes[8];
+            mpack_store_double(bytes, (double)tag.v.f);
+            mpack_hasher_code(hasher, mpack_hash_code_double, mpack_load_u64(bytes));
+            #elif MPACK_FLOAT
+            char bytes[4];
+            mpack_store_float(bytes, tag.v.f);
+            mpack_hasher_code(hasher, mpack_hash_code_float, mpack_load_u32(bytes));
+            #else
+            mpack_hasher_code(hasher, mpack_hash_code_float, tag.v.f);
+            #endif
+            return;
+        }
+        case mpack_type_double: {
+            #if MPACK_DOUBLE
+            char bytes[8];
+            mpack_store_double(bytes, tag.v.d);
+            mpack_hasher_code(hasher, mpack_hash_code_double, mpack_load_u64(bytes));
+            #else
+            mpack_hasher_code(hasher, mpack_hash_code_double, tag.v.d);
+            #endif
+            return;
+        }
+
+        case mpack_type_str:
+            mpack_hasher_code(hasher, mpack_hash_code_str, tag.v.l);
+            return;
+        case mpack_type_bin:
+            mpack_hasher_code(hasher, mpack_hash_code_bin, tag.v.l);
+            return;
+        #if MPACK_EXTENSIONS
+        case mpack_type_ext:
+            mpack_hasher_code(hasher, mpack_hash_code_ext,
+                    ((uint64_t)(uint8_t)tag.exttype << 32) | tag.v.l);
+            return;
+        #endif
+        case mpack_type_array:
+            mpack_hasher_code(hasher, mpack_hash_code_array, tag.v.n);
+            return;
+        case mpack_type_map:
+            mpack_hasher_code(hasher, mpack_hash_code_map, tag.v.n);
+            return;
+    }
+}
+
+uint64_t mpack_hash_pair(uint64_t key, uint64_t value) {
+    uint64_t h = mpack_hash_round(key * MPACK_HASH_PRIME5, value);
+    return mpack_hash_avalanche(h ^ mpack_hash_rotl(key, 29));
+}
+
 #if MPACK_DEBUG && MPACK_STDIO
 void mpack_print_append(mpack_print_t* print, const char* data, size_t count) {
 
@@ -685,6 +685,17 @@ MPACK_INLINE bool mpack_tag_equal(mpack_tag_t left, mpack_tag_t right) {
     return mpack_tag_cmp(left, right) == 0;
 }
 
+/**
+ * Returns a 64-bit hash of the given bytes.
+ *
+ * This is a fast non-cryptographic hash (XXH64), suitable for hash tables and
+ * caches but not for security. The result is the same on all platforms.
+ *
+ * @see mpack_node_hash()
+ * @see mpack_read_hash()
+ */
+uint64_t mpack_hash_data(const char* data, size_t length, uint64_t seed);
+
 #if MPACK_DEBUG && MPACK_STDIO
 /**
  * Generates a json-like debug description of the given tag into the given buffer.
@@ -833,6 +844,78 @@ MPACK_INLINE mpack_tag_t mpack_tag_ext(int8_t exttype, int32_t length) {
  * @}
  */
 
+#ifdef MPACK_MALLOC
+/**
+ * @name Allocators
+ * @{
+ */
+
+/**
+ * A custom allocator that can be attached to an individual reader, writer or
+ * tree with mpack_reader_set_allocator(), mpack_writer_set_allocator() or
+ * mpack_tree_set_allocator().
+ *
+ * An instance without an allocator uses @ref MPACK_MALLOC, @ref MPACK_REALLOC
+ * and @ref MPACK_FREE. An allocator lets you route the memory of a single
+ * instance elsewhere (for example to a per-thread or per-request arena) without
+ * changing these macros for the whole library.
+ *
+ * The allocator is not copied. It must remain valid for as long as any
+ * instance uses it, and for as long as any memory allocated from it is live.
+ */
+typedef struct mpack_allocator_t {
+
+    /**
+     * Allocates a block of at least the given size, returning NULL on
+     * failure. This is required.
+     */
+    void* (*alloc_fn)(void* context, size_t size);
+
+    /**
+     * Resizes a block, returning the new block or NULL on failure. On
+     * failure the old block is left unchanged.
+     *
+     * The first used_size bytes of the block must be preserved. This may be
+     * NULL, in which case a new block is allocated and the used bytes are
+     * copied.
+     */
+    void* (*realloc_fn)(void* context, void* ptr, size_t used_size, size_t new_size);
+
+    /**
+     * Frees a block. The block is never NULL. This may be NULL if the
+     * allocator doesn't free individual blocks.
+     */
+    void (*free_fn)(void* context, void* ptr);
+
+    /** The context passed to the allocator functions. */
+    void* context;
+
+} mpack_allocator_t;
+
+/** @cond */
+
+MPACK_INLINE void* mpack_allocator_alloc(const mpack_allocator_t* allocator, size_t size) {
+    if (allocator == NULL)
+        return MPACK_MALLOC(size);
+    return allocator->alloc_fn(allocator->context, size);
+}
+
+void* mpack_allocator_realloc(const mpack_allocator_t* allocator, void* ptr, size_t used_size, size_t new_size);
+
+MPACK_INLINE void mpack_allocator_free(const mpack_allocator_t* allocator, void* ptr) {
+    if (allocator == NULL)
+        MPACK_FREE(ptr);
+    else if (allocator->free_fn != NULL && ptr != NULL)
+        allocator->free_fn(allocator->context, ptr);
+}
+
+/** @endcond */
+
+/**
+ * @}
+ */
+#endif
+
 /** @cond */
 
 /*
@@ -1159,6 +1242,36 @@ mpack_error_t mpack_track_destroy(mpack_track_t* track, bool cancel);
 
 
 
+/* Incremental hashing */
+
+typedef struct mpack_hasher_t {
+    uint64_t lanes[4];
+    uint64_t seed;
+    uint64_t total;     /* Total number of bytes hashed */
+    char tail[32];      /* Bytes not yet hashed, less than one stripe */
+    size_t tail_length;
+} mpack_hasher_t;
+
+void mpack_hasher_init(mpack_hasher_t* hasher, uint64_t seed);
+void mpack_hasher_update(mpack_hasher_t* hasher, const char* data, size_t length);
+void mpack_hasher_update_u64(mpack_hasher_t* hasher, uint64_t value);
+uint64_t mpack_hasher_finish(mpack_hasher_t* hasher);
+
+/**
+ * Hashes the type and value of a tag for mpack_node_hash() and
+ * mpack_read_hash(), normalized so that equal values hash the same regardless
+ * of how they are encoded.
+ */
+void mpack_hasher_tag(mpack_hasher_t* hasher, mpack_tag_t tag);
+
+/**
+ * Combines the hashes of a map key and its value. The hashes of the pairs of
+ * a map are summed so that the order of the keys does not matter.
+ */
+uint64_t mpack_hash_pair(uint64_t key, uint64_t value);
+
+
+
 /* Miscellaneous string functions */
 
 /**
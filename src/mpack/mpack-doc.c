@@ -0,0 +1,917 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define MPACK_INTERNAL 1
+
+#include "mpack-doc.h"
+
+MPACK_SILENCE_WARNINGS_BEGIN
+
+#if MPACK_NODE && MPACK_WRITER && defined(MPACK_MALLOC)
+
+void mpack_doc_init(mpack_doc_t* doc, mpack_tree_t* tree) {
+    mpack_memset(doc, 0, sizeof(*doc));
+    doc->tree = tree;
+    doc->allocator = tree->allocator;
+    doc->error = mpack_tree_error(tree);
+}
+
+mpack_error_t mpack_doc_destroy(mpack_doc_t* doc) {
+    if (doc->edits)
+        mpack_allocator_free(doc->allocator, doc->edits);
+    if (doc->dirty)
+        mpack_allocator_free(doc->allocator, doc->dirty);
+    if (doc->bytes)
+        mpack_allocator_free(doc->allocator, doc->bytes);
+    doc->edits = NULL;
+    doc->dirty = NULL;
+    doc->bytes = NULL;
+    return doc->error;
+}
+
+static void mpack_doc_flag_error(mpack_doc_t* doc, mpack_error_t error) {
+    mpack_log("doc %p setting error %i: %s\n", (void*)doc, (int)error, mpack_error_to_string(error));
+    if (doc->error == mpack_ok)
+        doc->error = error;
+}
+
+void mpack_doc_set_allocator(mpack_doc_t* doc, const mpack_allocator_t* allocator) {
+    if (doc->edits != NULL || doc->dirty != NULL || doc->bytes != NULL) {
+        mpack_break("cannot change the allocator of a document after it has been edited!");
+        mpack_doc_flag_error(doc, mpack_error_bug);
+        return;
+    }
+    doc->allocator = allocator;
+}
+
+// Grows an array of the given element size to hold at least one more element.
+static bool mpack_doc_grow(mpack_doc_t* doc, void** array, size_t* capacity, size_t count, size_t size) {
+    if (count < *capacity)
+        return true;
+
+    size_t new_capacity = (*capacity == 0) ? 8 : *capacity * 2;
+    if (new_capacity > SIZE_MAX / size) {
+        mpack_doc_flag_error(doc, mpack_error_too_big);
+        return false;
+    }
+
+    void* new_array = (*array == NULL) ?
+        mpack_allocator_alloc(doc->allocator, new_capacity * size) :
+        mpack_allocator_realloc(doc->allocator, *array, count * size, new_capacity * size);
+    if (new_array == NULL) {
+        mpack_doc_flag_error(doc, mpack_error_memory);
+        return false;
+    }
+
+    *array = new_array;
+    *capacity = new_capacity;
+    return true;
+}
+
+// Copies the given bytes into the document, returning their offset.
+static size_t mpack_doc_copy(mpack_doc_t* doc, const char* data, size_t length) {
+    if (length > doc->bytes_capacity - doc->bytes_used) {
+        size_t new_capacity = (doc->bytes_capacity == 0) ? 64 : doc->bytes_capacity;
+        while (new_capacity - doc->bytes_used < length) {
+            if (new_capacity > SIZE_MAX / 2) {
+                mpack_doc_flag_error(doc, mpack_error_too_big);
+                return 0;
+            }
+            new_capacity *= 2;
+        }
+
+        char* new_bytes = (doc->bytes == NULL) ?
+            (char*)mpack_allocator_alloc(doc->allocator, new_capacity) :
+            (char*)mpack_allocator_realloc(doc->allocator, doc->bytes, doc->bytes_used, new_capacity);
+        if (new_bytes == NULL) {
+            mpack_doc_flag_error(doc, mpack_error_memory);
+            return 0;
+        }
+        doc->bytes = new_bytes;
+        doc->bytes_capacity = new_capacity;
+    }
+
+    size_t offset = doc->bytes_used;
+    if (length > 0)
+        mpack_memcpy(doc->bytes + offset, data, length);
+    doc->bytes_used += length;
+    return offset;
+}
+
+static bool mpack_doc_is_dirty(mpack_doc_t* doc, mpack_node_data_t* data) {
+    size_t i;
+    for (i = 0; i < doc->dirty_count; ++i)
+        if (doc->dirty[i] == data)
+            return true;
+    return false;
+}
+
+static void mpack_doc_mark_dirty(mpack_doc_t* doc, mpack_node_data_t* data) {
+    if (mpack_doc_is_dirty(doc, data))
+        return;
+    if (!mpack_doc_grow(doc, (void**)&doc->dirty, &doc->dirty_capacity,
+                doc->dirty_count, sizeof(*doc->dirty)))
+        return;
+    doc->dirty[doc->dirty_count++] = data;
+}
+
+// Follows the given number of steps of a path from the root, marking each map
+// or array along the way as dirty. Returns a nil node if the path does not
+// exist.
+static mpack_node_t mpack_doc_resolve(mpack_doc_t* doc, const mpack_path_t* path, size_t count) {
+    mpack_node_t node = mpack_tree_root(doc->tree);
+    size_t i;
+    for (i = 0; i < count; ++i) {
+        const mpack_path_step_t* step = &path->steps[i];
+        mpack_doc_mark_dirty(doc, node.data);
+
+        if (step->type == mpack_path_step_key) {
+            if (mpack_node_type(node) != mpack_type_map) {
+                mpack_doc_flag_error(doc, mpack_error_type);
+                break;
+            }
+            node = mpack_node_map_str_optional(node, step->key, step->length);
+        } else {
+            if (mpack_node_type(node) != mpack_type_array) {
+                mpack_doc_flag_error(doc, mpack_error_type);
+                break;
+            }
+            if (step->index >= mpack_node_array_length(node)) {
+                mpack_doc_flag_error(doc, mpack_error_data);
+                break;
+            }
+            node = mpack_node_array_at(node, step->index);
+        }
+
+        if (mpack_tree_error(doc->tree) != mpack_ok) {
+            mpack_doc_flag_error(doc, mpack_tree_error(doc->tree));
+            break;
+        }
+        if (mpack_node_is_missing(node)) {
+            mpack_doc_flag_error(doc, mpack_error_data);
+            break;
+        }
+    }
+
+    if (doc->error != mpack_ok)
+        return mpack_tree_nil_node(doc->tree);
+    mpack_doc_mark_dirty(doc, node.data);
+    return node;
+}
+
+// Resolves the map or array containing the last step of a path and starts a
+// new edit of it. Returns NULL if the path is invalid.
+static mpack_doc_edit_t* mpack_doc_start_edit(mpack_doc_t* doc, const mpack_path_t* path,
+        mpack_doc_edit_type_t type, size_t steps)
+{
+    if (doc->error != mpack_ok)
+        return NULL;
+
+    if (mpack_path_has_wildcard(path)) {
+        mpack_break("cannot edit a path with wildcards!");
+        mpack_doc_flag_error(doc, mpack_error_bug);
+        return NULL;
+    }
+
+    mpack_node_t container = mpack_doc_resolve(doc, path, steps);
+    if (doc->error != mpack_ok)
+        return NULL;
+
+    if (!mpack_doc_grow(doc, (void**)&doc->edits, &doc->edit_capacity,
+                doc->edit_count, sizeof(*doc->edits)))
+        return NULL;
+
+    mpack_doc_edit_t* edit = &doc->edits[doc->edit_count];
+    mpack_memset(edit, 0, sizeof(*edit));
+    edit->container = container.data;
+    edit->type = type;
+
+    // resolve the last step of the path within the container
+    if (steps == path->count)
+        return edit;
+    const mpack_path_step_t* step = &path->steps[steps];
+    if (step->type == mpack_path_step_key) {
+        if (mpack_node_type(container) != mpack_type_map || type == mpack_doc_edit_insert) {
+            mpack_doc_flag_error(doc, mpack_error_type);
+            return NULL;
+        }
+        edit->key = true;
+        edit->found = mpack_node_map_contains_str(container, step->key, step->length);
+        edit->key_length = step->length;
+        edit->key_offset = mpack_doc_copy(doc, step->key, step->length);
+    } else {
+        if (mpack_node_type(container) != mpack_type_array) {
+            mpack_doc_flag_error(doc, mpack_error_type);
+            return NULL;
+        }
+        size_t length = mpack_node_array_length(container);
+        if (step->index > length || (step->index == length && type != mpack_doc_edit_insert)) {
+            mpack_doc_flag_error(doc, mpack_error_data);
+            return NULL;
+        }
+        edit->index = step->index;
+    }
+
+    if (mpack_tree_error(doc->tree) != mpack_ok)
+        mpack_doc_flag_error(doc, mpack_tree_error(doc->tree));
+    return (doc->error == mpack_ok) ? edit : NULL;
+}
+
+static void mpack_doc_finish_edit(mpack_doc_t* doc, mpack_doc_edit_t* edit, const char* value, size_t length) {
+    if (edit == NULL)
+        return;
+    edit->value_length = length;
+    edit->value_offset = mpack_doc_copy(doc, value, length);
+    if (doc->error == mpack_ok)
+        ++doc->edit_count;
+}
+
+void mpack_doc_set(mpack_doc_t* doc, const mpack_path_t* path, const char* value, size_t length) {
+    if (path->count == 0) {
+        // replacing the root is an edit with no container
+        mpack_doc_edit_t* edit = NULL;
+        if (doc->error == mpack_ok && mpack_doc_grow(doc, (void**)&doc->edits,
+                    &doc->edit_capacity, doc->edit_count, sizeof(*doc->edits)))
+        {
+            edit = &doc->edits[doc->edit_count];
+            mpack_memset(edit, 0, sizeof(*edit));
+            edit->type = mpack_doc_edit_set;
+        }
+        mpack_doc_finish_edit(doc, edit, value, length);
+        return;
+    }
+
+    mpack_doc_edit_t* edit = mpack_doc_start_edit(doc, path, mpack_doc_edit_set, path->count - 1);
+    mpack_doc_finish_edit(doc, edit, value, length);
+}
+
+void mpack_doc_remove(mpack_doc_t* doc, const mpack_path_t* path) {
+    if (path->count == 0) {
+        mpack_break("cannot remove the root of a document!");
+        mpack_doc_flag_error(doc, mpack_error_bug);
+        return;
+    }
+    mpack_doc_edit_t* edit = mpack_doc_start_edit(doc, path, mpack_doc_edit_remove, path->count - 1);
+    mpack_doc_finish_edit(doc, edit, NULL, 0);
+}
+
+void mpack_doc_insert(mpack_doc_t* doc, const mpack_path_t* path, const char* value, size_t length) {
+    if (path->count == 0) {
+        mpack_break("cannot insert at the root of a document!");
+        mpack_doc_flag_error(doc, mpack_error_bug);
+        return;
+    }
+    mpack_doc_edit_t* edit = mpack_doc_start_edit(doc, path, mpack_doc_edit_insert, path->count - 1);
+    mpack_doc_finish_edit(doc, edit, value, length);
+}
+
+void mpack_doc_append(mpack_doc_t* doc, const mpack_path_t* path, const char* value, size_t length) {
+    mpack_doc_edit_t* edit = mpack_doc_start_edit(doc, path, mpack_doc_edit_insert, path->count);
+    if (edit == NULL)
+        return;
+
+    mpack_node_t array = {edit->container, doc->tree};
+    if (mpack_node_type(array) != mpack_type_array) {
+        mpack_doc_flag_error(doc, mpack_error_type);
+        return;
+    }
+    edit->index = mpack_node_array_length(array);
+    mpack_doc_finish_edit(doc, edit, value, length);
+}
+
+
+
+/*
+ * Writing
+ */
+
+// Returns the last set or remove edit of the given map key, or NULL if the key
+// has not been edited.
+static const mpack_doc_edit_t* mpack_doc_find_key(mpack_doc_t* doc, mpack_node_data_t* map,
+        const char* key, size_t length)
+{
+    size_t i;
+    for (i = doc->edit_count; i > 0; --i) {
+        const mpack_doc_edit_t* edit = &doc->edits[i - 1];
+        if (edit->container == map && edit->key && edit->key_length == length &&
+                mpack_memcmp(doc->bytes + edit->key_offset, key, length) == 0)
+            return edit;
+    }
+    return NULL;
+}
+
+// Returns the last set or remove edit of the given array index, or NULL if the
+// element has not been edited.
+static const mpack_doc_edit_t* mpack_doc_find_index(mpack_doc_t* doc, mpack_node_data_t* array, size_t index) {
+    size_t i;
+    for (i = doc->edit_count; i > 0; --i) {
+        const mpack_doc_edit_t* edit = &doc->edits[i - 1];
+        if (edit->container == array && edit->type != mpack_doc_edit_insert && edit->index == index)
+            return edit;
+    }
+    return NULL;
+}
+
+// Returns true if the given edit is the one that determines the final state of
+// its map key or array index.
+static bool mpack_doc_is_last(mpack_doc_t* doc, const mpack_doc_edit_t* edit) {
+    if (edit->key)
+        return edit == mpack_doc_find_key(doc, edit->container,
+                doc->bytes + edit->key_offset, edit->key_length);
+    return edit == mpack_doc_find_index(doc, edit->container, edit->index);
+}
+
+static void mpack_doc_write_value(mpack_doc_t* doc, mpack_writer_t* writer, const mpack_doc_edit_t* edit) {
+    mpack_write_object_bytes(writer, doc->bytes + edit->value_offset, edit->value_length);
+}
+
+static void mpack_doc_write_element(mpack_doc_t* doc, mpack_writer_t* writer, mpack_node_t node);
+
+static void mpack_doc_write_map(mpack_doc_t* doc, mpack_writer_t* writer, mpack_node_t map) {
+    size_t pairs = mpack_node_map_count(map);
+    size_t count = pairs;
+    size_t i;
+
+    for (i = 0; i < doc->edit_count; ++i) {
+        const mpack_doc_edit_t* edit = &doc->edits[i];
+        if (edit->container != map.data || !mpack_doc_is_last(doc, edit))
+            continue;
+        if (edit->found && edit->type == mpack_doc_edit_remove)
+            --count;
+        else if (!edit->found && edit->type == mpack_doc_edit_set)
+            ++count;
+    }
+
+    if (count > MPACK_UINT32_MAX) {
+        mpack_writer_flag_error(writer, mpack_error_too_big);
+        return;
+    }
+    mpack_start_map(writer, (uint32_t)count);
+
+    for (i = 0; i < pairs; ++i) {
+        mpack_node_t key = mpack_node_map_key_at(map, i);
+        mpack_node_t value = mpack_node_map_value_at(map, i);
+
+        const mpack_doc_edit_t* edit = NULL;
+        if (mpack_node_type(key) == mpack_type_str)
+            edit = mpack_doc_find_key(doc, map.data, mpack_node_str(key), mpack_node_strlen(key));
+
+        if (edit && edit->type == mpack_doc_edit_remove)
+            continue;
+        mpack_write_node(writer, key);
+        if (edit)
+            mpack_doc_write_value(doc, writer, edit);
+        else
+            mpack_doc_write_element(doc, writer, value);
+    }
+
+    // new keys are written at the end in the order they were added
+    for (i = 0; i < doc->edit_count; ++i) {
+        const mpack_doc_edit_t* edit = &doc->edits[i];
+        if (edit->container != map.data || edit->found || edit->type != mpack_doc_edit_set ||
+                !mpack_doc_is_last(doc, edit))
+            continue;
+        mpack_write_str(writer, doc->bytes + edit->key_offset, (uint32_t)edit->key_length);
+        mpack_doc_write_value(doc, writer, edit);
+    }
+
+    mpack_finish_map(writer);
+}
+
+static void mpack_doc_write_inserts(mpack_doc_t* doc, mpack_writer_t* writer, mpack_node_data_t* array, size_t index) {
+    size_t i;
+    for (i = 0; i < doc->edit_count; ++i) {
+        const mpack_doc_edit_t* edit = &doc->edits[i];
+        if (edit->container == array && edit->type == mpack_doc_edit_insert && edit->index == index)
+            mpack_doc_write_value(doc, writer, edit);
+    }
+}
+
+static void mpack_doc_write_array(mpack_doc_t* doc, mpack_writer_t* writer, mpack_node_t array) {
+    size_t length = mpack_node_array_length(array);
+    size_t count = length;
+    size_t i;
+
+    for (i = 0; i < doc->edit_count; ++i) {
+        const mpack_doc_edit_t* edit = &doc->edits[i];
+        if (edit->container != array.data)
+            continue;
+        if (edit->type == mpack_doc_edit_insert)
+            ++count;
+        else if (edit->type == mpack_doc_edit_remove && mpack_doc_is_last(doc, edit))
+            --count;
+    }
+
+    if (count > MPACK_UINT32_MAX) {
+        mpack_writer_flag_error(writer, mpack_error_too_big);
+        return;
+    }
+    mpack_start_array(writer, (uint32_t)count);
+
+    for (i = 0; i < length; ++i) {
+        mpack_doc_write_inserts(doc, writer, array.data, i);
+        const mpack_doc_edit_t* edit = mpack_doc_find_index(doc, array.data, i);
+        if (edit && edit->type == mpack_doc_edit_remove)
+            continue;
+        if (edit)
+            mpack_doc_write_value(doc, writer, edit);
+        else
+            mpack_doc_write_element(doc, writer, mpack_node_array_at(array, i));
+    }
+    mpack_doc_write_inserts(doc, writer, array.data, length);
+
+    mpack_finish_array(writer);
+}
+
+// Writes a node, re-encoding it only if it contains edits. Only maps and
+// arrays along edited paths are dirty, so the recursion depth is bounded by
+// MPACK_PATH_MAX_STEPS.
+static void mpack_doc_write_element(mpack_doc_t* doc, mpack_writer_t* writer, mpack_node_t node) {
+    if (!mpack_doc_is_dirty(doc, node.data)) {
+        mpack_write_node(writer, node);
+        return;
+    }
+
+    if (mpack_node_type(node) == mpack_type_map)
+        mpack_doc_write_map(doc, writer, node);
+    else
+        mpack_doc_write_array(doc, writer, node);
+}
+
+void mpack_doc_write(mpack_doc_t* doc, mpack_writer_t* writer) {
+    if (doc->error != mpack_ok) {
+        mpack_writer_flag_error(writer, doc->error);
+        return;
+    }
+    if (mpack_writer_error(writer) != mpack_ok)
+        return;
+
+    size_t i;
+    for (i = doc->edit_count; i > 0; --i) {
+        if (doc->edits[i - 1].container == NULL) {
+            mpack_doc_write_value(doc, writer, &doc->edits[i - 1]);
+            return;
+        }
+    }
+
+    mpack_doc_write_element(doc, writer, mpack_tree_root(doc->tree));
+}
+
+
+
+/*
+ * Diff and patch
+ */
+
+typedef enum mpack_diff_op_t {
+    mpack_diff_op_set,
+    mpack_diff_op_remove,
+    mpack_diff_op_splice
+} mpack_diff_op_t;
+
+typedef struct mpack_diff_t {
+    mpack_writer_t* writer; // the writer, or NULL when counting operations
+    size_t count;           // the number of operations
+    size_t depth;           // the number of steps in the current path
+    mpack_path_step_t steps[MPACK_PATH_MAX_STEPS];
+} mpack_diff_t;
+
+// The result of comparing two nodes without their contents.
+typedef enum mpack_diff_compare_t {
+    mpack_diff_compare_unequal,
+    mpack_diff_compare_equal,
+    mpack_diff_compare_children // maps or arrays whose children must be compared
+} mpack_diff_compare_t;
+
+// A pair of maps or arrays whose children are being compared.
+typedef struct mpack_diff_frame_t {
+    mpack_node_t a;
+    mpack_node_t b;
+    size_t index; // the next child to compare
+    size_t total; // the number of children, counting both keys and values
+} mpack_diff_frame_t;
+
+#define MPACK_DIFF_LOCAL_DEPTH 8
+
+// Compares two nodes, but only the counts and spans of maps and arrays.
+static mpack_diff_compare_t mpack_diff_compare(mpack_node_t a, mpack_node_t b, size_t* total) {
+    mpack_type_t type = mpack_node_type(a);
+    if (type != mpack_node_type(b))
+        return mpack_diff_compare_unequal;
+
+    switch (type) {
+        case mpack_type_str:
+        case mpack_type_bin:
+        #if MPACK_EXTENSIONS
+        case mpack_type_ext:
+        #endif
+            return (mpack_tag_equal(mpack_node_tag(a), mpack_node_tag(b)) &&
+                    mpack_memcmp(mpack_node_data(a), mpack_node_data(b), mpack_node_data_len(a)) == 0) ?
+                mpack_diff_compare_equal : mpack_diff_compare_unequal;
+
+        case mpack_type_array:
+        case mpack_type_map: {
+            size_t a_length, b_length;
+            const char* a_span = mpack_node_span(a, &a_length);
+            const char* b_span = mpack_node_span(b, &b_length);
+            if (a_span && b_span)
+                return (a_length == b_length && mpack_memcmp(a_span, b_span, a_length) == 0) ?
+                    mpack_diff_compare_equal : mpack_diff_compare_unequal;
+
+            size_t count = (type == mpack_type_map) ? mpack_node_map_count(a) : mpack_node_array_length(a);
+            size_t b_count = (type == mpack_type_map) ? mpack_node_map_count(b) : mpack_node_array_length(b);
+            if (count != b_count)
+                return mpack_diff_compare_unequal;
+            *total = (type == mpack_type_map) ? count * 2 : count;
+            return mpack_diff_compare_children;
+        }
+
+        default:
+            return mpack_tag_equal(mpack_node_tag(a), mpack_node_tag(b)) ?
+                mpack_diff_compare_equal : mpack_diff_compare_unequal;
+    }
+}
+
+// Returns a child of a map or array, counting both keys and values of maps.
+static mpack_node_t mpack_diff_child(mpack_node_t node, size_t index) {
+    if (mpack_node_type(node) == mpack_type_map)
+        return (index % 2 == 0) ? mpack_node_map_key_at(node, index / 2) : mpack_node_map_value_at(node, index / 2);
+    return mpack_node_array_at(node, index);
+}
+
+// Grows the stack of mpack_diff_equal(). Returns false if it could not be
+// grown.
+static bool mpack_diff_grow(const mpack_allocator_t* allocator, mpack_diff_frame_t** stack,
+        size_t* capacity, mpack_diff_frame_t* local)
+{
+    if (*capacity > SIZE_MAX / 2 / sizeof(mpack_diff_frame_t))
+        return false;
+    size_t new_capacity = *capacity * 2;
+    mpack_diff_frame_t* new_stack;
+    if (*stack == local) {
+        new_stack = (mpack_diff_frame_t*)mpack_allocator_alloc(allocator,
+                sizeof(mpack_diff_frame_t) * new_capacity);
+        if (new_stack != NULL)
+            mpack_memcpy(new_stack, local, sizeof(mpack_diff_frame_t) * *capacity);
+    } else {
+        new_stack = (mpack_diff_frame_t*)mpack_allocator_realloc(allocator, *stack,
+                sizeof(mpack_diff_frame_t) * *capacity,
+                sizeof(mpack_diff_frame_t) * new_capacity);
+    }
+    if (new_stack == NULL)
+        return false;
+    *stack = new_stack;
+    *capacity = new_capacity;
+    return true;
+}
+
+// Returns true if the nodes are equal. Maps and arrays are compared with an
+// explicit stack rather than recursively so that deeply nested messages can't
+// overflow the call stack. If the stack can't grow, the nodes are considered
+// unequal, which only makes the delta larger.
+static bool mpack_diff_equal(mpack_node_t a, mpack_node_t b) {
+    const mpack_allocator_t* allocator = a.tree->allocator;
+    mpack_diff_frame_t local[MPACK_DIFF_LOCAL_DEPTH];
+    mpack_diff_frame_t* stack = local;
+    size_t capacity = MPACK_DIFF_LOCAL_DEPTH;
+    size_t depth = 0;
+    bool equal = true;
+
+    for (;;) {
+        size_t total = 0;
+        mpack_diff_compare_t result = mpack_diff_compare(a, b, &total);
+        if (result == mpack_diff_compare_unequal) {
+            equal = false;
+            break;
+        }
+        if (result == mpack_diff_compare_children && total > 0) {
+            if (depth == capacity && !mpack_diff_grow(allocator, &stack, &capacity, local)) {
+                equal = false;
+                break;
+            }
+            mpack_diff_frame_t* frame = &stack[depth++];
+            frame->a = a;
+            frame->b = b;
+            frame->index = 0;
+            frame->total = total;
+        }
+
+        // find the next pair of children to compare
+        while (depth > 0 && stack[depth - 1].index == stack[depth - 1].total)
+            --depth;
+        if (depth == 0)
+            break;
+        mpack_diff_frame_t* frame = &stack[depth - 1];
+        a = mpack_diff_child(frame->a, frame->index);
+        b = mpack_diff_child(frame->b, frame->index);
+        ++frame->index;
+    }
+
+    if (stack != local)
+        mpack_allocator_free(allocator, stack);
+    return equal;
+}
+
+static bool mpack_diff_str_keys(mpack_node_t map) {
+    size_t count = mpack_node_map_count(map);
+    size_t i;
+    for (i = 0; i < count; ++i)
+        if (mpack_node_type(mpack_node_map_key_at(map, i)) != mpack_type_str)
+            return false;
+    return true;
+}
+
+// Starts an operation, returning false if operations are only being counted.
+static bool mpack_diff_start_op(mpack_diff_t* diff, mpack_diff_op_t op, uint32_t length) {
+    ++diff->count;
+    if (diff->writer == NULL)
+        return false;
+
+    mpack_writer_t* writer = diff->writer;
+    mpack_start_array(writer, length);
+    mpack_write_u8(writer, (uint8_t)op);
+    mpack_start_array(writer, (uint32_t)diff->depth);
+    size_t i;
+    for (i = 0; i < diff->depth; ++i) {
+        const mpack_path_step_t* step = &diff->steps[i];
+        if (step->type == mpack_path_step_key)
+            mpack_write_str(writer, step->key, (uint32_t)step->length);
+        else
+            mpack_write_u32(writer, step->index);
+    }
+    mpack_finish_array(writer);
+    return true;
+}
+
+static void mpack_diff_push_key(mpack_diff_t* diff, mpack_node_t key) {
+    mpack_path_step_t* step = &diff->steps[diff->depth++];
+    step->type = mpack_path_step_key;
+    step->key = mpack_node_str(key);
+    step->length = mpack_node_strlen(key);
+}
+
+static void mpack_diff_push_index(mpack_diff_t* diff, size_t index) {
+    mpack_path_step_t* step = &diff->steps[diff->depth++];
+    step->type = mpack_path_step_index;
+    step->index = (uint32_t)index;
+}
+
+static void mpack_diff_element(mpack_diff_t* diff, mpack_node_t from, mpack_node_t to);
+
+static void mpack_diff_map(mpack_diff_t* diff, mpack_node_t from, mpack_node_t to) {
+    size_t count = mpack_node_map_count(from);
+    size_t i;
+    for (i = 0; i < count; ++i) {
+        mpack_node_t key = mpack_node_map_key_at(from, i);
+        mpack_node_t value = mpack_node_map_str_optional(to, mpack_node_str(key), mpack_node_strlen(key));
+        mpack_diff_push_key(diff, key);
+        if (mpack_node_is_missing(value)) {
+            if (mpack_diff_start_op(diff, mpack_diff_op_remove, 2))
+                mpack_finish_array(diff->writer);
+        } else {
+            mpack_diff_element(diff, mpack_node_map_value_at(from, i), value);
+        }
+        --diff->depth;
+    }
+
+    count = mpack_node_map_count(to);
+    for (i = 0; i < count; ++i) {
+        mpack_node_t key = mpack_node_map_key_at(to, i);
+        if (mpack_node_map_contains_str(from, mpack_node_str(key), mpack_node_strlen(key)))
+            continue;
+        mpack_diff_push_key(diff, key);
+        if (mpack_diff_start_op(diff, mpack_diff_op_set, 3)) {
+            mpack_write_node(diff->writer, mpack_node_map_value_at(to, i));
+            mpack_finish_array(diff->writer);
+        }
+        --diff->depth;
+    }
+}
+
+static void mpack_diff_array(mpack_diff_t* diff, mpack_node_t from, mpack_node_t to) {
+    size_t from_length = mpack_node_array_length(from);
+    size_t to_length = mpack_node_array_length(to);
+    size_t min = (from_length < to_length) ? from_length : to_length;
+
+    size_t prefix = 0;
+    while (prefix < min && mpack_diff_equal(mpack_node_array_at(from, prefix), mpack_node_array_at(to, prefix)))
+        ++prefix;
+    size_t suffix = 0;
+    while (prefix + suffix < min && mpack_diff_equal(mpack_node_array_at(from, from_length - suffix - 1),
+                mpack_node_array_at(to, to_length - suffix - 1)))
+        ++suffix;
+
+    // the changed elements in the middle are compared pairwise, and the rest
+    // are spliced
+    size_t removed = from_length - prefix - suffix;
+    size_t inserted = to_length - prefix - suffix;
+    size_t pairs = (removed < inserted) ? removed : inserted;
+    size_t i;
+    for (i = 0; i < pairs; ++i) {
+        mpack_diff_push_index(diff, prefix + i);
+        mpack_diff_element(diff, mpack_node_array_at(from, prefix + i), mpack_node_array_at(to, prefix + i));
+        --diff->depth;
+    }
+
+    if (removed == inserted)
+        return;
+    size_t index = prefix + pairs;
+    removed -= pairs;
+    inserted -= pairs;
+    if (mpack_diff_start_op(diff, mpack_diff_op_splice, 5)) {
+        mpack_writer_t* writer = diff->writer;
+        mpack_write_u32(writer, (uint32_t)index);
+        mpack_write_u32(writer, (uint32_t)removed);
+        mpack_start_array(writer, (uint32_t)inserted);
+        for (i = 0; i < inserted; ++i)
+            mpack_write_node(writer, mpack_node_array_at(to, index + i));
+        mpack_finish_array(writer);
+        mpack_finish_array(writer);
+    }
+}
+
+static void mpack_diff_element(mpack_diff_t* diff, mpack_node_t from, mpack_node_t to) {
+    if (mpack_diff_equal(from, to))
+        return;
+
+    mpack_type_t type = mpack_node_type(from);
+    if (type == mpack_node_type(to) && diff->depth < MPACK_PATH_MAX_STEPS) {
+        if (type == mpack_type_map && mpack_diff_str_keys(from) && mpack_diff_str_keys(to)) {
+            mpack_diff_map(diff, from, to);
+            return;
+        }
+        if (type == mpack_type_array) {
+            mpack_diff_array(diff, from, to);
+            return;
+        }
+    }
+
+    if (mpack_diff_start_op(diff, mpack_diff_op_set, 3)) {
+        mpack_write_node(diff->writer, to);
+        mpack_finish_array(diff->writer);
+    }
+}
+
+static bool mpack_diff_check(mpack_writer_t* writer, mpack_node_t from, mpack_node_t to) {
+    if (mpack_node_error(from) != mpack_ok)
+        mpack_writer_flag_error(writer, mpack_node_error(from));
+    if (mpack_node_error(to) != mpack_ok)
+        mpack_writer_flag_error(writer, mpack_node_error(to));
+    return mpack_writer_error(writer) == mpack_ok;
+}
+
+void mpack_node_diff(mpack_writer_t* writer, mpack_node_t from, mpack_node_t to) {
+    if (!mpack_diff_check(writer, from, to))
+        return;
+
+    // the operations are counted first so that the delta can be written
+    // without a builder
+    mpack_diff_t diff;
+    diff.writer = NULL;
+    diff.count = 0;
+    diff.depth = 0;
+    mpack_diff_element(&diff, from, to);
+    if (!mpack_diff_check(writer, from, to))
+        return;
+    if (diff.count > MPACK_UINT32_MAX) {
+        mpack_writer_flag_error(writer, mpack_error_too_big);
+        return;
+    }
+
+    mpack_start_array(writer, (uint32_t)diff.count);
+    diff.writer = writer;
+    mpack_diff_element(&diff, from, to);
+    mpack_finish_array(writer);
+    mpack_diff_check(writer, from, to);
+}
+
+// Reads a path from a delta. Returns false if it is malformed.
+static bool mpack_doc_patch_path(mpack_node_t node, mpack_path_t* path) {
+    size_t count = mpack_node_array_length(node);
+    if (count > MPACK_PATH_MAX_STEPS)
+        return false;
+
+    path->count = count;
+    path->wildcard = false;
+    size_t i;
+    for (i = 0; i < count; ++i) {
+        mpack_node_t step_node = mpack_node_array_at(node, i);
+        mpack_path_step_t* step = &path->steps[i];
+        if (mpack_node_type(step_node) == mpack_type_str) {
+            step->type = mpack_path_step_key;
+            step->key = mpack_node_str(step_node);
+            step->length = mpack_node_strlen(step_node);
+        } else {
+            step->type = mpack_path_step_index;
+            step->index = mpack_node_u32(step_node);
+        }
+    }
+    return mpack_node_error(node) == mpack_ok;
+}
+
+// Encodes a value of a delta and records it with the given edit function.
+static void mpack_doc_patch_value(mpack_doc_t* doc, const mpack_path_t* path, mpack_node_t value,
+        void (*edit)(mpack_doc_t*, const mpack_path_t*, const char*, size_t))
+{
+    char* data = NULL;
+    size_t size = 0;
+    mpack_writer_t writer;
+    mpack_writer_init_growable_allocator(&writer, &data, &size, doc->allocator);
+    mpack_write_node(&writer, value);
+    mpack_error_t error = mpack_writer_destroy(&writer);
+    if (error != mpack_ok) {
+        mpack_doc_flag_error(doc, error);
+        return;
+    }
+    edit(doc, path, data, size);
+    mpack_allocator_free(doc->allocator, data);
+}
+
+static void mpack_doc_patch_splice(mpack_doc_t* doc, mpack_path_t* path, mpack_node_t op) {
+    uint32_t index = mpack_node_u32(mpack_node_array_at(op, 2));
+    uint32_t removed = mpack_node_u32(mpack_node_array_at(op, 3));
+    mpack_node_t values = mpack_node_array_at(op, 4);
+    size_t inserted = mpack_node_array_length(values);
+    if (mpack_node_error(op) != mpack_ok)
+        return;
+    if (path->count == MPACK_PATH_MAX_STEPS || (uint64_t)index + removed > MPACK_UINT32_MAX) {
+        mpack_doc_flag_error(doc, mpack_error_data);
+        return;
+    }
+
+    mpack_path_step_t* step = &path->steps[path->count++];
+    step->type = mpack_path_step_index;
+    size_t i;
+    for (i = 0; i < removed; ++i) {
+        step->index = index + (uint32_t)i;
+        mpack_doc_remove(doc, path);
+    }
+    step->index = index;
+    for (i = 0; i < inserted; ++i)
+        mpack_doc_patch_value(doc, path, mpack_node_array_at(values, i), mpack_doc_insert);
+}
+
+void mpack_doc_patch(mpack_doc_t* doc, mpack_node_t delta) {
+    size_t count = mpack_node_array_length(delta);
+    size_t i;
+    for (i = 0; i < count && doc->error == mpack_ok; ++i) {
+        mpack_node_t op = mpack_node_array_at(delta, i);
+        size_t length = mpack_node_array_length(op);
+        mpack_path_t path;
+        if (length < 2 || !mpack_doc_patch_path(mpack_node_array_at(op, 1), &path)) {
+            mpack_doc_flag_error(doc, mpack_error_data);
+            break;
+        }
+
+        switch (mpack_node_uint(mpack_node_array_at(op, 0))) {
+            case mpack_diff_op_set:
+                if (length == 3)
+                    mpack_doc_patch_value(doc, &path, mpack_node_array_at(op, 2), mpack_doc_set);
+                else
+                    mpack_doc_flag_error(doc, mpack_error_data);
+                break;
+            case mpack_diff_op_remove:
+                if (length == 2)
+                    mpack_doc_remove(doc, &path);
+                else
+                    mpack_doc_flag_error(doc, mpack_error_data);
+                break;
+            case mpack_diff_op_splice:
+                if (length == 5)
+                    mpack_doc_patch_splice(doc, &path, op);
+                else
+                    mpack_doc_flag_error(doc, mpack_error_data);
+                break;
+            default:
+                mpack_doc_flag_error(doc, mpack_error_data);
+                break;
+        }
+    }
+
+    // a delta with the wrong types is malformed
+    mpack_error_t error = mpack_node_error(delta);
+    if (error != mpack_ok)
+        mpack_doc_flag_error(doc, (error == mpack_error_type) ? mpack_error_data : error);
+}
+
+#endif
+
+MPACK_SILENCE_WARNINGS_END
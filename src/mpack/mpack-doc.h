@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file
+ *
+ * Declares the MPack Document API.
+ */
+
+#ifndef MPACK_DOC_H
+#define MPACK_DOC_H 1
+
+#include "mpack-node.h"
+
+MPACK_SILENCE_WARNINGS_BEGIN
+MPACK_EXTERN_C_BEGIN
+
+#if MPACK_NODE && MPACK_WRITER && defined(MPACK_MALLOC)
+
+/**
+ * @defgroup doc Document API
+ *
+ * The MPack Document API records edits to a parsed @ref mpack_tree_t and
+ * writes out the edited message.
+ *
+ * Edits do not modify the tree. Each edit is recorded as an overlay on a map
+ * or array of the tree, and the new values are copied into storage owned by
+ * the document. When the document is written, only the maps and arrays that
+ * contain edits are re-encoded; everything else is written with
+ * mpack_write_node(). If the tree was parsed with spans enabled (see
+ * mpack_tree_set_spans()), untouched maps and arrays are therefore copied
+ * directly from the original message.
+ *
+ * Edits are addressed by compiled paths (see @ref mpack_path_t.) Paths and
+ * indices always refer to the original message, not to the result of previous
+ * edits. Editing the same map key or array index more than once keeps only the
+ * last edit, and edits within a value that is replaced or removed by another
+ * edit have no effect.
+ *
+ * New values are passed as a single complete MessagePack object, for example
+ * one encoded with a @ref mpack_writer_t into a small buffer. The bytes are
+ * not validated.
+ *
+ * Edits are looked up with a linear search, so the document is intended for
+ * messages with a small number of edits.
+ *
+ * @{
+ */
+
+/**
+ * A set of edits to a parsed tree.
+ *
+ * This structure is opaque; its fields should not be accessed outside
+ * of MPack.
+ */
+typedef struct mpack_doc_t mpack_doc_t;
+
+/* Hide internals from documentation */
+/** @cond */
+
+typedef enum mpack_doc_edit_type_t {
+    mpack_doc_edit_set,    /* Replaces or adds a value */
+    mpack_doc_edit_remove, /* Removes a value */
+    mpack_doc_edit_insert  /* Inserts an element into an array */
+} mpack_doc_edit_type_t;
+
+typedef struct mpack_doc_edit_t {
+    mpack_node_data_t* container; /* The edited map or array, or NULL for the root */
+    mpack_doc_edit_type_t type;
+    bool key;                     /* Whether this edits a map by key */
+    bool found;                   /* Whether the key exists in the original map */
+    size_t index;                 /* The index of an array element */
+    size_t key_offset;            /* The offset of the key in the document's bytes */
+    size_t key_length;
+    size_t value_offset;          /* The offset of the value in the document's bytes */
+    size_t value_length;
+} mpack_doc_edit_t;
+
+struct mpack_doc_t {
+    mpack_tree_t* tree;
+    const mpack_allocator_t* allocator; /* The allocator for edits and bytes */
+    mpack_error_t error;
+
+    mpack_doc_edit_t* edits;
+    size_t edit_count;
+    size_t edit_capacity;
+
+    mpack_node_data_t** dirty; /* Maps and arrays that contain edits */
+    size_t dirty_count;
+    size_t dirty_capacity;
+
+    char* bytes;               /* Copied keys and values */
+    size_t bytes_used;
+    size_t bytes_capacity;
+};
+
+/** @endcond */
+
+/**
+ * @name Document Functions
+ * @{
+ */
+
+/**
+ * Initializes a document for editing the given parsed tree.
+ *
+ * The document does not take ownership of the tree. The tree must remain
+ * valid and must not be parsed again while the document is in use.
+ *
+ * If the tree is in an error state, the error is copied to the document.
+ *
+ * The document allocates its edits with the tree's allocator (see
+ * mpack_tree_set_allocator()) unless another is set with
+ * mpack_doc_set_allocator().
+ */
+void mpack_doc_init(mpack_doc_t* doc, mpack_tree_t* tree);
+
+/**
+ * Sets the allocator with which the document allocates its edits and the
+ * bytes of their keys and values, or NULL to use @ref MPACK_MALLOC. For
+ * example, a document that lives only as long as a request can allocate from
+ * the request's arena (see mpack_arena_allocator()).
+ *
+ * This must be called before the first edit.
+ *
+ * @see mpack_allocator_t
+ */
+void mpack_doc_set_allocator(mpack_doc_t* doc, const mpack_allocator_t* allocator);
+
+/**
+ * Destroys the document, freeing its edits.
+ *
+ * @return The final error state of the document.
+ */
+mpack_error_t mpack_doc_destroy(mpack_doc_t* doc);
+
+/**
+ * Returns the error state of the document.
+ */
+MPACK_INLINE mpack_error_t mpack_doc_error(mpack_doc_t* doc) {
+    return doc->error;
+}
+
+/**
+ * Returns the number of edits recorded in the document.
+ */
+MPACK_INLINE size_t mpack_doc_edit_count(mpack_doc_t* doc) {
+    return doc->edit_count;
+}
+
+/**
+ * Replaces the value at the given path with the given encoded object.
+ *
+ * If the last step of the path is a key, the key is added to its map if it
+ * does not already exist. If it is an index, it must be the index of an
+ * existing element of its array. An empty path replaces the whole message.
+ *
+ * Flags @ref mpack_error_data if the path does not exist, or @ref
+ * mpack_error_type if a step does not match the type of its element. The path
+ * must not contain wildcards.
+ */
+void mpack_doc_set(mpack_doc_t* doc, const mpack_path_t* path, const char* value, size_t length);
+
+/**
+ * Removes the key/value pair or array element at the given path.
+ *
+ * Removing a key that does not exist has no effect. Removing an array index
+ * that does not exist flags @ref mpack_error_data.
+ */
+void mpack_doc_remove(mpack_doc_t* doc, const mpack_path_t* path);
+
+/**
+ * Inserts the given encoded object into an array before the element at the
+ * given path.
+ *
+ * The last step of the path must be an index no greater than the length of
+ * its array. Objects inserted at the same index are written in the order in
+ * which they were inserted.
+ */
+void mpack_doc_insert(mpack_doc_t* doc, const mpack_path_t* path, const char* value, size_t length);
+
+/**
+ * Appends the given encoded object to the array at the given path.
+ */
+void mpack_doc_append(mpack_doc_t* doc, const mpack_path_t* path, const char* value, size_t length);
+
+/**
+ * Writes the edited message to the given writer.
+ *
+ * Any error in the document is flagged on the writer. The document is not
+ * modified, so it can be written any number of times.
+ */
+void mpack_doc_write(mpack_doc_t* doc, mpack_writer_t* writer);
+
+/**
+ * @}
+ */
+
+/**
+ * @name Diff Functions
+ *
+ * A delta describes how to turn one message into another. It is itself a
+ * MessagePack array of operations, each of which is an array starting with
+ * an operation code:
+ *
+ * - <tt>[0, path, value]</tt> sets the value at a path, as in mpack_doc_set()
+ * - <tt>[1, path]</tt> removes the value at a path, as in mpack_doc_remove()
+ * - <tt>[2, path, index, count, [values...]]</tt> splices the array at a
+ *   path, removing @c count elements starting at @c index and inserting the
+ *   given values in their place
+ *
+ * A path is an array of steps, where each step is either a str key of a map
+ * or a uint index of an array. As with the rest of the Document API, paths
+ * and indices in a delta refer to the original message.
+ *
+ * @{
+ */
+
+/**
+ * Writes a delta that turns the message at @a from into the message at @a to.
+ *
+ * Maps and arrays that are equal are skipped without being compared element
+ * by element if their original bytes are equal. This requires that both trees
+ * record spans (see mpack_tree_set_spans()); otherwise maps and arrays are
+ * compared structurally.
+ *
+ * Maps are compared by key. A map that contains keys other than strings is
+ * replaced in full. Arrays are compared by trimming their common prefix and
+ * suffix; the remaining elements are compared pairwise, and any left over are
+ * spliced. Changes deeper than @ref MPACK_PATH_MAX_STEPS replace the value at
+ * that depth.
+ *
+ * Any error in either tree is flagged on the writer.
+ *
+ * @param writer The writer to which to write the delta.
+ * @param from The root of the original message.
+ * @param to The root of the new message.
+ */
+void mpack_node_diff(mpack_writer_t* writer, mpack_node_t from, mpack_node_t to);
+
+/**
+ * Records the operations of a delta written by mpack_node_diff() as edits to
+ * the given document.
+ *
+ * Writing the document afterwards produces the new message. Flags @ref
+ * mpack_error_data on the document if the delta is malformed or does not
+ * apply to the document's tree.
+ *
+ * @param doc The document, which should be a document of the original
+ *        message.
+ * @param delta The root of the delta.
+ */
+void mpack_doc_patch(mpack_doc_t* doc, mpack_node_t delta);
+
+/**
+ * @}
+ */
+
+/**
+ * @}
+ */
+
+#endif
+
+MPACK_EXTERN_C_END
+MPACK_SILENCE_WARNINGS_END
+
+#endif
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define MPACK_INTERNAL 1
+
+#include "mpack-event.h"
+
+MPACK_SILENCE_WARNINGS_BEGIN
+
+#if MPACK_READER
+
+void mpack_event_parser_init(mpack_event_parser_t* parser, mpack_reader_t* reader,
+        mpack_event_frame_t* stack, size_t stack_capacity)
+{
+    mpack_assert(stack != NULL || stack_capacity == 0, "stack is NULL");
+    parser->reader = reader;
+    parser->stack = stack;
+    parser->stack_capacity = stack_capacity;
+    parser->depth = 0;
+    parser->complete = false;
+}
+
+// Pops the top frame off the stack, producing the finish event of its map or
+// array.
+static void mpack_event_finish(mpack_event_parser_t* parser, mpack_event_t* event) {
+    mpack_event_frame_t* frame = &parser->stack[--parser->depth];
+
+    if (frame->map) {
+        mpack_done_map(parser->reader);
+        event->type = mpack_event_finish_map;
+        event->tag = mpack_tag_make_map(0);
+    } else {
+        mpack_done_array(parser->reader);
+        event->type = mpack_event_finish_array;
+        event->tag = mpack_tag_make_array(0);
+    }
+
+    event->data = NULL;
+    event->depth = parser->depth;
+    event->key = false;
+
+    if (parser->depth == 0)
+        parser->complete = true;
+}
+
+// Reads the contents of a str, bin or ext in-place.
+static const char* mpack_event_read_data(mpack_reader_t* reader, mpack_type_t type, uint32_t length) {
+    const char* data = mpack_read_bytes_inplace(reader, length);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return NULL;
+
+    #if MPACK_EXTENSIONS
+    if (type == mpack_type_ext) {
+        mpack_done_ext(reader);
+    } else
+    #endif
+    if (type == mpack_type_bin) {
+        mpack_done_bin(reader);
+    } else {
+        mpack_done_str(reader);
+    }
+
+    return data;
+}
+
+bool mpack_event_next(mpack_event_parser_t* parser, mpack_event_t* event) {
+    mpack_reader_t* reader = parser->reader;
+    if (mpack_reader_error(reader) != mpack_ok || parser->complete)
+        return false;
+
+    // figure out where the next element goes, closing the current map or
+    // array if it has no elements left
+    bool key = false;
+    if (parser->depth > 0) {
+        mpack_event_frame_t* frame = &parser->stack[parser->depth - 1];
+        if (frame->left == 0) {
+            mpack_event_finish(parser, event);
+            return mpack_reader_error(reader) == mpack_ok;
+        }
+
+        if (!frame->map) {
+            --frame->left;
+        } else if (frame->value_next) {
+            frame->value_next = false;
+            --frame->left;
+        } else {
+            frame->value_next = true;
+            key = true;
+        }
+    }
+
+    mpack_tag_t tag = mpack_read_tag(reader);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return false;
+
+    event->tag = tag;
+    event->data = NULL;
+    event->depth = parser->depth;
+    event->key = key;
+
+    mpack_type_t type = mpack_tag_type(&tag);
+    switch (type) {
+        case mpack_type_array:
+        case mpack_type_map:
+            if (parser->depth == parser->stack_capacity) {
+                mpack_log("event parser depth %i exceeds stack capacity\n", (int)parser->depth);
+                mpack_reader_flag_error(reader, mpack_error_too_big);
+                return false;
+            }
+            parser->stack[parser->depth].map = type == mpack_type_map;
+            parser->stack[parser->depth].value_next = false;
+            parser->stack[parser->depth].left = tag.v.n;
+            ++parser->depth;
+            event->type = (type == mpack_type_map) ? mpack_event_start_map : mpack_event_start_array;
+            return true;
+
+        case mpack_type_str:
+        case mpack_type_bin:
+        #if MPACK_EXTENSIONS
+        case mpack_type_ext:
+        #endif
+            event->data = mpack_event_read_data(reader, type, tag.v.l);
+            if (mpack_reader_error(reader) != mpack_ok)
+                return false;
+            break;
+
+        default:
+            break;
+    }
+
+    event->type = mpack_event_value;
+    if (parser->depth == 0)
+        parser->complete = true;
+    return true;
+}
+
+mpack_error_t mpack_event_parse(mpack_reader_t* reader,
+        mpack_event_frame_t* stack, size_t stack_capacity,
+        const mpack_event_callbacks_t* callbacks, void* context)
+{
+    mpack_event_parser_t parser;
+    mpack_event_parser_init(&parser, reader, stack, stack_capacity);
+
+    mpack_event_t event;
+    while (mpack_event_next(&parser, &event)) {
+        void (*callback)(void*, const mpack_event_t*) = NULL;
+        switch (event.type) {
+            case mpack_event_value:        callback = callbacks->value;        break;
+            case mpack_event_start_array:  callback = callbacks->start_array;  break;
+            case mpack_event_finish_array: callback = callbacks->finish_array; break;
+            case mpack_event_start_map:    callback = callbacks->start_map;    break;
+            case mpack_event_finish_map:   callback = callbacks->finish_map;   break;
+        }
+        if (callback)
+            callback(context, &event);
+    }
+
+    return mpack_reader_error(reader);
+}
+
+#endif
+
+MPACK_SILENCE_WARNINGS_END
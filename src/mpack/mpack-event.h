@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file
+ *
+ * Declares the MPack Event API.
+ */
+
+#ifndef MPACK_EVENT_H
+#define MPACK_EVENT_H 1
+
+#include "mpack-reader.h"
+
+MPACK_SILENCE_WARNINGS_BEGIN
+MPACK_EXTERN_C_BEGIN
+
+#if MPACK_READER
+
+/**
+ * @defgroup event Event API
+ *
+ * The MPack Event API parses a MessagePack message from a @ref mpack_reader_t
+ * into a flat sequence of events: start and finish events for maps and
+ * arrays, and value events for everything else.
+ *
+ * This is a SAX-style parser. It does not allocate and it does not recurse.
+ * Open maps and arrays are tracked in a stack of frames provided by the
+ * caller, so the maximum depth of a message is determined by the size of this
+ * stack. A message nested deeper than the stack flags @ref mpack_error_too_big.
+ *
+ * Events can either be pulled one at a time with mpack_event_next(), or
+ * dispatched to a table of callbacks with mpack_event_parse().
+ *
+ * The contents of strings, binary blobs and extensions are passed in-place
+ * from the reader's buffer without copying. When reading from a stream, such
+ * data must therefore fit in the reader's buffer, otherwise @ref
+ * mpack_error_too_big is flagged.
+ *
+ * @{
+ */
+
+/**
+ * The type of an event.
+ */
+typedef enum mpack_event_type_t {
+    mpack_event_value = 1,      /**< A value that is not a map or array. */
+    mpack_event_start_array,    /**< The start of an array. */
+    mpack_event_finish_array,   /**< The end of an array. */
+    mpack_event_start_map,      /**< The start of a map. */
+    mpack_event_finish_map      /**< The end of a map. */
+} mpack_event_type_t;
+
+/**
+ * An event parsed by the Event API.
+ */
+typedef struct mpack_event_t {
+
+    /** The type of the event. */
+    mpack_event_type_t type;
+
+    /**
+     * The tag of the element.
+     *
+     * For value and start events, this is the tag read from the message; for
+     * start events the tag contains the element count of the map or array.
+     * For finish events this is a tag of the corresponding map or array type.
+     */
+    mpack_tag_t tag;
+
+    /**
+     * The contents of a str, bin or ext value, or NULL for any other event.
+     *
+     * This points directly into the reader's buffer. It is only valid until
+     * the next event is parsed. Its length is contained in the tag.
+     */
+    const char* data;
+
+    /**
+     * The number of maps and arrays that contain this element.
+     *
+     * The start and finish events of a map or array have the same depth.
+     * Elements within it have one greater depth.
+     */
+    size_t depth;
+
+    /** True if this element is a key in a map, false otherwise. */
+    bool key;
+
+} mpack_event_t;
+
+/**
+ * A frame of the stack of an event parser. Each frame tracks one open map or
+ * array.
+ *
+ * This structure is opaque; its fields should not be accessed outside
+ * of MPack.
+ */
+typedef struct mpack_event_frame_t mpack_event_frame_t;
+
+/**
+ * A pull parser that yields events from a reader.
+ *
+ * This structure is opaque; its fields should not be accessed outside
+ * of MPack.
+ */
+typedef struct mpack_event_parser_t mpack_event_parser_t;
+
+/* Hide internals from documentation */
+/** @cond */
+
+struct mpack_event_frame_t {
+    uint32_t left;   /* Number of elements (or key/value pairs) left */
+    bool map;        /* Whether this is a map */
+    bool value_next; /* Whether the next element of a map is a value */
+};
+
+struct mpack_event_parser_t {
+    mpack_reader_t* reader;      /* The reader from which to parse events */
+    mpack_event_frame_t* stack;  /* The stack of open maps and arrays */
+    size_t stack_capacity;       /* The number of frames in the stack */
+    size_t depth;                /* The number of frames in use */
+    bool complete;               /* Whether the message has been fully parsed */
+};
+
+/** @endcond */
+
+/**
+ * @name Event Functions
+ * @{
+ */
+
+/**
+ * Initializes an event parser to parse one message from the given reader.
+ *
+ * The parser does not take ownership of the reader or the stack. The reader
+ * must remain valid while the parser is in use, and it must be destroyed
+ * separately when done.
+ *
+ * @param parser The event parser to initialize.
+ * @param reader The reader from which to parse a message.
+ * @param stack An array of frames in which to track open maps and arrays.
+ * @param stack_capacity The number of frames in the stack. This is the
+ *        maximum depth of maps and arrays the message may contain.
+ */
+void mpack_event_parser_init(mpack_event_parser_t* parser, mpack_reader_t* reader,
+        mpack_event_frame_t* stack, size_t stack_capacity);
+
+/**
+ * Parses the next event from the message.
+ *
+ * Returns false without modifying the event if the message has been
+ * completely parsed or if an error occurs. Check mpack_reader_error() on the
+ * reader to tell the difference.
+ *
+ * Once this returns false after completing a message, the reader is
+ * positioned after the message. You can initialize the parser again to parse
+ * the next message from the same reader.
+ *
+ * @param parser The event parser.
+ * @param event [out] The parsed event.
+ * @return True if an event was parsed, false otherwise.
+ */
+bool mpack_event_next(mpack_event_parser_t* parser, mpack_event_t* event);
+
+/**
+ * Returns the number of maps and arrays currently open in the parser.
+ */
+MPACK_INLINE size_t mpack_event_parser_depth(mpack_event_parser_t* parser) {
+    return parser->depth;
+}
+
+/**
+ * Returns true if the parser has parsed a complete message.
+ */
+MPACK_INLINE bool mpack_event_parser_complete(mpack_event_parser_t* parser) {
+    return parser->complete;
+}
+
+/**
+ * A table of callbacks for events dispatched by mpack_event_parse().
+ *
+ * Any callback may be NULL, in which case the corresponding events are
+ * ignored. A callback can stop parsing by flagging an error on the reader.
+ */
+typedef struct mpack_event_callbacks_t {
+    /** Called for each value that is not a map or array. */
+    void (*value)(void* context, const mpack_event_t* event);
+
+    /** Called at the start of an array, before its elements. */
+    void (*start_array)(void* context, const mpack_event_t* event);
+
+    /** Called at the end of an array, after its elements. */
+    void (*finish_array)(void* context, const mpack_event_t* event);
+
+    /** Called at the start of a map, before its keys and values. */
+    void (*start_map)(void* context, const mpack_event_t* event);
+
+    /** Called at the end of a map, after its keys and values. */
+    void (*finish_map)(void* context, const mpack_event_t* event);
+} mpack_event_callbacks_t;
+
+/**
+ * Parses one message from the given reader, dispatching each event to the
+ * given callbacks.
+ *
+ * The reader is not destroyed. If parsing succeeds, the reader is positioned
+ * after the message.
+ *
+ * @param reader The reader from which to parse a message.
+ * @param stack An array of frames in which to track open maps and arrays.
+ * @param stack_capacity The number of frames in the stack. This is the
+ *        maximum depth of maps and arrays the message may contain.
+ * @param callbacks The callbacks to call for each event.
+ * @param context A context pointer passed to the callbacks.
+ * @return The error state of the reader.
+ */
+mpack_error_t mpack_event_parse(mpack_reader_t* reader,
+        mpack_event_frame_t* stack, size_t stack_capacity,
+        const mpack_event_callbacks_t* callbacks, void* context);
+
+/**
+ * @}
+ */
+
+/**
+ * @}
+ */
+
+#endif
+
+MPACK_EXTERN_C_END
+MPACK_SILENCE_WARNINGS_END
+
+#endif
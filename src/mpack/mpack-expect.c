@@ -474,7 +474,7 @@ void* mpack_expect_array_alloc_impl(mpack_reader_t* reader, size_t element_size,
         return NULL;
     }
 
-    void* p = MPACK_MALLOC(element_size * count);
+    void* p = mpack_allocator_alloc(reader->allocator, element_size * count);
     if (p == NULL) {
         mpack_reader_flag_error(reader, mpack_error_memory);
         return NULL;
@@ -663,7 +663,7 @@ char* mpack_expect_cstr_alloc(mpack_reader_t* reader, size_t maxsize) {
     char* str = mpack_expect_cstr_alloc_unchecked(reader, maxsize, &length);
 
     if (str && !mpack_str_check_no_null(str, length)) {
-        MPACK_FREE(str);
+        mpack_allocator_free(reader->allocator, str);
         mpack_reader_flag_error(reader, mpack_error_type);
         return NULL;
     }
@@ -676,7 +676,7 @@ char* mpack_expect_utf8_cstr_alloc(mpack_reader_t* reader, size_t maxsize) {
     char* str = mpack_expect_cstr_alloc_unchecked(reader, maxsize, &length);
 
     if (str && !mpack_utf8_check_no_null(str, length)) {
-        MPACK_FREE(str);
+        mpack_allocator_free(reader->allocator, str);
         mpack_reader_flag_error(reader, mpack_error_type);
         return NULL;
     }
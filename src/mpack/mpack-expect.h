@@ -868,7 +868,8 @@ bool mpack_expect_array_max_or_nil(mpack_reader_t* reader, uint32_t max_count, u
  * check the reader's error state.
  *
  * The allocated array must be freed with MPACK_FREE() (or simply free()
- * if MPack's allocator hasn't been customized.)
+ * if MPack's allocator hasn't been customized), or with the reader's
+ * allocator if one was set with mpack_reader_set_allocator().
  *
  * @throws mpack_error_type if the value is not an array or if its size is
  * greater than max_count.
@@ -892,7 +893,8 @@ bool mpack_expect_array_max_or_nil(mpack_reader_t* reader, uint32_t max_count, u
  * to check for errors; only check the reader's error state.
  *
  * The allocated array must be freed with MPACK_FREE() (or simply free()
- * if MPack's allocator hasn't been customized.)
+ * if MPack's allocator hasn't been customized), or with the reader's
+ * allocator if one was set with mpack_reader_set_allocator().
  *
  * @warning You must call @ref mpack_done_array() if and only if a non-zero
  * element count is read. This function does not differentiate between nil
@@ -1037,7 +1039,8 @@ void mpack_expect_utf8_cstr(mpack_reader_t* reader, char* buf, size_t size);
  * returned pointer if reading succeeds.
  *
  * The allocated string must be freed with MPACK_FREE() (or simply free()
- * if MPack's allocator hasn't been customized.)
+ * if MPack's allocator hasn't been customized), or with the reader's
+ * allocator if one was set with mpack_reader_set_allocator().
  *
  * @throws mpack_error_too_big If the string plus null-terminator is larger than the given maxsize.
  * @throws mpack_error_type If the value is not a string or contains a null byte.
@@ -1058,7 +1061,8 @@ char* mpack_expect_cstr_alloc(mpack_reader_t* reader, size_t maxsize);
  * it cannot be represented in a null-terminated string.
  *
  * The allocated string must be freed with MPACK_FREE() (or simply free()
- * if MPack's allocator hasn't been customized.)
+ * if MPack's allocator hasn't been customized), or with the reader's
+ * allocator if one was set with mpack_reader_set_allocator().
  * if you want a null-terminator.
  *
  * @throws mpack_error_too_big If the string plus null-terminator is larger
@@ -0,0 +1,526 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define MPACK_INTERNAL 1
+
+#include "mpack-index.h"
+
+MPACK_SILENCE_WARNINGS_BEGIN
+
+#if MPACK_READER && defined(MPACK_MALLOC)
+
+// The size of the chunks in which keys are hashed and compared.
+#define MPACK_INDEX_CHUNK_SIZE 64
+
+// The number of elements first allocated for the arrays of an index.
+#define MPACK_INDEX_INITIAL_CAPACITY 16
+
+void mpack_index_init(mpack_index_t* index) {
+    mpack_memset(index, 0, sizeof(*index));
+}
+
+void mpack_index_destroy(mpack_index_t* index) {
+    if (index->offsets)
+        mpack_allocator_free(index->allocator, index->offsets);
+    if (index->keys)
+        mpack_allocator_free(index->allocator, index->keys);
+    mpack_index_init(index);
+}
+
+static size_t mpack_index_sample_count(uint32_t count, uint32_t interval) {
+    return (count == 0) ? 0 : (size_t)(count - 1) / interval + 1;
+}
+
+// Grows an array of the index to hold at least one more element, up to the
+// count given by the data. Arrays grow as their elements are read rather than
+// being allocated up front, so that a count in corrupt or truncated data can't
+// request more memory than the data could fill. Returns NULL on failure,
+// leaving the old array in place.
+static void* mpack_index_grow(mpack_index_t* index, mpack_reader_t* reader, void* array,
+        size_t element_size, size_t* capacity, size_t count)
+{
+    if (count > SIZE_MAX / element_size) {
+        mpack_reader_flag_error(reader, mpack_error_too_big);
+        return NULL;
+    }
+    size_t new_capacity = (*capacity == 0) ? MPACK_INDEX_INITIAL_CAPACITY : *capacity * 2;
+    if (new_capacity > count)
+        new_capacity = count;
+
+    void* new_array;
+    if (array == NULL)
+        new_array = mpack_allocator_alloc(index->allocator, new_capacity * element_size);
+    else
+        new_array = mpack_allocator_realloc(index->allocator, array,
+                *capacity * element_size, new_capacity * element_size);
+    if (new_array == NULL) {
+        mpack_reader_flag_error(reader, mpack_error_memory);
+        return NULL;
+    }
+    *capacity = new_capacity;
+    return new_array;
+}
+
+// Ensures the offsets can hold the element at the given index.
+static bool mpack_index_reserve_offsets(mpack_index_t* index, mpack_reader_t* reader,
+        size_t used, size_t* capacity, size_t count)
+{
+    if (used < *capacity)
+        return true;
+    size_t* offsets = (size_t*)mpack_index_grow(index, reader, index->offsets,
+            sizeof(size_t), capacity, count);
+    if (offsets == NULL)
+        return false;
+    index->offsets = offsets;
+    return true;
+}
+
+// Ensures the keys can hold the key at the given index.
+static bool mpack_index_reserve_keys(mpack_index_t* index, mpack_reader_t* reader,
+        size_t used, size_t* capacity, size_t count)
+{
+    if (used < *capacity)
+        return true;
+    mpack_index_key_t* keys = (mpack_index_key_t*)mpack_index_grow(index, reader, index->keys,
+            sizeof(mpack_index_key_t), capacity, count);
+    if (keys == NULL)
+        return false;
+    index->keys = keys;
+    return true;
+}
+
+// Sorts the keys by hash with a stable bottom-up merge sort, so that the
+// first of several equal keys in a map is found first.
+static bool mpack_index_sort_keys(mpack_index_t* index) {
+    size_t count = index->key_count;
+    if (count < 2)
+        return true;
+    mpack_index_key_t* scratch = (mpack_index_key_t*)mpack_allocator_alloc(index->allocator,
+            count * sizeof(mpack_index_key_t));
+    if (scratch == NULL)
+        return false;
+
+    mpack_index_key_t* keys = index->keys;
+    size_t width, i;
+    for (width = 1; width < count; width *= 2) {
+        for (i = 0; i < count; i += 2 * width) {
+            size_t middle = (i + width < count) ? i + width : count;
+            size_t end = (i + 2 * width < count) ? i + 2 * width : count;
+            size_t a = i, b = middle, out = i;
+            while (a < middle && b < end) {
+                if (keys[b].hash < keys[a].hash)
+                    scratch[out++] = keys[b++];
+                else
+                    scratch[out++] = keys[a++];
+            }
+            while (a < middle)
+                scratch[out++] = keys[a++];
+            while (b < end)
+                scratch[out++] = keys[b++];
+        }
+        mpack_index_key_t* swap = keys;
+        keys = scratch;
+        scratch = swap;
+    }
+
+    // keys holds the sorted result; free whichever buffer is left over
+    index->keys = keys;
+    mpack_allocator_free(index->allocator, scratch);
+    return true;
+}
+
+// Reads the contents of a str, hashing them in chunks.
+static uint64_t mpack_index_read_key_hash(mpack_reader_t* reader, uint32_t length) {
+    char chunk[MPACK_INDEX_CHUNK_SIZE];
+    mpack_hasher_t hasher;
+    mpack_hasher_init(&hasher, 0);
+    while (length > 0) {
+        size_t step = (length < sizeof(chunk)) ? length : sizeof(chunk);
+        mpack_read_bytes(reader, chunk, step);
+        mpack_hasher_update(&hasher, chunk, step);
+        length -= (uint32_t)step;
+    }
+    mpack_done_str(reader);
+    return mpack_hasher_finish(&hasher);
+}
+
+// Reads a key of a map, recording it in the index if it is a string.
+static void mpack_index_build_key(mpack_index_t* index, mpack_reader_t* reader, size_t* capacity) {
+    size_t offset = mpack_reader_position(reader);
+    mpack_tag_t tag = mpack_peek_tag(reader);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return;
+    if (tag.type != mpack_type_str) {
+        mpack_discard(reader);
+        return;
+    }
+
+    tag = mpack_read_tag(reader);
+    uint64_t hash = mpack_index_read_key_hash(reader, tag.v.l);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return;
+    if (!mpack_index_reserve_keys(index, reader, index->key_count, capacity, index->count))
+        return;
+    index->keys[index->key_count].hash = hash;
+    index->keys[index->key_count].offset = offset;
+    ++index->key_count;
+}
+
+void mpack_index_build(mpack_index_t* index, mpack_reader_t* reader, uint32_t interval) {
+    mpack_assert(index->offsets == NULL && index->keys == NULL, "index is not empty!");
+    if (mpack_reader_error(reader) != mpack_ok)
+        return;
+
+    if (interval == 0) {
+        mpack_break("index interval cannot be zero!");
+        mpack_reader_flag_error(reader, mpack_error_bug);
+        return;
+    }
+
+    mpack_tag_t tag = mpack_read_tag(reader);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return;
+    if (tag.type != mpack_type_array && tag.type != mpack_type_map) {
+        mpack_reader_flag_error(reader, mpack_error_type);
+        return;
+    }
+
+    index->allocator = reader->allocator;
+    index->map = tag.type == mpack_type_map;
+    index->count = tag.v.n;
+    index->interval = interval;
+    size_t samples = mpack_index_sample_count(index->count, interval);
+    size_t offset_capacity = 0;
+    size_t key_capacity = 0;
+
+    uint32_t i;
+    for (i = 0; i < index->count && mpack_reader_error(reader) == mpack_ok; ++i) {
+        if (i % interval == 0) {
+            if (!mpack_index_reserve_offsets(index, reader, i / interval, &offset_capacity, samples))
+                break;
+            index->offsets[i / interval] = mpack_reader_position(reader);
+        }
+        if (index->map)
+            mpack_index_build_key(index, reader, &key_capacity);
+        mpack_discard(reader);
+    }
+    mpack_done_type(reader, tag.type);
+
+    if (mpack_reader_error(reader) == mpack_ok && !mpack_index_sort_keys(index))
+        mpack_reader_flag_error(reader, mpack_error_memory);
+    if (mpack_reader_error(reader) != mpack_ok)
+        mpack_index_destroy(index);
+}
+
+void mpack_index_seek_at(const mpack_index_t* index, mpack_reader_t* reader, uint32_t element) {
+    if (mpack_reader_error(reader) != mpack_ok)
+        return;
+
+    if (element >= index->count) {
+        mpack_reader_flag_error(reader, mpack_error_data);
+        return;
+    }
+
+    mpack_reader_seek(reader, index->offsets[element / index->interval]);
+
+    // discard the elements between the sampled offset and the one we want
+    size_t skip = element % index->interval;
+    if (index->map)
+        skip *= 2;
+    for (; skip > 0 && mpack_reader_error(reader) == mpack_ok; --skip)
+        mpack_discard(reader);
+}
+
+// Reads a key of the map indexed at the current position of the reader,
+// returning true if it matches the given key.
+static bool mpack_index_match_key(mpack_reader_t* reader, const char* key, size_t length) {
+    mpack_tag_t tag = mpack_read_tag(reader);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return false;
+
+    // the index doesn't match the data
+    if (tag.type != mpack_type_str) {
+        mpack_reader_flag_error(reader, mpack_error_invalid);
+        return false;
+    }
+
+    bool match = tag.v.l == length;
+    if (!match) {
+        mpack_skip_bytes(reader, tag.v.l);
+    } else {
+        char chunk[MPACK_INDEX_CHUNK_SIZE];
+        while (length > 0 && mpack_reader_error(reader) == mpack_ok) {
+            size_t step = (length < sizeof(chunk)) ? length : sizeof(chunk);
+            mpack_read_bytes(reader, chunk, step);
+            if (match && mpack_memcmp(chunk, key, step) != 0)
+                match = false;
+            key += step;
+            length -= step;
+        }
+    }
+
+    mpack_done_str(reader);
+    return match && mpack_reader_error(reader) == mpack_ok;
+}
+
+bool mpack_index_seek_key(const mpack_index_t* index, mpack_reader_t* reader,
+        const char* key, size_t length)
+{
+    if (mpack_reader_error(reader) != mpack_ok)
+        return false;
+
+    if (!index->map) {
+        mpack_reader_flag_error(reader, mpack_error_type);
+        return false;
+    }
+
+    // find the first key with a matching hash
+    uint64_t hash = mpack_hash_data(key, length, 0);
+    size_t low = 0;
+    size_t high = index->key_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (index->keys[middle].hash < hash)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    // check each key with that hash in case of collisions
+    for (; low < index->key_count && index->keys[low].hash == hash; ++low) {
+        mpack_reader_seek(reader, index->keys[low].offset);
+        if (mpack_index_match_key(reader, key, length))
+            return true;
+        if (mpack_reader_error(reader) != mpack_ok)
+            return false;
+    }
+    return false;
+}
+
+bool mpack_index_seek_cstr(const mpack_index_t* index, mpack_reader_t* reader, const char* cstr) {
+    mpack_assert(cstr != NULL, "cstr is NULL");
+    return mpack_index_seek_key(index, reader, cstr, mpack_strlen(cstr));
+}
+
+#if MPACK_WRITER
+void mpack_index_write(const mpack_index_t* index, mpack_writer_t* writer) {
+    size_t samples = mpack_index_sample_count(index->count, index->interval);
+    size_t i;
+
+    mpack_start_map(writer, 6);
+    mpack_write_cstr(writer, "map");
+    mpack_write_bool(writer, index->map);
+    mpack_write_cstr(writer, "count");
+    mpack_write_u32(writer, index->count);
+    mpack_write_cstr(writer, "interval");
+    mpack_write_u32(writer, index->interval);
+
+    mpack_write_cstr(writer, "offsets");
+    mpack_start_array(writer, (uint32_t)samples);
+    for (i = 0; i < samples; ++i)
+        mpack_write_u64(writer, index->offsets[i]);
+    mpack_finish_array(writer);
+
+    mpack_write_cstr(writer, "key_hashes");
+    mpack_start_array(writer, index->key_count);
+    for (i = 0; i < index->key_count; ++i)
+        mpack_write_u64(writer, index->keys[i].hash);
+    mpack_finish_array(writer);
+
+    mpack_write_cstr(writer, "key_offsets");
+    mpack_start_array(writer, index->key_count);
+    for (i = 0; i < index->key_count; ++i)
+        mpack_write_u64(writer, index->keys[i].offset);
+    mpack_finish_array(writer);
+
+    mpack_finish_map(writer);
+}
+#endif
+
+static uint64_t mpack_index_read_uint(mpack_reader_t* reader, uint64_t max) {
+    mpack_tag_t tag = mpack_read_tag(reader);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return 0;
+    if (tag.type != mpack_type_uint || tag.v.u > max) {
+        mpack_reader_flag_error(reader, mpack_error_invalid);
+        return 0;
+    }
+    return tag.v.u;
+}
+
+static uint32_t mpack_index_read_array(mpack_reader_t* reader) {
+    mpack_tag_t tag = mpack_read_tag(reader);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return 0;
+    if (tag.type != mpack_type_array) {
+        mpack_reader_flag_error(reader, mpack_error_invalid);
+        return 0;
+    }
+    return tag.v.n;
+}
+
+// Reads the array of key hashes or key offsets. Whichever comes first
+// allocates the keys; the other must have the same length. Each array may
+// only appear once.
+static void mpack_index_read_keys(mpack_index_t* index, mpack_reader_t* reader,
+        bool hashes, bool* seen_hashes, bool* seen_offsets)
+{
+    bool* seen = hashes ? seen_hashes : seen_offsets;
+    if (*seen) {
+        mpack_reader_flag_error(reader, mpack_error_invalid);
+        return;
+    }
+
+    uint32_t count = mpack_index_read_array(reader);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return;
+    bool first = !*seen_hashes && !*seen_offsets;
+    *seen = true;
+    if (!first && count != index->key_count) {
+        mpack_reader_flag_error(reader, mpack_error_invalid);
+        return;
+    }
+
+    size_t capacity = 0;
+    uint32_t i;
+    for (i = 0; i < count && mpack_reader_error(reader) == mpack_ok; ++i) {
+        if (first) {
+            if (!mpack_index_reserve_keys(index, reader, i, &capacity, count))
+                break;
+            ++index->key_count;
+        }
+        if (hashes)
+            index->keys[i].hash = mpack_index_read_uint(reader, MPACK_UINT64_MAX);
+        else
+            index->keys[i].offset = (size_t)mpack_index_read_uint(reader, SIZE_MAX);
+    }
+    mpack_done_array(reader);
+}
+
+static void mpack_index_read_offsets(mpack_index_t* index, mpack_reader_t* reader, size_t* samples) {
+    uint32_t count = mpack_index_read_array(reader);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return;
+    if (index->offsets != NULL) {
+        mpack_reader_flag_error(reader, mpack_error_invalid);
+        return;
+    }
+    *samples = count;
+
+    size_t capacity = 0;
+    uint32_t i;
+    for (i = 0; i < count && mpack_reader_error(reader) == mpack_ok; ++i) {
+        if (!mpack_index_reserve_offsets(index, reader, i, &capacity, count))
+            break;
+        index->offsets[i] = (size_t)mpack_index_read_uint(reader, SIZE_MAX);
+    }
+    mpack_done_array(reader);
+}
+
+// Checks that an index read from a sidecar is consistent, so that seeking
+// with it stays within its arrays. Both key arrays are required, even if
+// they are empty, since every key needs both its hash and its offset.
+static bool mpack_index_check(mpack_index_t* index, size_t samples, bool seen_hashes, bool seen_offsets) {
+    if (index->interval == 0 || samples != mpack_index_sample_count(index->count, index->interval))
+        return false;
+    if (!seen_hashes || !seen_offsets)
+        return false;
+    if (index->key_count > 0 && (!index->map || index->key_count > index->count))
+        return false;
+    uint32_t i;
+    for (i = 1; i < index->key_count; ++i)
+        if (index->keys[i].hash < index->keys[i - 1].hash)
+            return false;
+    return true;
+}
+
+static bool mpack_index_name_is(const char* name, size_t length, const char* cstr) {
+    return length == mpack_strlen(cstr) && mpack_memcmp(name, cstr, length) == 0;
+}
+
+void mpack_index_read(mpack_index_t* index, mpack_reader_t* reader) {
+    mpack_assert(index->offsets == NULL && index->keys == NULL, "index is not empty!");
+    if (mpack_reader_error(reader) != mpack_ok)
+        return;
+
+    mpack_tag_t tag = mpack_read_tag(reader);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return;
+    if (tag.type != mpack_type_map) {
+        mpack_reader_flag_error(reader, mpack_error_invalid);
+        return;
+    }
+
+    index->allocator = reader->allocator;
+    size_t samples = 0;
+    bool seen_hashes = false;
+    bool seen_offsets = false;
+    uint32_t i;
+    for (i = 0; i < tag.v.n && mpack_reader_error(reader) == mpack_ok; ++i) {
+        mpack_tag_t key = mpack_read_tag(reader);
+        if (mpack_reader_error(reader) != mpack_ok)
+            break;
+        if (key.type != mpack_type_str) {
+            mpack_reader_flag_error(reader, mpack_error_invalid);
+            break;
+        }
+
+        // unknown keys are ignored
+        char name[16];
+        if (key.v.l >= sizeof(name)) {
+            mpack_skip_bytes(reader, key.v.l);
+            mpack_done_str(reader);
+            mpack_discard(reader);
+            continue;
+        }
+        mpack_read_bytes(reader, name, key.v.l);
+        mpack_done_str(reader);
+
+        if (mpack_index_name_is(name, key.v.l, "map")) {
+            mpack_tag_t value = mpack_read_tag(reader);
+            if (value.type != mpack_type_bool)
+                mpack_reader_flag_error(reader, mpack_error_invalid);
+            index->map = value.v.b;
+        } else if (mpack_index_name_is(name, key.v.l, "count")) {
+            index->count = (uint32_t)mpack_index_read_uint(reader, MPACK_UINT32_MAX);
+        } else if (mpack_index_name_is(name, key.v.l, "interval")) {
+            index->interval = (uint32_t)mpack_index_read_uint(reader, MPACK_UINT32_MAX);
+        } else if (mpack_index_name_is(name, key.v.l, "offsets")) {
+            mpack_index_read_offsets(index, reader, &samples);
+        } else if (mpack_index_name_is(name, key.v.l, "key_hashes")) {
+            mpack_index_read_keys(index, reader, true, &seen_hashes, &seen_offsets);
+        } else if (mpack_index_name_is(name, key.v.l, "key_offsets")) {
+            mpack_index_read_keys(index, reader, false, &seen_hashes, &seen_offsets);
+        } else {
+            mpack_discard(reader);
+        }
+    }
+    mpack_done_map(reader);
+
+    if (mpack_reader_error(reader) == mpack_ok && !mpack_index_check(index, samples, seen_hashes, seen_offsets))
+        mpack_reader_flag_error(reader, mpack_error_invalid);
+    if (mpack_reader_error(reader) != mpack_ok)
+        mpack_index_destroy(index);
+}
+
+#endif
+
+MPACK_SILENCE_WARNINGS_END
@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file
+ *
+ * Declares the MPack Index API.
+ */
+
+#ifndef MPACK_INDEX_H
+#define MPACK_INDEX_H 1
+
+#include "mpack-reader.h"
+#include "mpack-writer.h"
+
+MPACK_SILENCE_WARNINGS_BEGIN
+MPACK_EXTERN_C_BEGIN
+
+#if MPACK_READER && defined(MPACK_MALLOC)
+
+/**
+ * @defgroup index Index API
+ *
+ * The MPack Index API provides random access into a large array or map
+ * without parsing or loading it.
+ *
+ * An index records the offsets of the elements of an array, or the key/value
+ * pairs of a map, sampled every so many elements. For a map it also records
+ * the offset of each string key along with a hash of the key. Seeking to an
+ * element jumps to the nearest sampled offset with mpack_reader_seek() and
+ * discards the few elements in between. Seeking to a key jumps directly to
+ * it.
+ *
+ * An index is built in one pass over the data with mpack_index_build(). It
+ * can be saved alongside the data as a small MessagePack sidecar with
+ * mpack_index_write() and loaded later with mpack_index_read().
+ *
+ * The offsets of an index are positions in the reader from which it was
+ * built (see mpack_reader_position()). To use the index, a reader must
+ * therefore start at the same place in the same data.
+ *
+ * @{
+ */
+
+/**
+ * The default number of elements between sampled offsets of an index.
+ *
+ * @see mpack_index_build()
+ */
+#define MPACK_INDEX_DEFAULT_INTERVAL 64
+
+/**
+ * An index of the elements of a map or array.
+ *
+ * This structure is opaque; its fields should not be accessed outside
+ * of MPack.
+ */
+typedef struct mpack_index_t mpack_index_t;
+
+/* Hide internals from documentation */
+/** @cond */
+
+typedef struct mpack_index_key_t {
+    uint64_t hash;  /* The hash of the key's bytes */
+    size_t offset;  /* The offset of the key */
+} mpack_index_key_t;
+
+struct mpack_index_t {
+    const mpack_allocator_t* allocator; /* The reader's allocator, or NULL */
+    bool map;                 /* Whether the indexed element is a map */
+    uint32_t count;           /* The number of elements, or pairs of a map */
+    uint32_t interval;        /* The number of elements between samples */
+    size_t* offsets;          /* The offset of every interval-th element */
+    mpack_index_key_t* keys;  /* The string keys of a map, sorted by hash */
+    uint32_t key_count;       /* The number of string keys */
+};
+
+/** @endcond */
+
+/**
+ * @name Index Functions
+ * @{
+ */
+
+/**
+ * Initializes an empty index. An empty index can be destroyed safely but
+ * cannot be used to seek.
+ */
+void mpack_index_init(mpack_index_t* index);
+
+/**
+ * Frees the memory used by an index.
+ */
+void mpack_index_destroy(mpack_index_t* index);
+
+/**
+ * Builds an index of the map or array at the current position of the reader.
+ *
+ * The whole map or array is read and discarded. If it is not a map or array,
+ * @ref mpack_error_type is flagged. Errors are flagged on the reader; the
+ * index is left empty if an error occurs.
+ *
+ * The index is allocated with the reader's allocator (see
+ * mpack_reader_set_allocator()), which must remain valid until the index is
+ * destroyed.
+ *
+ * @param index The index to build. It must be empty.
+ * @param reader The reader positioned at a map or array.
+ * @param interval The number of elements (or key/value pairs of a map)
+ *        between sampled offsets, for example @ref MPACK_INDEX_DEFAULT_INTERVAL.
+ *        A smaller interval makes seeking faster and the index larger.
+ */
+void mpack_index_build(mpack_index_t* index, mpack_reader_t* reader, uint32_t interval);
+
+/**
+ * Returns true if the index is of a map, or false if it is of an array or
+ * empty.
+ */
+MPACK_INLINE bool mpack_index_is_map(const mpack_index_t* index) {
+    return index->map;
+}
+
+/**
+ * Returns the number of elements of the indexed array, or the number of
+ * key/value pairs of the indexed map.
+ */
+MPACK_INLINE uint32_t mpack_index_count(const mpack_index_t* index) {
+    return index->count;
+}
+
+/**
+ * Moves the reader to the element at the given index of the indexed array,
+ * or to the key of the pair at the given index of the indexed map.
+ *
+ * The reader can then read the element as if it were a message of its own.
+ * If the index is out of bounds, @ref mpack_error_data is flagged on the
+ * reader.
+ *
+ * @see mpack_reader_seek()
+ */
+void mpack_index_seek_at(const mpack_index_t* index, mpack_reader_t* reader, uint32_t element);
+
+/**
+ * Moves the reader to the value for the given string key of the indexed map.
+ *
+ * The reader can then read the value as if it were a message of its own.
+ * If the map contains the key more than once, the first occurrence is used.
+ *
+ * @return True if the key was found, or false if it was not found or an
+ *         error occurred. If the key is not found, the position of the
+ *         reader is unspecified but no error is flagged.
+ */
+bool mpack_index_seek_key(const mpack_index_t* index, mpack_reader_t* reader,
+        const char* key, size_t length);
+
+/**
+ * Moves the reader to the value for the given null-terminated string key of
+ * the indexed map.
+ *
+ * @see mpack_index_seek_key()
+ */
+bool mpack_index_seek_cstr(const mpack_index_t* index, mpack_reader_t* reader, const char* cstr);
+
+#if MPACK_WRITER
+/**
+ * Writes an index to the given writer as a MessagePack map.
+ *
+ * The result can be loaded with mpack_index_read().
+ */
+void mpack_index_write(const mpack_index_t* index, mpack_writer_t* writer);
+#endif
+
+/**
+ * Reads an index written by mpack_index_write() from the given reader.
+ *
+ * If the index is malformed, @ref mpack_error_invalid is flagged on the
+ * reader and the index is left empty.
+ *
+ * The index is allocated with the reader's allocator, as with
+ * mpack_index_build().
+ *
+ * @param index The index to read. It must be empty.
+ * @param reader The reader from which to read the index.
+ */
+void mpack_index_read(mpack_index_t* index, mpack_reader_t* reader);
+
+/**
+ * @}
+ */
+
+/**
+ * @}
+ */
+
+#endif
+
+MPACK_EXTERN_C_END
+MPACK_SILENCE_WARNINGS_END
+
+#endif
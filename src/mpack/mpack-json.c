@@ -0,0 +1,1504 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define MPACK_INTERNAL 1
+
+#include "mpack-json.h"
+
+MPACK_SILENCE_WARNINGS_BEGIN
+
+// Returns true if any byte of the word is a quote, a backslash, a control
+// character or not ASCII. Strings are scanned a word at a time with this in
+// both directions. (This can have false positives in the bytes after a match,
+// but it is only used to test the whole word.)
+MPACK_STATIC_INLINE bool mpack_json_word_is_special(uint64_t word) {
+    const uint64_t ones = MPACK_UINT64_C(0x0101010101010101);
+    uint64_t quote = word ^ (ones * '"');
+    uint64_t backslash = word ^ (ones * '\\');
+    uint64_t special = ((word - ones * 0x20) & ~word) |
+            ((quote - ones) & ~quote) |
+            ((backslash - ones) & ~backslash) |
+            word;
+    return (special & (ones << 7)) != 0;
+}
+
+// Returns the length of the UTF-8 sequence starting with the given non-ASCII
+// byte, or 0 if it is not valid.
+MPACK_STATIC_INLINE size_t mpack_json_utf8_sequence(const char* p, const char* end) {
+    uint8_t c = (uint8_t)*p;
+    size_t sequence = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : 2;
+    if (sequence > (size_t)(end - p) || !mpack_utf8_check(p, sequence))
+        return 0;
+    return sequence;
+}
+
+#if MPACK_READER || MPACK_NODE
+
+/*
+ * Output
+ */
+
+void mpack_json_writer_init(mpack_json_writer_t* json, char* buffer, size_t size) {
+    mpack_assert(buffer != NULL || size == 0, "buffer is NULL with nonzero size!");
+    mpack_memset(json, 0, sizeof(*json));
+    json->buffer = buffer;
+    json->size = size;
+    json->ext = mpack_json_ext_object;
+    json->keys = mpack_json_keys_stringify;
+    json->error = mpack_ok;
+}
+
+void mpack_json_writer_set_flush(mpack_json_writer_t* json, mpack_json_flush_t flush) {
+    if (json->size < MPACK_JSON_MINIMUM_BUFFER_SIZE) {
+        mpack_break("buffer size is %i, but minimum buffer size for flush is %i",
+                (int)json->size, MPACK_JSON_MINIMUM_BUFFER_SIZE);
+        mpack_json_writer_flag_error(json, mpack_error_bug);
+        return;
+    }
+    json->flush = flush;
+}
+
+void mpack_json_writer_flag_error(mpack_json_writer_t* json, mpack_error_t error) {
+    mpack_log("json writer %p setting error %i: %s\n", (void*)json, (int)error, mpack_error_to_string(error));
+    if (json->error == mpack_ok)
+        json->error = error;
+}
+
+// Flushes the buffer, returning false if an error occurs.
+static bool mpack_json_flush_buffer(mpack_json_writer_t* json) {
+    if (json->flush == NULL) {
+        mpack_json_writer_flag_error(json, mpack_error_too_big);
+        return false;
+    }
+    size_t used = json->used;
+    json->used = 0;
+    json->flush(json, json->buffer, used);
+    return json->error == mpack_ok;
+}
+
+// Ensures that at least count bytes are free in the buffer, returning a
+// pointer to them or NULL if an error occurs. The count must not exceed
+// MPACK_JSON_MINIMUM_BUFFER_SIZE.
+MPACK_STATIC_INLINE char* mpack_json_reserve(mpack_json_writer_t* json, size_t count) {
+    mpack_assert(count <= MPACK_JSON_MINIMUM_BUFFER_SIZE, "cannot reserve %i bytes", (int)count);
+    if (json->error != mpack_ok)
+        return NULL;
+    if (json->size - json->used < count && !mpack_json_flush_buffer(json))
+        return NULL;
+    if (json->size - json->used < count) {
+        mpack_json_writer_flag_error(json, mpack_error_too_big);
+        return NULL;
+    }
+    return json->buffer + json->used;
+}
+
+MPACK_STATIC_INLINE void mpack_json_put(mpack_json_writer_t* json, char c) {
+    char* p = mpack_json_reserve(json, 1);
+    if (p) {
+        *p = c;
+        ++json->used;
+    }
+}
+
+void mpack_json_write_raw(mpack_json_writer_t* json, const char* text, size_t count) {
+    while (count > 0 && json->error == mpack_ok) {
+        size_t space = json->size - json->used;
+        if (space == 0) {
+            mpack_json_flush_buffer(json);
+            continue;
+        }
+        if (space > count)
+            space = count;
+        mpack_memcpy(json->buffer + json->used, text, space);
+        json->used += space;
+        text += space;
+        count -= space;
+    }
+}
+
+mpack_error_t mpack_json_writer_destroy(mpack_json_writer_t* json) {
+    if (json->error == mpack_ok && json->used > 0 && json->flush != NULL)
+        mpack_json_flush_buffer(json);
+    return json->error;
+}
+
+
+
+/*
+ * Numbers
+ */
+
+static const char mpack_json_digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static void mpack_json_write_u64(mpack_json_writer_t* json, uint64_t value, bool negative) {
+    char digits[20];
+    char* p = digits + sizeof(digits);
+    while (value >= 100) {
+        size_t pair = (size_t)(value % 100) * 2;
+        value /= 100;
+        *--p = mpack_json_digit_pairs[pair + 1];
+        *--p = mpack_json_digit_pairs[pair];
+    }
+    if (value >= 10) {
+        size_t pair = (size_t)value * 2;
+        *--p = mpack_json_digit_pairs[pair + 1];
+        *--p = mpack_json_digit_pairs[pair];
+    } else {
+        *--p = (char)('0' + value);
+    }
+
+    size_t count = (size_t)(digits + sizeof(digits) - p);
+    char* out = mpack_json_reserve(json, count + 1);
+    if (out == NULL)
+        return;
+    if (negative)
+        *out++ = '-';
+    mpack_memcpy(out, p, count);
+    json->used += count + (negative ? 1 : 0);
+}
+
+/*
+ * Reals are formatted with Grisu2 (Florian Loitsch, "Printing Floating-Point
+ * Numbers Quickly and Accurately with Integers", 2010) using the boundaries
+ * of the original float or double, so that the shortest digits for that
+ * precision are chosen. The output always parses back to the same value, and
+ * is the shortest such output in all but very rare cases (where it is one
+ * digit longer.) Only integer arithmetic is used, so this works from the raw
+ * bits even when MPACK_FLOAT or MPACK_DOUBLE are disabled.
+ */
+
+typedef struct mpack_json_diyfp_t {
+    uint64_t f;
+    int e;
+} mpack_json_diyfp_t;
+
+MPACK_STATIC_INLINE mpack_json_diyfp_t mpack_json_diyfp(uint64_t f, int e) {
+    mpack_json_diyfp_t x;
+    x.f = f;
+    x.e = e;
+    return x;
+}
+
+// Returns x * y rounded to the upper 64 bits of the product.
+static mpack_json_diyfp_t mpack_json_diyfp_mul(mpack_json_diyfp_t x, mpack_json_diyfp_t y) {
+    uint64_t x_lo = x.f & MPACK_UINT32_MAX, x_hi = x.f >> 32;
+    uint64_t y_lo = y.f & MPACK_UINT32_MAX, y_hi = y.f >> 32;
+    uint64_t lo_lo = x_lo * y_lo;
+    uint64_t hi_lo = x_hi * y_lo;
+    uint64_t lo_hi = x_lo * y_hi;
+    uint64_t hi_hi = x_hi * y_hi;
+    uint64_t mid = (lo_lo >> 32) + (hi_lo & MPACK_UINT32_MAX) + (lo_hi & MPACK_UINT32_MAX);
+    mid += (uint64_t)1 << 31; // round
+    return mpack_json_diyfp(hi_hi + (hi_lo >> 32) + (lo_hi >> 32) + (mid >> 32), x.e + y.e + 64);
+}
+
+static mpack_json_diyfp_t mpack_json_diyfp_normalize(mpack_json_diyfp_t x) {
+    mpack_assert(x.f != 0, "cannot normalize zero");
+    int shift;
+    for (shift = 32; shift > 0; shift /= 2) {
+        if ((x.f >> (64 - shift)) == 0) {
+            x.f <<= shift;
+            x.e -= shift;
+        }
+    }
+    return x;
+}
+
+typedef struct mpack_json_cached_power_t {
+    uint64_t f;
+    int16_t e;
+    int16_t k;
+} mpack_json_cached_power_t;
+
+// Normalized approximations of 10^k for every eighth k from -300 to 324
+static const mpack_json_cached_power_t mpack_json_cached_powers[] = {
+    {MPACK_UINT64_C(0xAB70FE17C79AC6CA), -1060, -300},
+    {MPACK_UINT64_C(0xFF77B1FCBEBCDC4F), -1034, -292},
+    {MPACK_UINT64_C(0xBE5691EF416BD60C), -1007, -284},
+    {MPACK_UINT64_C(0x8DD01FAD907FFC3C),  -980, -276},
+    {MPACK_UINT64_C(0xD3515C2831559A83),  -954, -268},
+    {MPACK_UINT64_C(0x9D71AC8FADA6C9B5),  -927, -260},
+    {MPACK_UINT64_C(0xEA9C227723EE8BCB),  -901, -252},
+    {MPACK_UINT64_C(0xAECC49914078536D),  -874, -244},
+    {MPACK_UINT64_C(0x823C12795DB6CE57),  -847, -236},
+    {MPACK_UINT64_C(0xC21094364DFB5637),  -821, -228},
+    {MPACK_UINT64_C(0x9096EA6F3848984F),  -794, -220},
+    {MPACK_UINT64_C(0xD77485CB25823AC7),  -768, -212},
+    {MPACK_UINT64_C(0xA086CFCD97BF97F4),  -741, -204},
+    {MPACK_UINT64_C(0xEF340A98172AACE5),  -715, -196},
+    {MPACK_UINT64_C(0xB23867FB2A35B28E),  -688, -188},
+    {MPACK_UINT64_C(0x84C8D4DFD2C63F3B),  -661, -180},
+    {MPACK_UINT64_C(0xC5DD44271AD3CDBA),  -635, -172},
+    {MPACK_UINT64_C(0x936B9FCEBB25C996),  -608, -164},
+    {MPACK_UINT64_C(0xDBAC6C247D62A584),  -582, -156},
+    {MPACK_UINT64_C(0xA3AB66580D5FDAF6),  -555, -148},
+    {MPACK_UINT64_C(0xF3E2F893DEC3F126),  -529, -140},
+    {MPACK_UINT64_C(0xB5B5ADA8AAFF80B8),  -502, -132},
+    {MPACK_UINT64_C(0x87625F056C7C4A8B),  -475, -124},
+    {MPACK_UINT64_C(0xC9BCFF6034C13053),  -449, -116},
+    {MPACK_UINT64_C(0x964E858C91BA2655),  -422, -108},
+    {MPACK_UINT64_C(0xDFF9772470297EBD),  -396, -100},
+    {MPACK_UINT64_C(0xA6DFBD9FB8E5B88F),  -369,  -92},
+    {MPACK_UINT64_C(0xF8A95FCF88747D94),  -343,  -84},
+    {MPACK_UINT64_C(0xB94470938FA89BCF),  -316,  -76},
+    {MPACK_UINT64_C(0x8A08F0F8BF0F156B),  -289,  -68},
+    {MPACK_UINT64_C(0xCDB02555653131B6),  -263,  -60},
+    {MPACK_UINT64_C(0x993FE2C6D07B7FAC),  -236,  -52},
+    {MPACK_UINT64_C(0xE45C10C42A2B3B06),  -210,  -44},
+    {MPACK_UINT64_C(0xAA242499697392D3),  -183,  -36},
+    {MPACK_UINT64_C(0xFD87B5F28300CA0E),  -157,  -28},
+    {MPACK_UINT64_C(0xBCE5086492111AEB),  -130,  -20},
+    {MPACK_UINT64_C(0x8CBCCC096F5088CC),  -103,  -12},
+    {MPACK_UINT64_C(0xD1B71758E219652C),   -77,   -4},
+    {MPACK_UINT64_C(0x9C40000000000000),   -50,    4},
+    {MPACK_UINT64_C(0xE8D4A51000000000),   -24,   12},
+    {MPACK_UINT64_C(0xAD78EBC5AC620000),     3,   20},
+    {MPACK_UINT64_C(0x813F3978F8940984),    30,   28},
+    {MPACK_UINT64_C(0xC097CE7BC90715B3),    56,   36},
+    {MPACK_UINT64_C(0x8F7E32CE7BEA5C70),    83,   44},
+    {MPACK_UINT64_C(0xD5D238A4ABE98068),   109,   52},
+    {MPACK_UINT64_C(0x9F4F2726179A2245),   136,   60},
+    {MPACK_UINT64_C(0xED63A231D4C4FB27),   162,   68},
+    {MPACK_UINT64_C(0xB0DE65388CC8ADA8),   189,   76},
+    {MPACK_UINT64_C(0x83C7088E1AAB65DB),   216,   84},
+    {MPACK_UINT64_C(0xC45D1DF942711D9A),   242,   92},
+    {MPACK_UINT64_C(0x924D692CA61BE758),   269,  100},
+    {MPACK_UINT64_C(0xDA01EE641A708DEA),   295,  108},
+    {MPACK_UINT64_C(0xA26DA3999AEF774A),   322,  116},
+    {MPACK_UINT64_C(0xF209787BB47D6B85),   348,  124},
+    {MPACK_UINT64_C(0xB454E4A179DD1877),   375,  132},
+    {MPACK_UINT64_C(0x865B86925B9BC5C2),   402,  140},
+    {MPACK_UINT64_C(0xC83553C5C8965D3D),   428,  148},
+    {MPACK_UINT64_C(0x952AB45CFA97A0B3),   455,  156},
+    {MPACK_UINT64_C(0xDE469FBD99A05FE3),   481,  164},
+    {MPACK_UINT64_C(0xA59BC234DB398C25),   508,  172},
+    {MPACK_UINT64_C(0xF6C69A72A3989F5C),   534,  180},
+    {MPACK_UINT64_C(0xB7DCBF5354E9BECE),   561,  188},
+    {MPACK_UINT64_C(0x88FCF317F22241E2),   588,  196},
+    {MPACK_UINT64_C(0xCC20CE9BD35C78A5),   614,  204},
+    {MPACK_UINT64_C(0x98165AF37B2153DF),   641,  212},
+    {MPACK_UINT64_C(0xE2A0B5DC971F303A),   667,  220},
+    {MPACK_UINT64_C(0xA8D9D1535CE3B396),   694,  228},
+    {MPACK_UINT64_C(0xFB9B7CD9A4A7443C),   720,  236},
+    {MPACK_UINT64_C(0xBB764C4CA7A44410),   747,  244},
+    {MPACK_UINT64_C(0x8BAB8EEFB6409C1A),   774,  252},
+    {MPACK_UINT64_C(0xD01FEF10A657842C),   800,  260},
+    {MPACK_UINT64_C(0x9B10A4E5E9913129),   827,  268},
+    {MPACK_UINT64_C(0xE7109BFBA19C0C9D),   853,  276},
+    {MPACK_UINT64_C(0xAC2820D9623BF429),   880,  284},
+    {MPACK_UINT64_C(0x80444B5E7AA7CF85),   907,  292},
+    {MPACK_UINT64_C(0xBF21E44003ACDD2D),   933,  300},
+    {MPACK_UINT64_C(0x8E679C2F5E44FF8F),   960,  308},
+    {MPACK_UINT64_C(0xD433179D9C8CB841),   986,  316},
+    {MPACK_UINT64_C(0x9E19DB92B4E31BA9),  1013,  324}
+};
+
+// Returns the cached power of ten that scales a number with the given binary
+// exponent into the range [2^-60, 2^-32] needed by the digit generation.
+static mpack_json_cached_power_t mpack_json_cached_power(int e) {
+    int f = -60 - e - 1;
+    int k = (f * 78913) / (1 << 18) + (f > 0 ? 1 : 0);
+    int index = (300 + k + 7) / 8;
+    mpack_assert(index >= 0 && (size_t)index < sizeof(mpack_json_cached_powers) / sizeof(*mpack_json_cached_powers),
+            "no cached power for exponent %i", e);
+    return mpack_json_cached_powers[index];
+}
+
+// Moves the last digit closer to w, as long as it stays within the bounds.
+static void mpack_json_grisu_round(char* digits, size_t count, uint64_t dist, uint64_t delta,
+        uint64_t rest, uint64_t ten_k)
+{
+    while (rest < dist && delta - rest >= ten_k &&
+            (rest + ten_k < dist || dist - rest > rest + ten_k - dist))
+    {
+        --digits[count - 1];
+        rest += ten_k;
+    }
+}
+
+// Generates the shortest digits in the interval (low, high), returning the
+// number of digits and adjusting the decimal exponent.
+static size_t mpack_json_grisu_digits(char* digits, int* exponent,
+        mpack_json_diyfp_t low, mpack_json_diyfp_t w, mpack_json_diyfp_t high)
+{
+    uint64_t delta = high.f - low.f;
+    uint64_t dist = high.f - w.f;
+    unsigned shift = (unsigned)-high.e;
+    uint64_t one = (uint64_t)1 << shift;
+
+    // the integral part fits in 32 bits
+    uint32_t integral = (uint32_t)(high.f >> shift);
+    uint64_t fraction = high.f & (one - 1);
+    size_t count = 0;
+
+    uint32_t pow10 = 1000000000;
+    int n = 10;
+    while (pow10 > integral && n > 1) {
+        pow10 /= 10;
+        --n;
+    }
+
+    while (n > 0) {
+        digits[count++] = (char)('0' + integral / pow10);
+        integral %= pow10;
+        --n;
+        uint64_t rest = ((uint64_t)integral << shift) + fraction;
+        if (rest <= delta) {
+            *exponent += n;
+            mpack_json_grisu_round(digits, count, dist, delta, rest, (uint64_t)pow10 << shift);
+            return count;
+        }
+        pow10 /= 10;
+    }
+
+    int m = 0;
+    for (;;) {
+        fraction *= 10;
+        digits[count++] = (char)('0' + (fraction >> shift));
+        fraction &= one - 1;
+        ++m;
+        delta *= 10;
+        dist *= 10;
+        if (fraction <= delta)
+            break;
+    }
+    *exponent -= m;
+    mpack_json_grisu_round(digits, count, dist, delta, fraction, one);
+    return count;
+}
+
+// Formats the decimal digits d * 10^exponent into the output, returning the
+// number of characters written. Fixed notation is used for decimal exponents
+// from -6 to 21 as in JavaScript, and there is always a fraction or exponent.
+static size_t mpack_json_format_decimal(char* out, const char* digits, size_t count, int exponent) {
+    int k = (int)count;
+    int n = k + exponent; // position of the decimal point
+    char* p = out;
+
+    if (k <= n && n <= 21) {
+        // digits[000].0
+        mpack_memcpy(p, digits, count);
+        p += count;
+        mpack_memset(p, '0', (size_t)(n - k));
+        p += n - k;
+        *p++ = '.';
+        *p++ = '0';
+    } else if (0 < n && n <= 21) {
+        // dig.its
+        mpack_memcpy(p, digits, (size_t)n);
+        p += n;
+        *p++ = '.';
+        mpack_memcpy(p, digits + n, (size_t)(k - n));
+        p += k - n;
+    } else if (-6 < n && n <= 0) {
+        // 0.[000]digits
+        *p++ = '0';
+        *p++ = '.';
+        mpack_memset(p, '0', (size_t)-n);
+        p += -n;
+        mpack_memcpy(p, digits, count);
+        p += count;
+    } else {
+        // d[.igits]e+123
+        *p++ = digits[0];
+        if (k > 1) {
+            *p++ = '.';
+            mpack_memcpy(p, digits + 1, count - 1);
+            p += count - 1;
+        }
+        *p++ = 'e';
+        int e = n - 1;
+        *p++ = e < 0 ? '-' : '+';
+        if (e < 0)
+            e = -e;
+        if (e >= 100)
+            *p++ = (char)('0' + e / 100);
+        if (e >= 10)
+            *p++ = (char)('0' + e / 10 % 10);
+        *p++ = (char)('0' + e % 10);
+    }
+
+    return (size_t)(p - out);
+}
+
+// Writes a float or double given its raw bits, its number of explicit
+// significand bits and its exponent bias (including the significand bits.)
+static void mpack_json_write_real(mpack_json_writer_t* json, uint64_t bits,
+        unsigned significand_bits, unsigned exponent_bits)
+{
+    uint64_t significand = bits & (((uint64_t)1 << significand_bits) - 1);
+    uint64_t biased = (bits >> significand_bits) & ((1u << exponent_bits) - 1);
+    bool negative = ((bits >> (significand_bits + exponent_bits)) & 1) != 0;
+    int bias = (1 << (exponent_bits - 1)) - 1 + (int)significand_bits;
+
+    if (biased == (1u << exponent_bits) - 1) {
+        mpack_json_write_raw(json, "null", 4);
+        return;
+    }
+
+    char out[32];
+    char* p = out;
+    if (negative)
+        *p++ = '-';
+
+    if (biased == 0 && significand == 0) {
+        *p++ = '0';
+        *p++ = '.';
+        *p++ = '0';
+        mpack_json_write_raw(json, out, (size_t)(p - out));
+        return;
+    }
+
+    mpack_json_diyfp_t v;
+    if (biased == 0) {
+        v = mpack_json_diyfp(significand, 1 - bias);
+    } else {
+        v = mpack_json_diyfp(significand | ((uint64_t)1 << significand_bits), (int)biased - bias);
+    }
+
+    // compute the boundaries halfway to the neighbouring values. the lower
+    // one is closer if v is a power of two (other than the smallest normal.)
+    mpack_json_diyfp_t high = mpack_json_diyfp_normalize(mpack_json_diyfp(2 * v.f + 1, v.e - 1));
+    mpack_json_diyfp_t low = (significand == 0 && biased > 1) ?
+            mpack_json_diyfp(4 * v.f - 1, v.e - 2) : mpack_json_diyfp(2 * v.f - 1, v.e - 1);
+    low.f <<= low.e - high.e;
+    low.e = high.e;
+    v = mpack_json_diyfp_normalize(v);
+
+    mpack_json_cached_power_t power = mpack_json_cached_power(high.e);
+    mpack_json_diyfp_t c = mpack_json_diyfp(power.f, power.e);
+    mpack_json_diyfp_t w = mpack_json_diyfp_mul(v, c);
+    low = mpack_json_diyfp_mul(low, c);
+    high = mpack_json_diyfp_mul(high, c);
+    ++low.f;
+    --high.f;
+
+    char digits[20];
+    int exponent = -power.k;
+    size_t count = mpack_json_grisu_digits(digits, &exponent, low, w, high);
+    p += mpack_json_format_decimal(p, digits, count, exponent);
+    mpack_json_write_raw(json, out, (size_t)(p - out));
+}
+
+
+
+/*
+ * Strings
+ */
+
+static const char mpack_json_hex[] = "0123456789abcdef";
+
+// Writes the contents of a JSON string (without quotes), escaping as needed.
+// Returns false if the string is not valid UTF-8.
+static bool mpack_json_write_escaped(mpack_json_writer_t* json, const char* data, size_t length) {
+    const char* p = data;
+    const char* end = data + length;
+    const char* run = p; // start of the bytes not yet written
+
+    while (p != end) {
+        // skip a word at a time over bytes that don't need escaping
+        while ((size_t)(end - p) >= 8) {
+            uint64_t word;
+            mpack_memcpy(&word, p, sizeof(word));
+            if (mpack_json_word_is_special(word))
+                break;
+            p += 8;
+        }
+        if (p == end)
+            break;
+
+        uint8_t c = (uint8_t)*p;
+        if (c >= 0x80) {
+            size_t sequence = mpack_json_utf8_sequence(p, end);
+            if (sequence == 0)
+                return false;
+            p += sequence;
+            continue;
+        }
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            ++p;
+            continue;
+        }
+
+        mpack_json_write_raw(json, run, (size_t)(p - run));
+        char out[6];
+        out[0] = '\\';
+        size_t count = 2;
+        switch (c) {
+            case '"':  out[1] = '"';  break;
+            case '\\': out[1] = '\\'; break;
+            case '\b': out[1] = 'b';  break;
+            case '\f': out[1] = 'f';  break;
+            case '\n': out[1] = 'n';  break;
+            case '\r': out[1] = 'r';  break;
+            case '\t': out[1] = 't';  break;
+            default:
+                out[1] = 'u';
+                out[2] = '0';
+                out[3] = '0';
+                out[4] = mpack_json_hex[c >> 4];
+                out[5] = mpack_json_hex[c & 0xF];
+                count = 6;
+                break;
+        }
+        mpack_json_write_raw(json, out, count);
+        run = ++p;
+    }
+
+    mpack_json_write_raw(json, run, (size_t)(end - run));
+    return true;
+}
+
+static const char mpack_json_base64[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Writes the given data as a base64 string, with quotes.
+static void mpack_json_write_base64(mpack_json_writer_t* json, const char* data, size_t length) {
+    const uint8_t* p = (const uint8_t*)data;
+    mpack_json_put(json, '"');
+
+    while (length >= 3) {
+        if (mpack_json_reserve(json, 4) == NULL)
+            return;
+        size_t triples = (json->size - json->used) / 4;
+        if (triples > length / 3)
+            triples = length / 3;
+        char* out = json->buffer + json->used;
+        size_t i;
+        for (i = 0; i < triples; ++i) {
+            uint32_t bits = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+            out[0] = mpack_json_base64[bits >> 18];
+            out[1] = mpack_json_base64[(bits >> 12) & 0x3F];
+            out[2] = mpack_json_base64[(bits >> 6) & 0x3F];
+            out[3] = mpack_json_base64[bits & 0x3F];
+            out += 4;
+            p += 3;
+        }
+        json->used += triples * 4;
+        length -= triples * 3;
+    }
+
+    if (length > 0) {
+        char* out = mpack_json_reserve(json, 4);
+        if (out == NULL)
+            return;
+        uint32_t bits = ((uint32_t)p[0] << 16) | (length > 1 ? (uint32_t)p[1] << 8 : 0);
+        out[0] = mpack_json_base64[bits >> 18];
+        out[1] = mpack_json_base64[(bits >> 12) & 0x3F];
+        out[2] = length > 1 ? mpack_json_base64[(bits >> 6) & 0x3F] : '=';
+        out[3] = '=';
+        json->used += 4;
+    }
+
+    mpack_json_put(json, '"');
+}
+
+
+
+/*
+ * Values
+ */
+
+// Writes a value that is not a map or array. If key is true, the value is
+// being written as a map key so it must produce a string. Returns
+// mpack_error_type if the value cannot be converted.
+static mpack_error_t mpack_json_write_value(mpack_json_writer_t* json, mpack_tag_t tag,
+        const char* data, bool key)
+{
+    if (key && tag.type != mpack_type_str && tag.type != mpack_type_bin) {
+        if (json->keys == mpack_json_keys_error)
+            return mpack_error_type;
+        #if MPACK_EXTENSIONS
+        if (tag.type == mpack_type_ext && json->ext != mpack_json_ext_null) {
+            if (json->ext != mpack_json_ext_base64)
+                return mpack_error_type;
+            key = false; // already a string
+        }
+        #endif
+    } else {
+        key = false;
+    }
+
+    if (key)
+        mpack_json_put(json, '"');
+
+    switch (tag.type) {
+        case mpack_type_missing:
+        case mpack_type_nil:
+            mpack_json_write_raw(json, "null", 4);
+            break;
+        case mpack_type_bool:
+            if (tag.v.b)
+                mpack_json_write_raw(json, "true", 4);
+            else
+                mpack_json_write_raw(json, "false", 5);
+            break;
+        case mpack_type_int:
+            if (tag.v.i < 0) {
+                mpack_json_write_u64(json, (uint64_t)0 - (uint64_t)tag.v.i, true);
+                break;
+            }
+            mpack_json_write_u64(json, (uint64_t)tag.v.i, false);
+            break;
+        case mpack_type_uint:
+            mpack_json_write_u64(json, tag.v.u, false);
+            break;
+
+        case mpack_type_float: {
+            #if MPACK_FLOAT
+            char bytes[4];
+            mpack_store_float(bytes, tag.v.f);
+            mpack_json_write_real(json, mpack_load_u32(bytes), 23, 8);
+            #else
+            mpack_json_write_real(json, tag.v.f, 23, 8);
+            #endif
+            break;
+        }
+        case mpack_type_double: {
+            #if MPACK_DOUBLE
+            char bytes[8];
+            mpack_store_double(bytes, tag.v.d);
+            mpack_json_write_real(json, mpack_load_u64(bytes), 52, 11);
+            #else
+            mpack_json_write_real(json, tag.v.d, 52, 11);
+            #endif
+            break;
+        }
+
+        case mpack_type_str:
+            mpack_json_put(json, '"');
+            if (!mpack_json_write_escaped(json, data, tag.v.l))
+                return mpack_error_type;
+            mpack_json_put(json, '"');
+            break;
+        case mpack_type_bin:
+            mpack_json_write_base64(json, data, tag.v.l);
+            break;
+
+        #if MPACK_EXTENSIONS
+        case mpack_type_ext:
+            switch (json->ext) {
+                case mpack_json_ext_object:
+                    mpack_json_write_raw(json, "{\"type\":", 8);
+                    if (tag.exttype < 0)
+                        mpack_json_write_u64(json, (uint64_t)(-(int)tag.exttype), true);
+                    else
+                        mpack_json_write_u64(json, (uint64_t)tag.exttype, false);
+                    mpack_json_write_raw(json, ",\"data\":", 8);
+                    mpack_json_write_base64(json, data, tag.v.l);
+                    mpack_json_put(json, '}');
+                    break;
+                case mpack_json_ext_base64:
+                    mpack_json_write_base64(json, data, tag.v.l);
+                    break;
+                case mpack_json_ext_null:
+                    mpack_json_write_raw(json, "null", 4);
+                    break;
+                case mpack_json_ext_error:
+                    return mpack_error_type;
+            }
+            break;
+        #endif
+
+        case mpack_type_array:
+        case mpack_type_map:
+            mpack_assert(0, "not a value");
+            break;
+    }
+
+    if (key)
+        mpack_json_put(json, '"');
+    return mpack_ok;
+}
+
+// Returns true if the given map key should be skipped along with its value.
+MPACK_STATIC_INLINE bool mpack_json_skip_key(mpack_json_writer_t* json, mpack_type_t type) {
+    return type != mpack_type_str && json->keys == mpack_json_keys_skip;
+}
+
+
+
+/*
+ * Reader
+ */
+
+#if MPACK_READER
+
+// Flags any error of the JSON writer on the reader, returning false if either
+// is in an error state.
+static bool mpack_json_reader_ok(mpack_json_writer_t* json, mpack_reader_t* reader) {
+    if (json->error != mpack_ok)
+        mpack_reader_flag_error(reader, json->error);
+    return mpack_reader_error(reader) == mpack_ok;
+}
+
+static void mpack_json_read_element(mpack_json_writer_t* json, mpack_reader_t* reader, bool key, size_t depth);
+
+// Discards the contents of an element whose tag has already been read.
+static void mpack_json_discard_contents(mpack_reader_t* reader, mpack_tag_t tag) {
+    uint32_t i;
+    switch (tag.type) {
+        case mpack_type_bin:
+        #if MPACK_EXTENSIONS
+        case mpack_type_ext:
+        #endif
+            mpack_skip_bytes(reader, tag.v.l);
+            mpack_done_type(reader, tag.type);
+            break;
+        case mpack_type_array:
+            for (i = 0; i < tag.v.n; ++i)
+                mpack_discard(reader);
+            mpack_done_array(reader);
+            break;
+        case mpack_type_map:
+            for (i = 0; i < tag.v.n; ++i) {
+                mpack_discard(reader);
+                mpack_discard(reader);
+            }
+            mpack_done_map(reader);
+            break;
+        default:
+            break;
+    }
+}
+
+// Writes an element whose tag has already been read. The depth is the number
+// of maps and arrays that contain the element.
+static void mpack_json_read_contents(mpack_json_writer_t* json, mpack_reader_t* reader,
+        mpack_tag_t tag, bool key, size_t depth)
+{
+    uint32_t i;
+    if ((tag.type == mpack_type_array || tag.type == mpack_type_map) && depth == MPACK_JSON_MAX_DEPTH) {
+        mpack_reader_flag_error(reader, mpack_error_too_big);
+        return;
+    }
+
+    switch (tag.type) {
+        case mpack_type_array:
+            if (key) {
+                mpack_reader_flag_error(reader, mpack_error_type);
+                return;
+            }
+            mpack_json_put(json, '[');
+            for (i = 0; i < tag.v.n && mpack_json_reader_ok(json, reader); ++i) {
+                if (i > 0)
+                    mpack_json_put(json, ',');
+                mpack_json_read_element(json, reader, false, depth + 1);
+            }
+            mpack_done_array(reader);
+            mpack_json_put(json, ']');
+            return;
+
+        case mpack_type_map: {
+            if (key) {
+                mpack_reader_flag_error(reader, mpack_error_type);
+                return;
+            }
+            bool first = true;
+            mpack_json_put(json, '{');
+            for (i = 0; i < tag.v.n && mpack_json_reader_ok(json, reader); ++i) {
+                mpack_tag_t key_tag = mpack_read_tag(reader);
+                if (mpack_reader_error(reader) != mpack_ok)
+                    return;
+                if (mpack_json_skip_key(json, key_tag.type)) {
+                    mpack_json_discard_contents(reader, key_tag);
+                    mpack_discard(reader);
+                    continue;
+                }
+                if (!first)
+                    mpack_json_put(json, ',');
+                first = false;
+                mpack_json_read_contents(json, reader, key_tag, true, depth + 1);
+                mpack_json_put(json, ':');
+                mpack_json_read_element(json, reader, false, depth + 1);
+            }
+            mpack_done_map(reader);
+            mpack_json_put(json, '}');
+            return;
+        }
+
+        case mpack_type_str:
+        case mpack_type_bin:
+        #if MPACK_EXTENSIONS
+        case mpack_type_ext:
+        #endif
+        {
+            const char* data = mpack_read_bytes_inplace(reader, tag.v.l);
+            if (mpack_reader_error(reader) != mpack_ok)
+                return;
+            mpack_done_type(reader, tag.type);
+            mpack_error_t error = mpack_json_write_value(json, tag, data, key);
+            if (error != mpack_ok)
+                mpack_reader_flag_error(reader, error);
+            return;
+        }
+
+        default: {
+            mpack_error_t error = mpack_json_write_value(json, tag, NULL, key);
+            if (error != mpack_ok)
+                mpack_reader_flag_error(reader, error);
+            return;
+        }
+    }
+}
+
+static void mpack_json_read_element(mpack_json_writer_t* json, mpack_reader_t* reader, bool key, size_t depth) {
+    mpack_tag_t tag = mpack_read_tag(reader);
+    if (mpack_reader_error(reader) == mpack_ok)
+        mpack_json_read_contents(json, reader, tag, key, depth);
+}
+
+void mpack_json_write_reader(mpack_json_writer_t* json, mpack_reader_t* reader) {
+    if (!mpack_json_reader_ok(json, reader))
+        return;
+    mpack_json_read_element(json, reader, false, 0);
+    if (mpack_json_reader_ok(json, reader))
+        return;
+    mpack_json_writer_flag_error(json, mpack_reader_error(reader));
+}
+
+size_t mpack_json_write_data(mpack_json_writer_t* json, const char* data, size_t size) {
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, data, size);
+    mpack_json_write_reader(json, &reader);
+    size_t remaining = mpack_reader_remaining(&reader, NULL);
+    if (mpack_reader_destroy(&reader) != mpack_ok)
+        return 0;
+    return size - remaining;
+}
+
+#endif
+
+
+
+/*
+ * Node
+ */
+
+#if MPACK_NODE
+
+// The depth is the number of maps and arrays that contain the node.
+static void mpack_json_node_element(mpack_json_writer_t* json, mpack_node_t node, bool key, size_t depth) {
+    mpack_tag_t tag = mpack_node_tag(node);
+    size_t i;
+    if ((tag.type == mpack_type_array || tag.type == mpack_type_map) && depth == MPACK_JSON_MAX_DEPTH) {
+        mpack_json_writer_flag_error(json, mpack_error_too_big);
+        return;
+    }
+
+    switch (tag.type) {
+        case mpack_type_array:
+            if (key) {
+                mpack_json_writer_flag_error(json, mpack_error_type);
+                return;
+            }
+            mpack_json_put(json, '[');
+            for (i = 0; i < tag.v.n && json->error == mpack_ok; ++i) {
+                if (i > 0)
+                    mpack_json_put(json, ',');
+                mpack_json_node_element(json, mpack_node_array_at(node, i), false, depth + 1);
+            }
+            mpack_json_put(json, ']');
+            return;
+
+        case mpack_type_map: {
+            if (key) {
+                mpack_json_writer_flag_error(json, mpack_error_type);
+                return;
+            }
+            bool first = true;
+            mpack_json_put(json, '{');
+            for (i = 0; i < tag.v.n && json->error == mpack_ok; ++i) {
+                mpack_node_t key_node = mpack_node_map_key_at(node, i);
+                if (mpack_json_skip_key(json, mpack_node_type(key_node)))
+                    continue;
+                if (!first)
+                    mpack_json_put(json, ',');
+                first = false;
+                mpack_json_node_element(json, key_node, true, depth + 1);
+                mpack_json_put(json, ':');
+                mpack_json_node_element(json, mpack_node_map_value_at(node, i), false, depth + 1);
+            }
+            mpack_json_put(json, '}');
+            return;
+        }
+
+        case mpack_type_str:
+        case mpack_type_bin:
+        #if MPACK_EXTENSIONS
+        case mpack_type_ext:
+        #endif
+        {
+            mpack_error_t error = mpack_json_write_value(json, tag, mpack_node_data(node), key);
+            if (error != mpack_ok)
+                mpack_json_writer_flag_error(json, error);
+            return;
+        }
+
+        default: {
+            mpack_error_t error = mpack_json_write_value(json, tag, NULL, key);
+            if (error != mpack_ok)
+                mpack_json_writer_flag_error(json, error);
+            return;
+        }
+    }
+}
+
+void mpack_json_write_node(mpack_json_writer_t* json, mpack_node_t node) {
+    if (json->error != mpack_ok)
+        return;
+    if (mpack_node_error(node) != mpack_ok) {
+        mpack_json_writer_flag_error(json, mpack_node_error(node));
+        return;
+    }
+    mpack_json_node_element(json, node, false, 0);
+    if (mpack_node_error(node) != mpack_ok)
+        mpack_json_writer_flag_error(json, mpack_node_error(node));
+}
+
+#endif
+
+#endif
+
+
+
+/*
+ * Parsing
+ */
+
+#if MPACK_WRITER && MPACK_BUILDER
+
+MPACK_STATIC_INLINE const char* mpack_json_skip_space(const char* p, const char* end) {
+    while (p != end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t'))
+        ++p;
+    return p;
+}
+
+MPACK_STATIC_INLINE bool mpack_json_is_digit(const char* p, const char* end) {
+    return p != end && *p >= '0' && *p <= '9';
+}
+
+// Parses the four hex digits of a \u escape.
+static bool mpack_json_parse_hex(const char* p, const char* end, uint32_t* value) {
+    if (end - p < 4)
+        return false;
+    uint32_t result = 0;
+    int i;
+    for (i = 0; i < 4; ++i) {
+        char c = p[i];
+        uint32_t digit;
+        if (c >= '0' && c <= '9')
+            digit = (uint32_t)(c - '0');
+        else if (c >= 'a' && c <= 'f')
+            digit = (uint32_t)(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F')
+            digit = (uint32_t)(c - 'A' + 10);
+        else
+            return false;
+        result = (result << 4) | digit;
+    }
+    *value = result;
+    return true;
+}
+
+// Decodes the escape sequence after a backslash into at most four bytes of
+// UTF-8, returning a pointer past it or NULL if it is not valid.
+static const char* mpack_json_unescape(const char* p, const char* end, char* out, size_t* count) {
+    if (p == end)
+        return NULL;
+    *count = 1;
+    switch (*p++) {
+        case '"':  out[0] = '"';  return p;
+        case '\\': out[0] = '\\'; return p;
+        case '/':  out[0] = '/';  return p;
+        case 'b':  out[0] = '\b'; return p;
+        case 'f':  out[0] = '\f'; return p;
+        case 'n':  out[0] = '\n'; return p;
+        case 'r':  out[0] = '\r'; return p;
+        case 't':  out[0] = '\t'; return p;
+        case 'u':  break;
+        default:   return NULL;
+    }
+
+    uint32_t code;
+    if (!mpack_json_parse_hex(p, end, &code))
+        return NULL;
+    p += 4;
+
+    // a high surrogate must be followed by an escaped low surrogate
+    if (code >= 0xD800 && code <= 0xDBFF) {
+        uint32_t low;
+        if (end - p < 2 || p[0] != '\\' || p[1] != 'u' ||
+                !mpack_json_parse_hex(p + 2, end, &low) ||
+                low < 0xDC00 || low > 0xDFFF)
+            return NULL;
+        p += 6;
+        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+    } else if (code >= 0xDC00 && code <= 0xDFFF) {
+        return NULL;
+    }
+
+    if (code < 0x80) {
+        out[0] = (char)code;
+    } else if (code < 0x800) {
+        out[0] = (char)(0xC0 | (code >> 6));
+        out[1] = (char)(0x80 | (code & 0x3F));
+        *count = 2;
+    } else if (code < 0x10000) {
+        out[0] = (char)(0xE0 | (code >> 12));
+        out[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (code & 0x3F));
+        *count = 3;
+    } else {
+        out[0] = (char)(0xF0 | (code >> 18));
+        out[1] = (char)(0x80 | ((code >> 12) & 0x3F));
+        out[2] = (char)(0x80 | ((code >> 6) & 0x3F));
+        out[3] = (char)(0x80 | (code & 0x3F));
+        *count = 4;
+    }
+    return p;
+}
+
+// Parses a string starting after its opening quote and writes it as a str,
+// returning a pointer past its closing quote or NULL if it is not valid.
+static const char* mpack_json_parse_string(mpack_writer_t* writer, const char* p, const char* end) {
+    const char* start = p;
+    size_t saved = 0; // bytes saved by unescaping
+    char decoded[4];
+    size_t count;
+
+    // find the end of the string, validating it and measuring its unescaped
+    // length
+    for (;;) {
+        while (end - p >= 8) {
+            uint64_t word;
+            mpack_memcpy(&word, p, sizeof(word));
+            if (mpack_json_word_is_special(word))
+                break;
+            p += 8;
+        }
+        if (p == end)
+            return NULL;
+
+        uint8_t c = (uint8_t)*p;
+        if (c == '"')
+            break;
+        if (c == '\\') {
+            const char* next = mpack_json_unescape(p + 1, end, decoded, &count);
+            if (next == NULL)
+                return NULL;
+            saved += (size_t)(next - p) - count;
+            p = next;
+        } else if (c >= 0x80) {
+            size_t sequence = mpack_json_utf8_sequence(p, end);
+            if (sequence == 0)
+                return NULL;
+            p += sequence;
+        } else if (c < 0x20) {
+            return NULL;
+        } else {
+            ++p;
+        }
+    }
+
+    size_t length = (size_t)(p - start) - saved;
+    if (length > MPACK_UINT32_MAX) {
+        mpack_writer_flag_error(writer, mpack_error_too_big);
+        return NULL;
+    }
+    if (saved == 0) {
+        mpack_write_str(writer, start, (uint32_t)length);
+        return p + 1;
+    }
+
+    // write it unescaped
+    mpack_start_str(writer, (uint32_t)length);
+    const char* run = start;
+    const char* q = start;
+    while (q != p) {
+        if (*q != '\\') {
+            ++q;
+            continue;
+        }
+        mpack_write_bytes(writer, run, (size_t)(q - run));
+        q = mpack_json_unescape(q + 1, p, decoded, &count);
+        mpack_write_bytes(writer, decoded, count);
+        run = q;
+    }
+    mpack_write_bytes(writer, run, (size_t)(p - run));
+    mpack_finish_str(writer);
+    return p + 1;
+}
+
+#if MPACK_DOUBLE
+static const double mpack_json_powers_of_ten[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#if MPACK_STDLIB
+// Converts a number with strtod(). The number is first rewritten as its
+// significant digits and an exponent, without a decimal point, so that the
+// result doesn't depend on the locale. Digits beyond the first 64 only
+// contribute a trailing 1 so that ties are still rounded correctly.
+static double mpack_json_strtod(const char* p, const char* end) {
+    char buffer[96];
+    size_t used = 0;
+    size_t digits = 0;
+    long exponent = 0;
+    bool point = false;
+    bool sticky = false;
+
+    if (*p == '-')
+        buffer[used++] = *p++;
+    for (; p != end && *p != 'e' && *p != 'E'; ++p) {
+        if (*p == '.') {
+            point = true;
+        } else if (digits == 0 && *p == '0') {
+            if (point)
+                --exponent;
+        } else if (digits < 64) {
+            buffer[used++] = *p;
+            ++digits;
+            if (point)
+                --exponent;
+        } else {
+            if (!point)
+                ++exponent;
+            sticky |= *p != '0';
+        }
+    }
+    if (digits == 0)
+        buffer[used++] = '0';
+    if (sticky) {
+        buffer[used++] = '1';
+        --exponent;
+    }
+
+    if (p != end) {
+        bool negative = *++p == '-';
+        if (*p == '-' || *p == '+')
+            ++p;
+        long value = 0;
+        for (; p != end; ++p)
+            if (value < 100000)
+                value = value * 10 + (*p - '0');
+        exponent += negative ? -value : value;
+    }
+
+    buffer[used++] = 'e';
+    if (exponent < 0) {
+        buffer[used++] = '-';
+        exponent = -exponent;
+    }
+    char* digits_end = buffer + sizeof(buffer) - 1;
+    char* q = digits_end;
+    do {
+        *--q = (char)('0' + exponent % 10);
+        exponent /= 10;
+    } while (exponent > 0);
+    mpack_memmove(buffer + used, q, (size_t)(digits_end - q));
+    used += (size_t)(digits_end - q);
+    buffer[used] = '\0';
+
+    return strtod(buffer, NULL);
+}
+#endif
+#endif
+
+// Parses a number and writes it as the smallest int, uint, float or double,
+// returning a pointer past it or NULL if it is not valid.
+static const char* mpack_json_parse_number(mpack_writer_t* writer, const char* p, const char* end) {
+    const char* start = p;
+    bool negative = false;
+    if (*p == '-') {
+        negative = true;
+        ++p;
+    }
+    if (!mpack_json_is_digit(p, end))
+        return NULL;
+
+    // the first 19 significant digits are accumulated in the mantissa, which
+    // can't overflow. the integer part is also accumulated separately in
+    // case it needs 20 digits.
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool truncated = false;
+    uint64_t integer = 0;
+    bool overflow = false;
+
+    if (*p == '0') {
+        ++p;
+    } else {
+        for (; mpack_json_is_digit(p, end); ++p) {
+            unsigned digit = (unsigned)(*p - '0');
+            if (digits < 19) {
+                mantissa = mantissa * 10 + digit;
+                ++digits;
+            } else {
+                ++exponent;
+                truncated |= digit != 0;
+            }
+            if (integer > (MPACK_UINT64_C(0xFFFFFFFFFFFFFFFF) - digit) / 10)
+                overflow = true;
+            integer = integer * 10 + digit;
+        }
+    }
+
+    bool real = false;
+    if (p != end && *p == '.') {
+        real = true;
+        ++p;
+        if (!mpack_json_is_digit(p, end))
+            return NULL;
+        for (; mpack_json_is_digit(p, end); ++p) {
+            unsigned digit = (unsigned)(*p - '0');
+            if (digits < 19) {
+                mantissa = mantissa * 10 + digit;
+                if (mantissa != 0)
+                    ++digits;
+                --exponent;
+            } else {
+                truncated |= digit != 0;
+            }
+        }
+    }
+
+    if (p != end && (*p == 'e' || *p == 'E')) {
+        real = true;
+        ++p;
+        bool exponent_negative = false;
+        if (p != end && (*p == '-' || *p == '+')) {
+            exponent_negative = *p == '-';
+            ++p;
+        }
+        if (!mpack_json_is_digit(p, end))
+            return NULL;
+        int value = 0;
+        for (; mpack_json_is_digit(p, end); ++p)
+            if (value < 100000)
+                value = value * 10 + (*p - '0');
+        exponent += exponent_negative ? -value : value;
+    }
+
+    if (!real && !overflow) {
+        if (!negative) {
+            mpack_write_u64(writer, integer);
+            return p;
+        }
+        if (integer <= MPACK_UINT64_C(0x8000000000000000)) {
+            mpack_write_i64(writer, (int64_t)((uint64_t)0 - integer));
+            return p;
+        }
+    }
+
+    #if MPACK_DOUBLE
+    double value;
+    if (!truncated && mantissa <= (MPACK_UINT64_C(1) << 53) && exponent >= -22 && exponent <= 22) {
+        // both the mantissa and the power of ten are exact so the result is
+        // correctly rounded
+        value = (double)mantissa;
+        if (exponent < 0)
+            value /= mpack_json_powers_of_ten[-exponent];
+        else
+            value *= mpack_json_powers_of_ten[exponent];
+        if (negative)
+            value = -value;
+    } else {
+        #if MPACK_STDLIB
+        value = mpack_json_strtod(start, p);
+        #else
+        MPACK_UNUSED(start);
+        value = (double)mantissa;
+        for (; exponent > 22; exponent -= 22)
+            value *= 1e22;
+        for (; exponent < -22; exponent += 22)
+            value /= 1e22;
+        if (exponent < 0)
+            value /= mpack_json_powers_of_ten[-exponent];
+        else
+            value *= mpack_json_powers_of_ten[exponent];
+        if (negative)
+            value = -value;
+        #endif
+    }
+
+    // the range is checked first because converting an out-of-range double
+    // to float is undefined
+    if (value >= -3.4028234663852886e38 && value <= 3.4028234663852886e38) {
+        float f = (float)value;
+        if ((double)f == value) {
+            mpack_write_float(writer, f);
+            return p;
+        }
+    }
+    mpack_write_double(writer, value);
+    #else
+    MPACK_UNUSED(start);
+    MPACK_UNUSED(mantissa);
+    MPACK_UNUSED(exponent);
+    MPACK_UNUSED(truncated);
+    mpack_writer_flag_error(writer, mpack_error_unsupported);
+    #endif
+    return p;
+}
+
+// Parses a key and the following colon, returning a pointer to the value or
+// NULL if they are not valid.
+static const char* mpack_json_parse_key(mpack_writer_t* writer, const char* p, const char* end) {
+    if (p == end || *p != '"')
+        return NULL;
+    p = mpack_json_parse_string(writer, p + 1, end);
+    if (p == NULL)
+        return NULL;
+    p = mpack_json_skip_space(p, end);
+    if (p == end || *p != ':')
+        return NULL;
+    return mpack_json_skip_space(p + 1, end);
+}
+
+// Parses a literal, returning a pointer past it or NULL if it doesn't match.
+MPACK_STATIC_INLINE const char* mpack_json_parse_literal(const char* p, const char* end,
+        const char* literal, size_t length)
+{
+    if ((size_t)(end - p) < length || mpack_memcmp(p, literal, length) != 0)
+        return NULL;
+    return p + length;
+}
+
+// Parses a value that is not an object or array.
+static const char* mpack_json_parse_value(mpack_writer_t* writer, const char* p, const char* end) {
+    switch (*p) {
+        case '"':
+            return mpack_json_parse_string(writer, p + 1, end);
+        case 't':
+            p = mpack_json_parse_literal(p, end, "true", 4);
+            if (p)
+                mpack_write_true(writer);
+            return p;
+        case 'f':
+            p = mpack_json_parse_literal(p, end, "false", 5);
+            if (p)
+                mpack_write_false(writer);
+            return p;
+        case 'n':
+            p = mpack_json_parse_literal(p, end, "null", 4);
+            if (p)
+                mpack_write_nil(writer);
+            return p;
+        default:
+            return mpack_json_parse_number(writer, p, end);
+    }
+}
+
+size_t mpack_write_json(mpack_writer_t* writer, const char* text, size_t length) {
+    const char* end = text + length;
+    const char* p = mpack_json_skip_space(text, end);
+
+    // whether each open container is an object (rather than an array)
+    bool objects[MPACK_JSON_MAX_DEPTH];
+    size_t depth = 0;
+    bool value_next = true;
+
+    while (p != NULL && mpack_writer_error(writer) == mpack_ok) {
+        if (value_next) {
+            if (p == end) {
+                p = NULL;
+                break;
+            }
+
+            bool object = *p == '{';
+            if (!object && *p != '[') {
+                p = mpack_json_parse_value(writer, p, end);
+                value_next = false;
+                continue;
+            }
+
+            if (depth == MPACK_JSON_MAX_DEPTH) {
+                mpack_writer_flag_error(writer, mpack_error_too_big);
+                break;
+            }
+            objects[depth++] = object;
+            if (object)
+                mpack_build_map(writer);
+            else
+                mpack_build_array(writer);
+
+            p = mpack_json_skip_space(p + 1, end);
+            if (p != end && *p == (object ? '}' : ']')) {
+                ++p;
+                --depth;
+                if (object)
+                    mpack_complete_map(writer);
+                else
+                    mpack_complete_array(writer);
+                value_next = false;
+            } else if (object) {
+                p = mpack_json_parse_key(writer, p, end);
+            }
+            continue;
+        }
+
+        // after a value we expect a comma or the end of its container
+        p = mpack_json_skip_space(p, end);
+        if (depth == 0)
+            break;
+        bool object = objects[depth - 1];
+        if (p != end && *p == ',') {
+            p = mpack_json_skip_space(p + 1, end);
+            if (object)
+                p = mpack_json_parse_key(writer, p, end);
+            value_next = true;
+        } else if (p != end && *p == (object ? '}' : ']')) {
+            ++p;
+            --depth;
+            if (object)
+                mpack_complete_map(writer);
+            else
+                mpack_complete_array(writer);
+        } else {
+            p = NULL;
+        }
+    }
+
+    if (p == NULL && mpack_writer_error(writer) == mpack_ok) {
+        mpack_log("invalid JSON\n");
+        mpack_writer_flag_error(writer, mpack_error_invalid);
+    }
+    if (mpack_writer_error(writer) != mpack_ok)
+        return 0;
+    return (size_t)(p - text);
+}
+
+#endif
+
+MPACK_SILENCE_WARNINGS_END
@@ -0,0 +1,364 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file
+ *
+ * Declares the MPack JSON API.
+ */
+
+#ifndef MPACK_JSON_H
+#define MPACK_JSON_H 1
+
+#include "mpack-node.h"
+
+MPACK_SILENCE_WARNINGS_BEGIN
+MPACK_EXTERN_C_BEGIN
+
+/**
+ * @defgroup json JSON API
+ *
+ * The MPack JSON API converts between MessagePack and JSON text.
+ *
+ * Unlike the debug printing functions (such as mpack_node_print_to_callback()),
+ * the output is strict JSON and the conversion does not use stdio, so it is
+ * available in release builds. A @ref mpack_json_writer_t wraps a buffer and,
+ * optionally, a flush function, in the same way as a @ref mpack_writer_t. It
+ * can convert a message from a buffer, a @ref mpack_reader_t or a parsed @ref
+ * mpack_node_t.
+ *
+ * Values are converted as follows:
+ *
+ * - nil, bool, int and uint are converted to their JSON equivalents.
+ * - float and double are written with the shortest number of digits that
+ *   parses back to the same value, and always with a fraction or exponent
+ *   (e.g. 1.0 rather than 1). Non-finite values are written as null.
+ * - str is written as a JSON string. It must be valid UTF-8, otherwise
+ *   @ref mpack_error_type is flagged.
+ * - bin is written as a JSON string containing its data in base64.
+ * - ext is written as configured by mpack_json_writer_set_ext().
+ * - map keys that are not strings are handled as configured by
+ *   mpack_json_writer_set_keys().
+ *
+ * In the other direction, mpack_write_json() parses JSON text and writes it
+ * to a @ref mpack_writer_t.
+ *
+ * @{
+ */
+
+#if MPACK_READER || MPACK_NODE
+
+/**
+ * @def MPACK_JSON_MINIMUM_BUFFER_SIZE
+ *
+ * The minimum buffer size for a JSON writer with a flush function.
+ */
+#define MPACK_JSON_MINIMUM_BUFFER_SIZE 32
+
+/**
+ * A buffered JSON writer.
+ *
+ * This structure is opaque; its fields should not be accessed outside
+ * of MPack.
+ */
+typedef struct mpack_json_writer_t mpack_json_writer_t;
+
+/**
+ * The JSON writer's flush function to flush the buffer to the output stream.
+ * It should flag an appropriate error on the JSON writer if flushing fails
+ * (usually mpack_error_io or mpack_error_memory.)
+ *
+ * @see mpack_json_writer_context()
+ */
+typedef void (*mpack_json_flush_t)(mpack_json_writer_t* json, const char* buffer, size_t count);
+
+/**
+ * Defines how a JSON writer converts ext values.
+ *
+ * @see mpack_json_writer_set_ext()
+ */
+typedef enum mpack_json_ext_t {
+    mpack_json_ext_object = 0, /**< An object of the form <tt>{"type":1,"data":"AQID"}</tt>, with the data in base64. This is the default. */
+    mpack_json_ext_base64,     /**< A string containing the data in base64. The ext type is dropped. */
+    mpack_json_ext_null,       /**< null. */
+    mpack_json_ext_error       /**< Flags @ref mpack_error_type. */
+} mpack_json_ext_t;
+
+/**
+ * Defines how a JSON writer converts map keys that are not strings.
+ *
+ * @see mpack_json_writer_set_keys()
+ */
+typedef enum mpack_json_keys_t {
+    mpack_json_keys_stringify = 0, /**< Converts the key to JSON and wraps it in a string, e.g. <tt>"1"</tt> or <tt>"null"</tt>. A bin key is written as a base64 string. This is the default. */
+    mpack_json_keys_skip,          /**< Skips the key and its value. */
+    mpack_json_keys_error          /**< Flags @ref mpack_error_type. */
+} mpack_json_keys_t;
+
+/* Hide internals from documentation */
+/** @cond */
+
+struct mpack_json_writer_t {
+    mpack_json_flush_t flush; /* Function to write bytes to the output stream */
+    void* context;            /* Context for the flush function */
+    char* buffer;             /* Byte buffer */
+    size_t size;              /* Size of the buffer */
+    size_t used;              /* Number of bytes used in the buffer */
+    mpack_json_ext_t ext;
+    mpack_json_keys_t keys;
+    mpack_error_t error;
+};
+
+/** @endcond */
+
+/**
+ * @name Lifecycle Functions
+ * @{
+ */
+
+/**
+ * Initializes a JSON writer with the given buffer. The writer does not
+ * assume ownership of the buffer.
+ *
+ * Without a flush function, an error is flagged if the output does not fit
+ * in the buffer. The output is not null-terminated.
+ *
+ * @param json The JSON writer to initialize.
+ * @param buffer The buffer into which to write JSON text.
+ * @param size The size of the buffer.
+ */
+void mpack_json_writer_init(mpack_json_writer_t* json, char* buffer, size_t size);
+
+/**
+ * Flushes any remaining output and cleans up the JSON writer, returning its
+ * error state.
+ */
+mpack_error_t mpack_json_writer_destroy(mpack_json_writer_t* json);
+
+/**
+ * @}
+ */
+
+/**
+ * @name Configuration
+ * @{
+ */
+
+/**
+ * Sets the flush function to write out the text when the buffer is full.
+ *
+ * The buffer must be at least @ref MPACK_JSON_MINIMUM_BUFFER_SIZE bytes.
+ */
+void mpack_json_writer_set_flush(mpack_json_writer_t* json, mpack_json_flush_t flush);
+
+/**
+ * Sets the custom pointer to pass to the flush function.
+ *
+ * @see mpack_json_writer_context()
+ */
+MPACK_INLINE void mpack_json_writer_set_context(mpack_json_writer_t* json, void* context) {
+    json->context = context;
+}
+
+/**
+ * Returns the custom context for the flush function.
+ *
+ * @see mpack_json_writer_set_context()
+ */
+MPACK_INLINE void* mpack_json_writer_context(mpack_json_writer_t* json) {
+    return json->context;
+}
+
+/**
+ * Sets how ext values are converted. The default is @ref
+ * mpack_json_ext_object.
+ */
+MPACK_INLINE void mpack_json_writer_set_ext(mpack_json_writer_t* json, mpack_json_ext_t ext) {
+    json->ext = ext;
+}
+
+/**
+ * Sets how map keys that are not strings are converted. The default is @ref
+ * mpack_json_keys_stringify.
+ *
+ * Maps and arrays cannot be converted to keys; they flag @ref mpack_error_type
+ * unless keys are skipped. Neither can ext keys when ext values are converted
+ * to objects.
+ */
+MPACK_INLINE void mpack_json_writer_set_keys(mpack_json_writer_t* json, mpack_json_keys_t keys) {
+    json->keys = keys;
+}
+
+/**
+ * @}
+ */
+
+/**
+ * @name Error Functions
+ * @{
+ */
+
+/**
+ * Places the JSON writer in the given error state.
+ *
+ * This can be called from a flush function if writing fails.
+ */
+void mpack_json_writer_flag_error(mpack_json_writer_t* json, mpack_error_t error);
+
+/**
+ * Returns the error state of the JSON writer.
+ */
+MPACK_INLINE mpack_error_t mpack_json_writer_error(mpack_json_writer_t* json) {
+    return json->error;
+}
+
+/**
+ * Returns the number of bytes of text in the buffer that have not been
+ * flushed.
+ */
+MPACK_INLINE size_t mpack_json_writer_buffer_used(mpack_json_writer_t* json) {
+    return json->used;
+}
+
+/**
+ * @}
+ */
+
+/**
+ * @name Conversion Functions
+ * @{
+ */
+
+/**
+ * Writes the given text as-is, for example a newline between messages.
+ */
+void mpack_json_write_raw(mpack_json_writer_t* json, const char* text, size_t count);
+
+#if MPACK_READER
+/**
+ * Reads one message from the given reader and writes it as JSON.
+ *
+ * The contents of each str, bin and ext are read in-place, so when reading
+ * from a stream they must fit in the reader's buffer, otherwise @ref
+ * mpack_error_too_big is flagged.
+ *
+ * Maps and arrays nested more than @ref MPACK_JSON_MAX_DEPTH deep flag @ref
+ * mpack_error_too_big.
+ *
+ * If an error occurs, it is flagged on both the reader and the JSON writer.
+ *
+ * @note This requires @ref MPACK_READER.
+ */
+void mpack_json_write_reader(mpack_json_writer_t* json, mpack_reader_t* reader);
+
+/**
+ * Writes the first message in the given buffer as JSON, returning the number
+ * of bytes it uses, or 0 if an error occurs.
+ *
+ * The buffer may contain several messages, in which case this can be called
+ * repeatedly to convert each of them.
+ *
+ * @note This requires @ref MPACK_READER.
+ */
+size_t mpack_json_write_data(mpack_json_writer_t* json, const char* data, size_t size);
+#endif
+
+#if MPACK_NODE
+/**
+ * Writes the given node and everything it contains as JSON.
+ *
+ * Maps and arrays nested more than @ref MPACK_JSON_MAX_DEPTH deep flag @ref
+ * mpack_error_too_big.
+ *
+ * If an error occurs, it is flagged on the JSON writer. The tree is not
+ * modified.
+ *
+ * @note This requires @ref MPACK_NODE.
+ */
+void mpack_json_write_node(mpack_json_writer_t* json, mpack_node_t node);
+#endif
+
+/**
+ * @}
+ */
+
+#endif
+
+#if MPACK_WRITER && MPACK_BUILDER
+
+/**
+ * @name Parsing Functions
+ * @{
+ */
+
+/**
+ * Parses one JSON value from the given text and writes it to the given
+ * writer as MessagePack.
+ *
+ * The value is written as it is parsed, without building an intermediate
+ * tree. Objects and arrays are written with the builder (see
+ * mpack_build_map()), so their sizes do not need to be known in advance.
+ * Objects may be nested at most @ref MPACK_JSON_MAX_DEPTH deep.
+ *
+ * Values are converted as follows:
+ *
+ * - Objects are written as maps, keeping the order and any duplicates of
+ *   their keys.
+ * - Numbers without a fraction or exponent are written as the smallest int
+ *   or uint that holds them. Those that don't fit in 64 bits are written as
+ *   reals.
+ * - Other numbers are written as a float if that represents them exactly,
+ *   and as a double otherwise. Reals require @ref MPACK_DOUBLE, otherwise
+ *   @ref mpack_error_unsupported is flagged. Without @ref MPACK_STDLIB,
+ *   numbers with more than 15 significant digits or large exponents may be
+ *   rounded differently than by strtod().
+ * - Strings are unescaped and written as str. The text must be valid UTF-8.
+ *
+ * Whitespace after the value is skipped. The text may contain more after the
+ * value, for example another value; the return value tells where it starts.
+ *
+ * If the text is not valid JSON, @ref mpack_error_invalid is flagged on the
+ * writer. The writer must not be in canonical mode (see
+ * mpack_writer_set_canonical()) since that does not support the builder.
+ *
+ * @note This requires @ref MPACK_WRITER and @ref MPACK_BUILDER.
+ *
+ * @param writer The writer to which to write the value.
+ * @param text The JSON text.
+ * @param length The length of the text in bytes.
+ * @return The number of bytes of text used, or 0 if an error occurs.
+ */
+size_t mpack_write_json(mpack_writer_t* writer, const char* text, size_t length);
+
+/**
+ * @}
+ */
+
+#endif
+
+/**
+ * @}
+ */
+
+MPACK_EXTERN_C_END
+MPACK_SILENCE_WARNINGS_END
+
+#endif
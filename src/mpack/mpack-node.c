@@ -63,17 +63,48 @@ MPACK_STATIC_INLINE int8_t mpack_node_exttype_unchecked(mpack_node_t node) {
  * Tree Parsing
  */
 
+// The largest length or count that can be stored in a node
+#if MPACK_NODE_COMPACT
+#define MPACK_NODE_MAX_LEN MPACK_NODE_COMPACT_MAX_LEN
+#else
+#define MPACK_NODE_MAX_LEN MPACK_UINT32_MAX
+#endif
+
 #ifdef MPACK_MALLOC
 
-// fix up the alloc size to make sure it exactly fits the
-// maximum number of nodes it can contain (the allocator will
-// waste it back anyway, but we round it down just in case)
+// Returns the number of nodes that fit in a page of the given size.
+MPACK_STATIC_INLINE size_t mpack_tree_page_nodes(size_t page_size) {
+    return (page_size - sizeof(mpack_tree_page_t)) / sizeof(mpack_node_data_t) + 1;
+}
+
+// Returns the alloc size of a page for the given number of nodes. This fixes
+// up the page size to make sure it exactly fits the maximum number of nodes
+// it can contain (the allocator will waste it back anyway, but we round it
+// down just in case.)
+MPACK_STATIC_INLINE size_t mpack_tree_page_alloc_size(size_t nodes) {
+    return sizeof(mpack_tree_page_t) + sizeof(mpack_node_data_t) * (nodes - 1);
+}
 
-#define MPACK_NODES_PER_PAGE \
-    ((MPACK_NODE_PAGE_SIZE - sizeof(mpack_tree_page_t)) / sizeof(mpack_node_data_t) + 1)
+// Returns the size of the node page to allocate after one of the given size.
+MPACK_STATIC_INLINE size_t mpack_tree_grow_page_size(mpack_tree_t* tree, size_t page_size) {
+    if (page_size > tree->max_page_size / 2)
+        return tree->max_page_size;
+    return page_size * 2;
+}
 
-#define MPACK_PAGE_ALLOC_SIZE \
-    (sizeof(mpack_tree_page_t) + sizeof(mpack_node_data_t) * (MPACK_NODES_PER_PAGE - 1))
+#if MPACK_STATS
+// Recalculates the memory allocated by the tree after an allocation or free.
+static void mpack_tree_stats_memory(mpack_tree_t* tree) {
+    size_t memory = tree->stats.node_memory + tree->buffer_capacity;
+    if (tree->parser.stack_owned)
+        memory += tree->parser.stack_capacity * sizeof(mpack_level_t);
+    tree->stats.memory = memory;
+    if (memory > tree->stats.peak_memory)
+        tree->stats.peak_memory = memory;
+}
+#else
+#define mpack_tree_stats_memory(tree) ((void)0)
+#endif
 
 #endif
 
@@ -110,7 +141,7 @@ static bool mpack_tree_reserve_fill(mpack_tree_t* tree) {
     if (tree->data_length + bytes > tree->buffer_capacity) {
 
         // TODO: check for overflow?
-        size_t new_capacity = (tree->buffer_capacity == 0) ? MPACK_BUFFER_SIZE : tree->buffer_capacity;
+        size_t new_capacity = (tree->buffer_capacity == 0) ? tree->buffer_size : tree->buffer_capacity;
         while (new_capacity < tree->data_length + bytes)
             new_capacity *= 2;
         if (new_capacity > tree->max_size)
@@ -118,11 +149,13 @@ static bool mpack_tree_reserve_fill(mpack_tree_t* tree) {
 
         mpack_log("expanding buffer from %i to %i\n", (int)tree->buffer_capacity, (int)new_capacity);
 
+        mpack_trace_begin(tree, mpack_trace_tree_realloc, new_capacity);
         char* new_buffer;
         if (tree->buffer == NULL)
-            new_buffer = (char*)MPACK_MALLOC(new_capacity);
+            new_buffer = (char*)mpack_allocator_alloc(tree->allocator, new_capacity);
         else
-            new_buffer = (char*)mpack_realloc(tree->buffer, tree->data_length, new_capacity);
+            new_buffer = (char*)mpack_allocator_realloc(tree->allocator, tree->buffer, tree->data_length, new_capacity);
+        mpack_trace_end(tree, mpack_trace_tree_realloc, new_capacity);
 
         if (new_buffer == NULL) {
             mpack_tree_flag_error(tree, mpack_error_memory);
@@ -132,12 +165,17 @@ static bool mpack_tree_reserve_fill(mpack_tree_t* tree) {
         tree->data = new_buffer;
         tree->buffer = new_buffer;
         tree->buffer_capacity = new_capacity;
+        mpack_stats_add(tree->stats, buffer_reallocs, 1);
+        mpack_tree_stats_memory(tree);
     }
 
     // request as much data as possible, looping until we have
     // all the data we need
     do {
+        mpack_trace_begin(tree, mpack_trace_tree_fill, tree->buffer_capacity - tree->data_length);
         size_t read = tree->read_fn(tree, tree->buffer + tree->data_length, tree->buffer_capacity - tree->data_length);
+        mpack_trace_end(tree, mpack_trace_tree_fill, read);
+        mpack_stats_add(tree->stats, fill_calls, 1);
 
         // If the fill function encounters an error, it should flag an error on
         // the tree.
@@ -158,6 +196,7 @@ static bool mpack_tree_reserve_fill(mpack_tree_t* tree) {
         }
 
         mpack_log("read %" PRIu32 " more bytes\n", (uint32_t)read);
+        mpack_stats_add(tree->stats, fill_bytes, read);
         tree->data_length += read;
         tree->parser.possible_nodes_left += read;
     } while (tree->parser.possible_nodes_left < bytes);
@@ -217,7 +256,9 @@ MPACK_STATIC_INLINE size_t mpack_tree_parser_stack_capacity(mpack_tree_t* tree)
     #endif
 }
 
-static bool mpack_tree_push_stack(mpack_tree_t* tree, mpack_node_data_t* first_child, size_t total) {
+static bool mpack_tree_push_stack(mpack_tree_t* tree, mpack_node_data_t* parent,
+        mpack_node_data_t* first_child, size_t total)
+{
     mpack_tree_parser_t* parser = &tree->parser;
     mpack_assert(parser->state == mpack_tree_parse_state_in_progress);
 
@@ -233,7 +274,8 @@ static bool mpack_tree_push_stack(mpack_tree_t* tree, mpack_node_data_t* first_c
 
         // Replace the stack-allocated parsing stack
         if (!parser->stack_owned) {
-            mpack_level_t* new_stack = (mpack_level_t*)MPACK_MALLOC(sizeof(mpack_level_t) * new_capacity);
+            mpack_level_t* new_stack = (mpack_level_t*)mpack_allocator_alloc(tree->allocator,
+                    sizeof(mpack_level_t) * new_capacity);
             if (!new_stack) {
                 mpack_tree_flag_error(tree, mpack_error_memory);
                 return false;
@@ -244,7 +286,7 @@ static bool mpack_tree_push_stack(mpack_tree_t* tree, mpack_node_data_t* first_c
 
         // Realloc the allocated parsing stack
         } else {
-            mpack_level_t* new_stack = (mpack_level_t*)mpack_realloc(parser->stack,
+            mpack_level_t* new_stack = (mpack_level_t*)mpack_allocator_realloc(tree->allocator, parser->stack,
                     sizeof(mpack_level_t) * parser->stack_capacity, sizeof(mpack_level_t) * new_capacity);
             if (!new_stack) {
                 mpack_tree_flag_error(tree, mpack_error_memory);
@@ -253,6 +295,7 @@ static bool mpack_tree_push_stack(mpack_tree_t* tree, mpack_node_data_t* first_c
             parser->stack = new_stack;
         }
         parser->stack_capacity = new_capacity;
+        mpack_tree_stats_memory(tree);
         #else
         mpack_tree_flag_error(tree, mpack_error_too_big);
         return false;
@@ -263,9 +306,166 @@ static bool mpack_tree_push_stack(mpack_tree_t* tree, mpack_node_data_t* first_c
     ++parser->level;
     parser->stack[parser->level].child = first_child;
     parser->stack[parser->level].left = total;
+    parser->stack[parser->level].parent = parent;
+    parser->stack[parser->level].paths = parser->paths;
     return true;
 }
 
+/*
+ * Allocates storage for the given number of contiguous nodes from the current
+ * page or pool, growing the tree if needed.
+ *
+ * Returns NULL and flags an error if the nodes could not be allocated.
+ */
+static mpack_node_data_t* mpack_tree_alloc_nodes(mpack_tree_t* tree, size_t total) {
+    mpack_tree_parser_t* parser = &tree->parser;
+
+    // If there are enough nodes left in the current page, no need to grow
+    if (total <= parser->nodes_left) {
+        mpack_node_data_t* nodes = parser->nodes;
+        parser->nodes += total;
+        parser->nodes_left -= total;
+        return nodes;
+    }
+
+    #ifdef MPACK_MALLOC
+
+    // We can't grow if we're using a fixed pool (i.e. we didn't start with a
+    // page), unless the pool is allowed to overflow into pages
+    if (!tree->next && !(tree->pool != NULL && tree->pool_overflow)) {
+        mpack_tree_flag_error(tree, mpack_error_too_big);
+        return NULL;
+    }
+
+    // Otherwise we need to grow, and the node's children need to be contiguous.
+    // This is a heuristic to decide whether we should waste the remaining space
+    // in the current page and start a new one, or give the children their
+    // own page. With a fraction of 1/8, this causes at most 12% additional
+    // waste. Note that reducing this too much causes less cache coherence and
+    // more malloc() overhead due to smaller allocations, so there's a tradeoff
+    // here. This heuristic could use some improvement, especially with custom
+    // page sizes.
+
+    mpack_tree_page_t* page;
+    mpack_node_data_t* nodes;
+    size_t page_nodes = mpack_tree_page_nodes(parser->page_size);
+
+    if (total > page_nodes || parser->nodes_left > page_nodes / 8) {
+        // TODO: this should check for overflow
+        page = (mpack_tree_page_t*)mpack_allocator_alloc(tree->allocator,
+                mpack_tree_page_alloc_size(total));
+        if (page == NULL) {
+            mpack_tree_flag_error(tree, mpack_error_memory);
+            return NULL;
+        }
+        mpack_stats_add(tree->stats, node_memory, mpack_tree_page_alloc_size(total));
+        mpack_log("allocated seperate page %p for %i children, %i left in page of %i total\n",
+                (void*)page, (int)total, (int)parser->nodes_left, (int)page_nodes);
+
+        nodes = page->nodes;
+
+    } else {
+        page = (mpack_tree_page_t*)mpack_allocator_alloc(tree->allocator,
+                mpack_tree_page_alloc_size(page_nodes));
+        if (page == NULL) {
+            mpack_tree_flag_error(tree, mpack_error_memory);
+            return NULL;
+        }
+        mpack_stats_add(tree->stats, node_memory, mpack_tree_page_alloc_size(page_nodes));
+        mpack_stats_add(tree->stats, wasted_nodes, parser->nodes_left);
+        mpack_log("allocated new page %p for %i children, wasting %i in page of %i total\n",
+                (void*)page, (int)total, (int)parser->nodes_left, (int)page_nodes);
+
+        nodes = page->nodes;
+        parser->nodes = page->nodes + total;
+        parser->nodes_left = page_nodes - total;
+        parser->page_size = mpack_tree_grow_page_size(tree, parser->page_size);
+    }
+
+    page->next = tree->next;
+    tree->next = page;
+    mpack_stats_add(tree->stats, node_pages, 1);
+    mpack_tree_stats_memory(tree);
+    return nodes;
+
+    #else
+    // We can't grow if we don't have an allocator
+    mpack_tree_flag_error(tree, mpack_error_too_big);
+    return NULL;
+    #endif
+}
+
+/*
+ * If the tree records spans, an extra node is allocated before the children
+ * of each non-empty map or array to record where it starts in the data. Its
+ * length is filled in by mpack_tree_finish_span() once its contents have
+ * been parsed, or left at zero if it does not fit in a uint32_t.
+ */
+MPACK_STATIC_INLINE size_t mpack_tree_span_nodes(mpack_tree_t* tree, size_t total) {
+    return (tree->parser.spans && total > 0) ? 1 : 0;
+}
+
+static mpack_node_data_t* mpack_tree_alloc_children(mpack_tree_t* tree, size_t total) {
+    size_t extra = mpack_tree_span_nodes(tree, total);
+    mpack_node_data_t* nodes = mpack_tree_alloc_nodes(tree, total + extra);
+    if (nodes == NULL || extra == 0)
+        return nodes;
+
+    // The current node starts at the current size of the tree.
+    nodes->type = mpack_type_missing;
+    nodes->len = 0;
+    nodes->value.offset = tree->size;
+    return nodes + 1;
+}
+
+static void mpack_tree_finish_span(mpack_tree_t* tree, mpack_level_t* level) {
+    mpack_node_data_t* parent = level->parent;
+    if (parent == NULL || parent == &tree->parser.skipped)
+        return;
+    mpack_node_data_t* span = parent->value.children - 1;
+    size_t length = tree->size - span->value.offset;
+    if (length <= MPACK_NODE_MAX_LEN)
+        span->len = (uint32_t)length & MPACK_NODE_MAX_LEN;
+}
+
+/*
+ * The contents of a lazy map or array are not parsed into nodes.
+ * They are parsed into the parser's skipped node instead, which validates
+ * them and determines their size. A non-empty map or array gets a single
+ * placeholder child of type mpack_type_missing that records the offset of its
+ * contents. This is replaced by its real children by mpack_node_expand() when
+ * they are first accessed.
+ */
+static bool mpack_tree_parse_children_lazy(mpack_tree_t* tree, mpack_node_data_t* node, size_t total) {
+    mpack_tree_parser_t* parser = &tree->parser;
+    if (total == 0)
+        return true;
+
+    // The contents start right after this node's header.
+    size_t offset = tree->size + parser->current_node_reserved + 1;
+
+    if (!mpack_tree_reserve_bytes(tree, total))
+        return false;
+
+    if (node != &parser->skipped) {
+        tree->node_count += 1 + mpack_tree_span_nodes(tree, 1);
+        if (tree->node_count > tree->max_nodes) {
+            mpack_tree_flag_error(tree, mpack_error_too_big);
+            return false;
+        }
+
+        mpack_node_data_t* placeholder = mpack_tree_alloc_children(tree, 1);
+        if (placeholder == NULL)
+            return false;
+        placeholder->type = mpack_type_missing;
+        placeholder->len = 0;
+        placeholder->value.offset = offset;
+        node->value.children = placeholder;
+    }
+
+    return mpack_tree_push_stack(tree, node, &parser->skipped, total);
+}
+
 static bool mpack_tree_parse_children(mpack_tree_t* tree, mpack_node_data_t* node) {
     mpack_tree_parser_t* parser = &tree->parser;
     mpack_assert(parser->state == mpack_tree_parse_state_in_progress);
@@ -282,8 +482,11 @@ static bool mpack_tree_parse_children(mpack_tree_t* tree, mpack_node_data_t* nod
         total *= 2;
     }
 
+    if (parser->paths == 0)
+        return mpack_tree_parse_children_lazy(tree, node, total);
+
     // Make sure we are under our total node limit (TODO can this overflow?)
-    tree->node_count += total;
+    tree->node_count += total + mpack_tree_span_nodes(tree, total);
     if (tree->node_count > tree->max_nodes) {
         mpack_tree_flag_error(tree, mpack_error_too_big);
         return false;
@@ -294,71 +497,28 @@ static bool mpack_tree_parse_children(mpack_tree_t* tree, mpack_node_data_t* nod
     if (!mpack_tree_reserve_bytes(tree, total))
         return false;
 
-    // If there are enough nodes left in the current page, no need to grow
-    if (total <= parser->nodes_left) {
-        node->value.children = parser->nodes;
-        parser->nodes += total;
-        parser->nodes_left -= total;
-
-    } else {
-
-        #ifdef MPACK_MALLOC
-
-        // We can't grow if we're using a fixed pool (i.e. we didn't start with a page)
-        if (!tree->next) {
-            mpack_tree_flag_error(tree, mpack_error_too_big);
-            return false;
-        }
-
-        // Otherwise we need to grow, and the node's children need to be contiguous.
-        // This is a heuristic to decide whether we should waste the remaining space
-        // in the current page and start a new one, or give the children their
-        // own page. With a fraction of 1/8, this causes at most 12% additional
-        // waste. Note that reducing this too much causes less cache coherence and
-        // more malloc() overhead due to smaller allocations, so there's a tradeoff
-        // here. This heuristic could use some improvement, especially with custom
-        // page sizes.
-
-        mpack_tree_page_t* page;
-
-        if (total > MPACK_NODES_PER_PAGE || parser->nodes_left > MPACK_NODES_PER_PAGE / 8) {
-            // TODO: this should check for overflow
-            page = (mpack_tree_page_t*)MPACK_MALLOC(
-                    sizeof(mpack_tree_page_t) + sizeof(mpack_node_data_t) * (total - 1));
-            if (page == NULL) {
-                mpack_tree_flag_error(tree, mpack_error_memory);
-                return false;
-            }
-            mpack_log("allocated seperate page %p for %i children, %i left in page of %i total\n",
-                    (void*)page, (int)total, (int)parser->nodes_left, (int)MPACK_NODES_PER_PAGE);
-
-            node->value.children = page->nodes;
-
-        } else {
-            page = (mpack_tree_page_t*)MPACK_MALLOC(MPACK_PAGE_ALLOC_SIZE);
-            if (page == NULL) {
-                mpack_tree_flag_error(tree, mpack_error_memory);
-                return false;
-            }
-            mpack_log("allocated new page %p for %i children, wasting %i in page of %i total\n",
-                    (void*)page, (int)total, (int)parser->nodes_left, (int)MPACK_NODES_PER_PAGE);
-
-            node->value.children = page->nodes;
-            parser->nodes = page->nodes + total;
-            parser->nodes_left = MPACK_NODES_PER_PAGE - total;
-        }
+    node->value.children = mpack_tree_alloc_children(tree, total);
+    if (node->value.children == NULL)
+        return false;
 
-        page->next = tree->next;
-        tree->next = page;
+    return mpack_tree_push_stack(tree, node, node->value.children, total);
+}
 
-        #else
-        // We can't grow if we don't have an allocator
+/*
+ * Stores a 32-bit length or count in a node. Compact nodes can't store all
+ * 32-bit lengths, in which case this flags mpack_error_too_big.
+ */
+MPACK_STATIC_INLINE bool mpack_tree_store_len(mpack_tree_t* tree, mpack_node_data_t* node, uint32_t len) {
+    #if MPACK_NODE_COMPACT
+    if (len > MPACK_NODE_MAX_LEN) {
         mpack_tree_flag_error(tree, mpack_error_too_big);
         return false;
-        #endif
     }
-
-    return mpack_tree_push_stack(tree, node->value.children, total);
+    #else
+    MPACK_UNUSED(tree);
+    #endif
+    node->len = len & MPACK_NODE_MAX_LEN;
+    return true;
 }
 
 static bool mpack_tree_parse_bytes(mpack_tree_t* tree, mpack_node_data_t* node) {
@@ -410,19 +570,19 @@ static bool mpack_tree_parse_node_contents(mpack_tree_t* tree, mpack_node_data_t
         // fixmap
         case 0x8:
             node->type = mpack_type_map;
-            node->len = (uint32_t)(type & ~0xf0);
+            node->len = (uint32_t)(type & 0x0f);
             return mpack_tree_parse_children(tree, node);
 
         // fixarray
         case 0x9:
             node->type = mpack_type_array;
-            node->len = (uint32_t)(type & ~0xf0);
+            node->len = (uint32_t)(type & 0x0f);
             return mpack_tree_parse_children(tree, node);
 
         // fixstr
         case 0xa: case 0xb:
             node->type = mpack_type_str;
-            node->len = (uint32_t)(type & ~0xe0);
+            node->len = (uint32_t)(type & 0x1f);
             return mpack_tree_parse_bytes(tree, node);
 
         // not one of the common infix types
@@ -468,14 +628,14 @@ static bool mpack_tree_parse_node_contents(mpack_tree_t* tree, mpack_node_data_t
         case 0x80: case 0x81: case 0x82: case 0x83: case 0x84: case 0x85: case 0x86: case 0x87:
         case 0x88: case 0x89: case 0x8a: case 0x8b: case 0x8c: case 0x8d: case 0x8e: case 0x8f:
             node->type = mpack_type_map;
-            node->len = (uint32_t)(type & ~0xf0);
+            node->len = (uint32_t)(type & 0x0f);
             return mpack_tree_parse_children(tree, node);
 
         // fixarray
         case 0x90: case 0x91: case 0x92: case 0x93: case 0x94: case 0x95: case 0x96: case 0x97:
         case 0x98: case 0x99: case 0x9a: case 0x9b: case 0x9c: case 0x9d: case 0x9e: case 0x9f:
             node->type = mpack_type_array;
-            node->len = (uint32_t)(type & ~0xf0);
+            node->len = (uint32_t)(type & 0x0f);
             return mpack_tree_parse_children(tree, node);
 
         // fixstr
@@ -484,7 +644,7 @@ static bool mpack_tree_parse_node_contents(mpack_tree_t* tree, mpack_node_data_t
         case 0xb0: case 0xb1: case 0xb2: case 0xb3: case 0xb4: case 0xb5: case 0xb6: case 0xb7:
         case 0xb8: case 0xb9: case 0xba: case 0xbb: case 0xbc: case 0xbd: case 0xbe: case 0xbf:
             node->type = mpack_type_str;
-            node->len = (uint32_t)(type & ~0xe0);
+            node->len = (uint32_t)(type & 0x1f);
             return mpack_tree_parse_bytes(tree, node);
         #endif
 
@@ -520,7 +680,8 @@ static bool mpack_tree_parse_node_contents(mpack_tree_t* tree, mpack_node_data_t
             node->type = mpack_type_bin;
             if (!mpack_tree_reserve_bytes(tree, sizeof(uint32_t)))
                 return false;
-            node->len = mpack_load_u32(tree->data + tree->size + 1);
+            if (!mpack_tree_store_len(tree, node, mpack_load_u32(tree->data + tree->size + 1)))
+                return false;
             return mpack_tree_parse_bytes(tree, node);
 
         #if MPACK_EXTENSIONS
@@ -542,7 +703,8 @@ static bool mpack_tree_parse_node_contents(mpack_tree_t* tree, mpack_node_data_t
         case 0xc9:
             if (!mpack_tree_reserve_bytes(tree, sizeof(uint32_t)))
                 return false;
-            node->len = mpack_load_u32(tree->data + tree->size + 1);
+            if (!mpack_tree_store_len(tree, node, mpack_load_u32(tree->data + tree->size + 1)))
+                return false;
             return mpack_tree_parse_ext(tree, node);
         #endif
 
@@ -685,7 +847,8 @@ static bool mpack_tree_parse_node_contents(mpack_tree_t* tree, mpack_node_data_t
         case 0xdb:
             if (!mpack_tree_reserve_bytes(tree, sizeof(uint32_t)))
                 return false;
-            node->len = mpack_load_u32(tree->data + tree->size + 1);
+            if (!mpack_tree_store_len(tree, node, mpack_load_u32(tree->data + tree->size + 1)))
+                return false;
             node->type = mpack_type_str;
             return mpack_tree_parse_bytes(tree, node);
 
@@ -701,7 +864,8 @@ static bool mpack_tree_parse_node_contents(mpack_tree_t* tree, mpack_node_data_t
         case 0xdd:
             if (!mpack_tree_reserve_bytes(tree, sizeof(uint32_t)))
                 return false;
-            node->len = mpack_load_u32(tree->data + tree->size + 1);
+            if (!mpack_tree_store_len(tree, node, mpack_load_u32(tree->data + tree->size + 1)))
+                return false;
             node->type = mpack_type_array;
             return mpack_tree_parse_children(tree, node);
 
@@ -717,7 +881,8 @@ static bool mpack_tree_parse_node_contents(mpack_tree_t* tree, mpack_node_data_t
         case 0xdf:
             if (!mpack_tree_reserve_bytes(tree, sizeof(uint32_t)))
                 return false;
-            node->len = mpack_load_u32(tree->data + tree->size + 1);
+            if (!mpack_tree_store_len(tree, node, mpack_load_u32(tree->data + tree->size + 1)))
+                return false;
             node->type = mpack_type_map;
             return mpack_tree_parse_children(tree, node);
 
@@ -784,6 +949,72 @@ static bool mpack_tree_parse_node(mpack_tree_t* tree, mpack_node_data_t* node) {
     return true;
 }
 
+/*
+ * Each node being parsed has a set of projection paths that match it, stored
+ * as a bitmask in parser->paths. A map or array with no matching paths is
+ * parsed lazily. A node at the end of a path is parsed completely, which is
+ * represented by MPACK_TREE_PATHS_ALL. Without a projection, every node
+ * matches either all or no paths depending on whether the tree is lazy.
+ *
+ * Each level of the stack records the paths matching its parent, from which
+ * the paths matching each of its children are derived. The keys of a
+ * projected map are always parsed lazily.
+ */
+#define MPACK_TREE_PATHS_ALL ((uint32_t)1 << MPACK_PROJECTION_MAX_PATHS)
+
+static bool mpack_tree_step_matches(mpack_tree_t* tree, const mpack_path_step_t* step,
+        mpack_node_data_t* key, size_t index)
+{
+    switch (step->type) {
+        case mpack_path_step_any:
+            return true;
+        case mpack_path_step_index:
+            return key == NULL && index == step->index;
+        case mpack_path_step_key:
+            return key != NULL && key->type == mpack_type_str && key->len == step->length &&
+                    mpack_memcmp(tree->data + key->value.offset, step->key, step->length) == 0;
+    }
+    return false;
+}
+
+static uint32_t mpack_tree_match_paths(mpack_tree_t* tree, mpack_level_t* level, mpack_node_data_t* child) {
+    const mpack_projection_t* projection = tree->projection;
+    mpack_assert(projection != NULL, "paths are only matched with a projection");
+
+    mpack_node_data_t* parent = level->parent;
+    size_t index = (size_t)(child - parent->value.children);
+    mpack_node_data_t* key = NULL;
+    if (parent->type == mpack_type_map) {
+        if (index % 2 == 0)
+            return 0;
+        key = child - 1;
+    }
+
+    // The root is at level 0, so the children at each level match the
+    // preceding step of each path.
+    size_t depth = tree->parser.level - 1;
+    uint32_t paths = 0;
+    size_t start = 0;
+    size_t i;
+    for (i = 0; i < projection->path_count; start = projection->path_end[i++]) {
+        if (!(level->paths & ((uint32_t)1 << i)))
+            continue;
+        if (!mpack_tree_step_matches(tree, &projection->steps[start + depth], key, index))
+            continue;
+        if (start + depth + 1 == projection->path_end[i])
+            return MPACK_TREE_PATHS_ALL;
+        paths |= (uint32_t)1 << i;
+    }
+    return paths;
+}
+
+MPACK_STATIC_INLINE uint32_t mpack_tree_child_paths(mpack_tree_t* tree, mpack_level_t* level, mpack_node_data_t* child) {
+    uint32_t paths = level->paths;
+    if (MPACK_LIKELY(paths == 0 || paths == MPACK_TREE_PATHS_ALL || level->parent == NULL))
+        return paths;
+    return mpack_tree_match_paths(tree, level, child);
+}
+
 /*
  * We read nodes in a loop instead of recursively for maximum performance. The
  * stack holds the amount of children left to read in each level of the tree.
@@ -802,10 +1033,14 @@ static bool mpack_tree_continue_parsing(mpack_tree_t* tree) {
     while (true) {
         mpack_node_data_t* node = parser->stack[parser->level].child;
         size_t level = parser->level;
+        parser->paths = mpack_tree_child_paths(tree, &parser->stack[level], node);
         if (!mpack_tree_parse_node(tree, node))
             return false;
         --parser->stack[level].left;
-        ++parser->stack[level].child;
+
+        // The skipped node of a lazy tree is re-used for every child.
+        if (node != &parser->skipped)
+            ++parser->stack[level].child;
 
         mpack_assert(mpack_tree_error(tree) == mpack_ok,
                 "mpack_tree_parse_node() should have returned false due to error!");
@@ -817,6 +1052,8 @@ static bool mpack_tree_continue_parsing(mpack_tree_t* tree) {
         // better error messages that contain the location of the error, so
         // it needs to be complete.)
         while (parser->stack[parser->level].left == 0) {
+            if (parser->spans)
+                mpack_tree_finish_span(tree, &parser->stack[parser->level]);
             if (parser->level == 0)
                 return true;
             --parser->level;
@@ -829,7 +1066,7 @@ static void mpack_tree_cleanup(mpack_tree_t* tree) {
 
     #ifdef MPACK_MALLOC
     if (tree->parser.stack_owned) {
-        MPACK_FREE(tree->parser.stack);
+        mpack_allocator_free(tree->allocator, tree->parser.stack);
         tree->parser.stack = NULL;
         tree->parser.stack_owned = false;
     }
@@ -838,12 +1075,171 @@ static void mpack_tree_cleanup(mpack_tree_t* tree) {
     while (page != NULL) {
         mpack_tree_page_t* next = page->next;
         mpack_log("freeing page %p\n", (void*)page);
-        MPACK_FREE(page);
+        mpack_allocator_free(tree->allocator, page);
         page = next;
     }
     tree->next = NULL;
+
+    #if MPACK_STATS
+    tree->stats.node_memory = 0;
+    mpack_tree_stats_memory(tree);
     #endif
+    #endif
+}
+
+static uint32_t mpack_tree_root_paths(mpack_tree_t* tree) {
+    const mpack_projection_t* projection = tree->projection;
+    if (projection == NULL)
+        return tree->lazy ? 0 : MPACK_TREE_PATHS_ALL;
+    if (projection->all)
+        return MPACK_TREE_PATHS_ALL;
+    return (uint32_t)(((uint64_t)1 << projection->path_count) - 1);
+}
+
+static bool mpack_tree_count_length(const char** p, const char* end, size_t width, uint32_t* length) {
+    if ((size_t)(end - *p) < width)
+        return false;
+    switch (width) {
+        case 1: *length = mpack_load_u8(*p); break;
+        case 2: *length = mpack_load_u16(*p); break;
+        default: *length = mpack_load_u32(*p); break;
+    }
+    *p += width;
+    return true;
+}
+
+/*
+ * Counts the nodes needed to parse the message at the start of the tree's
+ * data, including the extra nodes for spans. This is a quick structural
+ * scan: it finds the end of each element without validating its contents,
+ * which is left to the parser. It needs no stack regardless of the depth of
+ * the message.
+ *
+ * Returns false if the message is not entirely within the given size or its
+ * structure is malformed.
+ */
+static bool mpack_tree_count_nodes(mpack_tree_t* tree, size_t data_size, size_t* count) {
+    const char* p = tree->data;
+    const char* end = tree->data + data_size;
+    size_t nodes = 0;
+    size_t left = 1;
+
+    while (left > 0) {
+
+        // Each element is at least one byte. This also bounds the node count
+        // (and therefore the allocation) by the size of the data.
+        if (left > (size_t)(end - p))
+            return false;
+        --left;
+        ++nodes;
+
+        uint8_t type = mpack_load_u8(p++);
+        uint64_t size = 0;
+        uint64_t children = 0;
+        uint32_t length;
+
+        if (type <= 0x7f || type >= 0xe0) {
+            // positive or negative fixint
+        } else if (type <= 0x8f) {
+            children = (uint64_t)(type & 0xf) * 2;
+        } else if (type <= 0x9f) {
+            children = type & 0xf;
+        } else if (type <= 0xbf) {
+            size = type & 0x1f;
+        } else {
+            switch (type) {
+                case 0xc0: case 0xc2: case 0xc3: break;
+
+                case 0xcc: case 0xd0: size = 1; break;
+                case 0xcd: case 0xd1: size = 2; break;
+                case 0xca: case 0xce: case 0xd2: size = 4; break;
+                case 0xcb: case 0xcf: case 0xd3: size = 8; break;
+
+                // fixext, including the exttype
+                case 0xd4: size = 2; break;
+                case 0xd5: size = 3; break;
+                case 0xd6: size = 5; break;
+                case 0xd7: size = 9; break;
+                case 0xd8: size = 17; break;
+
+                // bin, str and ext
+                case 0xc4: case 0xd9: case 0xc7:
+                    if (!mpack_tree_count_length(&p, end, 1, &length))
+                        return false;
+                    size = (uint64_t)length + (type == 0xc7 ? 1 : 0);
+                    break;
+                case 0xc5: case 0xda: case 0xc8:
+                    if (!mpack_tree_count_length(&p, end, 2, &length))
+                        return false;
+                    size = (uint64_t)length + (type == 0xc8 ? 1 : 0);
+                    break;
+                case 0xc6: case 0xdb: case 0xc9:
+                    if (!mpack_tree_count_length(&p, end, 4, &length))
+                        return false;
+                    size = (uint64_t)length + (type == 0xc9 ? 1 : 0);
+                    break;
+
+                // arrays and maps
+                case 0xdc: case 0xde:
+                    if (!mpack_tree_count_length(&p, end, 2, &length))
+                        return false;
+                    children = (uint64_t)length * (type == 0xde ? 2 : 1);
+                    break;
+                case 0xdd: case 0xdf:
+                    if (!mpack_tree_count_length(&p, end, 4, &length))
+                        return false;
+                    children = (uint64_t)length * (type == 0xdf ? 2 : 1);
+                    break;
+
+                default:
+                    return false;
+            }
+        }
+
+        if (size > (uint64_t)(end - p))
+            return false;
+        p += size;
+
+        if (children > 0) {
+            if (children > (uint64_t)(end - p))
+                return false;
+            left += (size_t)children;
+            nodes += mpack_tree_span_nodes(tree, 1);
+        }
+    }
+
+    *count = nodes;
+    return true;
+}
+
+#ifdef MPACK_MALLOC
+/*
+ * Allocates the first page of nodes for a message. If exact allocation is
+ * enabled and the message is already buffered, this is a single block with
+ * exactly as many nodes as the message needs; otherwise it is a normal page.
+ */
+static mpack_tree_page_t* mpack_tree_alloc_first_page(mpack_tree_t* tree, size_t* count) {
+    *count = mpack_tree_page_nodes(tree->page_size);
+
+    size_t exact;
+    if (tree->exact && !tree->lazy && tree->projection == NULL &&
+            mpack_tree_count_nodes(tree, tree->data_length, &exact) && exact <= tree->max_nodes)
+    {
+        *count = exact;
+    }
+    size_t size = mpack_tree_page_alloc_size(*count);
+
+    mpack_tree_page_t* page = (mpack_tree_page_t*)mpack_allocator_alloc(tree->allocator, size);
+    mpack_log("allocated initial page %p of size %i count %i\n",
+            (void*)page, (int)size, (int)*count);
+    if (page == NULL)
+        return NULL;
+    page->next = NULL;
+    mpack_stats_add(tree->stats, node_pages, 1);
+    mpack_stats_add(tree->stats, node_memory, size);
+    return page;
 }
+#endif
 
 static bool mpack_tree_parse_start(mpack_tree_t* tree) {
     if (mpack_tree_error(tree) != mpack_ok)
@@ -853,12 +1249,19 @@ static bool mpack_tree_parse_start(mpack_tree_t* tree) {
     mpack_assert(parser->state != mpack_tree_parse_state_in_progress,
             "previous parsing was not finished!");
 
+    if (tree->frozen != NULL) {
+        mpack_break("cannot parse a frozen tree!");
+        mpack_tree_flag_error(tree, mpack_error_bug);
+        return false;
+    }
+
     if (parser->state == mpack_tree_parse_state_parsed)
         mpack_tree_cleanup(tree);
 
     mpack_log("starting parse\n");
     tree->parser.state = mpack_tree_parse_state_in_progress;
     tree->parser.current_node_reserved = 0;
+    tree->parser.spans = tree->spans;
 
     // check if we previously parsed a tree
     if (tree->size > 0) {
@@ -873,6 +1276,7 @@ static bool mpack_tree_parse_start(mpack_tree_t* tree) {
         // buffer size. Maybe this should be configurable.
         if (tree->buffer != NULL) {
             mpack_memmove(tree->buffer, tree->buffer + tree->size, tree->data_length - tree->size);
+            mpack_stats_add(tree->stats, moved_bytes, tree->data_length - tree->size);
         }
         else
         #endif
@@ -899,22 +1303,23 @@ static bool mpack_tree_parse_start(mpack_tree_t* tree) {
     parser->stack = parser->stack_local;
     parser->stack_owned = false;
     parser->stack_capacity = sizeof(parser->stack_local) / sizeof(*parser->stack_local);
+    parser->page_size = tree->page_size;
 
     if (tree->pool == NULL) {
 
         // allocate first page
-        mpack_tree_page_t* page = (mpack_tree_page_t*)MPACK_MALLOC(MPACK_PAGE_ALLOC_SIZE);
-        mpack_log("allocated initial page %p of size %i count %i\n",
-                (void*)page, (int)MPACK_PAGE_ALLOC_SIZE, (int)MPACK_NODES_PER_PAGE);
+        size_t count;
+        mpack_tree_page_t* page = mpack_tree_alloc_first_page(tree, &count);
         if (page == NULL) {
             tree->error = mpack_error_memory;
             return false;
         }
-        page->next = NULL;
         tree->next = page;
+        mpack_tree_stats_memory(tree);
 
         parser->nodes = page->nodes;
-        parser->nodes_left = MPACK_NODES_PER_PAGE;
+        parser->nodes_left = count;
+        parser->page_size = mpack_tree_grow_page_size(tree, tree->page_size);
     }
     else
     #endif
@@ -932,6 +1337,8 @@ static bool mpack_tree_parse_start(mpack_tree_t* tree) {
     parser->level = 0;
     parser->stack[0].child = tree->root;
     parser->stack[0].left = 1;
+    parser->stack[0].parent = NULL;
+    parser->stack[0].paths = mpack_tree_root_paths(tree);
 
     return true;
 }
@@ -985,6 +1392,85 @@ bool mpack_tree_try_parse(mpack_tree_t* tree) {
 }
 
 
+/*
+ * Parses the contents of a map or array in a lazy tree into nodes. This
+ * re-uses the parser of the tree to parse only the children of the given
+ * node, skipping over their own contents. The skipped contents are scanned
+ * again when each child is expanded, so expanding a whole message costs
+ * O(n * d) (see mpack_tree_set_lazy().)
+ *
+ * Returns false and flags an error if the children could not be parsed.
+ */
+static bool mpack_node_expand(mpack_node_t node) {
+    mpack_tree_t* tree = node.tree;
+    mpack_tree_parser_t* parser = &tree->parser;
+    mpack_node_data_t* data = node.data;
+
+    mpack_assert(parser->state == mpack_tree_parse_state_parsed,
+            "tree has not been parsed!");
+
+    // The overflow of the count of a map was checked during parsing.
+    size_t total = data->len;
+    if (data->type == mpack_type_map)
+        total *= 2;
+
+    tree->node_count += total + mpack_tree_span_nodes(tree, total);
+    if (tree->node_count > tree->max_nodes) {
+        mpack_tree_flag_error(tree, mpack_error_too_big);
+        return false;
+    }
+
+    mpack_node_data_t* children = mpack_tree_alloc_children(tree, total);
+    if (children == NULL)
+        return false;
+    if (parser->spans)
+        children[-1] = data->value.children[-1];
+
+    mpack_log("expanding %i children at offset %i\n", (int)total,
+            (int)data->value.children->value.offset);
+
+    // The contents have already been validated, so we know they fit within
+    // the parsed message. As in mpack_tree_parse_children(), one byte has
+    // already been reserved for each child.
+    size_t size = tree->size;
+    size_t possible_nodes_left = parser->possible_nodes_left;
+    tree->size = data->value.children->value.offset;
+    parser->possible_nodes_left = size - tree->size - total;
+    parser->state = mpack_tree_parse_state_in_progress;
+    parser->level = 0;
+    parser->stack[0].child = children;
+    parser->stack[0].left = total;
+    parser->stack[0].parent = data;
+    parser->stack[0].paths = 0;
+
+    bool ok = mpack_tree_continue_parsing(tree);
+
+    tree->size = size;
+    parser->possible_nodes_left = possible_nodes_left;
+    parser->state = mpack_tree_parse_state_parsed;
+
+    if (!ok) {
+        if (mpack_tree_error(tree) == mpack_ok) {
+            mpack_break("contents of a lazy node could not be parsed!");
+            mpack_tree_flag_error(tree, mpack_error_bug);
+        }
+        return false;
+    }
+
+    data->value.children = children;
+    return true;
+}
+
+// Makes sure the children of a non-empty map or array have been parsed into
+// nodes. This is always true unless the tree is lazy.
+MPACK_STATIC_INLINE bool mpack_node_ensure_children(mpack_node_t node) {
+    if (MPACK_LIKELY(node.data->len == 0 ||
+                mpack_node_children(node.tree, node.data)->type != mpack_type_missing))
+        return true;
+    return mpack_node_expand(node);
+}
+
+
 
 /*
  * Tree functions
@@ -1013,6 +1499,11 @@ static void mpack_tree_init_clear(mpack_tree_t* tree) {
     tree->missing_node.type = mpack_type_missing;
     tree->max_size = SIZE_MAX;
     tree->max_nodes = SIZE_MAX;
+    #ifdef MPACK_MALLOC
+    tree->page_size = MPACK_NODE_PAGE_SIZE;
+    tree->max_page_size = MPACK_NODE_PAGE_SIZE;
+    tree->buffer_size = MPACK_BUFFER_SIZE;
+    #endif
 }
 
 #ifdef MPACK_MALLOC
@@ -1022,9 +1513,6 @@ void mpack_tree_init_data(mpack_tree_t* tree, const char* data, size_t length) {
     MPACK_STATIC_ASSERT(MPACK_NODE_PAGE_SIZE >= sizeof(mpack_tree_page_t),
             "MPACK_NODE_PAGE_SIZE is too small");
 
-    MPACK_STATIC_ASSERT(MPACK_PAGE_ALLOC_SIZE <= MPACK_NODE_PAGE_SIZE,
-            "incorrect page rounding?");
-
     tree->data = data;
     tree->data_length = length;
     tree->pool = NULL;
@@ -1060,6 +1548,49 @@ void mpack_tree_init_pool(mpack_tree_t* tree, const char* data, size_t length,
             (int)length, (int)node_pool_count);
 }
 
+void mpack_tree_init_view(mpack_tree_t* view, mpack_tree_t* tree) {
+    mpack_tree_init_clear(view);
+    #ifdef MPACK_MALLOC
+    view->next = NULL;
+    #endif
+
+    // the error handler of the tree is not called again
+    if (mpack_tree_error(tree) != mpack_ok) {
+        view->error = mpack_tree_error(tree);
+        return;
+    }
+
+    if (tree->parser.state != mpack_tree_parse_state_parsed) {
+        mpack_break("Tree has not been parsed! "
+                "Did you call mpack_tree_parse() or mpack_tree_try_parse()?");
+        mpack_tree_flag_error(view, mpack_error_bug);
+        return;
+    }
+
+    if (tree->lazy || tree->projection != NULL) {
+        mpack_break("cannot view a lazy or projected tree!");
+        mpack_tree_flag_error(view, mpack_error_bug);
+        return;
+    }
+
+    // The view borrows the nodes and data of the tree. It owns no pages,
+    // buffer or context, so destroying it frees nothing.
+    view->data = tree->data;
+    view->data_length = tree->data_length;
+    view->size = tree->size;
+    view->node_count = tree->node_count;
+    view->max_size = tree->max_size;
+    view->max_nodes = tree->max_nodes;
+    view->spans = tree->spans;
+    view->frozen = tree->frozen;
+    view->root = tree->root;
+    view->parser.spans = tree->parser.spans;
+    view->parser.state = mpack_tree_parse_state_parsed;
+
+    mpack_log("===========================\n");
+    mpack_log("initializing view of tree %p\n", (void*)tree);
+}
+
 void mpack_tree_init_error(mpack_tree_t* tree, mpack_error_t error) {
     mpack_tree_init_clear(tree);
     tree->error = error;
@@ -1086,6 +1617,70 @@ void mpack_tree_init_stream(mpack_tree_t* tree, mpack_tree_read_t read_fn, void*
 }
 #endif
 
+void mpack_tree_set_lazy(mpack_tree_t* tree, bool lazy) {
+    mpack_assert(tree->parser.state != mpack_tree_parse_state_in_progress,
+            "cannot change lazy parsing while a message is being parsed!");
+    tree->lazy = lazy;
+}
+
+void mpack_tree_set_spans(mpack_tree_t* tree, bool spans) {
+    mpack_assert(tree->parser.state != mpack_tree_parse_state_in_progress,
+            "cannot change span recording while a message is being parsed!");
+    tree->spans = spans;
+}
+
+void mpack_tree_set_projection(mpack_tree_t* tree, const mpack_projection_t* projection) {
+    mpack_assert(tree->parser.state != mpack_tree_parse_state_in_progress,
+            "cannot change the projection while a message is being parsed!");
+    tree->projection = projection;
+}
+
+#ifdef MPACK_MALLOC
+void mpack_tree_set_allocator(mpack_tree_t* tree, const mpack_allocator_t* allocator) {
+    mpack_assert(tree->next == NULL && tree->buffer == NULL && !tree->parser.stack_owned,
+            "cannot change the allocator after the tree has allocated memory!");
+    tree->allocator = allocator;
+}
+
+void mpack_tree_set_pool_overflow(mpack_tree_t* tree, bool overflow) {
+    mpack_assert(tree->parser.state != mpack_tree_parse_state_in_progress,
+            "cannot change pool overflow while a message is being parsed!");
+    tree->pool_overflow = overflow;
+}
+
+void mpack_tree_set_exact_alloc(mpack_tree_t* tree, bool exact) {
+    mpack_assert(tree->parser.state != mpack_tree_parse_state_in_progress,
+            "cannot change exact allocation while a message is being parsed!");
+    tree->exact = exact;
+}
+
+void mpack_tree_set_page_size(mpack_tree_t* tree, size_t initial_size, size_t max_size) {
+    mpack_assert(tree->parser.state != mpack_tree_parse_state_in_progress,
+            "cannot change the page size while a message is being parsed!");
+    if (initial_size < sizeof(mpack_tree_page_t) || max_size < initial_size) {
+        mpack_break("invalid node page sizes %i and %i!", (int)initial_size, (int)max_size);
+        mpack_tree_flag_error(tree, mpack_error_bug);
+        return;
+    }
+    tree->page_size = initial_size;
+    tree->max_page_size = max_size;
+}
+
+void mpack_tree_set_buffer_size(mpack_tree_t* tree, size_t size) {
+    if (size == 0) {
+        mpack_break("buffer size cannot be zero!");
+        mpack_tree_flag_error(tree, mpack_error_bug);
+        return;
+    }
+    if (tree->buffer != NULL) {
+        mpack_break("cannot change the buffer size after the buffer has been allocated!");
+        mpack_tree_flag_error(tree, mpack_error_bug);
+        return;
+    }
+    tree->buffer_size = size;
+}
+#endif
+
 void mpack_tree_set_limits(mpack_tree_t* tree, size_t max_message_size, size_t max_message_nodes) {
     mpack_assert(max_message_size > 0);
     mpack_assert(max_message_nodes > 0);
@@ -1220,7 +1815,11 @@ mpack_error_t mpack_tree_destroy(mpack_tree_t* tree) {
 
     #ifdef MPACK_MALLOC
     if (tree->buffer)
-        MPACK_FREE(tree->buffer);
+        mpack_allocator_free(tree->allocator, tree->buffer);
+    #endif
+
+    #if MPACK_STATS
+    tree->stats.memory = 0;
     #endif
 
     if (tree->teardown)
@@ -1242,6 +1841,233 @@ void mpack_tree_flag_error(mpack_tree_t* tree, mpack_error_t error) {
 
 
 
+/*
+ * Frozen tree functions
+ *
+ * A frozen image starts with a fixed-size header in native byte order,
+ * followed by the nodes of the tree and then the data of the message. The
+ * nodes are laid out breadth-first so that the children of each map or array
+ * are contiguous (preceded by their span node if the tree records spans.)
+ * Each map or array stores the index of its first child instead of a pointer.
+ */
+
+#define MPACK_FROZEN_HEADER_SIZE 32
+#define MPACK_FROZEN_VERSION 1
+#define MPACK_FROZEN_BYTE_ORDER 0x01020304u
+#define MPACK_FROZEN_FLAG_SPANS 0x1
+#define MPACK_FROZEN_FLAG_EXTENSIONS 0x2
+
+static const char mpack_frozen_magic[4] = {'M', 'P', 'K', 'F'};
+
+static uint8_t mpack_tree_frozen_flags(bool spans) {
+    uint8_t flags = 0;
+    if (spans)
+        flags |= MPACK_FROZEN_FLAG_SPANS;
+    #if MPACK_EXTENSIONS
+    flags |= MPACK_FROZEN_FLAG_EXTENSIONS;
+    #endif
+    return flags;
+}
+
+// Parses the children of the given node into nodes if it is a lazy map or
+// array. Returns false if an error occurs.
+static bool mpack_tree_frozen_expand(mpack_node_t node) {
+    mpack_type_t type = node.data->type;
+    if (type != mpack_type_array && type != mpack_type_map)
+        return true;
+    return mpack_node_ensure_children(node);
+}
+
+static size_t mpack_tree_frozen_size_impl(mpack_tree_t* tree, size_t* node_count) {
+    mpack_tree_root(tree); // flags an error if the tree has not been parsed
+    if (mpack_tree_error(tree) != mpack_ok)
+        return 0;
+
+    // The image has a node for every element of the message, so the nodes
+    // are counted from the data. This also counts the contents of lazy maps
+    // and arrays that have not been expanded yet.
+    if (!mpack_tree_count_nodes(tree, tree->size, node_count)) {
+        mpack_tree_flag_error(tree, mpack_error_invalid);
+        return 0;
+    }
+
+    if (*node_count > (SIZE_MAX - MPACK_FROZEN_HEADER_SIZE - tree->size) / sizeof(mpack_node_data_t)) {
+        mpack_tree_flag_error(tree, mpack_error_too_big);
+        return 0;
+    }
+    return MPACK_FROZEN_HEADER_SIZE + *node_count * sizeof(mpack_node_data_t) + tree->size;
+}
+
+size_t mpack_tree_frozen_size(mpack_tree_t* tree) {
+    size_t node_count;
+    return mpack_tree_frozen_size_impl(tree, &node_count);
+}
+
+size_t mpack_tree_freeze(mpack_tree_t* tree, char* buffer, size_t size) {
+    size_t node_count;
+    size_t frozen_size = mpack_tree_frozen_size_impl(tree, &node_count);
+    if (frozen_size == 0)
+        return 0;
+    if (size < frozen_size) {
+        mpack_tree_flag_error(tree, mpack_error_too_big);
+        return 0;
+    }
+
+    // header
+    uint32_t byte_order = MPACK_FROZEN_BYTE_ORDER;
+    uint64_t counts[2];
+    counts[0] = node_count;
+    counts[1] = tree->size;
+    mpack_memset(buffer, 0, MPACK_FROZEN_HEADER_SIZE);
+    mpack_memcpy(buffer, mpack_frozen_magic, sizeof(mpack_frozen_magic));
+    buffer[4] = (char)MPACK_FROZEN_VERSION;
+    buffer[5] = (char)sizeof(mpack_node_data_t);
+    buffer[6] = (char)mpack_tree_frozen_flags(tree->parser.spans);
+    mpack_memcpy(buffer + 8, &byte_order, sizeof(byte_order));
+    mpack_memcpy(buffer + 16, counts, sizeof(counts));
+
+    // The nodes are copied breadth-first. Each map or array is copied with
+    // pointers to its children, which are then copied after the nodes
+    // already in the image and replaced with the index of the first one.
+    // The buffer may not be aligned so nodes are copied with memcpy().
+    // The maps and arrays of a lazy tree are expanded just before they are
+    // copied, so the original nodes are always up to date.
+    char* nodes = buffer + MPACK_FROZEN_HEADER_SIZE;
+    size_t count = 1;
+    size_t i, j;
+    if (!mpack_tree_frozen_expand(mpack_tree_root(tree)))
+        return 0;
+    mpack_memcpy(nodes, tree->root, sizeof(mpack_node_data_t));
+    for (i = 0; i < count; ++i) {
+        mpack_node_data_t data;
+        mpack_memcpy(&data, nodes + i * sizeof(data), sizeof(data));
+        if ((data.type != mpack_type_array && data.type != mpack_type_map) || data.len == 0)
+            continue;
+
+        size_t total = data.len;
+        if (data.type == mpack_type_map)
+            total *= 2;
+        mpack_node_data_t* children = mpack_node_children(tree, &data);
+        for (j = 0; j < total; ++j)
+            if (!mpack_tree_frozen_expand(mpack_node(tree, children + j)))
+                return 0;
+
+        size_t extra = mpack_tree_span_nodes(tree, total);
+        mpack_memcpy(nodes + count * sizeof(data), children - extra, (total + extra) * sizeof(data));
+        data.value.offset = count + extra;
+        mpack_memcpy(nodes + i * sizeof(data), &data, sizeof(data));
+        count += total + extra;
+    }
+    if (count != node_count) {
+        mpack_break("frozen node count %i does not match %i", (int)count, (int)node_count);
+        mpack_tree_flag_error(tree, mpack_error_bug);
+        return 0;
+    }
+
+    mpack_memcpy(nodes + node_count * sizeof(mpack_node_data_t), tree->data, tree->size);
+    mpack_log("froze tree with %i nodes and %i bytes of data into %i bytes\n",
+            (int)node_count, (int)tree->size, (int)frozen_size);
+    return frozen_size;
+}
+
+void mpack_tree_init_frozen(mpack_tree_t* tree, const char* image, size_t size) {
+    mpack_tree_init_clear(tree);
+    #ifdef MPACK_MALLOC
+    tree->next = NULL;
+    #endif
+
+    if ((uintptr_t)image % sizeof(uint64_t) != 0) {
+        mpack_break("frozen image is not aligned to 8 bytes!");
+        mpack_tree_flag_error(tree, mpack_error_bug);
+        return;
+    }
+
+    if (size < MPACK_FROZEN_HEADER_SIZE) {
+        mpack_tree_flag_error(tree, mpack_error_invalid);
+        return;
+    }
+
+    uint32_t byte_order;
+    uint64_t counts[2];
+    mpack_memcpy(&byte_order, image + 8, sizeof(byte_order));
+    mpack_memcpy(counts, image + 16, sizeof(counts));
+
+    // The node layout is specific to the build, so anything different from
+    // what this build would write is rejected.
+    uint8_t flags = (uint8_t)image[6];
+    bool spans = (flags & MPACK_FROZEN_FLAG_SPANS) != 0;
+    if (mpack_memcmp(image, mpack_frozen_magic, sizeof(mpack_frozen_magic)) != 0 ||
+            (uint8_t)image[4] != MPACK_FROZEN_VERSION ||
+            (uint8_t)image[5] != sizeof(mpack_node_data_t) ||
+            flags != mpack_tree_frozen_flags(spans) ||
+            byte_order != MPACK_FROZEN_BYTE_ORDER)
+    {
+        mpack_log("frozen image header does not match this build\n");
+        mpack_tree_flag_error(tree, mpack_error_invalid);
+        return;
+    }
+
+    // The nodes and data must exactly fill the rest of the image.
+    uint64_t node_count = counts[0];
+    uint64_t data_length = counts[1];
+    uint64_t available = size - MPACK_FROZEN_HEADER_SIZE;
+    if (node_count == 0 || data_length == 0 ||
+            node_count > available / sizeof(mpack_node_data_t) ||
+            data_length != available - node_count * sizeof(mpack_node_data_t))
+    {
+        mpack_tree_flag_error(tree, mpack_error_invalid);
+        return;
+    }
+
+    // The nodes are never written so it's safe to cast away const.
+    tree->frozen = (mpack_node_data_t*)(uintptr_t)(image + MPACK_FROZEN_HEADER_SIZE);
+    tree->root = tree->frozen;
+    tree->node_count = (size_t)node_count;
+    tree->data = image + MPACK_FROZEN_HEADER_SIZE + tree->node_count * sizeof(mpack_node_data_t);
+    tree->data_length = (size_t)data_length;
+    tree->size = (size_t)data_length;
+    tree->spans = spans;
+    tree->parser.spans = spans;
+    tree->parser.state = mpack_tree_parse_state_parsed;
+
+    mpack_log("===========================\n");
+    mpack_log("initializing frozen tree with %i nodes and %i bytes of data\n",
+            (int)tree->node_count, (int)tree->data_length);
+}
+
+
+
+/*
+ * Projection functions
+ */
+
+void mpack_projection_init(mpack_projection_t* projection) {
+    mpack_memset(projection, 0, sizeof(*projection));
+}
+
+mpack_error_t mpack_projection_add(mpack_projection_t* projection, const char* path) {
+    mpack_assert(path != NULL, "path is NULL");
+    if (*path == '\0') {
+        projection->all = true;
+        return mpack_ok;
+    }
+
+    if (projection->path_count == MPACK_PROJECTION_MAX_PATHS)
+        return mpack_error_too_big;
+
+    size_t count;
+    mpack_error_t error = mpack_path_parse(path, projection->steps + projection->step_count,
+            MPACK_PROJECTION_MAX_STEPS - projection->step_count, &count);
+    if (error != mpack_ok)
+        return error;
+
+    projection->step_count += count;
+    projection->path_end[projection->path_count++] = projection->step_count;
+    return mpack_ok;
+}
+
+
+
 /*
  * Node misc functions
  */
@@ -1319,7 +2145,7 @@ static void mpack_node_print_element(mpack_node_t node, mpack_print_t* print, si
                 for (j = 0; j < depth + 1; ++j)
                     mpack_print_append_cstr(print, "    ");
                 mpack_node_print_element(mpack_node_array_at(node, i), print, depth + 1);
-                if (i != data->len - 1)
+                if (i + 1 != data->len)
                     mpack_print_append_cstr(print, ",");
                 mpack_print_append_cstr(print, "\n");
             }
@@ -1336,7 +2162,7 @@ static void mpack_node_print_element(mpack_node_t node, mpack_print_t* print, si
                 mpack_node_print_element(mpack_node_map_key_at(node, i), print, depth + 1);
                 mpack_print_append_cstr(print, ": ");
                 mpack_node_print_element(mpack_node_map_value_at(node, i), print, depth + 1);
-                if (i != data->len - 1)
+                if (i + 1 != data->len)
                     mpack_print_append_cstr(print, ",");
                 mpack_print_append_cstr(print, "\n");
             }
@@ -1641,7 +2467,7 @@ char* mpack_node_data_alloc(mpack_node_t node, size_t maxlen) {
         return NULL;
     }
 
-    char* ret = (char*) MPACK_MALLOC((size_t)node.data->len);
+    char* ret = (char*) mpack_allocator_alloc(node.tree->allocator, (size_t)node.data->len);
     if (ret == NULL) {
         mpack_node_flag_error(node, mpack_error_memory);
         return NULL;
@@ -1677,7 +2503,7 @@ char* mpack_node_cstr_alloc(mpack_node_t node, size_t maxlen) {
         return NULL;
     }
 
-    char* ret = (char*) MPACK_MALLOC((size_t)(node.data->len + 1));
+    char* ret = (char*) mpack_allocator_alloc(node.tree->allocator, (size_t)(node.data->len + 1));
     if (ret == NULL) {
         mpack_node_flag_error(node, mpack_error_memory);
         return NULL;
@@ -1714,7 +2540,7 @@ char* mpack_node_utf8_cstr_alloc(mpack_node_t node, size_t maxlen) {
         return NULL;
     }
 
-    char* ret = (char*) MPACK_MALLOC((size_t)(node.data->len + 1));
+    char* ret = (char*) mpack_allocator_alloc(node.tree->allocator, (size_t)(node.data->len + 1));
     if (ret == NULL) {
         mpack_node_flag_error(node, mpack_error_memory);
         return NULL;
@@ -1740,6 +2566,9 @@ static mpack_node_data_t* mpack_node_map_int_impl(mpack_node_t node, int64_t num
         return NULL;
     }
 
+    if (!mpack_node_ensure_children(node))
+        return NULL;
+
     mpack_node_data_t* found = NULL;
 
     size_t i;
@@ -1772,6 +2601,9 @@ static mpack_node_data_t* mpack_node_map_uint_impl(mpack_node_t node, uint64_t n
         return NULL;
     }
 
+    if (!mpack_node_ensure_children(node))
+        return NULL;
+
     mpack_node_data_t* found = NULL;
 
     size_t i;
@@ -1806,6 +2638,9 @@ static mpack_node_data_t* mpack_node_map_str_impl(mpack_node_t node, const char*
         return NULL;
     }
 
+    if (!mpack_node_ensure_children(node))
+        return NULL;
+
     mpack_tree_t* tree = node.tree;
     mpack_node_data_t* found = NULL;
 
@@ -1898,6 +2733,387 @@ bool mpack_node_map_contains_cstr(mpack_node_t node, const char* cstr) {
     return mpack_node_map_contains_str(node, cstr, mpack_strlen(cstr));
 }
 
+const char* mpack_node_span(mpack_node_t node, size_t* length) {
+    mpack_tree_t* tree = node.tree;
+    *length = 0;
+    if (mpack_node_error(node) != mpack_ok)
+        return NULL;
+
+    if (node.data == tree->root) {
+        *length = tree->size;
+        return tree->data;
+    }
+
+    mpack_type_t type = node.data->type;
+    if ((type != mpack_type_array && type != mpack_type_map) ||
+            !tree->parser.spans || node.data->len == 0)
+        return NULL;
+    mpack_node_data_t* span = mpack_node_children(tree, node.data) - 1;
+    if (span->len == 0)
+        return NULL;
+    *length = span->len;
+    return tree->data + span->value.offset;
+}
+
+// The depth is the number of maps and arrays that contain the node. It is
+// limited because each level of nesting takes a call frame.
+static uint64_t mpack_node_hash_element(mpack_node_t node, uint64_t seed, size_t depth) {
+    mpack_tag_t tag = mpack_node_tag(node);
+    if ((tag.type == mpack_type_array || tag.type == mpack_type_map) && depth == MPACK_HASH_MAX_DEPTH) {
+        mpack_node_flag_error(node, mpack_error_too_big);
+        return 0;
+    }
+
+    mpack_hasher_t hasher;
+    mpack_hasher_init(&hasher, seed);
+    mpack_hasher_tag(&hasher, tag);
+
+    switch (tag.type) {
+        case mpack_type_str:
+        case mpack_type_bin:
+        #if MPACK_EXTENSIONS
+        case mpack_type_ext:
+        #endif
+            mpack_hasher_update(&hasher, mpack_node_data(node), tag.v.l);
+            break;
+
+        case mpack_type_array: {
+            size_t i;
+            for (i = 0; i < tag.v.n && mpack_node_error(node) == mpack_ok; ++i)
+                mpack_hasher_update_u64(&hasher,
+                        mpack_node_hash_element(mpack_node_array_at(node, i), seed, depth + 1));
+            break;
+        }
+
+        case mpack_type_map: {
+            // pairs are summed so that their order doesn't matter
+            uint64_t sum = 0;
+            size_t i;
+            for (i = 0; i < tag.v.n && mpack_node_error(node) == mpack_ok; ++i)
+                sum += mpack_hash_pair(
+                        mpack_node_hash_element(mpack_node_map_key_at(node, i), seed, depth + 1),
+                        mpack_node_hash_element(mpack_node_map_value_at(node, i), seed, depth + 1));
+            mpack_hasher_update_u64(&hasher, sum);
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    return mpack_hasher_finish(&hasher);
+}
+
+uint64_t mpack_node_hash(mpack_node_t node, uint64_t seed) {
+    if (mpack_node_error(node) != mpack_ok)
+        return 0;
+    uint64_t hash = mpack_node_hash_element(node, seed, 0);
+    return mpack_node_error(node) == mpack_ok ? hash : 0;
+}
+
+
+
+/*
+ * Path functions
+ */
+
+// Returns the child of the given node matched by a key or index step, or
+// NULL if the node has no such child or is not of the right type.
+static mpack_node_data_t* mpack_node_path_find(mpack_node_t node, const mpack_path_step_t* step) {
+    mpack_node_data_t* data = node.data;
+
+    if (step->type == mpack_path_step_index) {
+        if (data->type != mpack_type_array || step->index >= data->len)
+            return NULL;
+        if (!mpack_node_ensure_children(node))
+            return NULL;
+        return mpack_node_child(node, step->index);
+    }
+
+    mpack_assert(step->type == mpack_path_step_key, "wildcards cannot be found directly");
+    if (data->type != mpack_type_map)
+        return NULL;
+    if (!mpack_node_ensure_children(node))
+        return NULL;
+
+    // The key lengths are known up front, so most keys are rejected without
+    // looking at their contents.
+    const char* tree_data = node.tree->data;
+    size_t i;
+    for (i = 0; i < data->len; ++i) {
+        mpack_node_data_t* key = mpack_node_child(node, i * 2);
+        if (key->type == mpack_type_str && key->len == step->length &&
+                mpack_memcmp(tree_data + key->value.offset, step->key, step->length) == 0)
+            return mpack_node_child(node, i * 2 + 1);
+    }
+    return NULL;
+}
+
+static mpack_node_data_t* mpack_node_path_impl(mpack_node_t node, const mpack_path_t* path) {
+    if (mpack_node_error(node) != mpack_ok)
+        return NULL;
+
+    size_t i;
+    for (i = 0; i < path->count; ++i) {
+        const mpack_path_step_t* step = &path->steps[i];
+
+        if (step->type == mpack_path_step_any) {
+            mpack_break("path has a wildcard! Use mpack_node_path_iter_init() instead.");
+            mpack_node_flag_error(node, mpack_error_bug);
+            return NULL;
+        }
+
+        mpack_type_t type = (step->type == mpack_path_step_key) ? mpack_type_map : mpack_type_array;
+        if (node.data->type != type) {
+            mpack_node_flag_error(node, mpack_error_type);
+            return NULL;
+        }
+
+        node.data = mpack_node_path_find(node, step);
+        if (node.data == NULL)
+            return NULL;
+    }
+
+    return node.data;
+}
+
+mpack_node_t mpack_node_path(mpack_node_t node, const mpack_path_t* path) {
+    return mpack_node_wrap_lookup(node.tree, mpack_node_path_impl(node, path));
+}
+
+mpack_node_t mpack_node_path_optional(mpack_node_t node, const mpack_path_t* path) {
+    return mpack_node_wrap_lookup_optional(node.tree, mpack_node_path_impl(node, path));
+}
+
+void mpack_node_path_iter_init(mpack_node_path_iter_t* iter, mpack_node_t node, const mpack_path_t* path) {
+    iter->tree = node.tree;
+    iter->path = path;
+    iter->depth = 0;
+    iter->done = false;
+    iter->nodes[0] = node.data;
+    if (path->count > 0)
+        iter->next[0] = 0;
+}
+
+// Returns the next child of the node at the given depth that matches the
+// step at that depth, or NULL if there are no more.
+static mpack_node_data_t* mpack_node_path_iter_child(mpack_node_path_iter_t* iter, size_t depth) {
+    mpack_node_t node = mpack_node(iter->tree, iter->nodes[depth]);
+    const mpack_path_step_t* step = &iter->path->steps[depth];
+    uint32_t next = iter->next[depth];
+
+    if (step->type != mpack_path_step_any) {
+        // Keys and indices match at most one child.
+        if (next > 0)
+            return NULL;
+        iter->next[depth] = 1;
+        return mpack_node_path_find(node, step);
+    }
+
+    mpack_type_t type = node.data->type;
+    if ((type != mpack_type_array && type != mpack_type_map) || next >= node.data->len)
+        return NULL;
+    if (!mpack_node_ensure_children(node))
+        return NULL;
+    iter->next[depth] = next + 1;
+    return mpack_node_child(node, (type == mpack_type_map) ? (size_t)next * 2 + 1 : next);
+}
+
+bool mpack_node_path_iter_next(mpack_node_path_iter_t* iter, mpack_node_t* node) {
+    if (iter->done || mpack_tree_error(iter->tree) != mpack_ok)
+        return false;
+
+    size_t count = iter->path->count;
+    size_t depth = iter->depth;
+
+    // This is a depth-first search over the steps of the path. When a match
+    // is returned, the search resumes with the next candidate at the last
+    // step.
+    while (true) {
+        if (depth == count) {
+            *node = mpack_node(iter->tree, iter->nodes[depth]);
+            if (depth == 0)
+                iter->done = true;
+            else
+                iter->depth = depth - 1;
+            return true;
+        }
+
+        mpack_node_data_t* child = mpack_node_path_iter_child(iter, depth);
+        if (child != NULL) {
+            iter->nodes[++depth] = child;
+            if (depth < count)
+                iter->next[depth] = 0;
+            continue;
+        }
+
+        if (depth == 0 || mpack_tree_error(iter->tree) != mpack_ok) {
+            iter->done = true;
+            return false;
+        }
+        --depth;
+    }
+}
+
+
+
+/*
+ * Node writing functions
+ */
+
+#if MPACK_WRITER
+
+// A map or array being written by mpack_write_node().
+typedef struct mpack_write_node_frame_t {
+    mpack_node_data_t* next; // next child to write
+    size_t left;             // children left to write
+    mpack_type_t type;
+} mpack_write_node_frame_t;
+
+// Without malloc(), trees can't be deeper than the parser's fixed stack.
+#ifdef MPACK_MALLOC
+#define MPACK_WRITE_NODE_LOCAL_DEPTH MPACK_NODE_INITIAL_DEPTH
+#else
+#define MPACK_WRITE_NODE_LOCAL_DEPTH MPACK_NODE_MAX_DEPTH_WITHOUT_MALLOC
+#endif
+
+// Grows the stack of mpack_write_node(). Returns false and flags an error
+// if it could not be grown.
+static bool mpack_write_node_grow(mpack_writer_t* writer, mpack_tree_t* tree,
+        mpack_write_node_frame_t** stack, size_t* capacity, mpack_write_node_frame_t* local)
+{
+    #ifdef MPACK_MALLOC
+    size_t new_capacity = *capacity * 2;
+    mpack_write_node_frame_t* new_stack;
+    if (*stack == local) {
+        new_stack = (mpack_write_node_frame_t*)mpack_allocator_alloc(tree->allocator,
+                sizeof(mpack_write_node_frame_t) * new_capacity);
+        if (new_stack != NULL)
+            mpack_memcpy(new_stack, local, sizeof(mpack_write_node_frame_t) * *capacity);
+    } else {
+        new_stack = (mpack_write_node_frame_t*)mpack_allocator_realloc(tree->allocator, *stack,
+                sizeof(mpack_write_node_frame_t) * *capacity,
+                sizeof(mpack_write_node_frame_t) * new_capacity);
+    }
+    if (new_stack == NULL) {
+        mpack_writer_flag_error(writer, mpack_error_memory);
+        return false;
+    }
+    *stack = new_stack;
+    *capacity = new_capacity;
+    return true;
+    #else
+    MPACK_UNUSED(tree);
+    MPACK_UNUSED(stack);
+    MPACK_UNUSED(capacity);
+    MPACK_UNUSED(local);
+    mpack_writer_flag_error(writer, mpack_error_too_big);
+    return false;
+    #endif
+}
+
+// Writes a node. Maps and arrays are written with an explicit stack rather
+// than recursively so that deeply nested trees can't overflow the call stack.
+static void mpack_write_node_element(mpack_writer_t* writer, mpack_node_t node) {
+    mpack_tree_t* tree = node.tree;
+    mpack_write_node_frame_t local[MPACK_WRITE_NODE_LOCAL_DEPTH];
+    mpack_write_node_frame_t* stack = local;
+    size_t capacity = MPACK_WRITE_NODE_LOCAL_DEPTH;
+    size_t depth = 0;
+
+    // the original bytes may not be canonical
+    #ifdef MPACK_MALLOC
+    bool copy = !writer->canonical;
+    #else
+    bool copy = true;
+    #endif
+
+    for (;;) {
+        mpack_type_t type = node.data->type;
+        const char* span = NULL;
+        size_t length = 0;
+        if (copy && (type == mpack_type_array || type == mpack_type_map))
+            span = mpack_node_span(node, &length);
+
+        if (span) {
+            mpack_write_object_bytes(writer, span, length);
+        } else {
+            mpack_write_tag(writer, mpack_node_tag(node));
+
+            switch (type) {
+                case mpack_type_str:
+                case mpack_type_bin:
+                #if MPACK_EXTENSIONS
+                case mpack_type_ext:
+                #endif
+                    mpack_write_bytes(writer, mpack_node_data_unchecked(node), node.data->len);
+                    mpack_finish_type(writer, type);
+                    break;
+
+                case mpack_type_array:
+                case mpack_type_map: {
+                    if (!mpack_node_ensure_children(node)) {
+                        mpack_writer_flag_error(writer, mpack_node_error(node));
+                        break;
+                    }
+                    if (depth == capacity && !mpack_write_node_grow(writer, tree, &stack, &capacity, local))
+                        break;
+                    mpack_write_node_frame_t* frame = &stack[depth++];
+                    frame->next = mpack_node_children(tree, node.data);
+                    frame->left = node.data->len;
+                    if (type == mpack_type_map)
+                        frame->left *= 2;
+                    frame->type = type;
+                    break;
+                }
+
+                default:
+                    break;
+            }
+        }
+
+        // find the next node to write, finishing any completed maps and arrays
+        while (depth > 0 && mpack_writer_error(writer) == mpack_ok) {
+            mpack_write_node_frame_t* frame = &stack[depth - 1];
+            if (frame->left > 0)
+                break;
+            mpack_finish_type(writer, frame->type);
+            --depth;
+        }
+        if (depth == 0 || mpack_writer_error(writer) != mpack_ok)
+            break;
+
+        mpack_write_node_frame_t* frame = &stack[depth - 1];
+        node = mpack_node(tree, frame->next++);
+        --frame->left;
+    }
+
+    #ifdef MPACK_MALLOC
+    if (stack != local)
+        mpack_allocator_free(tree->allocator, stack);
+    #endif
+}
+
+void mpack_write_node(mpack_writer_t* writer, mpack_node_t node) {
+    if (mpack_node_error(node) != mpack_ok) {
+        mpack_writer_flag_error(writer, mpack_node_error(node));
+        return;
+    }
+    if (mpack_writer_error(writer) != mpack_ok)
+        return;
+    mpack_write_node_element(writer, node);
+}
+
+#ifdef MPACK_MALLOC
+void mpack_write_node_canonical(mpack_writer_t* writer, mpack_node_t node) {
+    bool canonical = writer->canonical;
+    writer->canonical = true;
+    mpack_write_node(writer, node);
+    writer->canonical = canonical;
+}
+#endif
+#endif
+
 size_t mpack_node_enum_optional(mpack_node_t node, const char* strings[], size_t count) {
     if (mpack_node_error(node) != mpack_ok)
         return count;
@@ -2358,6 +3574,9 @@ mpack_node_t mpack_node_array_at(mpack_node_t node, size_t index) {
         return mpack_tree_nil_node(node.tree);
     }
 
+    if (!mpack_node_ensure_children(node))
+        return mpack_tree_nil_node(node.tree);
+
     return mpack_node(node.tree, mpack_node_child(node, index));
 }
 
@@ -2388,6 +3607,9 @@ static mpack_node_t mpack_node_map_at(mpack_node_t node, size_t index, size_t of
         return mpack_tree_nil_node(node.tree);
     }
 
+    if (!mpack_node_ensure_children(node))
+        return mpack_tree_nil_node(node.tree);
+
     return mpack_node(node.tree, mpack_node_child(node, index * 2 + offset));
 }
 
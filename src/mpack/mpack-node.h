@@ -29,6 +29,8 @@
 #define MPACK_NODE_H 1
 
 #include "mpack-reader.h"
+#include "mpack-path.h"
+#include "mpack-writer.h"
 
 MPACK_SILENCE_WARNINGS_BEGIN
 MPACK_EXTERN_C_BEGIN
@@ -69,7 +71,7 @@ typedef struct mpack_node_t mpack_node_t;
  * for nodes instead of letting the tree allocate it.
  *
  * @ref mpack_node_data_t is 16 bytes on most common architectures (32-bit
- * and 64-bit.)
+ * and 64-bit), or 12 bytes if @ref MPACK_NODE_COMPACT is enabled.
  */
 typedef struct mpack_node_data_t mpack_node_data_t;
 
@@ -81,6 +83,20 @@ typedef struct mpack_node_data_t mpack_node_data_t;
  */
 typedef struct mpack_tree_t mpack_tree_t;
 
+/**
+ * A set of paths that select which parts of a message are parsed into nodes.
+ *
+ * @see mpack_tree_set_projection()
+ */
+typedef struct mpack_projection_t mpack_projection_t;
+
+/**
+ * The maximum number of paths in a projection.
+ *
+ * @see mpack_projection_add()
+ */
+#define MPACK_PROJECTION_MAX_PATHS 31
+
 /**
  * An error handler function to be called when an error is flagged on
  * the tree.
@@ -135,6 +151,27 @@ typedef size_t (*mpack_tree_read_t)(mpack_tree_t* tree, char* buffer, size_t cou
  */
 typedef void (*mpack_tree_teardown_t)(mpack_tree_t* tree);
 
+#if MPACK_STATS
+/**
+ * Performance counters of a tree.
+ *
+ * These are only available if @ref MPACK_STATS is enabled.
+ *
+ * @see mpack_tree_stats()
+ */
+typedef struct mpack_tree_stats_t {
+    size_t fill_calls;      /**< The number of calls to the read function. */
+    size_t fill_bytes;      /**< The number of bytes returned by the read function. */
+    size_t buffer_reallocs; /**< The number of times the stream buffer was grown. */
+    size_t moved_bytes;     /**< The number of bytes moved to the start of the stream buffer between messages. */
+    size_t node_pages;      /**< The number of node pages allocated. */
+    size_t wasted_nodes;    /**< The number of nodes left unused in node pages that were abandoned for a new page. */
+    size_t node_memory;     /**< The number of bytes currently allocated in node pages. */
+    size_t memory;          /**< The number of bytes currently allocated by the tree for node pages, the stream buffer and the parse stack. */
+    size_t peak_memory;     /**< The maximum number of bytes allocated by the tree at once. */
+} mpack_tree_stats_t;
+#endif
+
 
 
 /* Hide internals from documentation */
@@ -145,7 +182,25 @@ struct mpack_node_t {
     mpack_tree_t* tree;
 };
 
+#if MPACK_NODE_COMPACT
+/**
+ * The maximum length of a node when @ref MPACK_NODE_COMPACT is enabled.
+ */
+#define MPACK_NODE_COMPACT_MAX_LEN ((uint32_t)0x07ffffff)
+
+#pragma pack(push, 4)
+#endif
+
 struct mpack_node_data_t {
+    #if MPACK_NODE_COMPACT
+    // Enum bit-fields are an extension in C, but are supported by all common
+    // compilers.
+    #if defined(__GNUC__) && !defined(__cplusplus)
+    __extension__
+    #endif
+    mpack_type_t type : 5;
+    uint32_t len : 27;
+    #else
     mpack_type_t type;
 
     /*
@@ -154,6 +209,7 @@ struct mpack_node_data_t {
      * or the number of bytes if the type is str, bin or ext.
      */
     uint32_t len;
+    #endif
 
     union {
         bool     b; /* The value if the type is bool. */
@@ -174,10 +230,18 @@ struct mpack_node_data_t {
         uint64_t u; /* The value if the type is unsigned int. */
         size_t offset; /* The byte offset for str, bin and ext */
 
-        mpack_node_data_t* children; /* The children for map or array */
+        /*
+         * The children for map or array. In a frozen tree, the index of the
+         * first child in the frozen nodes is stored in offset instead.
+         */
+        mpack_node_data_t* children;
     } value;
 };
 
+#if MPACK_NODE_COMPACT
+#pragma pack(pop)
+#endif
+
 typedef struct mpack_tree_page_t {
     struct mpack_tree_page_t* next;
     mpack_node_data_t nodes[1]; // variable size
@@ -190,10 +254,20 @@ typedef enum mpack_tree_parse_state_t {
 } mpack_tree_parse_state_t;
 
 typedef struct mpack_level_t {
-    mpack_node_data_t* child;
+    mpack_node_data_t* child; // next child, or the skipped node in a lazy tree
     size_t left; // children left in level
+    mpack_node_data_t* parent; // map or array containing the children, or NULL for the root
+    uint32_t paths; // projection paths matching the parent (see mpack-node.c)
 } mpack_level_t;
 
+struct mpack_projection_t {
+    bool all;          // whether a path selects the whole message
+    size_t path_count;
+    size_t step_count;
+    size_t path_end[MPACK_PROJECTION_MAX_PATHS]; // end of the steps of each path
+    mpack_path_step_t steps[MPACK_PROJECTION_MAX_STEPS];
+};
+
 typedef struct mpack_tree_parser_t {
     mpack_tree_parse_state_t state;
 
@@ -219,10 +293,19 @@ typedef struct mpack_tree_parser_t {
 
     mpack_node_data_t* nodes; // next node in current page/pool
     size_t nodes_left; // nodes left in current page/pool
+    #ifdef MPACK_MALLOC
+    size_t page_size; // size in bytes of the next node page to allocate
+    #endif
 
     size_t current_node_reserved;
     size_t level;
 
+    // The contents of lazy maps and arrays are parsed into this node rather
+    // than into the tree's pages.
+    mpack_node_data_t skipped;
+    uint32_t paths; // projection paths matching the node being parsed
+    bool spans; // whether the nodes of the current message record spans
+
     #ifdef MPACK_MALLOC
     // It's much faster to allocate the initial parsing stack inline within the
     // parser. We replace it with a heap allocation if we need to grow it.
@@ -260,6 +343,10 @@ struct mpack_tree_t {
 
     size_t max_size;  // maximum message size
     size_t max_nodes; // maximum nodes in a message
+    bool lazy;        // whether maps and arrays are expanded on first access
+    const mpack_projection_t* projection; // paths to parse eagerly, or NULL
+    bool spans;       // whether maps and arrays record their source bytes
+    mpack_node_data_t* frozen; // nodes of a frozen image, or NULL if not frozen
 
     mpack_tree_parser_t parser;
     mpack_node_data_t* root;
@@ -269,6 +356,20 @@ struct mpack_tree_t {
 
     #ifdef MPACK_MALLOC
     mpack_tree_page_t* next;
+    const mpack_allocator_t* allocator; // allocator for pages and buffers, or NULL
+    bool pool_overflow; // whether a pool may overflow into allocated pages
+    bool exact;         // whether buffered messages get an exactly-sized node block
+    size_t page_size;     // size in bytes of the first node page of a message
+    size_t max_page_size; // size in bytes to which node pages can grow
+    size_t buffer_size;   // initial size in bytes of the stream buffer
+    #endif
+
+    #if MPACK_STATS
+    mpack_tree_stats_t stats; /* Performance counters */
+    #endif
+
+    #if MPACK_TRACING
+    const mpack_trace_t* trace; /* Tracing hooks */
     #endif
 };
 
@@ -281,8 +382,14 @@ MPACK_INLINE mpack_node_t mpack_node(mpack_tree_t* tree, mpack_node_data_t* data
     return node;
 }
 
+MPACK_INLINE mpack_node_data_t* mpack_node_children(mpack_tree_t* tree, mpack_node_data_t* data) {
+    if (tree->frozen != NULL)
+        return tree->frozen + data->value.offset;
+    return data->value.children;
+}
+
 MPACK_INLINE mpack_node_data_t* mpack_node_child(mpack_node_t node, size_t child) {
-    return node.data->value.children + child;
+    return mpack_node_children(node.tree, node.data) + child;
 }
 
 MPACK_INLINE mpack_node_t mpack_tree_nil_node(mpack_tree_t* tree) {
@@ -364,7 +471,8 @@ void mpack_tree_init_stream(mpack_tree_t* tree, mpack_tree_read_t read_fn, void*
  * Configure the tree if desired, then call mpack_tree_parse() to parse it.
  *
  * If the data does not fit in the pool, @ref mpack_error_too_big will be flagged
- * on the tree.
+ * on the tree, unless overflow into allocated pages is enabled with
+ * mpack_tree_set_pool_overflow().
  *
  * The tree must be destroyed with mpack_tree_destroy(), even if parsing fails.
  */
@@ -378,6 +486,58 @@ void mpack_tree_init_pool(mpack_tree_t* tree, const char* data, size_t length,
  */
 void mpack_tree_init_error(mpack_tree_t* tree, mpack_error_t error);
 
+/**
+ * Initializes a tree from a frozen image created by mpack_tree_freeze().
+ *
+ * The tree is ready for use immediately: nothing is parsed and nothing is
+ * allocated. The nodes and data of the tree are read directly from the image,
+ * and they are never modified, so the image can be mapped read-only from a
+ * file and shared between processes. Do not call mpack_tree_parse() on the
+ * tree.
+ *
+ * The image must be aligned to 8 bytes and must remain valid until after the
+ * tree is destroyed. Only the header of the image is checked; @ref
+ * mpack_error_invalid is flagged if it is malformed or if the image was
+ * created by a build of MPack with a different node layout (for example on a
+ * platform with a different word size or byte order.) The nodes themselves
+ * are not validated, so an image must only be loaded if it is trusted.
+ *
+ * The tree must be destroyed with mpack_tree_destroy().
+ *
+ * @param tree The tree to initialize
+ * @param image The frozen image
+ * @param size The size of the frozen image in bytes
+ *
+ * @see mpack_tree_freeze()
+ */
+void mpack_tree_init_frozen(mpack_tree_t* tree, const char* image, size_t size);
+
+/**
+ * Initializes a view of a parsed tree, so that the tree can be read by
+ * multiple threads at once.
+ *
+ * Node functions never modify the nodes of a tree, but they flag errors on
+ * the tree of the node (and call its error handler), so a tree cannot be
+ * shared between threads. Instead, each thread can read the tree through its
+ * own view. A view shares the nodes and data of the tree without copying
+ * them, but it has its own error state and error handler: nodes from a view,
+ * including its root from mpack_tree_root(), flag errors on the view only.
+ *
+ * The tree must have been parsed successfully, and it must not be lazy or
+ * have a projection (see mpack_tree_set_lazy() and
+ * mpack_tree_set_projection()) since expanding nodes would modify it;
+ * otherwise @ref mpack_error_bug is flagged on the view. If the tree is
+ * already in an error state, the view starts in the same error state.
+ *
+ * A view must not be parsed. It must be destroyed with mpack_tree_destroy(),
+ * and the tree must not be parsed again or destroyed while it has views.
+ * Creating a view only reads the tree, so views can be created concurrently.
+ *
+ * @param view The view to initialize
+ * @param tree The parsed tree to view
+ */
+void mpack_tree_init_view(mpack_tree_t* view, mpack_tree_t* tree);
+
 #if MPACK_STDIO
 /**
  * Initializes a tree to parse the given file. The tree must be destroyed with
@@ -440,7 +600,8 @@ void mpack_tree_init_stdfile(mpack_tree_t* tree, FILE* stdfile, size_t max_bytes
  * called (where maximums are required.)
  *
  * If a pool of nodes is used, the node limit is the lesser of this limit and
- * the pool size.
+ * the pool size, unless the pool is allowed to overflow (see
+ * mpack_tree_set_pool_overflow().)
  *
  * @param tree The tree parser
  * @param max_message_size The maximum size of a message in bytes
@@ -450,6 +611,176 @@ void mpack_tree_init_stdfile(mpack_tree_t* tree, FILE* stdfile, size_t max_bytes
 void mpack_tree_set_limits(mpack_tree_t* tree, size_t max_message_size,
         size_t max_message_nodes);
 
+/**
+ * Sets whether the tree parses messages lazily.
+ *
+ * When lazy parsing is enabled, mpack_tree_parse() and mpack_tree_try_parse()
+ * validate the whole message but create a node only for the root. The
+ * children of a map or array are parsed into nodes the first time they are
+ * accessed, for example by mpack_node_array_at() or mpack_node_map_cstr().
+ * The time and memory spent creating nodes then scales with the parts of the
+ * message that are accessed rather than with the size of the message.
+ *
+ * Until its children are accessed, a non-empty map or array uses a single
+ * node to record where its contents start in the data. Expanding a map or
+ * array skips over the contents of its own children so that they can be
+ * expanded lazily in turn.
+ *
+ * Since the end of a child is not recorded, its contents are scanned again
+ * each time one of its ancestors is expanded. Accessing every node of a
+ * message of size n nested to depth d therefore takes O(n * d) time, which is
+ * quadratic for deeply nested messages. Lazy parsing is best suited to wide,
+ * shallow messages of which only some parts are accessed; disable it for
+ * messages that will be traversed completely.
+ *
+ * Since accessing the contents of a map or array may need to allocate nodes,
+ * node functions on a lazy tree can flag @ref mpack_error_memory, or @ref
+ * mpack_error_too_big if the node limit is exceeded. Nodes of a lazy tree
+ * must not be accessed concurrently from multiple threads.
+ *
+ * This must not be called while a message is being parsed. Lazy parsing is
+ * disabled by default.
+ *
+ * @param tree The tree parser
+ * @param lazy True to parse maps and arrays lazily, false otherwise
+ */
+void mpack_tree_set_lazy(mpack_tree_t* tree, bool lazy);
+
+/**
+ * Sets a projection that selects which parts of a message are parsed into
+ * nodes.
+ *
+ * A map or array selected by a path in the projection, or along the way to
+ * one, is parsed into nodes as usual. Every other map or array is skipped as
+ * in a lazy tree: its contents are validated but not parsed into nodes until
+ * they are accessed. This makes parsing wide messages much cheaper when only
+ * a few of their paths are needed.
+ *
+ * The projection is not copied. It must remain valid and unchanged while the
+ * tree parses messages with it. A projection overrides lazy parsing (see
+ * mpack_tree_set_lazy()) for the maps and arrays that it selects. Pass NULL
+ * to remove the projection.
+ *
+ * This must not be called while a message is being parsed.
+ *
+ * @param tree The tree parser
+ * @param projection The projection, or NULL to parse all maps and arrays
+ */
+void mpack_tree_set_projection(mpack_tree_t* tree, const mpack_projection_t* projection);
+
+/**
+ * Sets whether the tree records where each map and array was found in the
+ * data.
+ *
+ * When spans are recorded, mpack_write_node() writes a map or array by
+ * copying its original bytes rather than encoding each of its nodes. This
+ * uses one additional node for each non-empty map or array in a message.
+ *
+ * The root node can always be copied this way regardless of this setting
+ * since it spans the whole message.
+ *
+ * This must not be called while a message is being parsed. It takes effect
+ * on the next message parsed. Spans are not recorded by default.
+ *
+ * @param tree The tree parser
+ * @param spans True to record the spans of maps and arrays, false otherwise
+ */
+void mpack_tree_set_spans(mpack_tree_t* tree, bool spans);
+
+#ifdef MPACK_MALLOC
+/**
+ * Sets the allocator with which the tree allocates node pages, its parsing
+ * stack, the buffer of a stream tree, and the data returned by
+ * mpack_node_data_alloc() and similar functions, or NULL to use @ref
+ * MPACK_MALLOC.
+ *
+ * This must be called before the first message is parsed. The data of a
+ * tree initialized with mpack_tree_init_filename() or
+ * mpack_tree_init_stdfile() is always allocated with @ref MPACK_MALLOC.
+ *
+ * @see mpack_allocator_t
+ */
+void mpack_tree_set_allocator(mpack_tree_t* tree, const mpack_allocator_t* allocator);
+
+/**
+ * Sets whether a tree initialized with mpack_tree_init_pool() may overflow
+ * its pool into allocated pages.
+ *
+ * When enabled, messages that fit in the pool are parsed without allocating,
+ * and the nodes of larger messages spill over into pages allocated as if no
+ * pool had been given, rather than flagging @ref mpack_error_too_big. Any
+ * pages are freed when the next message is parsed or when the tree is
+ * destroyed.
+ *
+ * This must not be called while a message is being parsed. It has no
+ * effect on trees without a pool. Overflow is disabled by default.
+ *
+ * @param tree The tree parser
+ * @param overflow True to allow the pool to overflow, false otherwise
+ */
+void mpack_tree_set_pool_overflow(mpack_tree_t* tree, bool overflow);
+
+/**
+ * Sets whether the tree allocates exactly as many nodes as a message needs.
+ *
+ * When enabled, if a message is entirely in the tree's buffer when parsing
+ * starts, the tree first scans its structure to count its nodes and then
+ * parses it into a single contiguous block of exactly that many nodes. This
+ * avoids the memory wasted at the end of node pages, needs only one
+ * allocation regardless of the size of the message, and lays out the
+ * children of each map and array in the order in which they are parsed.
+ *
+ * This is best suited to large messages that are already in memory, such as
+ * trees initialized with mpack_tree_init_data(). The scan reads the message
+ * twice, so it may be slower for small messages. If the message is not
+ * entirely buffered, is malformed, or exceeds the node limit, or if the tree
+ * uses a node pool, is lazy or has a projection, nodes are allocated in pages
+ * as usual.
+ *
+ * This must not be called while a message is being parsed. Exact allocation
+ * is disabled by default.
+ *
+ * @param tree The tree parser
+ * @param exact True to allocate exactly-sized node blocks, false otherwise
+ */
+void mpack_tree_set_exact_alloc(mpack_tree_t* tree, bool exact);
+
+/**
+ * Sets the sizes in bytes of the pages in which the tree allocates nodes.
+ *
+ * The first page of each message is @p initial_size bytes. Each further page
+ * is twice the size of the previous one, up to @p max_size. Small initial
+ * pages waste little memory on small messages, while large maximum pages let
+ * huge messages be parsed with few allocations. (The children of a map or
+ * array must be contiguous, so larger pages than this may still be allocated
+ * as needed.)
+ *
+ * Both sizes default to @ref MPACK_NODE_PAGE_SIZE, in which case pages do not
+ * grow. This must not be called while a message is being parsed.
+ *
+ * @param tree The tree parser
+ * @param initial_size The size of the first node page of each message. This
+ *        must be large enough to hold at least one node.
+ * @param max_size The maximum size of a node page. This must be at least
+ *        @p initial_size.
+ */
+void mpack_tree_set_page_size(mpack_tree_t* tree, size_t initial_size, size_t max_size);
+
+/**
+ * Sets the initial size in bytes of the buffer of a tree initialized with
+ * mpack_tree_init_stream().
+ *
+ * The buffer is allocated with this size when it is first needed, and
+ * doubles in size as needed up to the maximum message size. The default is
+ * @ref MPACK_BUFFER_SIZE. This must be called before the buffer is allocated,
+ * i.e. before the first message is parsed.
+ *
+ * @param tree The tree parser
+ * @param size The initial size of the buffer. This must not be zero.
+ */
+void mpack_tree_set_buffer_size(mpack_tree_t* tree, size_t size);
+#endif
+
 /**
  * Parses a MessagePack message into a tree of immutable nodes.
  *
@@ -523,6 +854,37 @@ MPACK_INLINE size_t mpack_tree_size(mpack_tree_t* tree) {
     return tree->size;
 }
 
+#if MPACK_STATS
+/**
+ * Returns the performance counters of the tree.
+ *
+ * The counters accumulate over all messages parsed by the tree.
+ *
+ * This is only available if @ref MPACK_STATS is enabled.
+ */
+MPACK_INLINE const mpack_tree_stats_t* mpack_tree_stats(mpack_tree_t* tree) {
+    return &tree->stats;
+}
+#endif
+
+#if MPACK_TRACING
+/**
+ * Sets the tracing hooks of the tree, or NULL to disable tracing.
+ *
+ * The hooks are called around each call to the read function and around
+ * each reallocation of the buffer of a stream tree. They are not copied;
+ * they must remain valid until the tree is destroyed or the hooks are
+ * replaced.
+ *
+ * This is only available if @ref MPACK_TRACING is enabled.
+ *
+ * @see trace
+ */
+MPACK_INLINE void mpack_tree_set_trace(mpack_tree_t* tree, const mpack_trace_t* trace) {
+    tree->trace = trace;
+}
+#endif
+
 /**
  * Destroys the tree.
  */
@@ -592,6 +954,83 @@ MPACK_INLINE void mpack_tree_set_teardown(mpack_tree_t* tree, mpack_tree_teardow
  */
 void mpack_tree_flag_error(mpack_tree_t* tree, mpack_error_t error);
 
+/**
+ * @}
+ */
+
+/**
+ * @name Projection Functions
+ * @{
+ */
+
+/**
+ * Initializes an empty projection.
+ *
+ * An empty projection selects nothing, so a tree parsed with it creates a
+ * node only for its root. Add paths to it with mpack_projection_add().
+ */
+void mpack_projection_init(mpack_projection_t* projection);
+
+/**
+ * Adds a path to a projection.
+ *
+ * The path uses the syntax of a compiled path (see @ref path), for example
+ * `events[*].ts`. The map or array found at the end of a path is parsed
+ * completely. An empty path selects the whole message.
+ *
+ * The keys of the path are not copied. The path string must remain valid
+ * while the projection is in use.
+ *
+ * @return @ref mpack_ok if the path was added, @ref mpack_error_invalid if the
+ *         path is malformed, or @ref mpack_error_too_big if the projection
+ *         has no room left for the path (see @ref MPACK_PROJECTION_MAX_PATHS
+ *         and @ref MPACK_PROJECTION_MAX_STEPS.)
+ */
+mpack_error_t mpack_projection_add(mpack_projection_t* projection, const char* path);
+
+/**
+ * @}
+ */
+
+/**
+ * @name Frozen Tree Functions
+ * @{
+ */
+
+/**
+ * Returns the size in bytes of the frozen image of a parsed tree.
+ *
+ * A frozen image contains a small header, the nodes of the tree, and the data
+ * of the message. The nodes are counted from the message itself, so the maps
+ * and arrays of a lazy or projected tree are not parsed by this function.
+ *
+ * Returns zero if the tree is in an error state.
+ *
+ * @see mpack_tree_freeze()
+ */
+size_t mpack_tree_frozen_size(mpack_tree_t* tree);
+
+/**
+ * Freezes a parsed tree into an image that can be loaded later with
+ * mpack_tree_init_frozen().
+ *
+ * The nodes of the image refer to their children by index rather than by
+ * pointer, so the image can be written to a file and mapped into memory by
+ * another process. It is only compatible with builds of MPack that have the
+ * same node layout.
+ *
+ * The maps and arrays of a lazy or projected tree are all parsed into nodes
+ * first, so this can flag an error if they do not fit. If the buffer is
+ * smaller than mpack_tree_frozen_size(), @ref mpack_error_too_big is flagged
+ * on the tree.
+ *
+ * @param tree The parsed tree to freeze
+ * @param buffer The buffer in which to write the image
+ * @param size The size of the buffer in bytes
+ * @return The size of the image, or zero if an error occurred.
+ */
+size_t mpack_tree_freeze(mpack_tree_t* tree, char* buffer, size_t size);
+
 /**
  * @}
  */
@@ -1106,11 +1545,12 @@ void mpack_node_copy_utf8_cstr(mpack_node_t node, char* buffer, size_t size);
 
 #ifdef MPACK_MALLOC
 /**
- * Allocates a new chunk of data using MPACK_MALLOC() with the bytes
- * contained by this node.
+ * Allocates a new chunk of data using MPACK_MALLOC() (or the tree's
+ * allocator) with the bytes contained by this node.
  *
  * The allocated data must be freed with MPACK_FREE() (or simply free()
- * if MPack's allocator hasn't been customized.)
+ * if MPack's allocator hasn't been customized), or with the tree's
+ * allocator if one was set with mpack_tree_set_allocator().
  *
  * @throws mpack_error_type If this node is not a str, bin or ext type
  * @throws mpack_error_too_big If the size of the data is larger than the
@@ -1125,11 +1565,12 @@ void mpack_node_copy_utf8_cstr(mpack_node_t node, char* buffer, size_t size);
 char* mpack_node_data_alloc(mpack_node_t node, size_t maxsize);
 
 /**
- * Allocates a new null-terminated string using MPACK_MALLOC() with the string
- * contained by this node.
+ * Allocates a new null-terminated string using MPACK_MALLOC() (or the
+ * tree's allocator) with the string contained by this node.
  *
  * The allocated string must be freed with MPACK_FREE() (or simply free()
- * if MPack's allocator hasn't been customized.)
+ * if MPack's allocator hasn't been customized), or with the tree's
+ * allocator if one was set with mpack_tree_set_allocator().
  *
  * @throws mpack_error_type If this node is not a string or contains NUL bytes
  * @throws mpack_error_too_big If the size of the string plus null-terminator
@@ -1144,11 +1585,12 @@ char* mpack_node_data_alloc(mpack_node_t node, size_t maxsize);
 char* mpack_node_cstr_alloc(mpack_node_t node, size_t maxsize);
 
 /**
- * Allocates a new null-terminated string using MPACK_MALLOC() with the UTF-8
- * string contained by this node.
+ * Allocates a new null-terminated string using MPACK_MALLOC() (or the
+ * tree's allocator) with the UTF-8 string contained by this node.
  *
  * The allocated string must be freed with MPACK_FREE() (or simply free()
- * if MPack's allocator hasn't been customized.)
+ * if MPack's allocator hasn't been customized), or with the tree's
+ * allocator if one was set with mpack_tree_set_allocator().
  *
  * @throws mpack_error_type If this node is not a string, is not valid UTF-8,
  *     or contains NUL bytes
@@ -1453,10 +1895,189 @@ bool mpack_node_map_contains_str(mpack_node_t node, const char* str, size_t leng
  */
 bool mpack_node_map_contains_cstr(mpack_node_t node, const char* cstr);
 
+/**
+ * Returns the encoded bytes of the given node in the original message, or
+ * NULL if they are not known.
+ *
+ * The bytes of the root node are always known. The bytes of any other map
+ * or array are known only if the tree records spans (see
+ * mpack_tree_set_spans()). The bytes of other types of nodes are not known.
+ *
+ * The pointer is valid as long as the data backing the tree is valid.
+ *
+ * @param node The node.
+ * @param length [out] The length of the bytes, or 0 if they are not known.
+ */
+const char* mpack_node_span(mpack_node_t node, size_t* length);
+
+/**
+ * Returns a 64-bit structural hash of the given node and everything it
+ * contains.
+ *
+ * The hash depends only on the values in the node, not on how they are
+ * encoded. Integers hash the same regardless of their width or signedness,
+ * strings and blobs hash the same regardless of their header size, and maps
+ * hash the same regardless of the order of their keys. A float hashes the
+ * same as the equivalent double only if both @ref MPACK_FLOAT and @ref
+ * MPACK_DOUBLE are enabled.
+ *
+ * The result is the same as mpack_read_hash() on the same data and the same
+ * seed, so hashes can be compared between trees and streams.
+ *
+ * Maps and arrays nested more than @ref MPACK_HASH_MAX_DEPTH deep flag
+ * @ref mpack_error_too_big on the tree.
+ *
+ * This is not a cryptographic hash; see mpack_hash_data().
+ *
+ * @param node The node to hash.
+ * @param seed A seed for the hash.
+ * @return The hash, or 0 if an error occurs.
+ */
+uint64_t mpack_node_hash(mpack_node_t node, uint64_t seed);
+
+/**
+ * @}
+ */
+
+/**
+ * @name Path Functions
+ * @{
+ */
+
+/**
+ * Returns the node found by following a compiled path from the given node.
+ *
+ * Each key step behaves like mpack_node_map_str() and each index step like
+ * mpack_node_array_at(), except that map lookups stop at the first matching
+ * key rather than checking the whole map for duplicates.
+ *
+ * The path must not contain a wildcard. Use mpack_node_path_iter_init() to
+ * find all matches of a path with wildcards.
+ *
+ * If an error occurs, a nil node is returned.
+ *
+ * @throws mpack_error_type If a key step is applied to a node that is not a
+ *         map, or an index step to a node that is not an array
+ * @throws mpack_error_data If a key is not found or an index is out of bounds
+ *
+ * @see mpack_path_compile()
+ */
+mpack_node_t mpack_node_path(mpack_node_t node, const mpack_path_t* path);
+
+/**
+ * Returns the node found by following a compiled path from the given node,
+ * or a missing node if a key is not found or an index is out of bounds.
+ *
+ * This is like mpack_node_path() except that it returns a missing node
+ * instead of flagging @ref mpack_error_data if the path matches nothing.
+ *
+ * @throws mpack_error_type If a key step is applied to a node that is not a
+ *         map, or an index step to a node that is not an array
+ *
+ * @see mpack_node_path()
+ * @see mpack_node_is_missing()
+ */
+mpack_node_t mpack_node_path_optional(mpack_node_t node, const mpack_path_t* path);
+
+/**
+ * An iterator over the nodes matching a compiled path.
+ *
+ * This structure is opaque; its fields should not be accessed outside
+ * of MPack.
+ */
+typedef struct mpack_node_path_iter_t mpack_node_path_iter_t;
+
+/* Hide internals from documentation */
+/** @cond */
+
+struct mpack_node_path_iter_t {
+    mpack_tree_t* tree;
+    const mpack_path_t* path;
+    size_t depth; // number of steps followed to reach the current node
+    bool done;
+    mpack_node_data_t* nodes[MPACK_PATH_MAX_STEPS + 1]; // node at each depth
+    uint32_t next[MPACK_PATH_MAX_STEPS]; // next child to try at each depth
+};
+
+/** @endcond */
+
+/**
+ * Initializes an iterator over all nodes that match a compiled path from the
+ * given node.
+ *
+ * Matches are found in message order. Steps that do not apply, such as a key
+ * step on a node that is not a map or a key that does not exist, simply match
+ * nothing; no error is flagged.
+ *
+ * The iterator holds pointers to the node's tree and to the path. Both must
+ * remain valid while the iterator is in use.
+ *
+ * @see mpack_node_path_iter_next()
+ */
+void mpack_node_path_iter_init(mpack_node_path_iter_t* iter, mpack_node_t node, const mpack_path_t* path);
+
+/**
+ * Finds the next node matching the path of the iterator.
+ *
+ * @param iter The iterator.
+ * @param node [out] The matching node.
+ * @return True if a matching node was found, false if there are no more
+ *         matches or the tree is in an error state.
+ */
+bool mpack_node_path_iter_next(mpack_node_path_iter_t* iter, mpack_node_t* node);
+
+/**
+ * @}
+ */
+
+#if MPACK_WRITER
+
+/**
+ * @name Node Writing Functions
+ * @{
+ */
+
+/**
+ * Writes the given node and all of its contents to a writer.
+ *
+ * If the node is the root of its tree, or if it is a map or array and the
+ * tree records spans (see mpack_tree_set_spans()), its original bytes are
+ * copied to the writer as is, unless the writer is in canonical mode.
+ * Otherwise its contents are written node by node, in which case numbers are
+ * written in their smallest encoding.
+ *
+ * If the node's tree is in an error state, its error is flagged on the
+ * writer.
+ *
+ * @param writer The writer.
+ * @param node The node to write.
+ */
+void mpack_write_node(mpack_writer_t* writer, mpack_node_t node);
+
+#ifdef MPACK_MALLOC
+/**
+ * Writes the given node and all of its contents to a writer in canonical
+ * form, regardless of whether the writer is in canonical mode.
+ *
+ * The contents are written node by node with the keys of maps sorted, so
+ * logically equal trees produce the same bytes no matter how their messages
+ * were encoded. See mpack_writer_set_canonical() for a description of the
+ * canonical form.
+ *
+ * @note This requires @ref MPACK_MALLOC.
+ *
+ * @param writer The writer.
+ * @param node The node to write.
+ */
+void mpack_write_node_canonical(mpack_writer_t* writer, mpack_node_t node);
+#endif
+
 /**
  * @}
  */
 
+#endif
+
 /**
  * @}
  */
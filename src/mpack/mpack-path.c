@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define MPACK_INTERNAL 1
+
+#include "mpack-path.h"
+
+MPACK_SILENCE_WARNINGS_BEGIN
+
+#if MPACK_READER || MPACK_NODE
+
+mpack_error_t mpack_path_parse(const char* expression, mpack_path_step_t* steps,
+        size_t capacity, size_t* count)
+{
+    size_t n = 0;
+    const char* p = expression;
+    while (*p != '\0') {
+        if (n == capacity)
+            return mpack_error_too_big;
+        mpack_path_step_t* step = &steps[n++];
+
+        if (*p == '[') {
+            ++p;
+            if (*p == '*') {
+                step->type = mpack_path_step_any;
+                ++p;
+            } else {
+                if (*p < '0' || *p > '9')
+                    return mpack_error_invalid;
+                uint64_t index = 0;
+                while (*p >= '0' && *p <= '9') {
+                    index = index * 10 + (uint64_t)(*p - '0');
+                    if (index > MPACK_UINT32_MAX)
+                        return mpack_error_invalid;
+                    ++p;
+                }
+                step->type = mpack_path_step_index;
+                step->index = (uint32_t)index;
+            }
+            if (*p != ']')
+                return mpack_error_invalid;
+            ++p;
+            continue;
+        }
+
+        // Keys other than the first must be preceded by a dot
+        if (p != expression) {
+            if (*p != '.')
+                return mpack_error_invalid;
+            ++p;
+        }
+        const char* key = p;
+        while (*p != '\0' && *p != '.' && *p != '[')
+            ++p;
+        if (p == key)
+            return mpack_error_invalid;
+        step->type = mpack_path_step_key;
+        step->key = key;
+        step->length = (size_t)(p - key);
+    }
+
+    *count = n;
+    return mpack_ok;
+}
+
+mpack_error_t mpack_path_compile(mpack_path_t* path, const char* expression) {
+    mpack_assert(expression != NULL, "expression is NULL");
+    size_t count;
+    mpack_error_t error = mpack_path_parse(expression, path->steps,
+            sizeof(path->steps) / sizeof(*path->steps), &count);
+    if (error != mpack_ok)
+        return error;
+
+    path->count = count;
+    path->wildcard = false;
+    size_t i;
+    for (i = 0; i < count; ++i)
+        if (path->steps[i].type == mpack_path_step_any)
+            path->wildcard = true;
+    return mpack_ok;
+}
+
+#endif
+
+MPACK_SILENCE_WARNINGS_END
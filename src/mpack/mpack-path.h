@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file
+ *
+ * Declares compiled MessagePack paths.
+ */
+
+#ifndef MPACK_PATH_H
+#define MPACK_PATH_H 1
+
+#include "mpack-common.h"
+
+MPACK_SILENCE_WARNINGS_BEGIN
+MPACK_EXTERN_C_BEGIN
+
+#if MPACK_READER || MPACK_NODE
+
+/**
+ * @defgroup path Paths
+ *
+ * A path selects elements within a message by a sequence of map keys and
+ * array indices from its root. A path is compiled once from an expression
+ * and can then be evaluated repeatedly without parsing the expression again.
+ *
+ * A path expression is a sequence of steps:
+ *
+ * - A key in a map, such as `user`. Keys other than the first must be
+ *   preceded by a dot, as in `user.id`. Only string keys can be matched.
+ * - An index in an array in brackets, such as `[3]`.
+ * - A wildcard `[*]`, which matches every element of an array and every
+ *   value of a map.
+ *
+ * For example `items[*].price` selects the `price` value of every map in the
+ * `items` array. An empty expression selects the root.
+ *
+ * Keys are not copied when a path is compiled. The expression string must
+ * remain valid while the path is in use.
+ *
+ * @see mpack_node_path()
+ *
+ * @{
+ */
+
+/**
+ * A compiled path.
+ *
+ * This structure is opaque; its fields should not be accessed outside
+ * of MPack.
+ */
+typedef struct mpack_path_t mpack_path_t;
+
+/* Hide internals from documentation */
+/** @cond */
+
+typedef enum mpack_path_step_type_t {
+    mpack_path_step_key,   // a key in a map
+    mpack_path_step_index, // an index in an array
+    mpack_path_step_any    // any element of an array or value of a map
+} mpack_path_step_type_t;
+
+typedef struct mpack_path_step_t {
+    mpack_path_step_type_t type;
+    uint32_t index;  // index for index steps
+    const char* key; // key for key steps (not null-terminated)
+    size_t length;   // length of key
+} mpack_path_step_t;
+
+struct mpack_path_t {
+    size_t count;
+    bool wildcard; // whether any step is a wildcard
+    mpack_path_step_t steps[MPACK_PATH_MAX_STEPS];
+};
+
+/*
+ * Parses a path expression into at most capacity steps, storing the number
+ * of steps in count. Nothing is stored in count if an error is returned.
+ */
+mpack_error_t mpack_path_parse(const char* expression, mpack_path_step_t* steps,
+        size_t capacity, size_t* count);
+
+/** @endcond */
+
+/**
+ * Compiles a path expression.
+ *
+ * If an error is returned, the contents of the path are unspecified and it
+ * must not be evaluated.
+ *
+ * @param path The path to compile into.
+ * @param expression The path expression. It must remain valid while the
+ *        path is in use.
+ * @return @ref mpack_ok if the path was compiled, @ref mpack_error_invalid if
+ *         the expression is malformed, or @ref mpack_error_too_big if it has
+ *         more than @ref MPACK_PATH_MAX_STEPS steps.
+ */
+mpack_error_t mpack_path_compile(mpack_path_t* path, const char* expression);
+
+/**
+ * Returns the number of steps in a compiled path.
+ */
+MPACK_INLINE size_t mpack_path_length(const mpack_path_t* path) {
+    return path->count;
+}
+
+/**
+ * Returns true if the compiled path contains a wildcard, in which case it
+ * can match any number of elements.
+ */
+MPACK_INLINE bool mpack_path_has_wildcard(const mpack_path_t* path) {
+    return path->wildcard;
+}
+
+/**
+ * @}
+ */
+
+#endif
+
+MPACK_EXTERN_C_END
+MPACK_SILENCE_WARNINGS_END
+
+#endif
@@ -719,6 +719,42 @@
     #error "MPACK_WRITE_TRACKING requires MPACK_WRITER."
 #endif
 
+/**
+ * @def MPACK_STATS
+ *
+ * Enables performance counters for readers, writers and trees.
+ *
+ * When enabled, each @ref mpack_reader_t, @ref mpack_writer_t and @ref
+ * mpack_tree_t counts calls to its fill or flush function, reads and writes
+ * that straddle the end of its buffer, memory it allocates, and so on. These
+ * counters can be queried with mpack_reader_stats(), mpack_writer_stats()
+ * and mpack_tree_stats(). They are useful for tuning buffer and page sizes
+ * and custom fill and flush functions.
+ *
+ * This is disabled by default. When disabled, the counters and their query
+ * functions are compiled out entirely.
+ */
+#ifndef MPACK_STATS
+    #define MPACK_STATS 0
+#endif
+
+/**
+ * @def MPACK_TRACING
+ *
+ * Enables tracing hooks for readers, writers and trees.
+ *
+ * When enabled, a @ref mpack_trace_t can be attached to a reader, writer or
+ * tree to be called at the start and end of potentially slow events such as
+ * fills, flushes, buffer reallocations and builder resolves. See @ref trace
+ * for details.
+ *
+ * This is disabled by default. When disabled, the hooks are compiled out
+ * entirely.
+ */
+#ifndef MPACK_TRACING
+    #define MPACK_TRACING 0
+#endif
+
 /**
  * @}
  */
@@ -767,6 +803,8 @@
  * provide the best performance with minimal memory waste.
  * Increasing this does not improve performance even when writing
  * huge messages.
+ *
+ * @see mpack_tree_set_buffer_size() to change this for a tree
  */
 #ifndef MPACK_BUFFER_SIZE
 #define MPACK_BUFFER_SIZE 4096
@@ -794,6 +832,9 @@
  * Using as many nodes fit in one memory page seems to provide the
  * best performance, and has very little waste when parsing small
  * messages.
+ *
+ * @see mpack_tree_set_page_size() to change this for a tree, and to let
+ * its pages grow
  */
 #ifndef MPACK_NODE_PAGE_SIZE
 #define MPACK_NODE_PAGE_SIZE MPACK_PAGE_SIZE
@@ -804,6 +845,8 @@
  *
  * Builder writes are deferred to the allocated builder buffer which is
  * composed of a list of buffer pages. This defines the size of those pages.
+ *
+ * @see mpack_writer_set_builder_page_size() to change this for a writer
  */
 #ifndef MPACK_BUILDER_PAGE_SIZE
 #define MPACK_BUILDER_PAGE_SIZE MPACK_PAGE_SIZE
@@ -862,6 +905,78 @@
 #define MPACK_NODE_MAX_DEPTH_WITHOUT_MALLOC 32
 #endif
 
+/**
+ * @def MPACK_NODE_COMPACT
+ *
+ * Enables a compact layout for tree nodes.
+ *
+ * When enabled, the type and length of a node share a single 32-bit field
+ * and the node is packed to 4-byte alignment. This makes @ref
+ * mpack_node_data_t 12 bytes rather than 16 on most 64-bit platforms,
+ * reducing the memory used by large trees and the cache misses when
+ * traversing them. Node functions work as usual.
+ *
+ * The length of a str, bin or ext node, and the element count of an array
+ * or map node, is limited to @ref MPACK_NODE_COMPACT_MAX_LEN. Parsing a
+ * message that exceeds it flags @ref mpack_error_too_big.
+ *
+ * This is disabled by default.
+ */
+#ifndef MPACK_NODE_COMPACT
+#define MPACK_NODE_COMPACT 0
+#endif
+
+/**
+ * The maximum total number of steps in the paths of a projection.
+ *
+ * @see mpack_projection_add()
+ */
+#ifndef MPACK_PROJECTION_MAX_STEPS
+#define MPACK_PROJECTION_MAX_STEPS 64
+#endif
+
+/**
+ * The maximum number of steps in a compiled path.
+ *
+ * @see mpack_path_compile()
+ */
+#ifndef MPACK_PATH_MAX_STEPS
+#define MPACK_PATH_MAX_STEPS 16
+#endif
+
+/**
+ * The maximum depth of nested objects and arrays when parsing JSON, and of
+ * nested maps and arrays when writing MessagePack as JSON.
+ *
+ * @see mpack_write_json()
+ * @see mpack_json_write_reader()
+ * @see mpack_json_write_node()
+ */
+#ifndef MPACK_JSON_MAX_DEPTH
+#define MPACK_JSON_MAX_DEPTH 64
+#endif
+
+/**
+ * The maximum depth of nested maps and arrays within a map written in
+ * canonical mode.
+ *
+ * @see mpack_writer_set_canonical()
+ */
+#ifndef MPACK_CANONICAL_MAX_DEPTH
+#define MPACK_CANONICAL_MAX_DEPTH 64
+#endif
+
+/**
+ * The maximum depth of nested maps and arrays when computing a structural
+ * hash.
+ *
+ * @see mpack_node_hash()
+ * @see mpack_read_hash()
+ */
+#ifndef MPACK_HASH_MAX_DEPTH
+#define MPACK_HASH_MAX_DEPTH 256
+#endif
+
 /**
  * @def MPACK_NO_BUILTINS
  *
@@ -1784,6 +1899,15 @@ MPACK_EXTERN_C_BEGIN
 
 
 
+/* Performance counters */
+#if MPACK_STATS
+    #define mpack_stats_add(stats, field, amount) ((void)((stats).field += (amount)))
+#else
+    #define mpack_stats_add(stats, field, amount) ((void)0)
+#endif
+
+
+
 /* Debug logging */
 #if 0
     #include <stdio.h>
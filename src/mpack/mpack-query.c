@@ -0,0 +1,330 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define MPACK_INTERNAL 1
+
+#include "mpack-query.h"
+
+MPACK_SILENCE_WARNINGS_BEGIN
+
+#if MPACK_READER
+
+/*
+ * The paths of a query that match an element are tracked as a bitmask. Only
+ * the maps and arrays that lead to deeper steps of some path are entered;
+ * these are tracked in a stack of frames that is at most as deep as the
+ * longest path.
+ */
+typedef struct mpack_query_frame_t {
+    uint32_t left;  // elements (or key/value pairs) left
+    uint32_t index; // index of the next element of an array
+    uint32_t paths; // paths matching the map or array
+    bool map;
+} mpack_query_frame_t;
+
+#define MPACK_QUERY_BIT(i) ((uint32_t)1 << (i))
+
+void mpack_query_init(mpack_query_t* query) {
+    query->count = 0;
+}
+
+mpack_error_t mpack_query_add(mpack_query_t* query, const mpack_path_t* path,
+        mpack_query_fn_t fn, mpack_query_aggregate_t* aggregate)
+{
+    mpack_assert(path != NULL, "path is NULL");
+    if (query->count == MPACK_QUERY_MAX_PATHS)
+        return mpack_error_too_big;
+
+    if (aggregate)
+        mpack_memset(aggregate, 0, sizeof(*aggregate));
+
+    mpack_query_path_t* entry = &query->paths[query->count++];
+    entry->path = path;
+    entry->fn = fn;
+    entry->aggregate = aggregate;
+    return mpack_ok;
+}
+
+// Skips the given number of elements. Each element is walked tag by tag
+// since MessagePack does not record the size of maps and arrays, but the
+// contents of strings, binary blobs and extensions are skipped in bulk.
+static void mpack_query_skip(mpack_reader_t* reader, uint64_t count) {
+    #if MPACK_READ_TRACKING
+    // Tracking needs every map and array to be finished individually.
+    for (; count > 0 && mpack_reader_error(reader) == mpack_ok; --count)
+        mpack_discard(reader);
+    #else
+    while (count > 0 && mpack_reader_error(reader) == mpack_ok) {
+        --count;
+        mpack_tag_t tag = mpack_read_tag(reader);
+        switch (tag.type) {
+            case mpack_type_str:
+            case mpack_type_bin:
+            #if MPACK_EXTENSIONS
+            case mpack_type_ext:
+            #endif
+                mpack_skip_bytes(reader, tag.v.l);
+                break;
+            case mpack_type_array:
+                count += tag.v.n;
+                break;
+            case mpack_type_map:
+                count += (uint64_t)tag.v.n * 2;
+                break;
+            default:
+                break;
+        }
+    }
+    #endif
+}
+
+// Skips the contents of the element whose tag has just been read.
+static void mpack_query_skip_contents(mpack_reader_t* reader, mpack_tag_t tag) {
+    switch (tag.type) {
+        case mpack_type_str:
+        case mpack_type_bin:
+        #if MPACK_EXTENSIONS
+        case mpack_type_ext:
+        #endif
+            mpack_skip_bytes(reader, tag.v.l);
+            break;
+        case mpack_type_array:
+            mpack_query_skip(reader, tag.v.n);
+            break;
+        case mpack_type_map:
+            mpack_query_skip(reader, (uint64_t)tag.v.n * 2);
+            break;
+        default:
+            return;
+    }
+    mpack_done_type(reader, tag.type);
+}
+
+static void mpack_query_aggregate(mpack_query_aggregate_t* aggregate, mpack_tag_t tag) {
+    ++aggregate->count;
+
+    #if MPACK_DOUBLE
+    double value;
+    switch (tag.type) {
+        case mpack_type_int:    value = (double)tag.v.i; break;
+        case mpack_type_uint:   value = (double)tag.v.u; break;
+        #if MPACK_FLOAT
+        case mpack_type_float:  value = (double)tag.v.f; break;
+        #endif
+        case mpack_type_double: value = tag.v.d;         break;
+        default:
+            return;
+    }
+
+    if (aggregate->numbers == 0) {
+        aggregate->min = value;
+        aggregate->max = value;
+    } else {
+        if (value < aggregate->min)
+            aggregate->min = value;
+        if (value > aggregate->max)
+            aggregate->max = value;
+    }
+    aggregate->sum += value;
+    ++aggregate->numbers;
+
+    #else
+    if (tag.type == mpack_type_int || tag.type == mpack_type_uint ||
+            tag.type == mpack_type_float || tag.type == mpack_type_double)
+        ++aggregate->numbers;
+    #endif
+}
+
+static void mpack_query_report(mpack_query_t* query, void* context,
+        uint32_t matched, mpack_tag_t tag, const char* data)
+{
+    mpack_query_match_t match;
+    match.tag = tag;
+    match.data = data;
+
+    size_t i;
+    for (i = 0; i < query->count; ++i) {
+        if (!(matched & MPACK_QUERY_BIT(i)))
+            continue;
+        mpack_query_path_t* entry = &query->paths[i];
+        if (entry->aggregate)
+            mpack_query_aggregate(entry->aggregate, tag);
+        if (entry->fn) {
+            match.path = i;
+            entry->fn(context, &match);
+        }
+    }
+}
+
+// Reads an element matched by the given paths after the given number of
+// steps. Matches are reported, and a frame is pushed if some path continues
+// into the element.
+static void mpack_query_element(mpack_query_t* query, mpack_reader_t* reader, void* context,
+        mpack_query_frame_t* frames, size_t* depth, uint32_t paths)
+{
+    mpack_tag_t tag = mpack_read_tag(reader);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return;
+
+    uint32_t matched = 0;
+    uint32_t deeper = 0;
+    bool wants_data = false;
+    size_t i;
+    for (i = 0; i < query->count; ++i) {
+        if (!(paths & MPACK_QUERY_BIT(i)))
+            continue;
+        if (query->paths[i].path->count == *depth) {
+            matched |= MPACK_QUERY_BIT(i);
+            if (query->paths[i].fn)
+                wants_data = true;
+        } else {
+            deeper |= MPACK_QUERY_BIT(i);
+        }
+    }
+
+    switch (tag.type) {
+        case mpack_type_str:
+        case mpack_type_bin:
+        #if MPACK_EXTENSIONS
+        case mpack_type_ext:
+        #endif
+            if (wants_data) {
+                const char* data = mpack_read_bytes_inplace(reader, tag.v.l);
+                if (mpack_reader_error(reader) != mpack_ok)
+                    return;
+                mpack_done_type(reader, tag.type);
+                mpack_query_report(query, context, matched, tag, data);
+            } else {
+                mpack_query_skip_contents(reader, tag);
+                mpack_query_report(query, context, matched, tag, NULL);
+            }
+            return;
+
+        case mpack_type_array:
+        case mpack_type_map:
+            mpack_query_report(query, context, matched, tag, NULL);
+            if (deeper == 0 || mpack_reader_error(reader) != mpack_ok) {
+                mpack_query_skip_contents(reader, tag);
+                return;
+            }
+            mpack_assert(*depth < MPACK_PATH_MAX_STEPS, "paths cannot be this deep");
+            frames[*depth].left = tag.v.n;
+            frames[*depth].index = 0;
+            frames[*depth].paths = deeper;
+            frames[*depth].map = tag.type == mpack_type_map;
+            ++*depth;
+            return;
+
+        default:
+            mpack_query_report(query, context, matched, tag, NULL);
+            return;
+    }
+}
+
+// Returns the paths that match the next element of an array.
+static uint32_t mpack_query_match_index(mpack_query_t* query, uint32_t paths, size_t step, uint32_t index) {
+    uint32_t result = 0;
+    size_t i;
+    for (i = 0; i < query->count; ++i) {
+        if (!(paths & MPACK_QUERY_BIT(i)))
+            continue;
+        const mpack_path_step_t* s = &query->paths[i].path->steps[step];
+        if (s->type == mpack_path_step_any || (s->type == mpack_path_step_index && s->index == index))
+            result |= MPACK_QUERY_BIT(i);
+    }
+    return result;
+}
+
+// Reads the next key of a map, returning the paths that match its value.
+static uint32_t mpack_query_match_key(mpack_query_t* query, mpack_reader_t* reader, uint32_t paths, size_t step) {
+    mpack_tag_t tag = mpack_read_tag(reader);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return 0;
+
+    // The key is only read if some path has a key of the same length.
+    uint32_t result = 0;
+    bool compare = false;
+    size_t i;
+    for (i = 0; i < query->count; ++i) {
+        if (!(paths & MPACK_QUERY_BIT(i)))
+            continue;
+        const mpack_path_step_t* s = &query->paths[i].path->steps[step];
+        if (s->type == mpack_path_step_any)
+            result |= MPACK_QUERY_BIT(i);
+        else if (s->type == mpack_path_step_key && tag.type == mpack_type_str && s->length == tag.v.l)
+            compare = true;
+    }
+
+    if (!compare) {
+        mpack_query_skip_contents(reader, tag);
+        return result;
+    }
+
+    const char* key = mpack_read_bytes_inplace(reader, tag.v.l);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return 0;
+    for (i = 0; i < query->count; ++i) {
+        if (!(paths & MPACK_QUERY_BIT(i)))
+            continue;
+        const mpack_path_step_t* s = &query->paths[i].path->steps[step];
+        if (s->type == mpack_path_step_key && s->length == tag.v.l &&
+                mpack_memcmp(key, s->key, s->length) == 0)
+            result |= MPACK_QUERY_BIT(i);
+    }
+    mpack_done_str(reader);
+    return result;
+}
+
+mpack_error_t mpack_query_run(mpack_query_t* query, mpack_reader_t* reader, void* context) {
+    mpack_query_frame_t frames[MPACK_PATH_MAX_STEPS];
+    size_t depth = 0;
+    uint32_t paths = (query->count == 32) ? ~(uint32_t)0 : MPACK_QUERY_BIT(query->count) - 1;
+
+    while (mpack_reader_error(reader) == mpack_ok) {
+        if (paths == 0)
+            mpack_query_skip(reader, 1);
+        else
+            mpack_query_element(query, reader, context, frames, &depth, paths);
+
+        // close finished maps and arrays
+        while (depth > 0 && frames[depth - 1].left == 0) {
+            --depth;
+            mpack_done_type(reader, frames[depth].map ? mpack_type_map : mpack_type_array);
+        }
+        if (depth == 0)
+            break;
+
+        // the children of the innermost frame match the step after the ones
+        // that led to it
+        mpack_query_frame_t* frame = &frames[depth - 1];
+        --frame->left;
+        if (frame->map)
+            paths = mpack_query_match_key(query, reader, frame->paths, depth - 1);
+        else
+            paths = mpack_query_match_index(query, frame->paths, depth - 1, frame->index++);
+    }
+
+    return mpack_reader_error(reader);
+}
+
+#endif
+
+MPACK_SILENCE_WARNINGS_END
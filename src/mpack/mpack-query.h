@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file
+ *
+ * Declares the MPack streaming query engine.
+ */
+
+#ifndef MPACK_QUERY_H
+#define MPACK_QUERY_H 1
+
+#include "mpack-reader.h"
+#include "mpack-path.h"
+
+MPACK_SILENCE_WARNINGS_BEGIN
+MPACK_EXTERN_C_BEGIN
+
+#if MPACK_READER
+
+/**
+ * @defgroup query Query API
+ *
+ * The MPack Query API evaluates a set of compiled paths (see @ref path)
+ * against messages from a @ref mpack_reader_t without building a tree.
+ *
+ * Each path in a query can have a callback, which is called with every
+ * element the path matches, and an aggregate, which accumulates statistics
+ * over the numbers the path matches. Elements that cannot match any path are
+ * skipped without being reported, and the contents of strings and binary
+ * blobs that are not reported are skipped without being read.
+ *
+ * The query engine does not allocate and does not recurse. It only tracks
+ * the maps and arrays along the paths of the query, so messages can be
+ * nested arbitrarily deep.
+ *
+ * @{
+ */
+
+/**
+ * The maximum number of paths in a query.
+ */
+#define MPACK_QUERY_MAX_PATHS 32
+
+/**
+ * An element matched by a path of a query.
+ */
+typedef struct mpack_query_match_t {
+
+    /** The index of the matched path, in the order it was added to the query. */
+    size_t path;
+
+    /**
+     * The tag of the element.
+     *
+     * For a map or array this contains its element count. Its contents are
+     * not reported, although they may be matched by other paths.
+     */
+    mpack_tag_t tag;
+
+    /**
+     * The contents of a str, bin or ext, or NULL for any other type.
+     *
+     * This points directly into the reader's buffer. It is only valid during
+     * the callback. Its length is contained in the tag.
+     */
+    const char* data;
+
+} mpack_query_match_t;
+
+/**
+ * A callback for elements matched by a path of a query.
+ *
+ * A callback can stop the query by flagging an error on the reader.
+ */
+typedef void (*mpack_query_fn_t)(void* context, const mpack_query_match_t* match);
+
+/**
+ * Statistics over the elements matched by a path of a query.
+ *
+ * An aggregate accumulates over all messages the query is run on. It is
+ * cleared when it is added to a query.
+ */
+typedef struct mpack_query_aggregate_t {
+
+    /** The number of elements matched. */
+    uint64_t count;
+
+    /** The number of matched elements that are numbers. */
+    uint64_t numbers;
+
+    #if MPACK_DOUBLE
+    /**
+     * The sum of the matched numbers.
+     *
+     * Integers are converted to double, so sums with a magnitude beyond
+     * 2^53 are not exact.
+     */
+    double sum;
+
+    /** The smallest matched number, or 0 if no numbers were matched. */
+    double min;
+
+    /** The largest matched number, or 0 if no numbers were matched. */
+    double max;
+    #endif
+
+} mpack_query_aggregate_t;
+
+/**
+ * A set of paths to evaluate against messages from a reader.
+ *
+ * This structure is opaque; its fields should not be accessed outside
+ * of MPack.
+ */
+typedef struct mpack_query_t mpack_query_t;
+
+/* Hide internals from documentation */
+/** @cond */
+
+typedef struct mpack_query_path_t {
+    const mpack_path_t* path;
+    mpack_query_fn_t fn;
+    mpack_query_aggregate_t* aggregate;
+} mpack_query_path_t;
+
+struct mpack_query_t {
+    size_t count;
+    mpack_query_path_t paths[MPACK_QUERY_MAX_PATHS];
+};
+
+/** @endcond */
+
+/**
+ * @name Query Functions
+ * @{
+ */
+
+/**
+ * Initializes an empty query.
+ */
+void mpack_query_init(mpack_query_t* query);
+
+/**
+ * Adds a path to a query.
+ *
+ * The path is not copied. It must remain valid and unchanged while the query
+ * is in use.
+ *
+ * @param query The query.
+ * @param path The compiled path to match.
+ * @param fn The callback to call for each match, or NULL.
+ * @param aggregate An aggregate to accumulate matched numbers into, or NULL.
+ *        It is cleared by this call.
+ * @return @ref mpack_ok, or @ref mpack_error_too_big if the query already
+ *         has @ref MPACK_QUERY_MAX_PATHS paths.
+ */
+mpack_error_t mpack_query_add(mpack_query_t* query, const mpack_path_t* path,
+        mpack_query_fn_t fn, mpack_query_aggregate_t* aggregate);
+
+/**
+ * Runs a query on one message from the given reader.
+ *
+ * The reader is not destroyed. If the query succeeds, the reader is
+ * positioned after the message, so this can be called in a loop to run a
+ * query over a stream of messages.
+ *
+ * The contents of matched strings, binary blobs and extensions are read
+ * in-place, so they must fit in the reader's buffer when reading from a
+ * stream. Otherwise @ref mpack_error_too_big is flagged.
+ *
+ * @param query The query.
+ * @param reader The reader from which to read a message.
+ * @param context A context pointer passed to the callbacks.
+ * @return The error state of the reader.
+ */
+mpack_error_t mpack_query_run(mpack_query_t* query, mpack_reader_t* reader, void* context);
+
+/**
+ * @}
+ */
+
+/**
+ * @}
+ */
+
+#endif
+
+MPACK_EXTERN_C_END
+MPACK_SILENCE_WARNINGS_END
+
+#endif
@@ -37,6 +37,7 @@ void mpack_reader_init(mpack_reader_t* reader, char* buffer, size_t size, size_t
     reader->size = size;
     reader->data = buffer;
     reader->end = buffer + count;
+    reader->received = count;
 
     #if MPACK_READ_TRACKING
     mpack_reader_flag_if_error(reader, mpack_track_init(&reader->track));
@@ -60,6 +61,7 @@ void mpack_reader_init_data(mpack_reader_t* reader, const char* data, size_t cou
     mpack_memset(reader, 0, sizeof(*reader));
     reader->data = data;
     reader->end = data + count;
+    reader->received = count;
 
     #if MPACK_READ_TRACKING
     mpack_reader_flag_if_error(reader, mpack_track_init(&reader->track));
@@ -94,6 +96,11 @@ void mpack_reader_set_skip(mpack_reader_t* reader, mpack_reader_skip_t skip) {
     reader->skip = skip;
 }
 
+void mpack_reader_set_seek(mpack_reader_t* reader, mpack_reader_seek_t seek) {
+    mpack_assert(reader->size != 0, "cannot use seek function without a writeable buffer!");
+    reader->seek = seek;
+}
+
 #if MPACK_STDIO
 static size_t mpack_file_reader_fill(mpack_reader_t* reader, char* buffer, size_t count) {
     if (feof((FILE *)reader->context)) {
@@ -125,6 +132,25 @@ static void mpack_file_reader_skip(mpack_reader_t* reader, size_t count) {
     mpack_reader_skip_using_fill(reader, count);
 }
 
+static void mpack_file_reader_seek(mpack_reader_t* reader, size_t offset) {
+    if (mpack_reader_error(reader) != mpack_ok)
+        return;
+    FILE* file = (FILE*)reader->context;
+
+    // The file may not have started at its beginning, so we seek relative
+    // to the current position of the source.
+    size_t position = reader->received;
+    size_t distance = (offset > position) ? offset - position : position - offset;
+    if (distance > (size_t)LONG_MAX) {
+        mpack_reader_flag_error(reader, mpack_error_io);
+        return;
+    }
+    long delta = (offset > position) ? (long)distance : -(long)distance;
+    mpack_log("seeking %li bytes\n", delta);
+    if (fseek(file, delta, SEEK_CUR) != 0)
+        mpack_reader_flag_error(reader, mpack_error_io);
+}
+
 static void mpack_file_reader_teardown(mpack_reader_t* reader) {
     MPACK_FREE(reader->buffer);
     reader->buffer = NULL;
@@ -132,6 +158,7 @@ static void mpack_file_reader_teardown(mpack_reader_t* reader) {
     reader->size = 0;
     reader->fill = NULL;
     reader->skip = NULL;
+    reader->seek = NULL;
     reader->teardown = NULL;
 }
 
@@ -164,6 +191,7 @@ void mpack_reader_init_stdfile(mpack_reader_t* reader, FILE* file, bool close_wh
     mpack_reader_set_context(reader, file);
     mpack_reader_set_fill(reader, mpack_file_reader_fill);
     mpack_reader_set_skip(reader, mpack_file_reader_skip);
+    mpack_reader_set_seek(reader, mpack_file_reader_seek);
     mpack_reader_set_teardown(reader, close_when_done ?
             mpack_file_reader_teardown_close :
             mpack_file_reader_teardown);
@@ -210,6 +238,61 @@ size_t mpack_reader_remaining(mpack_reader_t* reader, const char** data) {
     return (size_t)(reader->end - reader->data);
 }
 
+size_t mpack_reader_position(mpack_reader_t* reader) {
+    if (mpack_reader_error(reader) != mpack_ok)
+        return 0;
+    return reader->received - (size_t)(reader->end - reader->data);
+}
+
+static void mpack_skip_bytes_straddle(mpack_reader_t* reader, size_t count);
+
+void mpack_reader_seek(mpack_reader_t* reader, size_t offset) {
+    if (mpack_reader_error(reader) != mpack_ok)
+        return;
+
+    #if MPACK_READ_TRACKING
+    if (mpack_reader_flag_if_error(reader, mpack_track_check_empty(&reader->track)) != mpack_ok)
+        return;
+    #endif
+
+    mpack_log("seeking to offset %i\n", (int)offset);
+    size_t position = mpack_reader_position(reader);
+
+    // Without a fill function, all of the data is in memory.
+    if (reader->fill == NULL) {
+        if (offset > reader->received) {
+            mpack_reader_flag_error(reader, mpack_error_invalid);
+            return;
+        }
+        reader->data = reader->end - (reader->received - offset);
+        return;
+    }
+
+    // Check if the offset is still in the buffer
+    if (offset >= position && offset <= reader->received) {
+        reader->data += offset - position;
+        return;
+    }
+
+    if (reader->seek != NULL) {
+        reader->seek(reader, offset);
+        if (mpack_reader_error(reader) != mpack_ok)
+            return;
+        reader->data = reader->buffer;
+        reader->end = reader->buffer;
+        reader->received = offset;
+        return;
+    }
+
+    // Without a seek function we can only go forward.
+    if (offset < position) {
+        mpack_log("cannot seek backwards without a seek function\n");
+        mpack_reader_flag_error(reader, mpack_error_io);
+        return;
+    }
+    mpack_skip_bytes_straddle(reader, offset - position);
+}
+
 void mpack_reader_flag_error(mpack_reader_t* reader, mpack_error_t error) {
     mpack_log("reader %p setting error %i: %s\n", (void*)reader, (int)error, mpack_error_to_string(error));
 
@@ -231,7 +314,10 @@ MPACK_NOINLINE static size_t mpack_fill_range(mpack_reader_t* reader, char* p, s
 
     size_t count = 0;
     while (count < min_bytes) {
+        mpack_trace_begin(reader, mpack_trace_reader_fill, max_bytes - count);
         size_t read = reader->fill(reader, p + count, max_bytes - count);
+        mpack_trace_end(reader, mpack_trace_reader_fill, read);
+        mpack_stats_add(reader->stats, fill_calls, 1);
 
         // Reader fill functions can flag an error or return 0 on failure. We
         // also guard against functions that return -1 just in case.
@@ -243,6 +329,8 @@ MPACK_NOINLINE static size_t mpack_fill_range(mpack_reader_t* reader, char* p, s
         }
 
         count += read;
+        reader->received += read;
+        mpack_stats_add(reader->stats, fill_bytes, read);
     }
     return count;
 }
@@ -276,6 +364,8 @@ MPACK_NOINLINE bool mpack_reader_ensure_straddle(mpack_reader_t* reader, size_t
     // move the existing data to the start of the buffer
     size_t left = (size_t)(reader->end - reader->data);
     mpack_memmove(reader->buffer, reader->data, left);
+    mpack_stats_add(reader->stats, straddles, 1);
+    mpack_stats_add(reader->stats, moved_bytes, left);
     reader->end -= reader->data - reader->buffer;
     reader->data = reader->buffer;
 
@@ -334,6 +424,8 @@ MPACK_NOINLINE void mpack_read_native_straddle(mpack_reader_t* reader, char* p,
         return;
     }
 
+    mpack_stats_add(reader->stats, straddles, 1);
+
     // flush what's left of the buffer
     if (left > 0) {
         mpack_log("flushing %i bytes remaining in buffer\n", (int)left);
@@ -385,7 +477,14 @@ MPACK_NOINLINE static void mpack_skip_bytes_straddle(mpack_reader_t* reader, siz
     // fill the buffer and skip from it instead of trying to seek.
     if (reader->skip && count > reader->size / 16) {
         mpack_log("calling skip function for %i bytes\n", (int)count);
+
+        // The skip function may fall back to filling the buffer, in which
+        // case the bytes left in the buffer have also been received.
+        size_t received = reader->received;
         reader->skip(reader, count);
+        mpack_stats_add(reader->stats, skip_calls, 1);
+        mpack_stats_add(reader->stats, skip_bytes, count);
+        reader->received = received + count + (size_t)(reader->end - reader->data);
         return;
     }
 
@@ -517,7 +616,7 @@ char* mpack_read_bytes_alloc_impl(mpack_reader_t* reader, size_t count, bool nul
         return NULL;
 
     // allocate data
-    char* data = (char*)MPACK_MALLOC(count + (null_terminated ? 1 : 0)); // TODO: can this overflow?
+    char* data = (char*)mpack_allocator_alloc(reader->allocator, count + (null_terminated ? 1 : 0)); // TODO: can this overflow?
     if (data == NULL) {
         mpack_reader_flag_error(reader, mpack_error_memory);
         return NULL;
@@ -528,7 +627,7 @@ char* mpack_read_bytes_alloc_impl(mpack_reader_t* reader, size_t count, bool nul
 
     // report flagged errors
     if (mpack_reader_error(reader) != mpack_ok) {
-        MPACK_FREE(data);
+        mpack_allocator_free(reader->allocator, data);
         if (reader->error_fn)
             reader->error_fn(reader, mpack_reader_error(reader));
         return NULL;
@@ -1031,6 +1130,89 @@ void mpack_discard(mpack_reader_t* reader) {
     }
 }
 
+// Hashes the next count bytes of the reader. Bytes already in the buffer are
+// hashed in place; otherwise a small chunk is read to refill the buffer.
+static void mpack_read_hash_bytes(mpack_reader_t* reader, mpack_hasher_t* hasher, size_t count) {
+    while (count > 0 && mpack_reader_error(reader) == mpack_ok) {
+        size_t left = (size_t)(reader->end - reader->data);
+        if (left > 0) {
+            if (left > count)
+                left = count;
+            mpack_hasher_update(hasher, reader->data, left);
+            mpack_skip_bytes(reader, left);
+            count -= left;
+            continue;
+        }
+
+        char chunk[32];
+        size_t step = count < sizeof(chunk) ? count : sizeof(chunk);
+        mpack_read_bytes(reader, chunk, step);
+        if (mpack_reader_error(reader) != mpack_ok)
+            return;
+        mpack_hasher_update(hasher, chunk, step);
+        count -= step;
+    }
+}
+
+// The depth is the number of maps and arrays that contain the element. It
+// is limited because each level of nesting takes a call frame.
+static uint64_t mpack_read_hash_element(mpack_reader_t* reader, uint64_t seed, size_t depth) {
+    mpack_tag_t tag = mpack_read_tag(reader);
+    if (mpack_reader_error(reader))
+        return 0;
+
+    if ((tag.type == mpack_type_array || tag.type == mpack_type_map) && depth == MPACK_HASH_MAX_DEPTH) {
+        mpack_reader_flag_error(reader, mpack_error_too_big);
+        return 0;
+    }
+
+    mpack_hasher_t hasher;
+    mpack_hasher_init(&hasher, seed);
+    mpack_hasher_tag(&hasher, tag);
+
+    switch (tag.type) {
+        case mpack_type_str:
+        case mpack_type_bin:
+        #if MPACK_EXTENSIONS
+        case mpack_type_ext:
+        #endif
+            mpack_read_hash_bytes(reader, &hasher, tag.v.l);
+            mpack_done_type(reader, tag.type);
+            break;
+
+        case mpack_type_array: {
+            uint32_t i;
+            for (i = 0; i < tag.v.n && mpack_reader_error(reader) == mpack_ok; ++i)
+                mpack_hasher_update_u64(&hasher, mpack_read_hash_element(reader, seed, depth + 1));
+            mpack_done_array(reader);
+            break;
+        }
+
+        case mpack_type_map: {
+            // pairs are summed so that their order doesn't matter
+            uint64_t sum = 0;
+            uint32_t i;
+            for (i = 0; i < tag.v.n && mpack_reader_error(reader) == mpack_ok; ++i) {
+                uint64_t key = mpack_read_hash_element(reader, seed, depth + 1);
+                sum += mpack_hash_pair(key, mpack_read_hash_element(reader, seed, depth + 1));
+            }
+            mpack_hasher_update_u64(&hasher, sum);
+            mpack_done_map(reader);
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    return mpack_hasher_finish(&hasher);
+}
+
+uint64_t mpack_read_hash(mpack_reader_t* reader, uint64_t seed) {
+    uint64_t hash = mpack_read_hash_element(reader, seed, 0);
+    return mpack_reader_error(reader) == mpack_ok ? hash : 0;
+}
+
 #if MPACK_EXTENSIONS
 mpack_timestamp_t mpack_read_timestamp(mpack_reader_t* reader, size_t size) {
     mpack_timestamp_t timestamp = {0, 0};
@@ -29,6 +29,7 @@
 #define MPACK_READER_H 1
 
 #include "mpack-common.h"
+#include "mpack-trace.h"
 
 MPACK_SILENCE_WARNINGS_BEGIN
 MPACK_EXTERN_C_BEGIN
@@ -112,6 +113,19 @@ typedef size_t (*mpack_reader_fill_t)(mpack_reader_t* reader, char* buffer, size
  */
 typedef void (*mpack_reader_skip_t)(mpack_reader_t* reader, size_t count);
 
+/**
+ * The MPack reader's seek function. It should move the source so that the
+ * next byte filled is the byte at the given offset, where offset zero is
+ * the first byte the reader received from the source. mpack_reader_position()
+ * still returns the current position of the source when this is called.
+ *
+ * In case of error, it should flag an appropriate error on the reader.
+ *
+ * @see mpack_reader_seek()
+ * @see mpack_reader_context()
+ */
+typedef void (*mpack_reader_seek_t)(mpack_reader_t* reader, size_t offset);
+
 /**
  * An error handler function to be called when an error is flagged on
  * the reader.
@@ -143,6 +157,24 @@ typedef void (*mpack_reader_error_t)(mpack_reader_t* reader, mpack_error_t error
  */
 typedef void (*mpack_reader_teardown_t)(mpack_reader_t* reader);
 
+#if MPACK_STATS
+/**
+ * Performance counters of a reader.
+ *
+ * These are only available if @ref MPACK_STATS is enabled.
+ *
+ * @see mpack_reader_stats()
+ */
+typedef struct mpack_reader_stats_t {
+    size_t fill_calls;  /**< The number of calls to the fill function. */
+    size_t fill_bytes;  /**< The number of bytes returned by the fill function. */
+    size_t skip_calls;  /**< The number of calls to the skip function. */
+    size_t skip_bytes;  /**< The number of bytes skipped by the skip function. */
+    size_t straddles;   /**< The number of reads that straddled the end of the buffer. */
+    size_t moved_bytes; /**< The number of bytes moved to the start of the buffer. */
+} mpack_reader_stats_t;
+#endif
+
 /* Hide internals from documentation */
 /** @cond */
 
@@ -152,18 +184,32 @@ struct mpack_reader_t {
     mpack_reader_error_t error_fn;    /* Function to call on error */
     mpack_reader_teardown_t teardown; /* Function to teardown the context on destroy */
     mpack_reader_skip_t skip;         /* Function to skip bytes from the source */
+    mpack_reader_seek_t seek;         /* Function to seek within the source */
 
     char* buffer;       /* Writeable byte buffer */
     size_t size;        /* Size of the buffer */
 
     const char* data;   /* Current data pointer (in the buffer, if it is used) */
     const char* end;    /* The end of available data (in the buffer, if it is used) */
+    size_t received;    /* Total bytes received from the source, including those in the buffer */
 
     mpack_error_t error;  /* Error state */
 
     #if MPACK_READ_TRACKING
     mpack_track_t track; /* Stack of map/array/str/bin/ext reads */
     #endif
+
+    #ifdef MPACK_MALLOC
+    const mpack_allocator_t* allocator; /* Allocator for *_alloc() functions, or NULL */
+    #endif
+
+    #if MPACK_STATS
+    mpack_reader_stats_t stats; /* Performance counters */
+    #endif
+
+    #if MPACK_TRACING
+    const mpack_trace_t* trace; /* Tracing hooks */
+    #endif
 };
 
 /** @endcond */
@@ -343,6 +389,18 @@ void mpack_reader_set_fill(mpack_reader_t* reader, mpack_reader_fill_t fill);
  */
 void mpack_reader_set_skip(mpack_reader_t* reader, mpack_reader_skip_t skip);
 
+/**
+ * Sets the seek function to move to an arbitrary offset in the source stream.
+ *
+ * This is only needed for mpack_reader_seek() to move backwards or beyond the
+ * buffered data in a stream. A file reader (see mpack_reader_init_stdfile())
+ * uses a seek function automatically.
+ *
+ * @param reader The MPack reader.
+ * @param seek The function to seek within the source stream.
+ */
+void mpack_reader_set_seek(mpack_reader_t* reader, mpack_reader_seek_t seek);
+
 /**
  * Sets the error function to call when an error is flagged on the reader.
  *
@@ -373,6 +431,25 @@ MPACK_INLINE void mpack_reader_set_teardown(mpack_reader_t* reader, mpack_reader
     reader->teardown = teardown;
 }
 
+#ifdef MPACK_MALLOC
+/**
+ * Sets the allocator with which the reader allocates the data returned by
+ * mpack_read_bytes_alloc() and the Expect API's allocating functions, or
+ * NULL to use @ref MPACK_MALLOC.
+ *
+ * Data allocated by the reader must be freed with the allocator that was set
+ * when it was allocated.
+ *
+ * The buffer of a reader initialized with mpack_reader_init_filename() or
+ * mpack_reader_init_stdfile() is always allocated with @ref MPACK_MALLOC.
+ *
+ * @see mpack_allocator_t
+ */
+MPACK_INLINE void mpack_reader_set_allocator(mpack_reader_t* reader, const mpack_allocator_t* allocator) {
+    reader->allocator = allocator;
+}
+#endif
+
 /**
  * @}
  */
@@ -440,6 +517,58 @@ MPACK_INLINE mpack_error_t mpack_reader_flag_if_error(mpack_reader_t* reader, mp
  */
 size_t mpack_reader_remaining(mpack_reader_t* reader, const char** data);
 
+/**
+ * Returns the offset of the next byte to be read, where offset zero is the
+ * first byte the reader received from its data or source stream.
+ *
+ * Returns 0 if the reader is in an error state.
+ */
+size_t mpack_reader_position(mpack_reader_t* reader);
+
+/**
+ * Moves the reader to the given offset, as returned by mpack_reader_position().
+ *
+ * The offset must be at the start of an element. No map, array, string,
+ * binary or extension can be open in the reader.
+ *
+ * A reader of data in memory can seek anywhere in its data. A reader of a
+ * stream can seek within its buffered data or forward by skipping bytes;
+ * otherwise the stream needs a seek function (see mpack_reader_set_seek()),
+ * or @ref mpack_error_io is flagged.
+ *
+ * @param reader The MPack reader.
+ * @param offset The offset of the next byte to read.
+ */
+void mpack_reader_seek(mpack_reader_t* reader, size_t offset);
+
+#if MPACK_STATS
+/**
+ * Returns the performance counters of the reader.
+ *
+ * This is only available if @ref MPACK_STATS is enabled.
+ */
+MPACK_INLINE const mpack_reader_stats_t* mpack_reader_stats(mpack_reader_t* reader) {
+    return &reader->stats;
+}
+#endif
+
+#if MPACK_TRACING
+/**
+ * Sets the tracing hooks of the reader, or NULL to disable tracing.
+ *
+ * The hooks are called around each call to the fill function. They are not
+ * copied; they must remain valid until the reader is destroyed or the hooks
+ * are replaced.
+ *
+ * This is only available if @ref MPACK_TRACING is enabled.
+ *
+ * @see trace
+ */
+MPACK_INLINE void mpack_reader_set_trace(mpack_reader_t* reader, const mpack_trace_t* trace) {
+    reader->trace = trace;
+}
+#endif
+
 /**
  * Reads a MessagePack object header (an MPack tag.)
  *
@@ -614,7 +743,8 @@ char* mpack_read_bytes_alloc_impl(mpack_reader_t* reader, size_t count, bool nul
  * storage for them and returning the allocated pointer.
  *
  * The allocated string must be freed with MPACK_FREE() (or simply free()
- * if MPack's allocator hasn't been customized.)
+ * if MPack's allocator hasn't been customized), or with the reader's
+ * allocator if one was set with mpack_reader_set_allocator().
  *
  * Returns NULL if any error occurs, or if count is zero.
  */
@@ -816,6 +946,24 @@ MPACK_INLINE void mpack_done_ext(mpack_reader_t* reader) {
  */
 void mpack_discard(mpack_reader_t* reader);
 
+/**
+ * Reads the next object and returns a 64-bit structural hash of it and
+ * everything it contains.
+ *
+ * The hash is the same as mpack_node_hash() would return for the same data
+ * and seed. It does not depend on how values are encoded or on the order of
+ * keys in maps. Strings and blobs are hashed in chunks, so they do not need
+ * to fit in the reader's buffer.
+ *
+ * Maps and arrays nested more than @ref MPACK_HASH_MAX_DEPTH deep flag
+ * @ref mpack_error_too_big.
+ *
+ * @param reader The reader.
+ * @param seed A seed for the hash.
+ * @return The hash, or 0 if an error occurs.
+ */
+uint64_t mpack_read_hash(mpack_reader_t* reader, uint64_t seed);
+
 /**
  * @}
  */
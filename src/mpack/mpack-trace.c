@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define MPACK_INTERNAL 1
+
+#include "mpack-trace.h"
+
+MPACK_SILENCE_WARNINGS_BEGIN
+
+#if MPACK_TRACING
+
+// Returns the histogram bucket in which the given value is recorded.
+//
+// Values below the sub-bucket count have a bucket each. Above that, each
+// power of two is divided into sub-buckets by the four bits following the
+// leading one bit.
+static size_t mpack_trace_histogram_bucket(uint64_t value) {
+    if (value < MPACK_TRACE_HISTOGRAM_SUB_BUCKETS)
+        return (size_t)value;
+
+    size_t exponent = 4;
+    while ((value >> (exponent - 4)) >= MPACK_TRACE_HISTOGRAM_SUB_BUCKETS * 2)
+        ++exponent;
+    return (exponent - 3) * MPACK_TRACE_HISTOGRAM_SUB_BUCKETS +
+            (size_t)((value >> (exponent - 4)) & (MPACK_TRACE_HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+// Returns the largest value recorded in the given bucket.
+static uint64_t mpack_trace_histogram_bucket_max(size_t bucket) {
+    if (bucket < MPACK_TRACE_HISTOGRAM_SUB_BUCKETS)
+        return (uint64_t)bucket;
+
+    size_t shift = bucket / MPACK_TRACE_HISTOGRAM_SUB_BUCKETS - 1;
+    uint64_t low = (uint64_t)(MPACK_TRACE_HISTOGRAM_SUB_BUCKETS +
+            bucket % MPACK_TRACE_HISTOGRAM_SUB_BUCKETS) << shift;
+    return low + (((uint64_t)1 << shift) - 1);
+}
+
+static void mpack_trace_histogram_begin(void* context, mpack_trace_event_t event, size_t bytes) {
+    MPACK_UNUSED(bytes);
+    mpack_trace_histogram_t* histogram = (mpack_trace_histogram_t*)context;
+    histogram->started[event] = histogram->clock();
+}
+
+static void mpack_trace_histogram_end(void* context, mpack_trace_event_t event, size_t bytes) {
+    mpack_trace_histogram_t* histogram = (mpack_trace_histogram_t*)context;
+    uint64_t now = histogram->clock();
+    uint64_t started = histogram->started[event];
+    mpack_trace_histogram_record(histogram, event, now > started ? now - started : 0);
+    histogram->bytes[event] += bytes;
+}
+
+void mpack_trace_histogram_init(mpack_trace_histogram_t* histogram, mpack_trace_clock_t clock) {
+    mpack_assert(clock != NULL, "clock is NULL");
+    mpack_memset(histogram, 0, sizeof(*histogram));
+    histogram->trace.begin = &mpack_trace_histogram_begin;
+    histogram->trace.end = &mpack_trace_histogram_end;
+    histogram->trace.context = histogram;
+    histogram->clock = clock;
+}
+
+void mpack_trace_histogram_record(mpack_trace_histogram_t* histogram,
+        mpack_trace_event_t event, uint64_t value)
+{
+    ++histogram->buckets[event][mpack_trace_histogram_bucket(value)];
+    ++histogram->count[event];
+    histogram->total[event] += value;
+    if (value > histogram->max[event])
+        histogram->max[event] = value;
+}
+
+void mpack_trace_histogram_merge(mpack_trace_histogram_t* target, const mpack_trace_histogram_t* source) {
+    size_t event, bucket;
+    for (event = 0; event < MPACK_TRACE_EVENT_COUNT; ++event) {
+        target->count[event] += source->count[event];
+        target->total[event] += source->total[event];
+        target->bytes[event] += source->bytes[event];
+        if (source->max[event] > target->max[event])
+            target->max[event] = source->max[event];
+        for (bucket = 0; bucket < MPACK_TRACE_HISTOGRAM_BUCKETS; ++bucket)
+            target->buckets[event][bucket] += source->buckets[event][bucket];
+    }
+}
+
+void mpack_trace_histogram_reset(mpack_trace_histogram_t* histogram) {
+    mpack_memset(histogram->count, 0, sizeof(histogram->count));
+    mpack_memset(histogram->total, 0, sizeof(histogram->total));
+    mpack_memset(histogram->max, 0, sizeof(histogram->max));
+    mpack_memset(histogram->bytes, 0, sizeof(histogram->bytes));
+    mpack_memset(histogram->buckets, 0, sizeof(histogram->buckets));
+}
+
+uint64_t mpack_trace_histogram_percentile(const mpack_trace_histogram_t* histogram,
+        mpack_trace_event_t event, uint64_t numerator, uint64_t denominator)
+{
+    mpack_assert(denominator != 0 && numerator <= denominator, "invalid fraction");
+
+    uint64_t count = histogram->count[event];
+    if (count == 0)
+        return 0;
+
+    // the rank of the value we want, rounded up, and at least the first
+    uint64_t rank = (count / denominator) * numerator +
+            ((count % denominator) * numerator + denominator - 1) / denominator;
+    if (rank == 0)
+        rank = 1;
+
+    uint64_t seen = 0;
+    size_t bucket;
+    for (bucket = 0; bucket < MPACK_TRACE_HISTOGRAM_BUCKETS; ++bucket) {
+        seen += histogram->buckets[event][bucket];
+        if (seen >= rank)
+            break;
+    }
+
+    // the bucket may extend past the largest value actually recorded
+    uint64_t value = mpack_trace_histogram_bucket_max(bucket);
+    return value < histogram->max[event] ? value : histogram->max[event];
+}
+
+#endif
+
+MPACK_SILENCE_WARNINGS_END
@@ -0,0 +1,321 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file
+ *
+ * Declares the MPack tracing hooks and latency histograms.
+ */
+
+#ifndef MPACK_TRACE_H
+#define MPACK_TRACE_H 1
+
+#include "mpack-common.h"
+
+MPACK_SILENCE_WARNINGS_BEGIN
+MPACK_EXTERN_C_BEGIN
+
+#if MPACK_TRACING
+
+/**
+ * @defgroup trace Tracing
+ *
+ * Tracing hooks report when potentially slow events start and end in a
+ * reader, writer or tree. This lets you attribute latency to I/O (fills and
+ * flushes), allocation (buffer reallocations) or encoding (builder
+ * resolves) rather than to parsing or writing in general.
+ *
+ * A @ref mpack_trace_t is attached to a reader, writer or tree with
+ * mpack_reader_set_trace(), mpack_writer_set_trace() or
+ * mpack_tree_set_trace(). MPack does not have a clock; the hooks are only
+ * told which event is happening and how many bytes are involved. You can
+ * timestamp them yourself or use the bundled @ref mpack_trace_histogram_t,
+ * which records event durations with a clock you provide.
+ *
+ * If an error handler longjmps or throws out of an event, the end hook of
+ * that event is not called.
+ *
+ * Tracing is only available if @ref MPACK_TRACING is enabled.
+ *
+ * @{
+ */
+
+/**
+ * An event reported to tracing hooks.
+ *
+ * Events of different types may be nested. For example a builder resolve
+ * may flush the writer.
+ */
+typedef enum mpack_trace_event_t {
+
+    /**
+     * A call to the fill function of a reader.
+     *
+     * The bytes are the space available in the buffer at the start, and the
+     * number of bytes filled at the end.
+     */
+    mpack_trace_reader_fill,
+
+    /**
+     * A call to the flush function of a writer.
+     *
+     * The bytes are the number of bytes flushed.
+     */
+    mpack_trace_writer_flush,
+
+    /**
+     * The resolve of a completed builder, in which the encoded contents of
+     * all builder pages are written out to the writer.
+     *
+     * The bytes are zero at the start and the number of bytes copied out of
+     * builder pages at the end.
+     */
+    mpack_trace_builder_resolve,
+
+    /**
+     * A call to the read function of a tree.
+     *
+     * The bytes are the space available in the buffer at the start, and the
+     * number of bytes read at the end.
+     */
+    mpack_trace_tree_fill,
+
+    /**
+     * A reallocation of the buffer of a stream tree.
+     *
+     * The bytes are the new capacity of the buffer.
+     */
+    mpack_trace_tree_realloc
+
+} mpack_trace_event_t;
+
+/**
+ * The number of distinct @ref mpack_trace_event_t events.
+ */
+#define MPACK_TRACE_EVENT_COUNT 5
+
+/**
+ * Tracing hooks.
+ *
+ * Either hook may be NULL. The hooks are called synchronously on the thread
+ * using the reader, writer or tree. They should not use the reader, writer
+ * or tree or flag errors on it.
+ */
+typedef struct mpack_trace_t {
+
+    /** Called at the start of an event. */
+    void (*begin)(void* context, mpack_trace_event_t event, size_t bytes);
+
+    /** Called at the end of an event. */
+    void (*end)(void* context, mpack_trace_event_t event, size_t bytes);
+
+    /** The context passed to the hooks. */
+    void* context;
+
+} mpack_trace_t;
+
+/* Hide internals from documentation */
+/** @cond */
+
+MPACK_INLINE void mpack_trace_begin_impl(const mpack_trace_t* trace, mpack_trace_event_t event, size_t bytes) {
+    if (trace != NULL && trace->begin != NULL)
+        trace->begin(trace->context, event, bytes);
+}
+
+MPACK_INLINE void mpack_trace_end_impl(const mpack_trace_t* trace, mpack_trace_event_t event, size_t bytes) {
+    if (trace != NULL && trace->end != NULL)
+        trace->end(trace->context, event, bytes);
+}
+
+/** @endcond */
+
+/**
+ * @name Latency Histograms
+ * @{
+ */
+
+/* Hide internals from documentation */
+/** @cond */
+
+// Values below this are recorded exactly. Above it, each power of two is
+// divided into this many buckets, so values are recorded with a precision
+// of about 6%.
+#define MPACK_TRACE_HISTOGRAM_SUB_BUCKETS 16
+#define MPACK_TRACE_HISTOGRAM_BUCKETS (MPACK_TRACE_HISTOGRAM_SUB_BUCKETS * 61)
+
+/** @endcond */
+
+/**
+ * A clock for a latency histogram. It should return the current time in
+ * any unit (for example nanoseconds or CPU cycles) from a monotonic source.
+ */
+typedef uint64_t (*mpack_trace_clock_t)(void);
+
+/**
+ * A collector that records the duration of traced events in log-linear
+ * histograms, one for each type of event. This is similar to an HDR
+ * histogram: durations are recorded with a relative precision of about 6%
+ * across the full range of a uint64_t.
+ *
+ * A histogram has a single writer. It does not lock and is not atomic.
+ * To collect latency from multiple threads, give each thread its own
+ * histogram (for example in thread-local storage), then combine them with
+ * mpack_trace_histogram_merge() when reporting.
+ *
+ * Recording does not allocate; all buckets are stored inline. The
+ * histogram is large, so you will likely want to allocate it statically
+ * or on the heap rather than on the stack.
+ *
+ * @see mpack_trace_histogram_init()
+ */
+typedef struct mpack_trace_histogram_t mpack_trace_histogram_t;
+
+/* Hide internals from documentation */
+/** @cond */
+
+struct mpack_trace_histogram_t {
+    mpack_trace_t trace;         /* Hooks that record into this histogram */
+    mpack_trace_clock_t clock;   /* The clock used to time events */
+    uint64_t started[MPACK_TRACE_EVENT_COUNT]; /* Start time of each open event */
+    uint64_t count[MPACK_TRACE_EVENT_COUNT];   /* Number of recorded values */
+    uint64_t total[MPACK_TRACE_EVENT_COUNT];   /* Sum of recorded values */
+    uint64_t max[MPACK_TRACE_EVENT_COUNT];     /* Largest recorded value */
+    uint64_t bytes[MPACK_TRACE_EVENT_COUNT];   /* Sum of bytes at the end of events */
+    uint32_t buckets[MPACK_TRACE_EVENT_COUNT][MPACK_TRACE_HISTOGRAM_BUCKETS];
+};
+
+/** @endcond */
+
+/**
+ * Initializes an empty latency histogram.
+ *
+ * @param histogram The histogram to initialize.
+ * @param clock The clock with which to time events.
+ */
+void mpack_trace_histogram_init(mpack_trace_histogram_t* histogram, mpack_trace_clock_t clock);
+
+/**
+ * Returns tracing hooks that record the duration of each event into the
+ * histogram. Attach these to a reader, writer or tree to collect its
+ * latency.
+ */
+MPACK_INLINE const mpack_trace_t* mpack_trace_histogram_hooks(mpack_trace_histogram_t* histogram) {
+    return &histogram->trace;
+}
+
+/**
+ * Records a duration for the given event directly.
+ */
+void mpack_trace_histogram_record(mpack_trace_histogram_t* histogram,
+        mpack_trace_event_t event, uint64_t value);
+
+/**
+ * Adds all values recorded in the source histogram to the target histogram.
+ */
+void mpack_trace_histogram_merge(mpack_trace_histogram_t* target, const mpack_trace_histogram_t* source);
+
+/**
+ * Clears all values recorded in the histogram.
+ */
+void mpack_trace_histogram_reset(mpack_trace_histogram_t* histogram);
+
+/**
+ * Returns the number of durations recorded for the given event.
+ */
+MPACK_INLINE uint64_t mpack_trace_histogram_count(const mpack_trace_histogram_t* histogram,
+        mpack_trace_event_t event)
+{
+    return histogram->count[event];
+}
+
+/**
+ * Returns the sum of durations recorded for the given event.
+ */
+MPACK_INLINE uint64_t mpack_trace_histogram_total(const mpack_trace_histogram_t* histogram,
+        mpack_trace_event_t event)
+{
+    return histogram->total[event];
+}
+
+/**
+ * Returns the largest duration recorded for the given event.
+ */
+MPACK_INLINE uint64_t mpack_trace_histogram_max(const mpack_trace_histogram_t* histogram,
+        mpack_trace_event_t event)
+{
+    return histogram->max[event];
+}
+
+/**
+ * Returns the total number of bytes reported at the end of the given event.
+ */
+MPACK_INLINE uint64_t mpack_trace_histogram_bytes(const mpack_trace_histogram_t* histogram,
+        mpack_trace_event_t event)
+{
+    return histogram->bytes[event];
+}
+
+/**
+ * Returns the duration below which the given fraction of recorded
+ * durations for the event fall.
+ *
+ * The result is the largest value that falls in the same bucket as the
+ * duration at that rank (or the largest duration recorded, if smaller), so
+ * it is never less than the true value and at most about 6% larger.
+ * Returns 0 if nothing has been recorded.
+ *
+ * @param histogram The histogram.
+ * @param event The event.
+ * @param numerator The numerator of the fraction, e.g. 99 for p99 or 999
+ *     for p99.9.
+ * @param denominator The denominator of the fraction, e.g. 100 for p99 or
+ *     1000 for p99.9.
+ */
+uint64_t mpack_trace_histogram_percentile(const mpack_trace_histogram_t* histogram,
+        mpack_trace_event_t event, uint64_t numerator, uint64_t denominator);
+
+/**
+ * @}
+ */
+
+/**
+ * @}
+ */
+
+#endif
+
+/* Hide internals from documentation */
+/** @cond */
+
+#if MPACK_TRACING
+    #define mpack_trace_begin(object, event, bytes) mpack_trace_begin_impl((object)->trace, event, bytes)
+    #define mpack_trace_end(object, event, bytes) mpack_trace_end_impl((object)->trace, event, bytes)
+#else
+    #define mpack_trace_begin(object, event, bytes) ((void)0)
+    #define mpack_trace_end(object, event, bytes) ((void)0)
+#endif
+
+/** @endcond */
+
+MPACK_EXTERN_C_END
+MPACK_SILENCE_WARNINGS_END
+
+#endif
@@ -92,6 +92,17 @@ static inline void mpack_writer_track_element(mpack_writer_t* writer) {
     #endif
 }
 
+#if MPACK_STATS
+// Records memory allocated and freed by the writer.
+static void mpack_writer_stats_memory(mpack_writer_t* writer, size_t allocated, size_t freed) {
+    writer->stats.memory = writer->stats.memory + allocated - freed;
+    if (writer->stats.memory > writer->stats.peak_memory)
+        writer->stats.peak_memory = writer->stats.memory;
+}
+#else
+#define mpack_writer_stats_memory(writer, allocated, freed) ((void)0)
+#endif
+
 static void mpack_writer_clear(mpack_writer_t* writer) {
     #if MPACK_COMPATIBILITY
     writer->version = mpack_version_current;
@@ -118,6 +129,25 @@ static void mpack_writer_clear(mpack_writer_t* writer) {
     writer->builder.stash_buffer = NULL;
     writer->builder.stash_position = NULL;
     writer->builder.stash_end = NULL;
+    writer->builder.page_size = MPACK_BUILDER_PAGE_SIZE;
+    #endif
+
+    #ifdef MPACK_MALLOC
+    writer->canonical = false;
+    writer->canonical_depth = 0;
+    writer->canonical_stash_buffer = NULL;
+    writer->canonical_stash_position = NULL;
+    writer->canonical_stash_end = NULL;
+    writer->canonical_stash_flush = NULL;
+    writer->allocator = NULL;
+    #endif
+
+    #if MPACK_STATS
+    mpack_memset(&writer->stats, 0, sizeof(writer->stats));
+    #endif
+
+    #if MPACK_TRACING
+    writer->trace = NULL;
     #endif
 }
 
@@ -218,7 +248,7 @@ static void mpack_growable_writer_flush(mpack_writer_t* writer, const char* data
     mpack_log("flush growing buffer size from %i to %i\n", (int)size, (int)new_size);
 
     // grow the buffer
-    char* new_buffer = (char*)mpack_realloc(writer->buffer, used, new_size);
+    char* new_buffer = (char*)mpack_allocator_realloc(writer->allocator, writer->buffer, used, new_size);
     if (new_buffer == NULL) {
         mpack_writer_flag_error(writer, mpack_error_memory);
         return;
@@ -226,6 +256,8 @@ static void mpack_growable_writer_flush(mpack_writer_t* writer, const char* data
     writer->position = new_buffer + used;
     writer->buffer = new_buffer;
     writer->end = writer->buffer + new_size;
+    mpack_stats_add(writer->stats, buffer_reallocs, 1);
+    mpack_writer_stats_memory(writer, new_size, size);
 
     // append the extra data
     if (count > 0) {
@@ -239,6 +271,9 @@ static void mpack_growable_writer_flush(mpack_writer_t* writer, const char* data
 static void mpack_growable_writer_teardown(mpack_writer_t* writer) {
     mpack_growable_writer_t* growable_writer = (mpack_growable_writer_t*)mpack_writer_get_reserved(writer);
 
+    // The buffer is either handed off or freed.
+    mpack_writer_stats_memory(writer, 0, mpack_writer_buffer_size(writer));
+
     if (mpack_writer_error(writer) == mpack_ok) {
 
         // shrink the buffer to an appropriate size if the data is
@@ -251,9 +286,9 @@ static void mpack_growable_writer_teardown(mpack_writer_t* writer) {
             // do this so we enforce it ourselves.
             size_t size = (used != 0) ? used : 1;
 
-            char* buffer = (char*)mpack_realloc(writer->buffer, used, size);
+            char* buffer = (char*)mpack_allocator_realloc(writer->allocator, writer->buffer, used, size);
             if (!buffer) {
-                MPACK_FREE(writer->buffer);
+                mpack_allocator_free(writer->allocator, writer->buffer);
                 mpack_writer_flag_error(writer, mpack_error_memory);
                 return;
             }
@@ -266,7 +301,7 @@ static void mpack_growable_writer_teardown(mpack_writer_t* writer) {
         writer->buffer = NULL;
 
     } else if (writer->buffer) {
-        MPACK_FREE(writer->buffer);
+        mpack_allocator_free(writer->allocator, writer->buffer);
         writer->buffer = NULL;
     }
 
@@ -274,6 +309,12 @@ static void mpack_growable_writer_teardown(mpack_writer_t* writer) {
 }
 
 void mpack_writer_init_growable(mpack_writer_t* writer, char** target_data, size_t* target_size) {
+    mpack_writer_init_growable_allocator(writer, target_data, target_size, NULL);
+}
+
+void mpack_writer_init_growable_allocator(mpack_writer_t* writer, char** target_data, size_t* target_size,
+        const mpack_allocator_t* allocator)
+{
     mpack_assert(target_data != NULL, "cannot initialize writer without a destination for the data");
     mpack_assert(target_size != NULL, "cannot initialize writer without a destination for the size");
 
@@ -288,16 +329,36 @@ void mpack_writer_init_growable(mpack_writer_t* writer, char** target_data, size
     growable_writer->target_size = target_size;
 
     size_t capacity = MPACK_BUFFER_SIZE;
-    char* buffer = (char*)MPACK_MALLOC(capacity);
+    char* buffer = (char*)mpack_allocator_alloc(allocator, capacity);
     if (buffer == NULL) {
         mpack_writer_init_error(writer, mpack_error_memory);
         return;
     }
 
     mpack_writer_init(writer, buffer, capacity);
+    writer->allocator = allocator;
+    mpack_writer_stats_memory(writer, capacity, 0);
     mpack_writer_set_flush(writer, mpack_growable_writer_flush);
     mpack_writer_set_teardown(writer, mpack_growable_writer_teardown);
 }
+
+void mpack_writer_set_allocator(mpack_writer_t* writer, const mpack_allocator_t* allocator) {
+    // The buffer of a growable writer (or of an open canonical map, which
+    // uses the growable flush) belongs to the current allocator.
+    if (writer->flush == mpack_growable_writer_flush) {
+        mpack_break("cannot change the allocator of a growable writer or with an open canonical map!");
+        mpack_writer_flag_error(writer, mpack_error_bug);
+        return;
+    }
+    #if MPACK_BUILDER
+    if (writer->builder.current_build != NULL) {
+        mpack_break("cannot change the allocator with an open builder!");
+        mpack_writer_flag_error(writer, mpack_error_bug);
+        return;
+    }
+    #endif
+    writer->allocator = allocator;
+}
 #endif
 
 #if MPACK_STDIO
@@ -309,6 +370,7 @@ static void mpack_file_writer_flush(mpack_writer_t* writer, const char* buffer,
 }
 
 static void mpack_file_writer_teardown(mpack_writer_t* writer) {
+    mpack_writer_stats_memory(writer, 0, mpack_writer_buffer_size(writer));
     MPACK_FREE(writer->buffer);
     writer->buffer = NULL;
     writer->context = NULL;
@@ -340,6 +402,7 @@ void mpack_writer_init_stdfile(mpack_writer_t* writer, FILE* file, bool close_wh
     }
 
     mpack_writer_init(writer, buffer, capacity);
+    mpack_writer_stats_memory(writer, capacity, 0);
     mpack_writer_set_context(writer, file);
     mpack_writer_set_flush(writer, mpack_file_writer_flush);
     mpack_writer_set_teardown(writer, close_when_done ?
@@ -376,7 +439,11 @@ MPACK_STATIC_INLINE void mpack_writer_flush_unchecked(mpack_writer_t* writer) {
     // versus flushing external data. see mpack_growable_writer_flush()
     size_t used = mpack_writer_buffer_used(writer);
     writer->position = writer->buffer;
+    mpack_stats_add(writer->stats, flush_calls, 1);
+    mpack_stats_add(writer->stats, flush_bytes, used);
+    mpack_trace_begin(writer, mpack_trace_writer_flush, used);
     writer->flush(writer, writer->buffer, used);
+    mpack_trace_end(writer, mpack_trace_writer_flush, used);
 }
 
 void mpack_writer_flush_message(mpack_writer_t* writer) {
@@ -465,6 +532,7 @@ MPACK_NOINLINE static void mpack_write_native_straddle(mpack_writer_t* writer, c
             "big write requested for %i bytes, but there is %i available "
             "space in buffer. should have called mpack_write_native() instead",
             (int)count, (int)(mpack_writer_buffer_left(writer)));
+    mpack_stats_add(writer->stats, straddles, 1);
 
     #if MPACK_BUILDER
     // if we have a build in progress, we can't flush. we need to copy all
@@ -507,7 +575,11 @@ MPACK_NOINLINE static void mpack_write_native_straddle(mpack_writer_t* writer, c
 
     // flush the extra data directly if it doesn't fit in the buffer
     if (count > mpack_writer_buffer_left(writer)) {
+        mpack_stats_add(writer->stats, flush_calls, 1);
+        mpack_stats_add(writer->stats, flush_bytes, count);
+        mpack_trace_begin(writer, mpack_trace_writer_flush, count);
         writer->flush(writer, p, count);
+        mpack_trace_end(writer, mpack_trace_writer_flush, count);
         if (mpack_writer_error(writer) != mpack_ok)
             return;
     } else {
@@ -528,6 +600,264 @@ MPACK_STATIC_INLINE void mpack_write_native(mpack_writer_t* writer, const char*
     }
 }
 
+#ifdef MPACK_MALLOC
+void mpack_writer_set_canonical(mpack_writer_t* writer, bool canonical) {
+    if (writer->canonical_depth > 0) {
+        mpack_break("cannot change canonical mode while a map is open!");
+        mpack_writer_flag_error(writer, mpack_error_bug);
+        return;
+    }
+    writer->canonical = canonical;
+}
+
+// Diverts writes to a growable buffer when a map is started in canonical
+// mode, or counts the nesting of maps and arrays while already diverted.
+static void mpack_writer_canonical_push(mpack_writer_t* writer, mpack_type_t type) {
+    if (writer->canonical_depth > 0) {
+        if (++writer->canonical_depth > MPACK_CANONICAL_MAX_DEPTH)
+            mpack_writer_flag_error(writer, mpack_error_too_big);
+        return;
+    }
+    if (!writer->canonical || type != mpack_type_map || writer->error != mpack_ok)
+        return;
+
+    char* buffer = (char*)mpack_allocator_alloc(writer->allocator, MPACK_BUFFER_SIZE);
+    if (buffer == NULL) {
+        mpack_writer_flag_error(writer, mpack_error_memory);
+        return;
+    }
+
+    writer->canonical_stash_buffer = writer->buffer;
+    writer->canonical_stash_position = writer->position;
+    writer->canonical_stash_end = writer->end;
+    writer->canonical_stash_flush = writer->flush;
+    writer->buffer = buffer;
+    writer->position = buffer;
+    writer->end = buffer + MPACK_BUFFER_SIZE;
+    writer->flush = mpack_growable_writer_flush;
+    writer->canonical_depth = 1;
+    mpack_writer_stats_memory(writer, MPACK_BUFFER_SIZE, 0);
+}
+
+static void mpack_writer_canonical_restore(mpack_writer_t* writer) {
+    writer->buffer = writer->canonical_stash_buffer;
+    writer->position = writer->canonical_stash_position;
+    writer->end = writer->canonical_stash_end;
+    writer->flush = writer->canonical_stash_flush;
+    writer->canonical_depth = 0;
+}
+
+// Parses the header of an encoded element. Returns the size of the header, or
+// 0 if it is invalid. The count is the number of elements of an array, the
+// number of key/value pairs of a map, or the number of bytes that follow the
+// header of any other element.
+static size_t mpack_canonical_header(const char* p, size_t left, mpack_type_t* type, size_t* count) {
+    if (left == 0)
+        return 0;
+    uint8_t b = mpack_load_u8(p);
+    *type = mpack_type_nil;
+    *count = 0;
+
+    size_t size = 1;  // size of the header
+    size_t width = 0; // width of the count following the type byte
+    if (b <= 0x7f || b >= 0xe0 || b == 0xc0 || b == 0xc2 || b == 0xc3) {
+        // fixint, nil, bool
+    } else if (b <= 0x8f) {
+        *type = mpack_type_map;
+        *count = b & 0x0f;
+    } else if (b <= 0x9f) {
+        *type = mpack_type_array;
+        *count = b & 0x0f;
+    } else if (b <= 0xbf) {
+        *type = mpack_type_str;
+        *count = b & 0x1f;
+    } else {
+        switch (b) {
+            case 0xc4: case 0xd9: width = 1; *type = mpack_type_str; break;
+            case 0xc5: case 0xda: width = 2; *type = mpack_type_str; break;
+            case 0xc6: case 0xdb: width = 4; *type = mpack_type_str; break;
+            case 0xc7: width = 1; size = 2; *type = mpack_type_str; break; // ext has a type byte
+            case 0xc8: width = 2; size = 2; *type = mpack_type_str; break;
+            case 0xc9: width = 4; size = 2; *type = mpack_type_str; break;
+            case 0xca: *count = 4; break;
+            case 0xcb: *count = 8; break;
+            case 0xcc: case 0xd0: *count = 1; break;
+            case 0xcd: case 0xd1: *count = 2; break;
+            case 0xce: case 0xd2: *count = 4; break;
+            case 0xcf: case 0xd3: *count = 8; break;
+            case 0xd4: *count = 2; break; // fixext, including its type byte
+            case 0xd5: *count = 3; break;
+            case 0xd6: *count = 5; break;
+            case 0xd7: *count = 9; break;
+            case 0xd8: *count = 17; break;
+            case 0xdc: width = 2; *type = mpack_type_array; break;
+            case 0xdd: width = 4; *type = mpack_type_array; break;
+            case 0xde: width = 2; *type = mpack_type_map; break;
+            case 0xdf: width = 4; *type = mpack_type_map; break;
+            default: return 0;
+        }
+    }
+
+    if (left < size + width)
+        return 0;
+    if (width == 1)
+        *count = mpack_load_u8(p + 1);
+    else if (width == 2)
+        *count = mpack_load_u16(p + 1);
+    else if (width == 4)
+        *count = mpack_load_u32(p + 1);
+    return size + width;
+}
+
+// Compares two encoded keys by their bytes.
+static int mpack_canonical_compare(const char* data, const size_t* starts, const size_t* key_sizes,
+        size_t left, size_t right)
+{
+    size_t left_size = key_sizes[left];
+    size_t right_size = key_sizes[right];
+    int cmp = mpack_memcmp(data + starts[left], data + starts[right],
+            left_size < right_size ? left_size : right_size);
+    if (cmp != 0)
+        return cmp;
+    return (left_size < right_size) ? -1 : (left_size > right_size) ? 1 : 0;
+}
+
+// Sorts the key/value pairs of a map with a stable bottom-up merge sort of
+// their indices, then rearranges the bytes of the map's contents.
+static bool mpack_canonical_sort_pairs(mpack_writer_t* writer, char* data, size_t* starts, size_t count) {
+    size_t* key_sizes = starts + count + 1;
+    size_t* order = key_sizes + count;
+    size_t* scratch = order + count;
+    size_t i;
+
+    for (i = 0; i < count; ++i)
+        order[i] = i;
+
+    size_t width;
+    for (width = 1; width < count; width *= 2) {
+        for (i = 0; i < count; i += 2 * width) {
+            size_t middle = (i + width < count) ? i + width : count;
+            size_t end = (i + 2 * width < count) ? i + 2 * width : count;
+            size_t a = i, b = middle, out = i;
+            while (a < middle && b < end) {
+                if (mpack_canonical_compare(data, starts, key_sizes, order[b], order[a]) < 0)
+                    scratch[out++] = order[b++];
+                else
+                    scratch[out++] = order[a++];
+            }
+            while (a < middle)
+                scratch[out++] = order[a++];
+            while (b < end)
+                scratch[out++] = order[b++];
+        }
+        size_t* swap = order;
+        order = scratch;
+        scratch = swap;
+    }
+
+    size_t first = starts[0];
+    size_t length = starts[count] - first;
+    char* sorted = (char*)mpack_allocator_alloc(writer->allocator, length);
+    if (sorted == NULL)
+        return false;
+    size_t position = 0;
+    for (i = 0; i < count; ++i) {
+        size_t pair = order[i];
+        size_t pair_size = starts[pair + 1] - starts[pair];
+        mpack_memcpy(sorted + position, data + starts[pair], pair_size);
+        position += pair_size;
+    }
+    mpack_memcpy(data + first, sorted, length);
+    mpack_allocator_free(writer->allocator, sorted);
+    return true;
+}
+
+// Sorts the keys of all maps within the encoded element at the given offset,
+// in place. Returns the size of the element, or 0 if an error was flagged.
+// The depth is the number of maps and arrays that contain the element.
+static size_t mpack_canonical_sort(mpack_writer_t* writer, char* data, size_t offset, size_t size, size_t depth) {
+    mpack_type_t type;
+    size_t count;
+    size_t header = mpack_canonical_header(data + offset, size - offset, &type, &count);
+    if (header == 0) {
+        mpack_writer_flag_error(writer, mpack_error_invalid);
+        return 0;
+    }
+
+    size_t position = offset + header;
+    if (type != mpack_type_array && type != mpack_type_map) {
+        if (count > size - position) {
+            mpack_writer_flag_error(writer, mpack_error_invalid);
+            return 0;
+        }
+        return header + count;
+    }
+
+    // object bytes are not counted when they are written, so the depth is
+    // checked again here
+    if (depth == MPACK_CANONICAL_MAX_DEPTH) {
+        mpack_writer_flag_error(writer, mpack_error_too_big);
+        return 0;
+    }
+
+    size_t* starts = NULL;
+    if (type == mpack_type_map && count > 1) {
+        // pair offsets, key sizes, and two arrays of indices for sorting
+        if (count > (SIZE_MAX / sizeof(size_t) - 1) / 4) {
+            mpack_writer_flag_error(writer, mpack_error_too_big);
+            return 0;
+        }
+        starts = (size_t*)mpack_allocator_alloc(writer->allocator, (count * 4 + 1) * sizeof(size_t));
+        if (starts == NULL) {
+            mpack_writer_flag_error(writer, mpack_error_memory);
+            return 0;
+        }
+    }
+
+    size_t elements = (type == mpack_type_map) ? count * 2 : count;
+    bool sorted = true;
+    size_t i;
+    for (i = 0; i < elements; ++i) {
+        if (starts && i % 2 == 0)
+            starts[i / 2] = position;
+        size_t element = mpack_canonical_sort(writer, data, position, size, depth + 1);
+        if (element == 0)
+            break;
+        if (starts && i % 2 == 0) {
+            starts[count + 1 + i / 2] = element;
+            if (i > 0 && mpack_canonical_compare(data, starts, starts + count + 1, i / 2 - 1, i / 2) > 0)
+                sorted = false;
+        }
+        position += element;
+    }
+
+    if (starts) {
+        starts[count] = position;
+        if (writer->error == mpack_ok && !sorted && !mpack_canonical_sort_pairs(writer, data, starts, count))
+            mpack_writer_flag_error(writer, mpack_error_memory);
+        mpack_allocator_free(writer->allocator, starts);
+    }
+
+    return (writer->error == mpack_ok) ? position - offset : 0;
+}
+
+void mpack_writer_canonical_finish(mpack_writer_t* writer) {
+    char* data = writer->buffer;
+    size_t used = mpack_writer_buffer_used(writer);
+    mpack_writer_stats_memory(writer, 0, mpack_writer_buffer_size(writer));
+    mpack_writer_canonical_restore(writer);
+
+    if (writer->error == mpack_ok) {
+        size_t size = mpack_canonical_sort(writer, data, 0, used, 0);
+        if (size != used && writer->error == mpack_ok)
+            mpack_writer_flag_error(writer, mpack_error_invalid);
+        if (writer->error == mpack_ok)
+            mpack_write_native(writer, data, used);
+    }
+    mpack_allocator_free(writer->allocator, data);
+}
+#endif
+
 mpack_error_t mpack_writer_destroy(mpack_writer_t* writer) {
 
     // clean up tracking, asserting if we're not already in an error state
@@ -557,7 +887,8 @@ mpack_error_t mpack_writer_destroy(mpack_writer_t* writer) {
         #endif
         while (page != NULL) {
             mpack_builder_page_t* next = page->next;
-            MPACK_FREE(page);
+            mpack_writer_stats_memory(writer, 0, builder->page_size);
+            mpack_allocator_free(writer->allocator, page);
             page = next;
         }
 
@@ -575,9 +906,29 @@ mpack_error_t mpack_writer_destroy(mpack_writer_t* writer) {
     }
     #endif
 
+    #ifdef MPACK_MALLOC
+    if (writer->canonical_depth > 0) {
+        // A canonical map is open. As with builders, this is a bug unless an
+        // error was flagged.
+        if (mpack_writer_error(writer) == mpack_ok) {
+            mpack_break("writer cannot be destroyed with an incomplete canonical map unless "
+                    "an error was flagged!");
+            mpack_writer_flag_error(writer, mpack_error_bug);
+        }
+        mpack_writer_stats_memory(writer, 0, mpack_writer_buffer_size(writer));
+        mpack_allocator_free(writer->allocator, writer->buffer);
+        mpack_writer_canonical_restore(writer);
+    }
+    #endif
+
     // flush any outstanding data
     if (mpack_writer_error(writer) == mpack_ok && mpack_writer_buffer_used(writer) != 0 && writer->flush != NULL) {
-        writer->flush(writer, writer->buffer, mpack_writer_buffer_used(writer));
+        size_t used = mpack_writer_buffer_used(writer);
+        mpack_stats_add(writer->stats, flush_calls, 1);
+        mpack_stats_add(writer->stats, flush_bytes, used);
+        mpack_trace_begin(writer, mpack_trace_writer_flush, used);
+        writer->flush(writer, writer->buffer, used);
+        mpack_trace_end(writer, mpack_trace_writer_flush, used);
         writer->flush = NULL;
     }
 
@@ -662,6 +1013,13 @@ void mpack_write_object_bytes(mpack_writer_t* writer, const char* data, size_t b
     mpack_write_native(writer, data, bytes);
 }
 
+void mpack_write_elements(mpack_writer_t* writer, const char* data, size_t bytes, uint32_t count) {
+    uint32_t i;
+    for (i = 0; i < count && mpack_writer_error(writer) == mpack_ok; ++i)
+        mpack_writer_track_element(writer);
+    mpack_write_native(writer, data, bytes);
+}
+
 /*
  * Encode functions
  */
@@ -730,12 +1088,12 @@ MPACK_STATIC_INLINE void mpack_encode_float(char* p, float value) {
     mpack_store_u8(p, 0xca);
     mpack_store_float(p + 1, value);
 }
-#else
+#endif
+
 MPACK_STATIC_INLINE void mpack_encode_raw_float(char* p, uint32_t value) {
     mpack_store_u8(p, 0xca);
     mpack_store_u32(p + 1, value);
 }
-#endif
 
 #if MPACK_DOUBLE
 MPACK_STATIC_INLINE void mpack_encode_double(char* p, double value) {
@@ -1069,8 +1427,21 @@ void mpack_write_i64(mpack_writer_t* writer, int64_t value) {
 }
 
 #if MPACK_FLOAT
+#ifdef MPACK_MALLOC
+// The quiet NaN that all NaNs are written as in canonical mode.
+#define MPACK_CANONICAL_NAN 0x7fc00000u
+#endif
+
 void mpack_write_float(mpack_writer_t* writer, float value) {
     mpack_writer_track_element(writer);
+
+    #ifdef MPACK_MALLOC
+    if (writer->canonical && value != value) {
+        MPACK_WRITE_ENCODED(mpack_encode_raw_float, MPACK_TAG_SIZE_FLOAT, MPACK_CANONICAL_NAN);
+        return;
+    }
+    #endif
+
     MPACK_WRITE_ENCODED(mpack_encode_float, MPACK_TAG_SIZE_FLOAT, value);
 }
 #else
@@ -1081,8 +1452,37 @@ void mpack_write_raw_float(mpack_writer_t* writer, uint32_t value) {
 #endif
 
 #if MPACK_DOUBLE
+#if defined(MPACK_MALLOC) && MPACK_FLOAT
+// Returns true if the double converts to float without loss. Finite doubles
+// beyond the range of float are rejected first because converting them is
+// undefined. Of the values out of range, only infinities are unchanged when
+// doubled.
+MPACK_STATIC_INLINE bool mpack_double_fits_float(double value) {
+    if (value < -3.4028234663852886e38 || value > 3.4028234663852886e38)
+        return value * 2.0 == value;
+    return (double)(float)value == value;
+}
+#endif
+
 void mpack_write_double(mpack_writer_t* writer, double value) {
     mpack_writer_track_element(writer);
+
+    #if defined(MPACK_MALLOC) && MPACK_FLOAT
+    // In canonical mode, doubles that are exactly representable as floats
+    // (including infinities) are written as floats, and NaNs are written as
+    // the canonical float NaN.
+    if (writer->canonical) {
+        if (value != value) {
+            MPACK_WRITE_ENCODED(mpack_encode_raw_float, MPACK_TAG_SIZE_FLOAT, MPACK_CANONICAL_NAN);
+            return;
+        }
+        if (mpack_double_fits_float(value)) {
+            MPACK_WRITE_ENCODED(mpack_encode_float, MPACK_TAG_SIZE_FLOAT, (float)value);
+            return;
+        }
+    }
+    #endif
+
     MPACK_WRITE_ENCODED(mpack_encode_double, MPACK_TAG_SIZE_DOUBLE, value);
 }
 #else
@@ -1142,6 +1542,9 @@ static void mpack_write_map_notrack(mpack_writer_t* writer, uint32_t count) {
 
 void mpack_start_array(mpack_writer_t* writer, uint32_t count) {
     mpack_writer_track_element(writer);
+    #ifdef MPACK_MALLOC
+    mpack_writer_canonical_push(writer, mpack_type_array);
+    #endif
     mpack_write_array_notrack(writer, count);
     mpack_writer_track_push(writer, mpack_type_array, count);
     mpack_builder_compound_push(writer);
@@ -1149,6 +1552,9 @@ void mpack_start_array(mpack_writer_t* writer, uint32_t count) {
 
 void mpack_start_map(mpack_writer_t* writer, uint32_t count) {
     mpack_writer_track_element(writer);
+    #ifdef MPACK_MALLOC
+    mpack_writer_canonical_push(writer, mpack_type_map);
+    #endif
     mpack_write_map_notrack(writer, count);
     mpack_writer_track_push(writer, mpack_type_map, count);
     mpack_builder_compound_push(writer);
@@ -1439,6 +1845,22 @@ static inline void mpack_builder_check_sizes(mpack_writer_t* writer) {
     }
 }
 
+void mpack_writer_set_builder_page_size(mpack_writer_t* writer, size_t page_size) {
+    if (writer->builder.current_build != NULL) {
+        mpack_break("cannot change the builder page size with an open builder!");
+        mpack_writer_flag_error(writer, mpack_error_bug);
+        return;
+    }
+    if (page_size < (sizeof(mpack_builder_page_t) +
+            sizeof(mpack_build_t) + MPACK_WRITER_MINIMUM_BUFFER_SIZE))
+    {
+        mpack_break("builder page size %i is too small to be useful!", (int)page_size);
+        mpack_writer_flag_error(writer, mpack_error_bug);
+        return;
+    }
+    writer->builder.page_size = page_size;
+}
+
 static inline size_t mpack_builder_page_size(mpack_writer_t* writer, mpack_builder_page_t* page) {
     #if MPACK_BUILDER_INTERNAL_STORAGE
     if ((char*)page == writer->builder.internal)
@@ -1447,7 +1869,7 @@ static inline size_t mpack_builder_page_size(mpack_writer_t* writer, mpack_build
     (void)writer;
     (void)page;
     #endif
-    return MPACK_BUILDER_PAGE_SIZE;
+    return writer->builder.page_size;
 }
 
 static inline size_t mpack_builder_align_build(size_t bytes_used) {
@@ -1466,7 +1888,8 @@ static inline void mpack_builder_free_page(mpack_writer_t* writer, mpack_builder
     #else
     (void)writer;
     #endif
-    MPACK_FREE(page);
+    mpack_writer_stats_memory(writer, 0, writer->builder.page_size);
+    mpack_allocator_free(writer->allocator, page);
 }
 
 static inline size_t mpack_builder_page_remaining(mpack_writer_t* writer, mpack_builder_page_t* page) {
@@ -1494,11 +1917,13 @@ static void mpack_builder_add_page(mpack_writer_t* writer) {
     mpack_assert(writer->error == mpack_ok);
 
     mpack_log("adding a page.\n");
-    mpack_builder_page_t* page = (mpack_builder_page_t*)MPACK_MALLOC(MPACK_BUILDER_PAGE_SIZE);
+    mpack_builder_page_t* page = (mpack_builder_page_t*)mpack_allocator_alloc(writer->allocator, builder->page_size);
     if (page == NULL) {
         mpack_writer_flag_error(writer, mpack_error_memory);
         return;
     }
+    mpack_stats_add(writer->stats, builder_pages, 1);
+    mpack_writer_stats_memory(writer, builder->page_size, 0);
 
     page->next = NULL;
     page->bytes_used = sizeof(mpack_builder_page_t);
@@ -1553,11 +1978,13 @@ MPACK_NOINLINE static void mpack_builder_begin(mpack_writer_t* writer) {
     page = (mpack_builder_page_t*)builder->internal;
     mpack_log("beginning builder with internal storage %p\n", (void*)page);
     #else
-    page = (mpack_builder_page_t*)MPACK_MALLOC(MPACK_BUILDER_PAGE_SIZE);
+    page = (mpack_builder_page_t*)mpack_allocator_alloc(writer->allocator, builder->page_size);
     if (page == NULL) {
         mpack_writer_flag_error(writer, mpack_error_memory);
         return;
     }
+    mpack_stats_add(writer->stats, builder_pages, 1);
+    mpack_writer_stats_memory(writer, builder->page_size, 0);
     mpack_log("beginning builder with allocated page %p\n", (void*)page);
     #endif
 
@@ -1572,6 +1999,14 @@ static void mpack_builder_build(mpack_writer_t* writer, mpack_type_t type) {
     if (mpack_writer_error(writer) != mpack_ok)
         return;
 
+    #ifdef MPACK_MALLOC
+    if (writer->canonical) {
+        mpack_break("builders cannot be used in canonical mode!");
+        mpack_writer_flag_error(writer, mpack_error_bug);
+        return;
+    }
+    #endif
+
     mpack_writer_track_element(writer);
     mpack_writer_track_push_builder(writer, type);
 
@@ -1648,6 +2083,9 @@ static void mpack_builder_resolve(mpack_writer_t* writer) {
     mpack_writer_error_t error_fn = writer->error_fn;
     writer->error_fn = NULL;
 
+    mpack_trace_begin(writer, mpack_trace_builder_resolve, 0);
+    size_t resolved = 0;
+
     // The starting page is the internal storage (if we have it), otherwise
     // it's the first page in the array
     mpack_builder_page_t* page =
@@ -1716,6 +2154,8 @@ static void mpack_builder_resolve(mpack_writer_t* writer) {
                 mpack_log("writing out %zi bytes starting at %p in page %p\n",
                         step, (void*)((char*)page + offset), (void*)page);
                 mpack_write_native(writer, (char*)page + offset, step);
+                mpack_stats_add(writer->stats, resolve_bytes, step);
+                resolved += step;
                 offset += step;
                 left -= step;
             }
@@ -1762,6 +2202,8 @@ static void mpack_builder_resolve(mpack_writer_t* writer) {
     }
 
     mpack_log("done resolve.\n");
+    mpack_trace_end(writer, mpack_trace_builder_resolve, resolved);
+    MPACK_UNUSED(resolved);
 
     // We can now restore the error handler and call it if an error occurred.
     writer->error_fn = error_fn;
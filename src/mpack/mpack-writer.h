@@ -29,6 +29,7 @@
 #define MPACK_WRITER_H 1
 
 #include "mpack-common.h"
+#include "mpack-trace.h"
 
 #if MPACK_WRITER
 
@@ -105,6 +106,26 @@ typedef void (*mpack_writer_error_t)(mpack_writer_t* writer, mpack_error_t error
  */
 typedef void (*mpack_writer_teardown_t)(mpack_writer_t* writer);
 
+#if MPACK_STATS
+/**
+ * Performance counters of a writer.
+ *
+ * These are only available if @ref MPACK_STATS is enabled.
+ *
+ * @see mpack_writer_stats()
+ */
+typedef struct mpack_writer_stats_t {
+    size_t flush_calls;     /**< The number of calls to the flush function. */
+    size_t flush_bytes;     /**< The number of bytes passed to the flush function. */
+    size_t straddles;       /**< The number of writes that straddled the end of the buffer. */
+    size_t buffer_reallocs; /**< The number of times a growable buffer was grown. */
+    size_t builder_pages;   /**< The number of builder pages allocated. */
+    size_t resolve_bytes;   /**< The number of bytes copied out of builder pages. */
+    size_t memory;          /**< The number of bytes currently allocated by the writer. */
+    size_t peak_memory;     /**< The maximum number of bytes allocated by the writer at once. */
+} mpack_writer_stats_t;
+#endif
+
 /* Hide internals from documentation */
 /** @cond */
 
@@ -155,6 +176,7 @@ typedef struct mpack_builder_t {
     char* stash_buffer;
     char* stash_position;
     char* stash_end;
+    size_t page_size; // size in bytes of allocated builder pages
     #if MPACK_BUILDER_INTERNAL_STORAGE
     char internal[MPACK_BUILDER_INTERNAL_STORAGE_SIZE];
     #endif
@@ -183,11 +205,32 @@ struct mpack_writer_t {
     /* Reserved. You can use this space to allocate a custom
      * context in order to reduce heap allocations. */
     void* reserved[2];
+
+    const mpack_allocator_t* allocator; /* Allocator for buffers and pages, or NULL */
+    #endif
+
+    #ifdef MPACK_MALLOC
+    /* Canonical mode. While a map is open, writes are diverted to a
+     * growable buffer so that its keys can be sorted once it is finished. */
+    bool canonical;                          /* Whether canonical mode is enabled */
+    size_t canonical_depth;                  /* Open maps and arrays while diverted */
+    char* canonical_stash_buffer;            /* The stashed buffer while diverted */
+    char* canonical_stash_position;
+    char* canonical_stash_end;
+    mpack_writer_flush_t canonical_stash_flush;
     #endif
 
     #if MPACK_BUILDER
     mpack_builder_t builder;
     #endif
+
+    #if MPACK_STATS
+    mpack_writer_stats_t stats; /* Performance counters */
+    #endif
+
+    #if MPACK_TRACING
+    const mpack_trace_t* trace; /* Tracing hooks */
+    #endif
 };
 
 
@@ -221,6 +264,19 @@ MPACK_INLINE void mpack_writer_track_bytes(mpack_writer_t* writer, size_t count)
 }
 #endif
 
+#ifdef MPACK_MALLOC
+void mpack_writer_canonical_finish(mpack_writer_t* writer);
+#endif
+
+MPACK_INLINE void mpack_writer_canonical_pop(mpack_writer_t* writer) {
+    MPACK_UNUSED(writer);
+
+    #ifdef MPACK_MALLOC
+    if (writer->canonical_depth > 0 && --writer->canonical_depth == 0)
+        mpack_writer_canonical_finish(writer);
+    #endif
+}
+
 /** @endcond */
 
 /**
@@ -260,8 +316,28 @@ void mpack_writer_init(mpack_writer_t* writer, char* buffer, size_t size);
  * @param writer The MPack writer.
  * @param data Where to place the allocated data.
  * @param size Where to write the size of the data.
+ *
+ * @see mpack_writer_init_growable_allocator()
  */
 void mpack_writer_init_growable(mpack_writer_t* writer, char** data, size_t* size);
+
+/**
+ * Initializes an MPack writer using a growable buffer allocated with the
+ * given allocator.
+ *
+ * This is the same as mpack_writer_init_growable() except that the buffer,
+ * along with any other memory needed by the writer, is allocated with the
+ * given allocator. The data must be freed with the same allocator.
+ *
+ * @param writer The MPack writer.
+ * @param data Where to place the allocated data.
+ * @param size Where to write the size of the data.
+ * @param allocator The allocator, or NULL to use @ref MPACK_MALLOC.
+ *
+ * @see mpack_writer_set_allocator()
+ */
+void mpack_writer_init_growable_allocator(mpack_writer_t* writer, char** data, size_t* size,
+        const mpack_allocator_t* allocator);
 #endif
 
 /**
@@ -447,6 +523,72 @@ MPACK_INLINE void mpack_writer_set_teardown(mpack_writer_t* writer, mpack_writer
     writer->teardown = teardown;
 }
 
+#ifdef MPACK_MALLOC
+/**
+ * Sets the allocator with which the writer allocates builder pages and the
+ * temporary buffers of canonical mode, or NULL to use @ref MPACK_MALLOC.
+ *
+ * This cannot be changed while a builder or canonical map is open, and it
+ * cannot be used on a growable writer; use
+ * mpack_writer_init_growable_allocator() instead. The buffer of a writer
+ * initialized with mpack_writer_init_filename() or
+ * mpack_writer_init_stdfile() is always allocated with @ref MPACK_MALLOC.
+ *
+ * @see mpack_allocator_t
+ */
+void mpack_writer_set_allocator(mpack_writer_t* writer, const mpack_allocator_t* allocator);
+
+/**
+ * Enables or disables canonical mode.
+ *
+ * In canonical mode, logically equal data is always written as the same
+ * bytes regardless of the order in which the keys of maps were written:
+ *
+ * - The key/value pairs of each map are sorted by the bytewise lexicographic
+ *   order of their encoded keys, as in the deterministic encoding of CBOR
+ *   (RFC 8949.) Pairs with equal keys keep the order in which they were
+ *   written.
+ * - A double that can be represented exactly as a float, including an
+ *   infinity, is written as a float.
+ * - Every NaN, whether written as a float or a double, is written as the
+ *   same quiet float NaN (0x7fc00000), so the sign and payload of NaNs are
+ *   not preserved. This does not apply when MPACK_FINITE_MATH is enabled
+ *   (e.g. with -ffast-math) since NaNs can't be detected, so how they are
+ *   written is unspecified.
+ *
+ * Integers and the headers of strings, binary blobs and extensions are always
+ * written in their smallest encoding, so they need no special treatment.
+ * Bytes written with mpack_write_object_bytes() are written as is, so they
+ * must already be canonical.
+ *
+ * While a map is open, its contents are written into a temporary growable
+ * buffer, and they are sorted and written out to the writer's buffer when the
+ * map is finished. mpack_writer_buffer_used() and similar functions therefore
+ * do not reflect the contents of open maps. Canonical mode cannot be combined
+ * with builders (see mpack_build_map()), and it cannot be changed while a map
+ * is open.
+ *
+ * Maps and arrays can be nested at most @ref MPACK_CANONICAL_MAX_DEPTH deep
+ * within a canonical map, including the map itself, and bytes written with
+ * mpack_write_object_bytes() count towards this limit. Deeper nesting flags
+ * @ref mpack_error_too_big.
+ *
+ * @note This requires @ref MPACK_MALLOC.
+ *
+ * @see mpack_write_node_canonical()
+ */
+void mpack_writer_set_canonical(mpack_writer_t* writer, bool canonical);
+
+/**
+ * Returns true if the writer is in canonical mode.
+ *
+ * @see mpack_writer_set_canonical()
+ */
+MPACK_INLINE bool mpack_writer_is_canonical(mpack_writer_t* writer) {
+    return writer->canonical;
+}
+#endif
+
 /**
  * @}
  */
@@ -529,6 +671,38 @@ MPACK_INLINE mpack_error_t mpack_writer_error(mpack_writer_t* writer) {
     return writer->error;
 }
 
+#if MPACK_STATS
+/**
+ * Returns the performance counters of the writer.
+ *
+ * The memory counters include growable and file buffers allocated by the
+ * writer, the buffers of canonical maps and builder pages. They do not
+ * include the buffer of a writer initialized with mpack_writer_init().
+ *
+ * This is only available if @ref MPACK_STATS is enabled.
+ */
+MPACK_INLINE const mpack_writer_stats_t* mpack_writer_stats(mpack_writer_t* writer) {
+    return &writer->stats;
+}
+#endif
+
+#if MPACK_TRACING
+/**
+ * Sets the tracing hooks of the writer, or NULL to disable tracing.
+ *
+ * The hooks are called around each call to the flush function and around
+ * the resolve of each builder. They are not copied; they must remain valid
+ * until the writer is destroyed or the hooks are replaced.
+ *
+ * This is only available if @ref MPACK_TRACING is enabled.
+ *
+ * @see trace
+ */
+MPACK_INLINE void mpack_writer_set_trace(mpack_writer_t* writer, const mpack_trace_t* trace) {
+    writer->trace = trace;
+}
+#endif
+
 /**
  * Writes a MessagePack object header (an MPack Tag.)
  *
@@ -630,6 +804,32 @@ void mpack_write_nil(mpack_writer_t* writer);
 /** Write a pre-encoded messagepack object */
 void mpack_write_object_bytes(mpack_writer_t* writer, const char* data, size_t bytes);
 
+/**
+ * Writes a chunk of pre-encoded MessagePack elements into the current map or
+ * array, counting them as the given number of elements.
+ *
+ * This can be used to encode a large map or array in parallel. Each thread
+ * encodes a contiguous range of elements with its own writer (for example
+ * with mpack_writer_init_growable().) The map or array is then started with
+ * the total count (or with mpack_build_array() or mpack_build_map() if the
+ * total is not known in advance), and the chunks are written in order with
+ * this function.
+ *
+ * For a map, the count is the number of keys and values, so it is twice the
+ * number of key/value pairs in the chunk. The chunk must contain exactly this
+ * many complete elements; this is only checked in debug builds with
+ * MPACK_WRITE_TRACKING.
+ *
+ * If the writer has a flush function, a chunk larger than the buffer is
+ * passed to it directly without copying, unless a build is in progress.
+ *
+ * @param writer The MPack writer.
+ * @param data The encoded elements.
+ * @param bytes The size of the encoded elements in bytes.
+ * @param count The number of elements encoded in the chunk.
+ */
+void mpack_write_elements(mpack_writer_t* writer, const char* data, size_t bytes, uint32_t count);
+
 #if MPACK_EXTENSIONS
 /**
  * Writes a timestamp.
@@ -742,6 +942,7 @@ MPACK_INLINE void mpack_builder_compound_pop(mpack_writer_t* writer) {
 MPACK_INLINE void mpack_finish_array(mpack_writer_t* writer) {
     mpack_writer_track_pop(writer, mpack_type_array);
     mpack_builder_compound_pop(writer);
+    mpack_writer_canonical_pop(writer);
 }
 
 /**
@@ -758,6 +959,7 @@ MPACK_INLINE void mpack_finish_array(mpack_writer_t* writer) {
 MPACK_INLINE void mpack_finish_map(mpack_writer_t* writer) {
     mpack_writer_track_pop(writer, mpack_type_map);
     mpack_builder_compound_pop(writer);
+    mpack_writer_canonical_pop(writer);
 }
 
 /**
@@ -820,6 +1022,23 @@ void mpack_build_array(struct mpack_writer_t* writer);
  */
 void mpack_build_map(struct mpack_writer_t* writer);
 
+/**
+ * Sets the size in bytes of the pages that the writer allocates to build maps
+ * and arrays.
+ *
+ * The default is @ref MPACK_BUILDER_PAGE_SIZE. Larger pages need fewer
+ * allocations when building large messages, while smaller pages waste less
+ * memory when building small ones.
+ *
+ * This cannot be changed while a map or array is being built. A page size
+ * that is too small to hold a build and the smallest write flags @ref
+ * mpack_error_bug.
+ *
+ * @param writer The MPack writer.
+ * @param page_size The size of builder pages.
+ */
+void mpack_writer_set_builder_page_size(struct mpack_writer_t* writer, size_t page_size);
+
 /**
  * Completes an array being built.
  *
@@ -1080,7 +1299,12 @@ MPACK_INLINE void mpack_finish_ext(mpack_writer_t* writer) {
  * mpack_finish_*() function if you want to finish a dynamic type.
  */
 MPACK_INLINE void mpack_finish_type(mpack_writer_t* writer, mpack_type_t type) {
-    mpack_writer_track_pop(writer, type);
+    if (type == mpack_type_array)
+        mpack_finish_array(writer);
+    else if (type == mpack_type_map)
+        mpack_finish_map(writer);
+    else
+        mpack_writer_track_pop(writer, type);
 }
 
 /**
@@ -30,10 +30,18 @@
 #define MPACK_H 1
 
 #include "mpack-common.h"
+#include "mpack-trace.h"
+#include "mpack-arena.h"
+#include "mpack-path.h"
 #include "mpack-writer.h"
 #include "mpack-reader.h"
+#include "mpack-event.h"
+#include "mpack-index.h"
+#include "mpack-query.h"
 #include "mpack-expect.h"
 #include "mpack-node.h"
+#include "mpack-doc.h"
+#include "mpack-json.h"
 
 #endif
 
@@ -0,0 +1,965 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * bench.c is a benchmark of the major components of MPack. It:
+ *
+ * - generates a set of deterministic workloads from a fixed seed: small RPC
+ *   messages, wide maps, numeric arrays, text-heavy documents and deeply
+ *   nested data;
+ * - encodes each workload with the Write API and with builders;
+ * - decodes each workload with the dynamic Reader API, with the Expect API
+ *   and with the Node API;
+ * - and finally, prints the throughput and per-operation latency percentiles
+ *   of each as JSON, so that runs can be compared.
+ *
+ * Usage: bench [-o results.json] [-t seconds] [filter]
+ *
+ * Only benchmarks whose name (e.g. "node/text") contains the filter are run.
+ * A summary table is printed to stderr.
+ */
+
+// We need clock_gettime()
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 199309L
+#endif
+
+#include "mpack/mpack.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#if !MPACK_READER || !MPACK_EXPECT || !MPACK_NODE || !MPACK_WRITER || !MPACK_BUILDER
+#error "The benchmark requires all features of MPack."
+#endif
+
+// The seed of the workload generator. Changing it changes the workloads, so
+// results are only comparable between runs with the same seed.
+#define BENCH_SEED 0x4d5061636b42656eULL
+
+#define BENCH_DEFAULT_SECONDS 0.25
+#define BENCH_MIN_ITERATIONS 16
+#define BENCH_MAX_SAMPLES 200000
+#define BENCH_WARMUP 4
+
+// The maximum length of any string in a workload
+#define BENCH_MAX_STR 4096
+
+#define BENCH_RPC_STRS 2
+#define BENCH_WIDE_COUNT 1024
+#define BENCH_NUMERIC_COUNT 2048
+#define BENCH_TEXT_DOCS 64
+#define BENCH_TEXT_TAGS 4
+#define BENCH_DEEP_DEPTH 256
+
+static volatile uint64_t bench_sink;
+
+
+
+/*
+ * Clock
+ */
+
+static uint64_t bench_now(void) {
+    #ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+    #else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+    #endif
+}
+
+
+
+/*
+ * Workload generation
+ */
+
+// A xorshift64* generator. We don't use rand() because its sequence differs
+// between platforms.
+static uint64_t bench_random_state;
+
+static uint64_t bench_random(void) {
+    bench_random_state ^= bench_random_state >> 12;
+    bench_random_state ^= bench_random_state << 25;
+    bench_random_state ^= bench_random_state >> 27;
+    return bench_random_state * 0x2545F4914F6CDD1DULL;
+}
+
+static uint32_t bench_random_range(uint32_t min, uint32_t max) {
+    return min + (uint32_t)(bench_random() % (uint64_t)(max - min + 1));
+}
+
+// Returns a random integer of random width, so that all int encodings are
+// exercised.
+static uint64_t bench_random_int(void) {
+    return bench_random() >> (bench_random() % 64);
+}
+
+static double bench_random_double(void) {
+    return (double)(bench_random() >> 11) / 9007199254740992.0 * 2000.0 - 1000.0;
+}
+
+typedef struct bench_str_t {
+    char* data;
+    uint32_t length;
+} bench_str_t;
+
+static const char* bench_words[] = {
+    "the", "of", "and", "message", "pack", "a", "to", "in", "is", "encoding",
+    "binary", "serialization", "format", "it", "lets", "you", "exchange",
+    "data", "among", "multiple", "languages", "like", "JSON", "but", "fast",
+    "small", "integers", "are", "encoded", "into", "single", "byte", "short",
+    "strings", "require", "only", "one", "extra", "besides", "themselves",
+    "caf\xc3\xa9", "na\xc3\xafve", "\xe6\x97\xa5\xe6\x9c\xac", "r\xc3\xa9sum\xc3\xa9",
+};
+
+static void bench_random_text(bench_str_t* str, uint32_t min, uint32_t max) {
+    uint32_t length = bench_random_range(min, max);
+    str->data = (char*)malloc(length + 1);
+    if (str->data == NULL)
+        abort();
+
+    uint32_t pos = 0;
+    while (pos < length) {
+        const char* word = bench_words[bench_random() % (sizeof(bench_words) / sizeof(*bench_words))];
+        size_t word_length = strlen(word);
+        if (pos + word_length + 1 > length)
+            break;
+        if (pos != 0)
+            str->data[pos++] = ' ';
+        memcpy(str->data + pos, word, word_length);
+        pos += (uint32_t)word_length;
+    }
+    str->data[pos] = '\0';
+    str->length = pos;
+}
+
+static void bench_random_token(bench_str_t* str, uint32_t length) {
+    static const char alphabet[] = "0123456789abcdef";
+    str->data = (char*)malloc(length + 1);
+    if (str->data == NULL)
+        abort();
+    uint32_t i;
+    for (i = 0; i < length; ++i)
+        str->data[i] = alphabet[bench_random() % 16];
+    str->data[length] = '\0';
+    str->length = length;
+}
+
+// The values from which a workload is encoded. These are generated up front
+// so that the Write benchmarks measure only encoding, and so that the Expect
+// benchmarks have something to match against.
+typedef struct bench_data_t {
+    uint64_t* ints;
+    double* reals;
+    bench_str_t* strs;
+    size_t int_count;
+    size_t real_count;
+    size_t str_count;
+} bench_data_t;
+
+static void bench_data_alloc(bench_data_t* data, size_t ints, size_t reals, size_t strs) {
+    data->ints = (uint64_t*)calloc(ints, sizeof(uint64_t));
+    data->reals = (double*)calloc(reals, sizeof(double));
+    data->strs = (bench_str_t*)calloc(strs, sizeof(bench_str_t));
+    if ((ints != 0 && data->ints == NULL) || (reals != 0 && data->reals == NULL) ||
+            (strs != 0 && data->strs == NULL))
+        abort();
+    data->int_count = ints;
+    data->real_count = reals;
+    data->str_count = strs;
+}
+
+static void bench_data_free(bench_data_t* data) {
+    size_t i;
+    for (i = 0; i < data->str_count; ++i)
+        free(data->strs[i].data);
+    free(data->ints);
+    free(data->reals);
+    free(data->strs);
+}
+
+// The Write and Builder benchmarks share the same encoding functions. When
+// building, maps and arrays are started without a count and completed with
+// mpack_complete_*().
+
+static void bench_start_map(mpack_writer_t* writer, uint32_t count, bool build) {
+    if (build)
+        mpack_build_map(writer);
+    else
+        mpack_start_map(writer, count);
+}
+
+static void bench_finish_map(mpack_writer_t* writer, bool build) {
+    if (build)
+        mpack_complete_map(writer);
+    else
+        mpack_finish_map(writer);
+}
+
+static void bench_start_array(mpack_writer_t* writer, uint32_t count, bool build) {
+    if (build)
+        mpack_build_array(writer);
+    else
+        mpack_start_array(writer, count);
+}
+
+static void bench_finish_array(mpack_writer_t* writer, bool build) {
+    if (build)
+        mpack_complete_array(writer);
+    else
+        mpack_finish_array(writer);
+}
+
+static void bench_write_str(mpack_writer_t* writer, const bench_str_t* str) {
+    mpack_write_str(writer, str->data, str->length);
+}
+
+// Each workload writes its data with the Write API and reads it back with the
+// Expect API. The Reader and Node benchmarks walk the data generically.
+typedef struct bench_workload_t {
+    const char* name;
+    void (*generate)(bench_data_t* data);
+    void (*write)(mpack_writer_t* writer, const bench_data_t* data, bool build);
+    uint64_t (*expect)(mpack_reader_t* reader, const bench_data_t* data);
+} bench_workload_t;
+
+// A small RPC request of around a hundred bytes
+
+static const char* bench_rpc_methods[] = {
+    "get", "put", "delete", "list", "subscribe", "unsubscribe", "ping", "status",
+};
+
+static void bench_rpc_generate(bench_data_t* data) {
+    bench_data_alloc(data, 3, 1, BENCH_RPC_STRS);
+    data->ints[0] = bench_random() % 100000;
+    data->ints[1] = bench_random_int();
+    data->ints[2] = bench_random();
+    data->reals[0] = bench_random_double();
+
+    const char* method = bench_rpc_methods[bench_random() % (sizeof(bench_rpc_methods) / sizeof(*bench_rpc_methods))];
+    data->strs[0].length = (uint32_t)strlen(method);
+    data->strs[0].data = (char*)malloc(data->strs[0].length + 1);
+    if (data->strs[0].data == NULL)
+        abort();
+    memcpy(data->strs[0].data, method, data->strs[0].length + 1);
+    bench_random_token(&data->strs[1], 32);
+}
+
+static void bench_rpc_write(mpack_writer_t* writer, const bench_data_t* data, bool build) {
+    bench_start_map(writer, 5, build);
+    mpack_write_cstr(writer, "jsonrpc");
+    mpack_write_cstr(writer, "2.0");
+    mpack_write_cstr(writer, "id");
+    mpack_write_u64(writer, data->ints[0]);
+    mpack_write_cstr(writer, "method");
+    bench_write_str(writer, &data->strs[0]);
+    mpack_write_cstr(writer, "params");
+    bench_start_map(writer, 3, build);
+        mpack_write_cstr(writer, "user");
+        mpack_write_u64(writer, data->ints[1]);
+        mpack_write_cstr(writer, "token");
+        bench_write_str(writer, &data->strs[1]);
+        mpack_write_cstr(writer, "flags");
+        bench_start_array(writer, 3, build);
+            mpack_write_bool(writer, (data->ints[2] & 1) != 0);
+            mpack_write_bool(writer, (data->ints[2] & 2) != 0);
+            mpack_write_bool(writer, (data->ints[2] & 4) != 0);
+        bench_finish_array(writer, build);
+    bench_finish_map(writer, build);
+    mpack_write_cstr(writer, "deadline");
+    mpack_write_double(writer, data->reals[0]);
+    bench_finish_map(writer, build);
+}
+
+static uint64_t bench_rpc_expect(mpack_reader_t* reader, const bench_data_t* data) {
+    char buf[64];
+    uint64_t sum = 0;
+    MPACK_UNUSED(data);
+
+    mpack_expect_map_match(reader, 5);
+    mpack_expect_cstr_match(reader, "jsonrpc");
+    mpack_expect_cstr_match(reader, "2.0");
+    mpack_expect_cstr_match(reader, "id");
+    sum += mpack_expect_u64(reader);
+    mpack_expect_cstr_match(reader, "method");
+    sum += mpack_expect_str_buf(reader, buf, sizeof(buf));
+    mpack_expect_cstr_match(reader, "params");
+    mpack_expect_map_match(reader, 3);
+        mpack_expect_cstr_match(reader, "user");
+        sum += mpack_expect_u64(reader);
+        mpack_expect_cstr_match(reader, "token");
+        sum += mpack_expect_str_buf(reader, buf, sizeof(buf));
+        mpack_expect_cstr_match(reader, "flags");
+        mpack_expect_array_match(reader, 3);
+            sum += mpack_expect_bool(reader);
+            sum += mpack_expect_bool(reader);
+            sum += mpack_expect_bool(reader);
+        mpack_done_array(reader);
+    mpack_done_map(reader);
+    mpack_expect_cstr_match(reader, "deadline");
+    sum += (uint64_t)mpack_expect_double(reader);
+    mpack_done_map(reader);
+    return sum;
+}
+
+// A wide map of a thousand fields of mixed types
+
+static void bench_wide_generate(bench_data_t* data) {
+    bench_data_alloc(data, BENCH_WIDE_COUNT, BENCH_WIDE_COUNT, BENCH_WIDE_COUNT * 2);
+    size_t i;
+    for (i = 0; i < BENCH_WIDE_COUNT; ++i) {
+        char key[32];
+        snprintf(key, sizeof(key), "field_%04u", (unsigned)i);
+        bench_str_t* str = &data->strs[i];
+        str->length = (uint32_t)strlen(key);
+        str->data = (char*)malloc(str->length + 1);
+        if (str->data == NULL)
+            abort();
+        memcpy(str->data, key, str->length + 1);
+
+        data->ints[i] = bench_random_int();
+        data->reals[i] = bench_random_double();
+        bench_random_text(&data->strs[BENCH_WIDE_COUNT + i], 8, 24);
+    }
+}
+
+static void bench_wide_write(mpack_writer_t* writer, const bench_data_t* data, bool build) {
+    size_t i;
+    bench_start_map(writer, BENCH_WIDE_COUNT, build);
+    for (i = 0; i < BENCH_WIDE_COUNT; ++i) {
+        bench_write_str(writer, &data->strs[i]);
+        switch (i % 4) {
+            case 0: mpack_write_u64(writer, data->ints[i]); break;
+            case 1: bench_write_str(writer, &data->strs[BENCH_WIDE_COUNT + i]); break;
+            case 2: mpack_write_double(writer, data->reals[i]); break;
+            default: mpack_write_bool(writer, (data->ints[i] & 1) != 0); break;
+        }
+    }
+    bench_finish_map(writer, build);
+}
+
+static uint64_t bench_wide_expect(mpack_reader_t* reader, const bench_data_t* data) {
+    char buf[64];
+    uint64_t sum = 0;
+    size_t i;
+
+    mpack_expect_map_match(reader, BENCH_WIDE_COUNT);
+    for (i = 0; i < BENCH_WIDE_COUNT; ++i) {
+        mpack_expect_str_match(reader, data->strs[i].data, data->strs[i].length);
+        switch (i % 4) {
+            case 0: sum += mpack_expect_u64(reader); break;
+            case 1: sum += mpack_expect_str_buf(reader, buf, sizeof(buf)); break;
+            case 2: sum += (uint64_t)mpack_expect_double(reader); break;
+            default: sum += mpack_expect_bool(reader); break;
+        }
+    }
+    mpack_done_map(reader);
+    return sum;
+}
+
+// Arrays of integers and doubles
+
+static void bench_numeric_generate(bench_data_t* data) {
+    bench_data_alloc(data, BENCH_NUMERIC_COUNT, BENCH_NUMERIC_COUNT, 0);
+    size_t i;
+    for (i = 0; i < BENCH_NUMERIC_COUNT; ++i) {
+        data->ints[i] = bench_random_int();
+        data->reals[i] = bench_random_double();
+    }
+}
+
+static void bench_numeric_write(mpack_writer_t* writer, const bench_data_t* data, bool build) {
+    size_t i;
+    bench_start_map(writer, 2, build);
+    mpack_write_cstr(writer, "ints");
+    bench_start_array(writer, BENCH_NUMERIC_COUNT, build);
+    for (i = 0; i < BENCH_NUMERIC_COUNT; ++i)
+        mpack_write_u64(writer, data->ints[i]);
+    bench_finish_array(writer, build);
+    mpack_write_cstr(writer, "reals");
+    bench_start_array(writer, BENCH_NUMERIC_COUNT, build);
+    for (i = 0; i < BENCH_NUMERIC_COUNT; ++i)
+        mpack_write_double(writer, data->reals[i]);
+    bench_finish_array(writer, build);
+    bench_finish_map(writer, build);
+}
+
+static uint64_t bench_numeric_expect(mpack_reader_t* reader, const bench_data_t* data) {
+    uint64_t sum = 0;
+    size_t i;
+    MPACK_UNUSED(data);
+
+    mpack_expect_map_match(reader, 2);
+    mpack_expect_cstr_match(reader, "ints");
+    mpack_expect_array_match(reader, BENCH_NUMERIC_COUNT);
+    for (i = 0; i < BENCH_NUMERIC_COUNT; ++i)
+        sum += mpack_expect_u64(reader);
+    mpack_done_array(reader);
+    mpack_expect_cstr_match(reader, "reals");
+    mpack_expect_array_match(reader, BENCH_NUMERIC_COUNT);
+    for (i = 0; i < BENCH_NUMERIC_COUNT; ++i)
+        sum += (uint64_t)mpack_expect_double(reader);
+    mpack_done_array(reader);
+    mpack_done_map(reader);
+    return sum;
+}
+
+// An array of documents with long text bodies
+
+#define BENCH_TEXT_TAG_BASE (BENCH_TEXT_DOCS * 2)
+
+static void bench_text_generate(bench_data_t* data) {
+    bench_data_alloc(data, BENCH_TEXT_DOCS, 0, BENCH_TEXT_DOCS * (2 + BENCH_TEXT_TAGS));
+    size_t i, j;
+    for (i = 0; i < BENCH_TEXT_DOCS; ++i) {
+        data->ints[i] = bench_random() % 2000000000u;
+        bench_random_text(&data->strs[i * 2], 20, 60);
+        bench_random_text(&data->strs[i * 2 + 1], 500, BENCH_MAX_STR - 1);
+        for (j = 0; j < BENCH_TEXT_TAGS; ++j)
+            bench_random_text(&data->strs[BENCH_TEXT_TAG_BASE + i * BENCH_TEXT_TAGS + j], 3, 12);
+    }
+}
+
+static void bench_text_write(mpack_writer_t* writer, const bench_data_t* data, bool build) {
+    size_t i, j;
+    bench_start_array(writer, BENCH_TEXT_DOCS, build);
+    for (i = 0; i < BENCH_TEXT_DOCS; ++i) {
+        bench_start_map(writer, 4, build);
+        mpack_write_cstr(writer, "date");
+        mpack_write_u64(writer, data->ints[i]);
+        mpack_write_cstr(writer, "title");
+        bench_write_str(writer, &data->strs[i * 2]);
+        mpack_write_cstr(writer, "body");
+        bench_write_str(writer, &data->strs[i * 2 + 1]);
+        mpack_write_cstr(writer, "tags");
+        bench_start_array(writer, BENCH_TEXT_TAGS, build);
+        for (j = 0; j < BENCH_TEXT_TAGS; ++j)
+            bench_write_str(writer, &data->strs[BENCH_TEXT_TAG_BASE + i * BENCH_TEXT_TAGS + j]);
+        bench_finish_array(writer, build);
+        bench_finish_map(writer, build);
+    }
+    bench_finish_array(writer, build);
+}
+
+static uint64_t bench_expect_text(mpack_reader_t* reader, char* buf, size_t size) {
+    mpack_expect_utf8_cstr(reader, buf, size);
+    return (uint8_t)buf[0];
+}
+
+static uint64_t bench_text_expect(mpack_reader_t* reader, const bench_data_t* data) {
+    char buf[BENCH_MAX_STR];
+    uint64_t sum = 0;
+    size_t i, j;
+    MPACK_UNUSED(data);
+
+    mpack_expect_array_match(reader, BENCH_TEXT_DOCS);
+    for (i = 0; i < BENCH_TEXT_DOCS; ++i) {
+        mpack_expect_map_match(reader, 4);
+        mpack_expect_cstr_match(reader, "date");
+        sum += mpack_expect_u64(reader);
+        mpack_expect_cstr_match(reader, "title");
+        sum += bench_expect_text(reader, buf, sizeof(buf));
+        mpack_expect_cstr_match(reader, "body");
+        sum += bench_expect_text(reader, buf, sizeof(buf));
+        mpack_expect_cstr_match(reader, "tags");
+        mpack_expect_array_match(reader, BENCH_TEXT_TAGS);
+        for (j = 0; j < BENCH_TEXT_TAGS; ++j)
+            sum += bench_expect_text(reader, buf, sizeof(buf));
+        mpack_done_array(reader);
+        mpack_done_map(reader);
+    }
+    mpack_done_array(reader);
+    return sum;
+}
+
+// Deeply nested maps
+
+static void bench_deep_generate(bench_data_t* data) {
+    bench_data_alloc(data, BENCH_DEEP_DEPTH, 0, BENCH_DEEP_DEPTH);
+    size_t i;
+    for (i = 0; i < BENCH_DEEP_DEPTH; ++i) {
+        data->ints[i] = bench_random_int();
+        bench_random_text(&data->strs[i], 4, 16);
+    }
+}
+
+static void bench_deep_write(mpack_writer_t* writer, const bench_data_t* data, bool build) {
+    size_t i;
+    for (i = 0; i < BENCH_DEEP_DEPTH; ++i) {
+        bench_start_map(writer, 3, build);
+        mpack_write_cstr(writer, "id");
+        mpack_write_u64(writer, data->ints[i]);
+        mpack_write_cstr(writer, "name");
+        bench_write_str(writer, &data->strs[i]);
+        mpack_write_cstr(writer, "child");
+    }
+    mpack_write_nil(writer);
+    for (i = 0; i < BENCH_DEEP_DEPTH; ++i)
+        bench_finish_map(writer, build);
+}
+
+static uint64_t bench_deep_expect(mpack_reader_t* reader, const bench_data_t* data) {
+    char buf[64];
+    uint64_t sum = 0;
+    size_t i;
+    MPACK_UNUSED(data);
+
+    for (i = 0; i < BENCH_DEEP_DEPTH; ++i) {
+        mpack_expect_map_match(reader, 3);
+        mpack_expect_cstr_match(reader, "id");
+        sum += mpack_expect_u64(reader);
+        mpack_expect_cstr_match(reader, "name");
+        sum += mpack_expect_str_buf(reader, buf, sizeof(buf));
+        mpack_expect_cstr_match(reader, "child");
+    }
+    mpack_expect_nil(reader);
+    for (i = 0; i < BENCH_DEEP_DEPTH; ++i)
+        mpack_done_map(reader);
+    return sum;
+}
+
+static const bench_workload_t bench_workloads[] = {
+    {"rpc",     bench_rpc_generate,     bench_rpc_write,     bench_rpc_expect},
+    {"wide",    bench_wide_generate,    bench_wide_write,    bench_wide_expect},
+    {"numeric", bench_numeric_generate, bench_numeric_write, bench_numeric_expect},
+    {"text",    bench_text_generate,    bench_text_write,    bench_text_expect},
+    {"deep",    bench_deep_generate,    bench_deep_write,    bench_deep_expect},
+};
+
+#define BENCH_WORKLOAD_COUNT (sizeof(bench_workloads) / sizeof(*bench_workloads))
+
+
+
+/*
+ * Operations
+ *
+ * Each operation encodes or decodes one message of a workload and returns a
+ * checksum, or false on error.
+ */
+
+typedef struct bench_context_t {
+    const bench_workload_t* workload;
+    bench_data_t data;
+    char* message;   // the encoded message
+    size_t size;     // the size of the encoded message
+    char* buffer;    // a buffer of the same size to encode into
+} bench_context_t;
+
+static bool bench_op_write(bench_context_t* context, uint64_t* sum) {
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, context->buffer, context->size);
+    context->workload->write(&writer, &context->data, false);
+    *sum += mpack_writer_buffer_used(&writer);
+    return mpack_writer_destroy(&writer) == mpack_ok;
+}
+
+static bool bench_op_build(bench_context_t* context, uint64_t* sum) {
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, context->buffer, context->size);
+    context->workload->write(&writer, &context->data, true);
+    *sum += mpack_writer_buffer_used(&writer);
+    return mpack_writer_destroy(&writer) == mpack_ok;
+}
+
+static uint64_t bench_read_element(mpack_reader_t* reader) {
+    mpack_tag_t tag = mpack_read_tag(reader);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return 0;
+
+    uint64_t sum = 0;
+    uint32_t i;
+    switch (mpack_tag_type(&tag)) {
+        case mpack_type_uint:   sum = mpack_tag_uint_value(&tag); break;
+        case mpack_type_int:    sum = (uint64_t)mpack_tag_int_value(&tag); break;
+        case mpack_type_bool:   sum = mpack_tag_bool_value(&tag); break;
+        case mpack_type_float:  sum = (uint64_t)mpack_tag_float_value(&tag); break;
+        case mpack_type_double: sum = (uint64_t)mpack_tag_double_value(&tag); break;
+
+        case mpack_type_str:
+        case mpack_type_bin:
+        #if MPACK_EXTENSIONS
+        case mpack_type_ext:
+        #endif
+            if (mpack_read_bytes_inplace(reader, tag.v.l) != NULL)
+                sum = tag.v.l;
+            #if MPACK_EXTENSIONS
+            if (mpack_tag_type(&tag) == mpack_type_ext)
+                mpack_done_ext(reader);
+            else
+            #endif
+            if (mpack_tag_type(&tag) == mpack_type_bin)
+                mpack_done_bin(reader);
+            else
+                mpack_done_str(reader);
+            break;
+
+        case mpack_type_array:
+            for (i = 0; i < tag.v.n; ++i)
+                sum += bench_read_element(reader);
+            mpack_done_array(reader);
+            break;
+
+        case mpack_type_map:
+            for (i = 0; i < tag.v.n; ++i) {
+                sum += bench_read_element(reader);
+                sum += bench_read_element(reader);
+            }
+            mpack_done_map(reader);
+            break;
+
+        default:
+            break;
+    }
+    return sum;
+}
+
+static bool bench_op_read(bench_context_t* context, uint64_t* sum) {
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, context->message, context->size);
+    *sum += bench_read_element(&reader);
+    return mpack_reader_destroy(&reader) == mpack_ok;
+}
+
+static bool bench_op_expect(bench_context_t* context, uint64_t* sum) {
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, context->message, context->size);
+    *sum += context->workload->expect(&reader, &context->data);
+    return mpack_reader_destroy(&reader) == mpack_ok;
+}
+
+static uint64_t bench_walk_node(mpack_node_t node) {
+    uint64_t sum = 0;
+    size_t i;
+    switch (mpack_node_type(node)) {
+        case mpack_type_uint:   sum = mpack_node_u64(node); break;
+        case mpack_type_int:    sum = (uint64_t)mpack_node_i64(node); break;
+        case mpack_type_bool:   sum = mpack_node_bool(node); break;
+        case mpack_type_float:  sum = (uint64_t)mpack_node_float(node); break;
+        case mpack_type_double: sum = (uint64_t)mpack_node_double(node); break;
+
+        case mpack_type_str:
+        case mpack_type_bin:
+        #if MPACK_EXTENSIONS
+        case mpack_type_ext:
+        #endif
+            if (mpack_node_data(node) != NULL)
+                sum = mpack_node_data_len(node);
+            break;
+
+        case mpack_type_array:
+            for (i = 0; i < mpack_node_array_length(node); ++i)
+                sum += bench_walk_node(mpack_node_array_at(node, i));
+            break;
+
+        case mpack_type_map:
+            for (i = 0; i < mpack_node_map_count(node); ++i) {
+                sum += bench_walk_node(mpack_node_map_key_at(node, i));
+                sum += bench_walk_node(mpack_node_map_value_at(node, i));
+            }
+            break;
+
+        default:
+            break;
+    }
+    return sum;
+}
+
+static bool bench_op_node(bench_context_t* context, uint64_t* sum) {
+    mpack_tree_t tree;
+    mpack_tree_init_data(&tree, context->message, context->size);
+    mpack_tree_parse(&tree);
+    *sum += bench_walk_node(mpack_tree_root(&tree));
+    return mpack_tree_destroy(&tree) == mpack_ok;
+}
+
+typedef struct bench_api_t {
+    const char* name;
+    bool (*op)(bench_context_t* context, uint64_t* sum);
+} bench_api_t;
+
+static const bench_api_t bench_apis[] = {
+    {"write",   bench_op_write},
+    {"builder", bench_op_build},
+    {"reader",  bench_op_read},
+    {"expect",  bench_op_expect},
+    {"node",    bench_op_node},
+};
+
+#define BENCH_API_COUNT (sizeof(bench_apis) / sizeof(*bench_apis))
+
+
+
+/*
+ * Measurement
+ */
+
+typedef struct bench_result_t {
+    const char* api;
+    const char* workload;
+    size_t bytes;
+    size_t iterations;
+    uint64_t total_ns;
+    uint64_t min_ns;
+    uint64_t p50_ns;
+    uint64_t p90_ns;
+    uint64_t p99_ns;
+    uint64_t max_ns;
+} bench_result_t;
+
+static int bench_compare_u64(const void* left, const void* right) {
+    uint64_t a = *(const uint64_t*)left;
+    uint64_t b = *(const uint64_t*)right;
+    return (a > b) - (a < b);
+}
+
+// Returns the sample at the given percentile of the sorted samples using the
+// nearest-rank method.
+static uint64_t bench_percentile(const uint64_t* samples, size_t count, double percentile) {
+    size_t rank = (size_t)(percentile / 100.0 * (double)count + 0.999999);
+    if (rank == 0)
+        rank = 1;
+    if (rank > count)
+        rank = count;
+    return samples[rank - 1];
+}
+
+static bool bench_run(bench_context_t* context, const bench_api_t* api,
+        double seconds, uint64_t* samples, bench_result_t* result)
+{
+    uint64_t sum = 0;
+    size_t i;
+
+    for (i = 0; i < BENCH_WARMUP; ++i) {
+        if (!api->op(context, &sum)) {
+            fprintf(stderr, "%s/%s failed!\n", api->name, context->workload->name);
+            return false;
+        }
+    }
+
+    uint64_t budget = (uint64_t)(seconds * 1e9);
+    uint64_t total = 0;
+    size_t count = 0;
+    while (count < BENCH_MAX_SAMPLES && (total < budget || count < BENCH_MIN_ITERATIONS)) {
+        uint64_t start = bench_now();
+        bool ok = api->op(context, &sum);
+        uint64_t elapsed = bench_now() - start;
+        if (!ok) {
+            fprintf(stderr, "%s/%s failed!\n", api->name, context->workload->name);
+            return false;
+        }
+        samples[count++] = elapsed;
+        total += elapsed;
+    }
+    bench_sink += sum;
+
+    qsort(samples, count, sizeof(*samples), bench_compare_u64);
+    result->api = api->name;
+    result->workload = context->workload->name;
+    result->bytes = context->size;
+    result->iterations = count;
+    result->total_ns = total;
+    result->min_ns = samples[0];
+    result->p50_ns = bench_percentile(samples, count, 50);
+    result->p90_ns = bench_percentile(samples, count, 90);
+    result->p99_ns = bench_percentile(samples, count, 99);
+    result->max_ns = samples[count - 1];
+    return true;
+}
+
+static bool bench_context_init(bench_context_t* context, const bench_workload_t* workload) {
+    memset(context, 0, sizeof(*context));
+    context->workload = workload;
+
+    // Each workload gets its own seed so that adding a workload doesn't
+    // change the others.
+    bench_random_state = BENCH_SEED ^ (uint64_t)(workload - bench_workloads + 1) * 0x9E3779B97F4A7C15ULL;
+    workload->generate(&context->data);
+
+    mpack_writer_t writer;
+    mpack_writer_init_growable(&writer, &context->message, &context->size);
+    workload->write(&writer, &context->data, false);
+    if (mpack_writer_destroy(&writer) != mpack_ok) {
+        fprintf(stderr, "failed to encode workload %s\n", workload->name);
+        return false;
+    }
+
+    context->buffer = (char*)malloc(context->size);
+    return context->buffer != NULL;
+}
+
+static void bench_context_destroy(bench_context_t* context) {
+    bench_data_free(&context->data);
+    MPACK_FREE(context->message);
+    free(context->buffer);
+}
+
+
+
+/*
+ * Output
+ */
+
+static double bench_mb_per_s(const bench_result_t* result) {
+    return (double)result->bytes * (double)result->iterations * 1e3 / (double)result->total_ns;
+}
+
+static double bench_ops_per_s(const bench_result_t* result) {
+    return (double)result->iterations * 1e9 / (double)result->total_ns;
+}
+
+static void bench_print_json(FILE* file, const bench_result_t* results, size_t count, double seconds) {
+    size_t i;
+    fprintf(file, "{\n");
+    fprintf(file, "  \"version\": \"%s\",\n", MPACK_VERSION_STRING);
+    fprintf(file, "  \"seed\": %llu,\n", (unsigned long long)BENCH_SEED);
+    fprintf(file, "  \"seconds\": %g,\n", seconds);
+    fprintf(file, "  \"config\": {\n");
+    fprintf(file, "    \"buffer_size\": %u,\n", (unsigned)MPACK_BUFFER_SIZE);
+    fprintf(file, "    \"node_page_size\": %u,\n", (unsigned)MPACK_NODE_PAGE_SIZE);
+    fprintf(file, "    \"builder_page_size\": %u,\n", (unsigned)MPACK_BUILDER_PAGE_SIZE);
+    fprintf(file, "    \"optimize_for_size\": %s,\n", MPACK_OPTIMIZE_FOR_SIZE ? "true" : "false");
+    fprintf(file, "    \"debug\": %s\n", MPACK_DEBUG ? "true" : "false");
+    fprintf(file, "  },\n");
+    fprintf(file, "  \"results\": [\n");
+    for (i = 0; i < count; ++i) {
+        const bench_result_t* result = &results[i];
+        fprintf(file, "    {\"api\": \"%s\", \"workload\": \"%s\", \"bytes\": %u, "
+                "\"iterations\": %u, \"mb_per_s\": %.3f, \"ops_per_s\": %.1f, "
+                "\"ns\": {\"mean\": %.1f, \"min\": %llu, \"p50\": %llu, "
+                "\"p90\": %llu, \"p99\": %llu, \"max\": %llu}}%s\n",
+                result->api, result->workload, (unsigned)result->bytes,
+                (unsigned)result->iterations, bench_mb_per_s(result), bench_ops_per_s(result),
+                (double)result->total_ns / (double)result->iterations,
+                (unsigned long long)result->min_ns, (unsigned long long)result->p50_ns,
+                (unsigned long long)result->p90_ns, (unsigned long long)result->p99_ns,
+                (unsigned long long)result->max_ns,
+                i + 1 == count ? "" : ",");
+    }
+    fprintf(file, "  ]\n");
+    fprintf(file, "}\n");
+}
+
+static void bench_print_summary(const bench_result_t* result) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s/%s", result->api, result->workload);
+    fprintf(stderr, "%-18s %8u B %10.1f MB/s %12llu %12llu %12llu ns\n",
+            name, (unsigned)result->bytes, bench_mb_per_s(result),
+            (unsigned long long)result->p50_ns, (unsigned long long)result->p90_ns,
+            (unsigned long long)result->p99_ns);
+}
+
+static void bench_usage(const char* program) {
+    fprintf(stderr, "Usage: %s [-o results.json] [-t seconds] [filter]\n", program);
+}
+
+int main(int argc, char** argv) {
+    const char* output = NULL;
+    const char* filter = NULL;
+    double seconds = BENCH_DEFAULT_SECONDS;
+    int i;
+
+    for (i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            seconds = strtod(argv[++i], NULL);
+        } else if (argv[i][0] == '-' || filter != NULL) {
+            bench_usage(argv[0]);
+            return EXIT_FAILURE;
+        } else {
+            filter = argv[i];
+        }
+    }
+
+    uint64_t* samples = (uint64_t*)malloc(BENCH_MAX_SAMPLES * sizeof(uint64_t));
+    bench_result_t* results = (bench_result_t*)malloc(
+            BENCH_WORKLOAD_COUNT * BENCH_API_COUNT * sizeof(bench_result_t));
+    if (samples == NULL || results == NULL)
+        abort();
+    size_t result_count = 0;
+    bool ok = true;
+
+    fprintf(stderr, "%-18s %10s %15s %12s %12s %12s\n",
+            "benchmark", "size", "throughput", "p50", "p90", "p99");
+
+    size_t w, a;
+    for (w = 0; ok && w < BENCH_WORKLOAD_COUNT; ++w) {
+        bench_context_t context;
+        if (!bench_context_init(&context, &bench_workloads[w])) {
+            bench_context_destroy(&context);
+            ok = false;
+            break;
+        }
+
+        for (a = 0; ok && a < BENCH_API_COUNT; ++a) {
+            char name[64];
+            snprintf(name, sizeof(name), "%s/%s", bench_apis[a].name, bench_workloads[w].name);
+            if (filter != NULL && strstr(name, filter) == NULL)
+                continue;
+
+            bench_result_t* result = &results[result_count];
+            ok = bench_run(&context, &bench_apis[a], seconds, samples, result);
+            if (ok) {
+                bench_print_summary(result);
+                ++result_count;
+            }
+        }
+
+        bench_context_destroy(&context);
+    }
+
+    if (ok) {
+        FILE* file = stdout;
+        if (output != NULL) {
+            file = fopen(output, "w");
+            if (file == NULL) {
+                fprintf(stderr, "failed to open %s\n", output);
+                ok = false;
+            }
+        }
+        if (file != NULL) {
+            bench_print_json(file, results, result_count, seconds);
+            if (file != stdout)
+                ok = fclose(file) == 0 && ok;
+            if (output != NULL)
+                fprintf(stderr, "Wrote %s\n", output);
+        }
+    }
+
+    free(samples);
+    free(results);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
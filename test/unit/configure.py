@@ -437,6 +437,9 @@ addBuild('optimize-size-release', allfeatures + allconfigs + cflags + sizeOptimi
 
 # miscellaneous special builds
 addBuild('notrack', allfeatures + allconfigs + cflags + debugflags + ["-DMPACK_NO_TRACKING=1"])
+addDebugReleaseBuilds('stats', allfeatures + allconfigs + cflags + ["-DMPACK_STATS=1"])
+addDebugReleaseBuilds('tracing', allfeatures + allconfigs + cflags + ["-DMPACK_TRACING=1"])
+addDebugReleaseBuilds('compact', allfeatures + allconfigs + cflags + ["-DMPACK_NODE_COMPACT=1"])
 addDebugReleaseBuilds('realloc', allfeatures + allconfigs + cflags + ["-DMPACK_REALLOC=test_realloc"])
 if not msvc and compiler != "TinyCC":
     addBuild('O3', allfeatures + allconfigs + cflags + ["-O3"])
@@ -470,6 +473,22 @@ elif compiler != "TinyCC":
 
 
 
+###################################################
+# Benchmark configuration
+###################################################
+
+# The benchmark is built once in release mode with MPack's default
+# configuration rather than the test harness configuration (which uses tiny
+# buffers and instrumented allocators.) It is not run as part of "all"; run
+# the "run-bench" target to write results to .build/unit/bench/results.json.
+bench_cppflags = [flag for flag in global_cppflags if flag not in
+        ["-Itest/unit/src", "-DMPACK_VARIANT_BUILDS=1", "-DMPACK_HAS_CONFIG=1"]]
+bench_cppflags += allfeatures + ["-DMPACK_STDLIB=1", "-DMPACK_STDIO=1"]
+bench_cppflags += cflags + releaseflags
+bench_ldflags = []
+
+
+
 ###################################################
 # Ninja generation
 ###################################################
@@ -564,6 +583,26 @@ with open(ninja, "w") as out:
                 out.write("--show-leak-kinds=all --errors-for-leak-kinds=all ")
         out.write("\n")
 
+    benchfolder = path.join(globalbuild, "bench")
+    benchobjs = []
+    benchsrcs = [src for src in srcs if src.startswith(path.join("src", "mpack"))]
+    benchsrcs.append(path.join("test", "bench", "bench.c"))
+    for src in benchsrcs:
+        obj = path.join(benchfolder, "objs", src[:-2] + obj_extension)
+        benchobjs.append(obj)
+        out.write("build " + obj + ": compile " + src + "\n")
+        out.write(" flags = " + " ".join(bench_cppflags) + "\n")
+    bench = path.join(benchfolder, "bench") + exe_extension
+    out.write("build " + bench + ": link " + " ".join(benchobjs) + "\n")
+    out.write(" flags = " + " ".join(bench_ldflags) + "\n")
+    out.write("build bench: phony " + bench + "\n\n")
+    out.write("rule bench\n")
+    out.write(" command = $in $flags\n")
+    out.write(" pool = run_pool\n")
+    out.write("build run-bench: bench " + bench + "\n")
+    out.write(" flags = -o " + path.join(benchfolder, "results.json") + "\n")
+    out.write("\n")
+
     out.write("default run-everything-debug\n")
     out.write("build default: phony run-everything-debug\n")
     out.write("\n")
@@ -610,6 +649,7 @@ with open(path.join(globalbuild, "help"), "w") as out:
     out.write("    all\n")
     out.write("    clean\n")
     out.write("    help\n")
+    out.write("    run-bench\n")
     out.write("\n")
     for build in sorted(builds.keys()):
         out.write("    run-" + build + "\n")
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "test-arena.h"
+#include "test-write.h"
+#include "test-node.h"
+
+#ifdef MPACK_MALLOC
+
+#define TEST_ARENA_CHUNK_SIZE 1024
+
+static void test_arena_alloc(void) {
+    mpack_arena_t arena;
+    mpack_arena_init(&arena, TEST_ARENA_CHUNK_SIZE, &test_allocator);
+    TEST_TRUE(test_allocator_active == 0);
+
+    // small blocks are aligned and share a chunk
+    char* first = (char*)mpack_arena_alloc(&arena, 1);
+    char* second = (char*)mpack_arena_alloc(&arena, 7);
+    TEST_TRUE(first != NULL && second != NULL);
+    TEST_TRUE(second > first && (size_t)(second - first) < 64);
+    TEST_TRUE((uintptr_t)second % sizeof(void*) == 0);
+    TEST_TRUE(test_allocator_active == 1);
+    size_t used = mpack_arena_used(&arena);
+    TEST_TRUE(used >= 8 && used < 64);
+
+    // a full chunk is replaced by a new one
+    size_t i;
+    for (i = 0; i < 8; ++i)
+        TEST_TRUE(mpack_arena_alloc(&arena, TEST_ARENA_CHUNK_SIZE / 8) != NULL);
+    TEST_TRUE(test_allocator_active == 2);
+
+    // large blocks get a chunk of their own
+    char* large = (char*)mpack_arena_alloc(&arena, TEST_ARENA_CHUNK_SIZE * 4);
+    TEST_TRUE(large != NULL);
+    mpack_memset(large, 0, TEST_ARENA_CHUNK_SIZE * 4);
+    TEST_TRUE(test_allocator_active == 3);
+
+    // a reset keeps only the current chunk
+    mpack_arena_reset(&arena);
+    TEST_TRUE(test_allocator_active == 1);
+    TEST_TRUE(mpack_arena_used(&arena) == 0);
+    TEST_TRUE(mpack_arena_alloc(&arena, 1) != NULL);
+    TEST_TRUE(test_allocator_active == 1);
+
+    mpack_arena_destroy(&arena);
+    TEST_TRUE(test_allocator_active == 0);
+}
+
+static void test_arena_realloc(void) {
+    mpack_arena_t arena;
+    mpack_arena_init(&arena, TEST_ARENA_CHUNK_SIZE, &test_allocator);
+    const mpack_allocator_t* allocator = mpack_arena_allocator(&arena);
+
+    // the most recent block grows in place
+    char* block = (char*)allocator->alloc_fn(allocator->context, 4);
+    mpack_memcpy(block, "abc", 4);
+    TEST_TRUE(allocator->realloc_fn(allocator->context, block, 4, 100) == block);
+    TEST_TRUE(mpack_arena_used(&arena) >= 100 && mpack_arena_used(&arena) < 120);
+
+    // other blocks are copied
+    TEST_TRUE(allocator->alloc_fn(allocator->context, 4) != NULL);
+    char* moved = (char*)allocator->realloc_fn(allocator->context, block, 4, 200);
+    TEST_TRUE(moved != NULL && moved != block);
+    TEST_TRUE(strcmp(moved, "abc") == 0);
+
+    // freeing does nothing
+    TEST_TRUE(allocator->free_fn == NULL);
+    mpack_allocator_free(allocator, moved);
+
+    mpack_arena_destroy(&arena);
+    TEST_TRUE(test_allocator_active == 0);
+}
+
+#if MPACK_NODE
+static void test_arena_tree(void) {
+    static const char test[] = "\x82\xa4""name\xa3""abc\xa4""tags\x93\x01\x02\x03";
+    mpack_arena_t arena;
+    mpack_arena_init(&arena, TEST_ARENA_CHUNK_SIZE, &test_allocator);
+
+    // node pages and allocated strings come from the arena
+    mpack_tree_t tree;
+    mpack_tree_init_data(&tree, test, sizeof(test) - 1);
+    mpack_tree_set_allocator(&tree, mpack_arena_allocator(&arena));
+    mpack_tree_parse(&tree);
+    char* name = mpack_node_cstr_alloc(mpack_node_map_cstr(mpack_tree_root(&tree), "name"), 16);
+    TEST_TRUE(name != NULL && strcmp(name, "abc") == 0);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+    TEST_TRUE(mpack_arena_used(&arena) > 0);
+    TEST_TRUE(test_allocator_active > 0);
+
+    // everything is released at once
+    mpack_arena_reset(&arena);
+    TEST_TRUE(mpack_arena_used(&arena) == 0);
+    mpack_arena_destroy(&arena);
+    TEST_TRUE(test_allocator_active == 0);
+}
+#endif
+
+#if MPACK_NODE && MPACK_WRITER
+static void test_arena_doc(void) {
+    static const char test[] = "\x81\xa4""name\xa3""abc";
+    mpack_arena_t arena;
+    mpack_arena_init(&arena, TEST_ARENA_CHUNK_SIZE, &test_allocator);
+    mpack_tree_t tree;
+    mpack_tree_init_data(&tree, test, sizeof(test) - 1);
+    mpack_tree_parse(&tree);
+
+    // the edits of the document come from the arena
+    mpack_doc_t doc;
+    mpack_doc_init(&doc, &tree);
+    mpack_doc_set_allocator(&doc, mpack_arena_allocator(&arena));
+    mpack_path_t path;
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, "name"));
+    mpack_doc_set(&doc, &path, "\xa3""xyz", 4);
+    TEST_TRUE(mpack_arena_used(&arena) > 0);
+
+    char buffer[16];
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    mpack_doc_write(&doc, &writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(memcmp(buffer, "\x81\xa4""name\xa3""xyz", 9) == 0);
+
+    // the allocator can't change after the first edit
+    TEST_BREAK((mpack_doc_set_allocator(&doc, NULL), true));
+    TEST_TRUE(mpack_doc_destroy(&doc) == mpack_error_bug);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // a document inherits the allocator of its tree
+    mpack_tree_init_data(&tree, test, sizeof(test) - 1);
+    mpack_tree_set_allocator(&tree, mpack_arena_allocator(&arena));
+    mpack_tree_parse(&tree);
+    mpack_doc_init(&doc, &tree);
+    size_t used = mpack_arena_used(&arena);
+    mpack_doc_set(&doc, &path, "\xa3""xyz", 4);
+    TEST_TRUE(mpack_arena_used(&arena) > used);
+    TEST_TRUE(mpack_doc_destroy(&doc) == mpack_ok);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    mpack_arena_destroy(&arena);
+    TEST_TRUE(test_allocator_active == 0);
+}
+#endif
+
+#if MPACK_WRITER
+static void test_arena_writer(void) {
+    mpack_arena_t arena;
+    mpack_arena_init(&arena, TEST_ARENA_CHUNK_SIZE, &test_allocator);
+
+    // the growable buffer and builder pages come from the arena
+    char* data;
+    size_t size;
+    mpack_writer_t writer;
+    mpack_writer_init_growable_allocator(&writer, &data, &size, mpack_arena_allocator(&arena));
+    #if MPACK_BUILDER
+    mpack_build_map(&writer);
+    #else
+    mpack_start_map(&writer, 2);
+    #endif
+    mpack_write_cstr(&writer, "name");
+    mpack_write_cstr(&writer, lipsum);
+    mpack_write_cstr(&writer, "id");
+    mpack_write_u32(&writer, 12345);
+    #if MPACK_BUILDER
+    mpack_complete_map(&writer);
+    #else
+    mpack_finish_map(&writer);
+    #endif
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(data != NULL && size > strlen(lipsum));
+    TEST_TRUE(data[0] == '\x82');
+
+    mpack_arena_destroy(&arena);
+    TEST_TRUE(test_allocator_active == 0);
+}
+#endif
+
+void test_arena(void) {
+    test_arena_alloc();
+    test_arena_realloc();
+    #if MPACK_NODE
+    test_arena_tree();
+    #endif
+    #if MPACK_NODE && MPACK_WRITER
+    test_arena_doc();
+    #endif
+    #if MPACK_WRITER
+    test_arena_writer();
+    #endif
+}
+
+#endif
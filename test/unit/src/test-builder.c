@@ -419,6 +419,46 @@ static void test_builder_resolve_error(void) {
     TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_too_big);
 }
 
+static size_t test_builder_page_count(size_t page_size) {
+    static char buf[1024];
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_writer_set_allocator(&writer, &test_allocator);
+    mpack_writer_set_builder_page_size(&writer, page_size);
+
+    mpack_build_array(&writer);
+    size_t i;
+    for (i = 0; i < 1000; ++i)
+        mpack_write_nil(&writer);
+    size_t pages = test_allocator_active;
+    mpack_complete_array(&writer);
+
+    size_t used = mpack_writer_buffer_used(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(test_allocator_active == 0);
+    TEST_TRUE(used == 3 + 1000);
+    TEST_TRUE(0 == memcmp(buf, "\xdc\x03\xe8\xc0", 4));
+    return pages;
+}
+
+static void test_builder_page_size(void) {
+    size_t pages = test_builder_page_count(MPACK_BUILDER_PAGE_SIZE);
+    TEST_TRUE(pages > 1);
+    TEST_TRUE(test_builder_page_count(4096) == 1);
+
+    // the page size must be large enough and cannot change during a build
+    static char buf[16];
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    TEST_BREAK((mpack_writer_set_builder_page_size(&writer, 1), true));
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
+
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_build_array(&writer);
+    TEST_BREAK((mpack_writer_set_builder_page_size(&writer, 4096), true));
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
+}
+
 void test_builder(void) {
     test_builder_basic();
     test_builder_repeat();
@@ -428,5 +468,6 @@ void test_builder(void) {
     test_builder_content();
     test_builder_strings();
     test_builder_resolve_error();
+    test_builder_page_size();
 }
 #endif
@@ -491,6 +491,27 @@ static void test_shorten_raw_double_to_float(void) {
     #endif
 }
 
+static void test_hash_data(void) {
+    TEST_TRUE(mpack_hash_data("", 0, 0) == MPACK_UINT64_C(0xef46db3751d8e999));
+    TEST_TRUE(mpack_hash_data("a", 1, 0) == MPACK_UINT64_C(0xd24ec4f1a98c6e5b));
+    TEST_TRUE(mpack_hash_data("abc", 3, 0) == MPACK_UINT64_C(0x44bc2cf5ad770999));
+
+    // long enough to use all four lanes, with a tail
+    char data[100];
+    size_t i;
+    for (i = 0; i < sizeof(data); ++i)
+        data[i] = (char)i;
+    TEST_TRUE(mpack_hash_data(data, sizeof(data), 0) == MPACK_UINT64_C(0x6ac1e58032166597));
+    TEST_TRUE(mpack_hash_data(data, sizeof(data), 12345) == MPACK_UINT64_C(0x028ba1ae2de4de27));
+
+    // hashing incrementally gives the same result
+    mpack_hasher_t hasher;
+    mpack_hasher_init(&hasher, 12345);
+    for (i = 0; i < sizeof(data); i += 7)
+        mpack_hasher_update(&hasher, data + i, i + 7 > sizeof(data) ? sizeof(data) - i : 7);
+    TEST_TRUE(mpack_hasher_finish(&hasher) == MPACK_UINT64_C(0x028ba1ae2de4de27));
+}
+
 void test_common() {
     test_tags_special();
     test_tags_simple();
@@ -500,5 +521,6 @@ void test_common() {
     test_strings();
     test_utf8_check();
     test_shorten_raw_double_to_float();
+    test_hash_data();
 }
 
@@ -0,0 +1,369 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "test-doc.h"
+#include "test-node.h"
+#include "test-write.h"
+
+#if MPACK_NODE && MPACK_WRITER && defined(MPACK_MALLOC)
+
+// {"a":1,"b":[1,2,3],"c":{"d":"x"}}, with the 3 not in its smallest encoding
+static const char test_doc_data[] = "\x83\xa1""a\x01\xa1""b\x93\x01\x02\xcc\x03\xa1""c\x81\xa1""d\xa1""x";
+
+static mpack_node_data_t pool[32];
+
+static void test_doc_parse(mpack_tree_t* tree, bool spans) {
+    mpack_tree_init_pool(tree, test_doc_data, sizeof(test_doc_data) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_set_spans(tree, spans);
+    mpack_tree_parse(tree);
+}
+
+static void test_doc_check(mpack_doc_t* doc, const char* expected, size_t length) {
+    char buffer[64];
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    mpack_doc_write(doc, &writer);
+    size_t used = mpack_writer_buffer_used(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(used == length, "wrote %i bytes, expected %i", (int)used, (int)length);
+    TEST_TRUE(mpack_memcmp(buffer, expected, length) == 0, "written bytes do not match");
+}
+
+static void test_doc_set_cstr(mpack_doc_t* doc, const char* expression, const char* value, size_t length) {
+    mpack_path_t path;
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, expression));
+    mpack_doc_set(doc, &path, value, length);
+}
+
+static mpack_error_t test_doc_remove_cstr(mpack_doc_t* doc, const char* expression) {
+    mpack_path_t path;
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, expression));
+    mpack_doc_remove(doc, &path);
+    return mpack_doc_error(doc);
+}
+
+static void test_doc_unedited(void) {
+    mpack_tree_t tree;
+    mpack_doc_t doc;
+
+    test_doc_parse(&tree, true);
+    mpack_doc_init(&doc, &tree);
+    test_doc_check(&doc, test_doc_data, sizeof(test_doc_data) - 1);
+    TEST_TRUE(mpack_doc_destroy(&doc) == mpack_ok);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+}
+
+static void test_doc_spans(void) {
+    mpack_tree_t tree;
+    mpack_doc_t doc;
+
+    // with spans, the untouched array is copied as is
+    test_doc_parse(&tree, true);
+    mpack_doc_init(&doc, &tree);
+    test_doc_set_cstr(&doc, "a", "\x05", 1);
+    test_doc_check(&doc, "\x83\xa1""a\x05\xa1""b\x93\x01\x02\xcc\x03\xa1""c\x81\xa1""d\xa1""x", 18);
+    TEST_TRUE(mpack_doc_destroy(&doc) == mpack_ok);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // without spans, it is re-encoded
+    test_doc_parse(&tree, false);
+    mpack_doc_init(&doc, &tree);
+    test_doc_set_cstr(&doc, "a", "\x05", 1);
+    test_doc_check(&doc, "\x83\xa1""a\x05\xa1""b\x93\x01\x02\x03\xa1""c\x81\xa1""d\xa1""x", 17);
+    TEST_TRUE(mpack_doc_destroy(&doc) == mpack_ok);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+}
+
+static void test_doc_edits(void) {
+    mpack_tree_t tree;
+    mpack_doc_t doc;
+    mpack_path_t path;
+
+    test_doc_parse(&tree, true);
+    mpack_doc_init(&doc, &tree);
+
+    test_doc_remove_cstr(&doc, "a");
+    test_doc_set_cstr(&doc, "e", "\xc3", 1);
+    test_doc_remove_cstr(&doc, "missing");
+
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, "b[0]"));
+    mpack_doc_insert(&doc, &path, "\x00", 1);
+    test_doc_set_cstr(&doc, "b[1]", "\x14", 1);
+    test_doc_remove_cstr(&doc, "b[2]");
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, "b"));
+    mpack_doc_append(&doc, &path, "\x04", 1);
+
+    test_doc_set_cstr(&doc, "c.d", "\xa1""y", 2);
+    TEST_TRUE(mpack_doc_edit_count(&doc) == 8);
+
+    // the document can be written more than once
+    static const char expected[] = "\x83\xa1""b\x94\x00\x01\x14\x04\xa1""c\x81\xa1""d\xa1""y\xa1""e\xc3";
+    test_doc_check(&doc, expected, sizeof(expected) - 1);
+    test_doc_check(&doc, expected, sizeof(expected) - 1);
+
+    TEST_TRUE(mpack_doc_destroy(&doc) == mpack_ok);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // the last edit of a key wins, and edits within replaced values are ignored
+    test_doc_parse(&tree, true);
+    mpack_doc_init(&doc, &tree);
+    test_doc_set_cstr(&doc, "a", "\x05", 1);
+    test_doc_remove_cstr(&doc, "a");
+    test_doc_set_cstr(&doc, "a", "\x06", 1);
+    test_doc_set_cstr(&doc, "c.d", "\xa1""y", 2);
+    test_doc_set_cstr(&doc, "c", "\xc0", 1);
+    test_doc_check(&doc, "\x83\xa1""a\x06\xa1""b\x93\x01\x02\xcc\x03\xa1""c\xc0", 14);
+    TEST_TRUE(mpack_doc_destroy(&doc) == mpack_ok);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // an empty path replaces the whole message
+    test_doc_parse(&tree, true);
+    mpack_doc_init(&doc, &tree);
+    test_doc_set_cstr(&doc, "a", "\x05", 1);
+    test_doc_set_cstr(&doc, "", "\x91\xc2", 2);
+    test_doc_check(&doc, "\x91\xc2", 2);
+    TEST_TRUE(mpack_doc_destroy(&doc) == mpack_ok);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+}
+
+// the document's memory comes from the tree's allocator
+static void test_doc_allocator(void) {
+    mpack_tree_t tree;
+    mpack_doc_t doc;
+
+    mpack_tree_init_pool(&tree, test_doc_data, sizeof(test_doc_data) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_set_allocator(&tree, &test_allocator);
+    mpack_tree_set_spans(&tree, true);
+    mpack_tree_parse(&tree);
+    size_t active = test_allocator_active;
+
+    mpack_doc_init(&doc, &tree);
+    test_doc_set_cstr(&doc, "a", "\x05", 1);
+    test_doc_set_cstr(&doc, "c.d", "\xa1""y", 2);
+    TEST_TRUE(test_allocator_active > active);
+    test_doc_check(&doc, "\x83\xa1""a\x05\xa1""b\x93\x01\x02\xcc\x03\xa1""c\x81\xa1""d\xa1""y", 18);
+    TEST_TRUE(mpack_doc_destroy(&doc) == mpack_ok);
+    TEST_TRUE(test_allocator_active == active);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+}
+
+static void test_doc_errors(void) {
+    mpack_tree_t tree;
+    mpack_doc_t doc;
+    mpack_path_t path;
+
+    // missing path
+    test_doc_parse(&tree, true);
+    mpack_doc_init(&doc, &tree);
+    test_doc_set_cstr(&doc, "x.y", "\x01", 1);
+    TEST_TRUE(mpack_doc_destroy(&doc) == mpack_error_data);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // index out of range
+    test_doc_parse(&tree, true);
+    mpack_doc_init(&doc, &tree);
+    test_doc_set_cstr(&doc, "b[3]", "\x01", 1);
+    TEST_TRUE(mpack_doc_destroy(&doc) == mpack_error_data);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // wrong types
+    test_doc_parse(&tree, true);
+    mpack_doc_init(&doc, &tree);
+    test_doc_set_cstr(&doc, "b.x", "\x01", 1);
+    TEST_TRUE(mpack_doc_destroy(&doc) == mpack_error_type);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    test_doc_parse(&tree, true);
+    mpack_doc_init(&doc, &tree);
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, "c.d"));
+    mpack_doc_insert(&doc, &path, "\x01", 1);
+    TEST_TRUE(mpack_doc_destroy(&doc) == mpack_error_type);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // errors are flagged on the writer
+    test_doc_parse(&tree, true);
+    mpack_doc_init(&doc, &tree);
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, "c"));
+    mpack_doc_append(&doc, &path, "\x01", 1);
+    TEST_TRUE(mpack_doc_error(&doc) == mpack_error_type);
+    char buffer[16];
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    mpack_doc_write(&doc, &writer);
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_type);
+    TEST_TRUE(mpack_doc_destroy(&doc) == mpack_error_type);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // wildcards cannot be edited
+    test_doc_parse(&tree, true);
+    mpack_doc_init(&doc, &tree);
+    TEST_BREAK(test_doc_remove_cstr(&doc, "b[*]") == mpack_error_bug);
+    TEST_TRUE(mpack_doc_destroy(&doc) == mpack_error_bug);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+}
+
+// Checks that the diff between two messages is the expected delta, and that
+// patching the first message with the delta produces the second.
+static void test_doc_diff_check(const char* to_data, size_t to_size, const char* expected, size_t length) {
+    mpack_node_data_t to_pool[32];
+    mpack_node_data_t delta_pool[32];
+    mpack_tree_t from, to, delta;
+    char buffer[64];
+
+    test_doc_parse(&from, true);
+    mpack_tree_init_pool(&to, to_data, to_size, to_pool, sizeof(to_pool) / sizeof(*to_pool));
+    mpack_tree_set_spans(&to, true);
+    mpack_tree_parse(&to);
+
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    mpack_node_diff(&writer, mpack_tree_root(&from), mpack_tree_root(&to));
+    size_t used = mpack_writer_buffer_used(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(used == length, "wrote %i bytes, expected %i", (int)used, (int)length);
+    TEST_TRUE(mpack_memcmp(buffer, expected, length) == 0, "delta does not match");
+
+    mpack_tree_init_pool(&delta, buffer, used, delta_pool, sizeof(delta_pool) / sizeof(*delta_pool));
+    mpack_tree_parse(&delta);
+    mpack_doc_t doc;
+    mpack_doc_init(&doc, &from);
+    mpack_doc_patch(&doc, mpack_tree_root(&delta));
+    test_doc_check(&doc, to_data, to_size);
+    TEST_TRUE(mpack_doc_destroy(&doc) == mpack_ok);
+
+    TEST_TREE_DESTROY_NOERROR(&delta);
+    TEST_TREE_DESTROY_NOERROR(&to);
+    TEST_TREE_DESTROY_NOERROR(&from);
+}
+
+static void test_doc_diff(void) {
+    // identical messages
+    test_doc_diff_check(test_doc_data, sizeof(test_doc_data) - 1, "\x90", 1);
+
+    // a change to a nested value
+    static const char nested[] = "\x83\xa1""a\x01\xa1""b\x93\x01\x02\xcc\x03\xa1""c\x81\xa1""d\xa1""y";
+    test_doc_diff_check(nested, sizeof(nested) - 1, "\x91\x93\x00\x92\xa1""c\xa1""d\xa1""y", 10);
+
+    // a removed key, an array splice and an added key
+    static const char edited[] = "\x83\xa1""b\x94\x00\x01\x02\x03\xa1""c\x81\xa1""d\xa1""x\xa1""e\xc3";
+    static const char delta[] = "\x93\x92\x01\x91\xa1""a\x95\x02\x91\xa1""b\x00\x00\x91\x00\x93\x00\x91\xa1""e\xc3";
+    test_doc_diff_check(edited, sizeof(edited) - 1, delta, sizeof(delta) - 1);
+
+    // a different type of root is replaced
+    test_doc_diff_check("\x01", 1, "\x91\x93\x00\x90\x01", 5);
+
+    // malformed deltas are flagged on the document
+    mpack_node_data_t delta_pool[8];
+    mpack_tree_t tree, bad;
+    mpack_doc_t doc;
+    test_doc_parse(&tree, true);
+    mpack_tree_init_pool(&bad, "\x91\x92\x07\x90", 4, delta_pool, sizeof(delta_pool) / sizeof(*delta_pool));
+    mpack_tree_parse(&bad);
+    mpack_doc_init(&doc, &tree);
+    mpack_doc_patch(&doc, mpack_tree_root(&bad));
+    TEST_TRUE(mpack_doc_destroy(&doc) == mpack_error_data);
+    TEST_TREE_DESTROY_NOERROR(&bad);
+
+    mpack_tree_init_pool(&bad, "\x91\x93\x00\x91\xc0\x01", 6, delta_pool, sizeof(delta_pool) / sizeof(*delta_pool));
+    mpack_tree_parse(&bad);
+    mpack_doc_init(&doc, &tree);
+    mpack_doc_patch(&doc, mpack_tree_root(&bad));
+    TEST_TRUE(mpack_doc_destroy(&doc) == mpack_error_data);
+    TEST_TREE_DESTROY_ERROR(&bad, mpack_error_type);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+}
+
+// Diffs nested arrays that differ only in their innermost value. The arrays
+// below the root have no spans so they must be compared element by element.
+static void test_doc_diff_deep(void) {
+    size_t depth = 200000;
+    char* from_data = (char*)MPACK_MALLOC(depth + 1);
+    char* to_data = (char*)MPACK_MALLOC(depth + 1);
+    TEST_TRUE(from_data != NULL && to_data != NULL);
+    if (from_data == NULL || to_data == NULL) {
+        if (from_data)
+            MPACK_FREE(from_data);
+        if (to_data)
+            MPACK_FREE(to_data);
+        return;
+    }
+    mpack_memset(from_data, 0x91, depth);
+    mpack_memset(to_data, 0x91, depth);
+    from_data[depth] = (char)0xc0;
+    to_data[depth] = (char)0xc3;
+
+    mpack_tree_t from, to;
+    mpack_tree_init_data(&from, from_data, depth + 1);
+    mpack_tree_parse(&from);
+    mpack_tree_init_data(&to, to_data, depth + 1);
+    mpack_tree_parse(&to);
+
+    // identical values produce an empty delta
+    char* buffer;
+    size_t used;
+    mpack_writer_t writer;
+    mpack_writer_init_growable(&writer, &buffer, &used);
+    mpack_node_diff(&writer, mpack_tree_root(&from), mpack_tree_root(&from));
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(used == 1 && buffer[0] == '\x90', "identical values should have an empty delta");
+    MPACK_FREE(buffer);
+
+    // patching with the delta reproduces the new message
+    mpack_writer_init_growable(&writer, &buffer, &used);
+    mpack_node_diff(&writer, mpack_tree_root(&from), mpack_tree_root(&to));
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+
+    mpack_tree_t delta;
+    mpack_tree_init_data(&delta, buffer, used);
+    mpack_tree_parse(&delta);
+    mpack_doc_t doc;
+    mpack_doc_init(&doc, &from);
+    mpack_doc_patch(&doc, mpack_tree_root(&delta));
+
+    char* patched;
+    size_t patched_size;
+    mpack_writer_init_growable(&writer, &patched, &patched_size);
+    mpack_doc_write(&doc, &writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(mpack_doc_destroy(&doc) == mpack_ok);
+    TEST_TRUE(patched_size == depth + 1 && mpack_memcmp(patched, to_data, depth + 1) == 0,
+            "patched message does not match");
+    MPACK_FREE(patched);
+
+    TEST_TREE_DESTROY_NOERROR(&delta);
+    MPACK_FREE(buffer);
+    TEST_TREE_DESTROY_NOERROR(&to);
+    TEST_TREE_DESTROY_NOERROR(&from);
+    MPACK_FREE(to_data);
+    MPACK_FREE(from_data);
+}
+
+void test_doc(void) {
+    test_doc_unedited();
+    test_doc_spans();
+    test_doc_edits();
+    test_doc_allocator();
+    test_doc_errors();
+    test_doc_diff();
+    test_doc_diff_deep();
+}
+
+#endif
@@ -0,0 +1,287 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "test-event.h"
+#include "test-reader.h"
+
+#if MPACK_READER
+
+static const char test_event_data[] =
+        "\x82\xa1""a\x93\x01\xa2""xy\xc0\xa1""b\x80";
+
+static void test_event_check(mpack_event_parser_t* parser, mpack_event_type_t type,
+        mpack_type_t tag_type, size_t depth, bool key)
+{
+    mpack_event_t event;
+    TEST_TRUE(mpack_event_next(parser, &event), "expected an event");
+    TEST_TRUE(event.type == type, "event type is %i, expected %i", (int)event.type, (int)type);
+    TEST_TRUE(mpack_tag_type(&event.tag) == tag_type, "tag type is %s, expected %s",
+            mpack_type_to_string(mpack_tag_type(&event.tag)), mpack_type_to_string(tag_type));
+    TEST_TRUE(event.depth == depth, "event depth is %i, expected %i", (int)event.depth, (int)depth);
+    TEST_TRUE(event.key == key);
+}
+
+static void test_event_next(void) {
+    mpack_reader_t reader;
+    TEST_READER_INIT_STR(&reader, test_event_data);
+
+    mpack_event_frame_t stack[2];
+    mpack_event_parser_t parser;
+    mpack_event_parser_init(&parser, &reader, stack, sizeof(stack) / sizeof(*stack));
+
+    mpack_event_t event;
+    test_event_check(&parser, mpack_event_start_map, mpack_type_map, 0, false);
+    test_event_check(&parser, mpack_event_value, mpack_type_str, 1, true);
+    test_event_check(&parser, mpack_event_start_array, mpack_type_array, 1, false);
+    TEST_TRUE(mpack_event_parser_depth(&parser) == 2);
+
+    TEST_TRUE(mpack_event_next(&parser, &event));
+    TEST_TRUE(mpack_tag_equal(event.tag, mpack_tag_uint(1)));
+    TEST_TRUE(event.data == NULL);
+
+    // strings are passed in-place from the buffer
+    TEST_TRUE(mpack_event_next(&parser, &event));
+    TEST_TRUE(mpack_tag_equal(event.tag, mpack_tag_str(2)));
+    TEST_TRUE(event.data == test_event_data + 6);
+
+    test_event_check(&parser, mpack_event_value, mpack_type_nil, 2, false);
+    test_event_check(&parser, mpack_event_finish_array, mpack_type_array, 1, false);
+    test_event_check(&parser, mpack_event_value, mpack_type_str, 1, true);
+    test_event_check(&parser, mpack_event_start_map, mpack_type_map, 1, false);
+    test_event_check(&parser, mpack_event_finish_map, mpack_type_map, 1, false);
+    TEST_TRUE(!mpack_event_parser_complete(&parser));
+    test_event_check(&parser, mpack_event_finish_map, mpack_type_map, 0, false);
+    TEST_TRUE(mpack_event_parser_complete(&parser));
+    TEST_TRUE(mpack_event_parser_depth(&parser) == 0);
+
+    TEST_TRUE(!mpack_event_next(&parser, &event));
+    TEST_READER_DESTROY_NOERROR(&reader);
+}
+
+static void test_event_multiple_messages(void) {
+    mpack_reader_t reader;
+    TEST_READER_INIT_STR(&reader, "\x01\x90\xc3");
+
+    mpack_event_parser_t parser;
+    mpack_event_t event;
+
+    // a scalar message doesn't need a stack
+    mpack_event_parser_init(&parser, &reader, NULL, 0);
+    TEST_TRUE(mpack_event_next(&parser, &event));
+    TEST_TRUE(mpack_tag_equal(event.tag, mpack_tag_uint(1)));
+    TEST_TRUE(!mpack_event_next(&parser, &event));
+
+    mpack_event_frame_t frame;
+    mpack_event_parser_init(&parser, &reader, &frame, 1);
+    test_event_check(&parser, mpack_event_start_array, mpack_type_array, 0, false);
+    test_event_check(&parser, mpack_event_finish_array, mpack_type_array, 0, false);
+    TEST_TRUE(!mpack_event_next(&parser, &event));
+
+    mpack_event_parser_init(&parser, &reader, &frame, 1);
+    TEST_TRUE(mpack_event_next(&parser, &event));
+    TEST_TRUE(mpack_tag_equal(event.tag, mpack_tag_true()));
+    TEST_TRUE(!mpack_event_next(&parser, &event));
+
+    TEST_READER_DESTROY_NOERROR(&reader);
+}
+
+static void test_event_errors(void) {
+    mpack_reader_t reader;
+    mpack_event_frame_t stack[2];
+    mpack_event_parser_t parser;
+    mpack_event_t event;
+
+    // nesting deeper than the stack
+    TEST_READER_INIT_STR(&reader, "\x91\x91\x91\xc0");
+    mpack_event_parser_init(&parser, &reader, stack, 2);
+    TEST_TRUE(mpack_event_next(&parser, &event));
+    TEST_TRUE(mpack_event_next(&parser, &event));
+    TEST_TRUE(!mpack_event_next(&parser, &event));
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_too_big);
+
+    // truncated data
+    TEST_READER_INIT_STR(&reader, "\x92\xa3""ab");
+    mpack_event_parser_init(&parser, &reader, stack, 2);
+    TEST_TRUE(mpack_event_next(&parser, &event));
+    TEST_TRUE(!mpack_event_next(&parser, &event));
+    TEST_TRUE(!mpack_event_next(&parser, &event));
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_invalid);
+
+    // invalid data
+    TEST_READER_INIT_STR(&reader, "\x91\xc1");
+    mpack_event_parser_init(&parser, &reader, stack, 2);
+    TEST_TRUE(mpack_event_next(&parser, &event));
+    TEST_TRUE(!mpack_event_next(&parser, &event));
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_invalid);
+}
+
+typedef struct test_event_counts_t {
+    mpack_reader_t* reader;
+    int values;
+    int strings;
+    int arrays;
+    int maps;
+    int finished;
+    size_t max_depth;
+} test_event_counts_t;
+
+static void test_event_value(void* context, const mpack_event_t* event) {
+    test_event_counts_t* counts = (test_event_counts_t*)context;
+    ++counts->values;
+    if (event->tag.type == mpack_type_str)
+        ++counts->strings;
+    if (event->depth > counts->max_depth)
+        counts->max_depth = event->depth;
+}
+
+static void test_event_start_array(void* context, const mpack_event_t* event) {
+    MPACK_UNUSED(event);
+    ++((test_event_counts_t*)context)->arrays;
+}
+
+static void test_event_start_map(void* context, const mpack_event_t* event) {
+    MPACK_UNUSED(event);
+    ++((test_event_counts_t*)context)->maps;
+}
+
+static void test_event_finish(void* context, const mpack_event_t* event) {
+    MPACK_UNUSED(event);
+    ++((test_event_counts_t*)context)->finished;
+}
+
+static void test_event_stop(void* context, const mpack_event_t* event) {
+    test_event_counts_t* counts = (test_event_counts_t*)context;
+    ++counts->values;
+    if (event->key)
+        mpack_reader_flag_error(counts->reader, mpack_error_data);
+}
+
+static void test_event_callbacks(void) {
+    mpack_event_callbacks_t callbacks;
+    mpack_memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.value = test_event_value;
+    callbacks.start_array = test_event_start_array;
+    callbacks.start_map = test_event_start_map;
+    callbacks.finish_array = test_event_finish;
+    callbacks.finish_map = test_event_finish;
+
+    mpack_reader_t reader;
+    mpack_event_frame_t stack[2];
+    test_event_counts_t counts;
+
+    mpack_memset(&counts, 0, sizeof(counts));
+    TEST_READER_INIT_STR(&reader, test_event_data);
+    TEST_TRUE(mpack_ok == mpack_event_parse(&reader, stack, 2, &callbacks, &counts));
+    TEST_READER_DESTROY_NOERROR(&reader);
+    TEST_TRUE(counts.values == 5);
+    TEST_TRUE(counts.strings == 3);
+    TEST_TRUE(counts.arrays == 1);
+    TEST_TRUE(counts.maps == 2);
+    TEST_TRUE(counts.finished == 3);
+    TEST_TRUE(counts.max_depth == 2);
+
+    // NULL callbacks are ignored
+    mpack_memset(&counts, 0, sizeof(counts));
+    callbacks.start_map = NULL;
+    callbacks.finish_map = NULL;
+    TEST_READER_INIT_STR(&reader, test_event_data);
+    TEST_TRUE(mpack_ok == mpack_event_parse(&reader, stack, 2, &callbacks, &counts));
+    TEST_READER_DESTROY_NOERROR(&reader);
+    TEST_TRUE(counts.values == 5);
+    TEST_TRUE(counts.maps == 0);
+    TEST_TRUE(counts.finished == 1);
+
+    // callbacks can stop parsing by flagging an error
+    mpack_memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.value = test_event_stop;
+    mpack_memset(&counts, 0, sizeof(counts));
+    counts.reader = &reader;
+    TEST_READER_INIT_STR(&reader, test_event_data);
+    TEST_TRUE(mpack_error_data == mpack_event_parse(&reader, stack, 2, &callbacks, &counts));
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_data);
+    TEST_TRUE(counts.values == 1);
+}
+
+typedef struct test_event_fill_state_t {
+    const char* data;
+    size_t remaining;
+} test_event_fill_state_t;
+
+static size_t test_event_fill(mpack_reader_t* reader, char* buffer, size_t count) {
+    test_event_fill_state_t* state = (test_event_fill_state_t*)reader->context;
+
+    // we return at most a few bytes at a time to force lots of fills
+    if (count > 3)
+        count = 3;
+    if (state->remaining < count)
+        count = state->remaining;
+    mpack_memcpy(buffer, state->data, count);
+    state->data += count;
+    state->remaining -= count;
+    return count;
+}
+
+static void test_event_stream(void) {
+    static const char data[] =
+            "\x93\xa3""abc\x92\xd9\x20""0123456789abcdef0123456789abcdef\xc4\x01\xff\xcb"
+            "\x40\x09\x21\xfb\x54\x44\x2d\x18";
+
+    char buffer[MPACK_READER_MINIMUM_BUFFER_SIZE * 2];
+    test_event_fill_state_t state = {data, sizeof(data) - 1};
+    mpack_reader_t reader;
+    mpack_reader_init(&reader, buffer, sizeof(buffer), 0);
+    mpack_reader_set_fill(&reader, test_event_fill);
+    mpack_reader_set_context(&reader, &state);
+
+    mpack_event_frame_t stack[2];
+    mpack_event_parser_t parser;
+    mpack_event_parser_init(&parser, &reader, stack, 2);
+
+    mpack_event_t event;
+    test_event_check(&parser, mpack_event_start_array, mpack_type_array, 0, false);
+    TEST_TRUE(mpack_event_next(&parser, &event));
+    TEST_TRUE(mpack_tag_equal(event.tag, mpack_tag_str(3)));
+    TEST_TRUE(mpack_memcmp(event.data, "abc", 3) == 0);
+    test_event_check(&parser, mpack_event_start_array, mpack_type_array, 1, false);
+    TEST_TRUE(mpack_event_next(&parser, &event));
+    TEST_TRUE(mpack_tag_equal(event.tag, mpack_tag_str(32)));
+    TEST_TRUE(mpack_memcmp(event.data, "0123456789abcdef0123456789abcdef", 32) == 0);
+    TEST_TRUE(mpack_event_next(&parser, &event));
+    TEST_TRUE(mpack_tag_equal(event.tag, mpack_tag_bin(1)));
+    TEST_TRUE(*event.data == '\xff');
+    test_event_check(&parser, mpack_event_finish_array, mpack_type_array, 1, false);
+    test_event_check(&parser, mpack_event_value, mpack_type_double, 1, false);
+    test_event_check(&parser, mpack_event_finish_array, mpack_type_array, 0, false);
+    TEST_TRUE(!mpack_event_next(&parser, &event));
+
+    TEST_READER_DESTROY_NOERROR(&reader);
+}
+
+void test_event(void) {
+    test_event_next();
+    test_event_multiple_messages();
+    test_event_errors();
+    test_event_callbacks();
+    test_event_stream();
+}
+
+#endif
+
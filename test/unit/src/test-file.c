@@ -391,6 +391,20 @@ static void test_file_discard(void) {
     mpack_discard(&reader);
     TEST_READER_DESTROY_NOERROR(&reader);
 }
+
+static void test_file_seek(void) {
+    mpack_reader_t reader;
+    mpack_reader_init_filename(&reader, test_filename);
+    mpack_discard(&reader);
+    size_t size = mpack_reader_position(&reader);
+
+    // seek back to the start and read the whole file again
+    mpack_reader_seek(&reader, 0);
+    TEST_TRUE(mpack_reader_position(&reader) == 0);
+    mpack_discard(&reader);
+    TEST_TRUE(mpack_reader_position(&reader) == size);
+    TEST_READER_DESTROY_NOERROR(&reader);
+}
 #endif
 
 #if MPACK_EXPECT
@@ -991,6 +1005,7 @@ void test_file(void) {
 
     #if MPACK_READER
     test_file_discard();
+    test_file_seek();
     #endif
     #if MPACK_EXPECT
     test_file_read_missing();
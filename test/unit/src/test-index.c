@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "test-index.h"
+#include "test-reader.h"
+
+#if MPACK_READER && defined(MPACK_MALLOC)
+
+// an array of the uints 0 to 199, some of which take more than one byte
+static char test_index_array[512];
+static size_t test_index_array_size;
+
+static void test_index_init_array(void) {
+    char* p = test_index_array;
+    *p++ = (char)0xdc;
+    *p++ = 0;
+    *p++ = (char)200;
+    int i;
+    for (i = 0; i < 200; ++i) {
+        if (i >= 128)
+            *p++ = (char)0xcc;
+        *p++ = (char)i;
+    }
+    test_index_array_size = (size_t)(p - test_index_array);
+}
+
+static void test_index_seek_array(mpack_index_t* index) {
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, test_index_array, test_index_array_size);
+    uint32_t i;
+    for (i = 200; i-- > 0;) {
+        mpack_index_seek_at(index, &reader, i);
+        TEST_TRUE(mpack_tag_equal(mpack_read_tag(&reader), mpack_tag_uint(i)));
+    }
+
+    // out of bounds
+    mpack_index_seek_at(index, &reader, 200);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_data);
+}
+
+static void test_index_array_build(void) {
+    test_index_init_array();
+
+    uint32_t intervals[] = {1, 7, 64, 500};
+    size_t i;
+    for (i = 0; i < sizeof(intervals) / sizeof(*intervals); ++i) {
+        mpack_index_t index;
+        mpack_index_init(&index);
+        mpack_reader_t reader;
+        mpack_reader_init_data(&reader, test_index_array, test_index_array_size);
+        mpack_index_build(&index, &reader, intervals[i]);
+        TEST_TRUE(mpack_reader_remaining(&reader, NULL) == 0);
+        TEST_READER_DESTROY_NOERROR(&reader);
+
+        TEST_TRUE(!mpack_index_is_map(&index));
+        TEST_TRUE(mpack_index_count(&index) == 200);
+        test_index_seek_array(&index);
+
+        // an array index can't seek to keys
+        mpack_reader_init_data(&reader, test_index_array, test_index_array_size);
+        TEST_TRUE(!mpack_index_seek_cstr(&index, &reader, "a"));
+        TEST_READER_DESTROY_ERROR(&reader, mpack_error_type);
+        mpack_index_destroy(&index);
+    }
+}
+
+static const char test_index_map[] =
+        "\x85\xa1""a\x01\xa2""bc\x92\x02\x03\x04\xc0\xa1""a\x05\xa3""def\x06";
+
+static void test_index_seek_map(mpack_index_t* index) {
+    mpack_reader_t reader;
+    TEST_READER_INIT_STR(&reader, test_index_map);
+
+    TEST_TRUE(mpack_index_seek_cstr(index, &reader, "def"));
+    TEST_TRUE(mpack_tag_equal(mpack_read_tag(&reader), mpack_tag_uint(6)));
+    TEST_TRUE(mpack_index_seek_cstr(index, &reader, "bc"));
+    TEST_TRUE(mpack_tag_equal(mpack_read_tag(&reader), mpack_tag_array(2)));
+    mpack_discard(&reader);
+    mpack_discard(&reader);
+    mpack_done_array(&reader);
+
+    // the first of duplicate keys is found
+    TEST_TRUE(mpack_index_seek_cstr(index, &reader, "a"));
+    TEST_TRUE(mpack_tag_equal(mpack_read_tag(&reader), mpack_tag_uint(1)));
+
+    // missing keys don't flag errors
+    TEST_TRUE(!mpack_index_seek_cstr(index, &reader, "b"));
+    TEST_TRUE(!mpack_index_seek_cstr(index, &reader, ""));
+
+    // pairs are found by position, including non-string keys
+    mpack_index_seek_at(index, &reader, 2);
+    TEST_TRUE(mpack_tag_equal(mpack_read_tag(&reader), mpack_tag_uint(4)));
+    mpack_index_seek_at(index, &reader, 4);
+    TEST_TRUE(mpack_tag_equal(mpack_read_tag(&reader), mpack_tag_str(3)));
+    mpack_skip_bytes(&reader, 3);
+    mpack_done_str(&reader);
+    TEST_TRUE(mpack_tag_equal(mpack_read_tag(&reader), mpack_tag_uint(6)));
+    TEST_READER_DESTROY_NOERROR(&reader);
+}
+
+static void test_index_map_build(void) {
+    mpack_index_t index;
+    mpack_index_init(&index);
+    mpack_reader_t reader;
+    TEST_READER_INIT_STR(&reader, test_index_map);
+    mpack_index_build(&index, &reader, 2);
+    TEST_READER_DESTROY_NOERROR(&reader);
+
+    TEST_TRUE(mpack_index_is_map(&index));
+    TEST_TRUE(mpack_index_count(&index) == 5);
+    test_index_seek_map(&index);
+    mpack_index_destroy(&index);
+
+    // only maps and arrays can be indexed
+    TEST_READER_INIT_STR(&reader, "\xa1""a");
+    mpack_index_build(&index, &reader, 2);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_type);
+    mpack_index_destroy(&index);
+
+    // truncated data
+    TEST_READER_INIT_STR(&reader, "\x92\x01");
+    mpack_index_build(&index, &reader, 2);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_invalid);
+    TEST_TRUE(mpack_index_count(&index) == 0);
+    mpack_index_destroy(&index);
+
+    // a huge count without the data to back it is truncated rather than
+    // running out of memory
+    TEST_READER_INIT_STR(&reader, "\xdf\xff\xff\xff\xff");
+    mpack_index_build(&index, &reader, 1);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_invalid);
+    mpack_index_destroy(&index);
+    TEST_READER_INIT_STR(&reader, "\xdd\xff\xff\xff\xff\x01\x02");
+    mpack_index_build(&index, &reader, 1);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_invalid);
+    mpack_index_destroy(&index);
+}
+
+// the index's memory comes from the reader's allocator
+static void test_index_allocator(void) {
+    mpack_index_t index;
+    mpack_index_init(&index);
+    mpack_reader_t reader;
+    TEST_READER_INIT_STR(&reader, test_index_map);
+    mpack_reader_set_allocator(&reader, &test_allocator);
+    mpack_index_build(&index, &reader, 2);
+    TEST_READER_DESTROY_NOERROR(&reader);
+    TEST_TRUE(test_allocator_active == 2);
+    test_index_seek_map(&index);
+    mpack_index_destroy(&index);
+    TEST_TRUE(test_allocator_active == 0);
+}
+
+#if MPACK_WRITER
+static void test_index_sidecar(void) {
+    char sidecar[256];
+    mpack_index_t index;
+    mpack_index_init(&index);
+    mpack_reader_t reader;
+    TEST_READER_INIT_STR(&reader, test_index_map);
+    mpack_index_build(&index, &reader, 2);
+    TEST_READER_DESTROY_NOERROR(&reader);
+
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, sidecar, sizeof(sidecar));
+    mpack_index_write(&index, &writer);
+    size_t size = mpack_writer_buffer_used(&writer);
+    TEST_TRUE(mpack_writer_destroy(&writer) == mpack_ok);
+    mpack_index_destroy(&index);
+
+    mpack_reader_init_data(&reader, sidecar, size);
+    mpack_index_read(&index, &reader);
+    TEST_READER_DESTROY_NOERROR(&reader);
+    test_index_seek_map(&index);
+    mpack_index_destroy(&index);
+
+    // inconsistent sidecars are rejected
+    TEST_READER_INIT_STR(&reader, "\x83\xa3""map\xc2\xa5""count\x02\xa8""interval\x01");
+    mpack_index_read(&index, &reader);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_invalid);
+    TEST_READER_INIT_STR(&reader, "\x84\xa3""map\xc3\xa5""count\x01\xa8""interval\x01"
+            "\xa7""offsets\x91\xcb");
+    mpack_index_read(&index, &reader);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_invalid);
+    TEST_READER_INIT_STR(&reader, "\x92\x01\x02");
+    mpack_index_read(&index, &reader);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_invalid);
+
+    // both key arrays are required, and only once each
+    TEST_READER_INIT_STR(&reader, "\x86\xa3""map\xc3\xa5""count\x01\xa8""interval\x01"
+            "\xa7""offsets\x91\x01\xaa""key_hashes\x91\x05\xaa""key_hashes\x91\x05");
+    mpack_index_read(&index, &reader);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_invalid);
+    TEST_READER_INIT_STR(&reader, "\x85\xa3""map\xc3\xa5""count\x01\xa8""interval\x01"
+            "\xa7""offsets\x91\x01\xab""key_offsets\x91\x01");
+    mpack_index_read(&index, &reader);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_invalid);
+    TEST_READER_INIT_STR(&reader, "\x86\xa3""map\xc3\xa5""count\x01\xa8""interval\x01"
+            "\xa7""offsets\x91\x01\xaa""key_hashes\x91\x05\xab""key_offsets\x91\x01");
+    mpack_index_read(&index, &reader);
+    TEST_READER_DESTROY_NOERROR(&reader);
+    mpack_index_destroy(&index);
+
+    // arrays claiming huge counts without the data are truncated rather than
+    // running out of memory
+    TEST_READER_INIT_STR(&reader, "\x81\xa7""offsets\xdd\xff\xff\xff\xff\x01");
+    mpack_index_read(&index, &reader);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_invalid);
+    TEST_READER_INIT_STR(&reader, "\x81\xaa""key_hashes\xdd\xff\xff\xff\xff");
+    mpack_index_read(&index, &reader);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_invalid);
+    TEST_READER_INIT_STR(&reader, "\x81\xab""key_offsets\xdd\xff\xff\xff\xff\x01\x02");
+    mpack_index_read(&index, &reader);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_invalid);
+}
+#endif
+
+void test_index(void) {
+    test_index_array_build();
+    test_index_map_build();
+    test_index_allocator();
+    #if MPACK_WRITER
+    test_index_sidecar();
+    #endif
+}
+
+#endif
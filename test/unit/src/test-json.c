@@ -0,0 +1,383 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "test-json.h"
+
+#if MPACK_READER || MPACK_NODE || (MPACK_WRITER && MPACK_BUILDER)
+
+#if MPACK_READER || MPACK_NODE
+
+typedef struct test_json_output_t {
+    char data[1024];
+    size_t used;
+} test_json_output_t;
+
+static void test_json_flush(mpack_json_writer_t* json, const char* buffer, size_t count) {
+    test_json_output_t* output = (test_json_output_t*)mpack_json_writer_context(json);
+    if (output->used + count > sizeof(output->data)) {
+        mpack_json_writer_flag_error(json, mpack_error_io);
+        return;
+    }
+    mpack_memcpy(output->data + output->used, buffer, count);
+    output->used += count;
+}
+
+static void test_json_writer_init(mpack_json_writer_t* json, char* buffer, test_json_output_t* output,
+        mpack_json_ext_t ext, mpack_json_keys_t keys)
+{
+    output->used = 0;
+    mpack_json_writer_init(json, buffer, MPACK_JSON_MINIMUM_BUFFER_SIZE);
+    mpack_json_writer_set_flush(json, test_json_flush);
+    mpack_json_writer_set_context(json, output);
+    mpack_json_writer_set_ext(json, ext);
+    mpack_json_writer_set_keys(json, keys);
+}
+
+static void test_json_output_check(mpack_json_writer_t* json, test_json_output_t* output,
+        mpack_error_t error, const char* expected)
+{
+    TEST_TRUE(mpack_json_writer_destroy(json) == error, "json writer error is %s, expected %s",
+            mpack_error_to_string(mpack_json_writer_error(json)), mpack_error_to_string(error));
+    if (error == mpack_ok) {
+        TEST_TRUE(output->used == mpack_strlen(expected) &&
+                mpack_memcmp(output->data, expected, output->used) == 0,
+                "json is \"%.*s\", expected \"%s\"", (int)output->used, output->data, expected);
+    }
+}
+
+// converts the message from a buffer and from a node, checking that both
+// give the expected json or error. the buffer has the minimum size so that
+// the output is flushed often.
+static void test_json_check(const char* data, size_t length, mpack_json_ext_t ext,
+        mpack_json_keys_t keys, mpack_error_t error, const char* expected)
+{
+    char buffer[MPACK_JSON_MINIMUM_BUFFER_SIZE];
+    test_json_output_t output;
+    mpack_json_writer_t json;
+
+    #if MPACK_READER
+    test_json_writer_init(&json, buffer, &output, ext, keys);
+    size_t used = mpack_json_write_data(&json, data, length);
+    TEST_TRUE(used == (error == mpack_ok ? length : 0));
+    test_json_output_check(&json, &output, error, expected);
+    #endif
+
+    #if MPACK_NODE
+    mpack_node_data_t pool[32];
+    mpack_tree_t tree;
+    mpack_tree_init_pool(&tree, data, length, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+    test_json_writer_init(&json, buffer, &output, ext, keys);
+    mpack_json_write_node(&json, mpack_tree_root(&tree));
+    test_json_output_check(&json, &output, error, expected);
+    TEST_TRUE(mpack_tree_destroy(&tree) == mpack_ok);
+    #endif
+}
+
+#define TEST_JSON(data, expected) \
+    test_json_check(data, sizeof(data) - 1, mpack_json_ext_object, \
+            mpack_json_keys_stringify, mpack_ok, expected)
+
+#define TEST_JSON_ERROR(data, error) \
+    test_json_check(data, sizeof(data) - 1, mpack_json_ext_object, \
+            mpack_json_keys_stringify, error, NULL)
+
+static void test_json_values(void) {
+    TEST_JSON("\xc0", "null");
+    TEST_JSON("\x9a\xc0\xc3\xc2\x00\xff\x7f\xd0\x80\xcd\xff\xff"
+            "\xcf\xff\xff\xff\xff\xff\xff\xff\xff\xd3\x80\x00\x00\x00\x00\x00\x00\x00",
+            "[null,true,false,0,-1,127,-128,65535,18446744073709551615,-9223372036854775808]");
+    TEST_JSON("\x83\xa1""a\x90\xa1""b\x80\xa1""c\x91\x81\xa0\xc0", "{\"a\":[],\"b\":{},\"c\":[{\"\":null}]}");
+
+    // reals use the shortest digits for their precision
+    TEST_JSON("\x96\xca\x3f\x80\x00\x00\xca\x3d\xcc\xcc\xcd\xcb\xc0\x04\x00\x00\x00\x00\x00\x00"
+            "\xcb\x44\x4b\x1a\xe4\xd6\xe2\xef\x50\xcb\x7f\xf8\x00\x00\x00\x00\x00\x00\xca\x80\x00\x00\x00",
+            "[1.0,0.1,-2.5,1e+21,null,-0.0]");
+    TEST_JSON("\x93\xca\x7f\x7f\xff\xff\xca\x00\x00\x00\x01\xcb\x3f\x1a\x36\xe2\xeb\x1c\x43\x2d",
+            "[3.4028235e+38,1e-45,0.0001]");
+
+    // bin is written as base64
+    TEST_JSON("\x95\xc4\x00\xc4\x01""a\xc4\x02""ab\xc4\x03""abc\xc4\x04""abcd",
+            "[\"\",\"YQ==\",\"YWI=\",\"YWJj\",\"YWJjZA==\"]");
+}
+
+static void test_json_strings(void) {
+    TEST_JSON("\xa8""a\"b\\\n\x01\xc3\xa9", "\"a\\\"b\\\\\\n\\u0001\xc3\xa9\"");
+    TEST_JSON("\xbb""0123456789abcdef\t0123456789", "\"0123456789abcdef\\t0123456789\"");
+    TEST_JSON("\xa4\xf0\x9f\x98\x80", "\"\xf0\x9f\x98\x80\"");
+
+    // strings must be valid UTF-8
+    TEST_JSON_ERROR("\xa2\xc3\x28", mpack_error_type);
+    TEST_JSON_ERROR("\xa9""01234567\xff", mpack_error_type);
+    TEST_JSON_ERROR("\xa3\xf0\x9f\x98", mpack_error_type);
+}
+
+static void test_json_keys(void) {
+    static const char data[] = "\x84\x01\xa1""a\xc0\xc3\xc4\x01""b\x02\xa1""c\x90";
+
+    test_json_check(data, sizeof(data) - 1, mpack_json_ext_object, mpack_json_keys_stringify,
+            mpack_ok, "{\"1\":\"a\",\"null\":true,\"Yg==\":2,\"c\":[]}");
+    test_json_check(data, sizeof(data) - 1, mpack_json_ext_object, mpack_json_keys_skip,
+            mpack_ok, "{\"c\":[]}");
+    test_json_check(data, sizeof(data) - 1, mpack_json_ext_object, mpack_json_keys_error,
+            mpack_error_type, NULL);
+
+    // maps and arrays can only be skipped
+    static const char compound[] = "\x82\x91\x01\x02\xa1""x\x03";
+    test_json_check(compound, sizeof(compound) - 1, mpack_json_ext_object, mpack_json_keys_stringify,
+            mpack_error_type, NULL);
+    test_json_check(compound, sizeof(compound) - 1, mpack_json_ext_object, mpack_json_keys_skip,
+            mpack_ok, "{\"x\":3}");
+}
+
+#if MPACK_EXTENSIONS
+static void test_json_ext(void) {
+    static const char data[] = "\x92\xc7\x03\x01\x01\x02\x03\xd4\xff\x00";
+
+    test_json_check(data, sizeof(data) - 1, mpack_json_ext_object, mpack_json_keys_stringify,
+            mpack_ok, "[{\"type\":1,\"data\":\"AQID\"},{\"type\":-1,\"data\":\"AA==\"}]");
+    test_json_check(data, sizeof(data) - 1, mpack_json_ext_base64, mpack_json_keys_stringify,
+            mpack_ok, "[\"AQID\",\"AA==\"]");
+    test_json_check(data, sizeof(data) - 1, mpack_json_ext_null, mpack_json_keys_stringify,
+            mpack_ok, "[null,null]");
+    test_json_check(data, sizeof(data) - 1, mpack_json_ext_error, mpack_json_keys_stringify,
+            mpack_error_type, NULL);
+
+    // ext keys are strings only as base64
+    static const char key[] = "\x81\xd4\x01\x00\xc0";
+    test_json_check(key, sizeof(key) - 1, mpack_json_ext_base64, mpack_json_keys_stringify,
+            mpack_ok, "{\"AA==\":null}");
+    test_json_check(key, sizeof(key) - 1, mpack_json_ext_null, mpack_json_keys_stringify,
+            mpack_ok, "{\"null\":null}");
+    test_json_check(key, sizeof(key) - 1, mpack_json_ext_object, mpack_json_keys_stringify,
+            mpack_error_type, NULL);
+}
+#endif
+
+#if MPACK_READER || defined(MPACK_MALLOC)
+// converts arrays nested to the given depth, checking the expected error
+static void test_json_depth_check(char* data, size_t depth, mpack_error_t error) {
+    char text[MPACK_JSON_MAX_DEPTH * 2 + 8];
+    mpack_json_writer_t json;
+    mpack_memset(data, 0x91, depth);
+    data[depth] = (char)0xc0;
+
+    #if MPACK_READER
+    mpack_json_writer_init(&json, text, sizeof(text));
+    TEST_TRUE(mpack_json_write_data(&json, data, depth + 1) == (error == mpack_ok ? depth + 1 : 0));
+    TEST_TRUE(mpack_json_writer_destroy(&json) == error);
+    if (error == mpack_ok)
+        TEST_TRUE(mpack_json_writer_buffer_used(&json) == depth * 2 + 4);
+    #endif
+
+    #if MPACK_NODE && defined(MPACK_MALLOC)
+    mpack_tree_t tree;
+    mpack_tree_init_data(&tree, data, depth + 1);
+    mpack_tree_parse(&tree);
+    mpack_json_writer_init(&json, text, sizeof(text));
+    mpack_json_write_node(&json, mpack_tree_root(&tree));
+    TEST_TRUE(mpack_json_writer_destroy(&json) == error);
+    if (error == mpack_ok)
+        TEST_TRUE(mpack_json_writer_buffer_used(&json) == depth * 2 + 4);
+    TEST_TRUE(mpack_tree_destroy(&tree) == mpack_ok);
+    #endif
+}
+
+static void test_json_depth(void) {
+    static char data[50001];
+    test_json_depth_check(data, MPACK_JSON_MAX_DEPTH, mpack_ok);
+    test_json_depth_check(data, MPACK_JSON_MAX_DEPTH + 1, mpack_error_too_big);
+
+    // deep enough to overflow the call stack without a limit
+    test_json_depth_check(data, sizeof(data) - 1, mpack_error_too_big);
+}
+#endif
+
+static void test_json_output(void) {
+    char buffer[16];
+    mpack_json_writer_t json;
+
+    #if MPACK_READER
+    // several messages in a buffer, separated by raw text
+    static const char data[] = "\x01\x92\xa1""a\xc3";
+    mpack_json_writer_init(&json, buffer, sizeof(buffer));
+    TEST_TRUE(1 == mpack_json_write_data(&json, data, sizeof(data) - 1));
+    mpack_json_write_raw(&json, "\n", 1);
+    TEST_TRUE(4 == mpack_json_write_data(&json, data + 1, sizeof(data) - 2));
+    TEST_TRUE(mpack_json_writer_destroy(&json) == mpack_ok);
+    TEST_TRUE(mpack_json_writer_buffer_used(&json) == 12);
+    TEST_TRUE(mpack_memcmp(buffer, "1\n[\"a\",true]", 12) == 0);
+
+    // without a flush function, the output must fit in the buffer
+    mpack_json_writer_init(&json, buffer, sizeof(buffer));
+    TEST_TRUE(0 == mpack_json_write_data(&json, "\x93\xa5hello\xa5world\xc0", 14));
+    TEST_TRUE(mpack_json_writer_destroy(&json) == mpack_error_too_big);
+
+    // truncated messages are errors
+    mpack_json_writer_init(&json, buffer, sizeof(buffer));
+    TEST_TRUE(0 == mpack_json_write_data(&json, "\x92\x01", 2));
+    TEST_TRUE(mpack_json_writer_destroy(&json) == mpack_error_invalid);
+    #endif
+
+    // the buffer is too small for a flush function
+    mpack_json_writer_init(&json, buffer, sizeof(buffer));
+    TEST_BREAK((mpack_json_writer_set_flush(&json, test_json_flush), true));
+    TEST_TRUE(mpack_json_writer_destroy(&json) == mpack_error_bug);
+}
+#endif
+
+#if MPACK_WRITER && MPACK_BUILDER
+static void test_json_parse_check(const char* text, size_t text_length, mpack_error_t error,
+        const char* data, size_t length)
+{
+    char buffer[256];
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    size_t consumed = mpack_write_json(&writer, text, text_length);
+    size_t written = mpack_writer_buffer_used(&writer);
+    TEST_TRUE(mpack_writer_destroy(&writer) == error, "writer error is %s, expected %s",
+            mpack_error_to_string(mpack_writer_error(&writer)), mpack_error_to_string(error));
+    if (error != mpack_ok) {
+        TEST_TRUE(consumed == 0);
+        return;
+    }
+    TEST_TRUE(consumed == text_length, "used %i bytes of %i", (int)consumed, (int)text_length);
+    TEST_TRUE(written == length && mpack_memcmp(buffer, data, length) == 0,
+            "wrong MessagePack for %s", text);
+}
+
+#define TEST_JSON_PARSE(text, data) \
+    test_json_parse_check(text, sizeof(text) - 1, mpack_ok, data, sizeof(data) - 1)
+
+#define TEST_JSON_PARSE_ERROR(text, error) \
+    test_json_parse_check(text, sizeof(text) - 1, error, NULL, 0)
+
+static void test_json_parse(void) {
+    TEST_JSON_PARSE("null", "\xc0");
+    TEST_JSON_PARSE(" [ true ,false,{ } , [] ]\n", "\x94\xc3\xc2\x80\x90");
+    TEST_JSON_PARSE("{\"a\":{\"b\":[]},\"a\":1}", "\x82\xa1""a\x81\xa1""b\x90\xa1""a\x01");
+
+    // integers use the smallest encoding
+    TEST_JSON_PARSE("[0,-0,127,128,-32,-33,65536,18446744073709551615,-9223372036854775808]",
+            "\x99\x00\x00\x7f\xcc\x80\xe0\xd0\xdf\xce\x00\x01\x00\x00"
+            "\xcf\xff\xff\xff\xff\xff\xff\xff\xff\xd3\x80\x00\x00\x00\x00\x00\x00\x00");
+
+    // reals are floats if they can be
+    #if MPACK_DOUBLE
+    TEST_JSON_PARSE("[1.0,-0.0,1.5e3,1e-400,0.30000000000000004,18446744073709551616]",
+            "\x96\xca\x3f\x80\x00\x00\xca\x80\x00\x00\x00\xca\x44\xbb\x80\x00\xca\x00\x00\x00\x00"
+            "\xcb\x3f\xd3\x33\x33\x33\x33\x33\x34\xca\x5f\x80\x00\x00");
+    TEST_JSON_PARSE("[0.1,1e300,123456789012345678901234567890e-10]",
+            "\x93\xcb\x3f\xb9\x99\x99\x99\x99\x99\x9a\xcb\x7e\x37\xe4\x3c\x88\x00\x75\x9c"
+            "\xcb\x43\xe5\x6a\x95\x31\x9d\x63\xe1");
+    #else
+    TEST_JSON_PARSE_ERROR("1.5", mpack_error_unsupported);
+    #endif
+
+    // strings are unescaped
+    TEST_JSON_PARSE("\"0123456789abcdefghij\"", "\xb4""0123456789abcdefghij");
+    TEST_JSON_PARSE("\"a\\\"b\\\\\\/\\b\\f\\n\\r\\t\\u0041\\u00e9\\u20AC\\ud83d\\ude00\"",
+            "\xb4""a\"b\\/\b\f\n\r\tA\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80");
+
+    // text after the value is left for the next call
+    char buffer[16];
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    TEST_TRUE(7 == mpack_write_json(&writer, "  [ ]  1", 8));
+    TEST_TRUE(1 == mpack_write_json(&writer, "1", 1));
+    TEST_TRUE(mpack_writer_destroy(&writer) == mpack_ok);
+    TEST_TRUE(mpack_writer_buffer_used(&writer) == 2);
+
+    // invalid JSON
+    TEST_JSON_PARSE_ERROR("", mpack_error_invalid);
+    TEST_JSON_PARSE_ERROR("[", mpack_error_invalid);
+    TEST_JSON_PARSE_ERROR("[1,]", mpack_error_invalid);
+    TEST_JSON_PARSE_ERROR("[1 2]", mpack_error_invalid);
+    TEST_JSON_PARSE_ERROR("{\"a\":1,}", mpack_error_invalid);
+    TEST_JSON_PARSE_ERROR("{\"a\" 1}", mpack_error_invalid);
+    TEST_JSON_PARSE_ERROR("{1:2}", mpack_error_invalid);
+    TEST_JSON_PARSE_ERROR("[1}", mpack_error_invalid);
+    TEST_JSON_PARSE_ERROR("tru", mpack_error_invalid);
+    TEST_JSON_PARSE_ERROR("-", mpack_error_invalid);
+    TEST_JSON_PARSE_ERROR("1.", mpack_error_invalid);
+    TEST_JSON_PARSE_ERROR("1e", mpack_error_invalid);
+    TEST_JSON_PARSE_ERROR("+1", mpack_error_invalid);
+    TEST_JSON_PARSE_ERROR("\"abc", mpack_error_invalid);
+    TEST_JSON_PARSE_ERROR("\"\x01\"", mpack_error_invalid);
+    TEST_JSON_PARSE_ERROR("\"\xc3\x28\"", mpack_error_invalid);
+    TEST_JSON_PARSE_ERROR("\"\\x\"", mpack_error_invalid);
+    TEST_JSON_PARSE_ERROR("\"\\u12\"", mpack_error_invalid);
+    TEST_JSON_PARSE_ERROR("\"\\ud800\"", mpack_error_invalid);
+    TEST_JSON_PARSE_ERROR("\"\\udc00\"", mpack_error_invalid);
+
+    // nesting is limited
+    char deep[MPACK_JSON_MAX_DEPTH + 1];
+    mpack_memset(deep, '[', sizeof(deep));
+    test_json_parse_check(deep, sizeof(deep), mpack_error_too_big, NULL, 0);
+}
+
+#if MPACK_READER && MPACK_DOUBLE
+static void test_json_round_trip(void) {
+    static const char data[] = "\x83\xa1""a\x93\x01\xd0\x80\xca\x3f\xc0\x00\x00"
+            "\xa1""b\x81\xa0\xc0\xa1""c\xcb\x3f\xb9\x99\x99\x99\x99\x99\x9a";
+
+    char text[64];
+    mpack_json_writer_t json;
+    mpack_json_writer_init(&json, text, sizeof(text));
+    TEST_TRUE(sizeof(data) - 1 == mpack_json_write_data(&json, data, sizeof(data) - 1));
+    TEST_TRUE(mpack_json_writer_destroy(&json) == mpack_ok);
+
+    char buffer[64];
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    size_t length = mpack_json_writer_buffer_used(&json);
+    TEST_TRUE(length == mpack_write_json(&writer, text, length));
+    TEST_TRUE(mpack_writer_destroy(&writer) == mpack_ok);
+    TEST_TRUE(mpack_writer_buffer_used(&writer) == sizeof(data) - 1);
+    TEST_TRUE(mpack_memcmp(buffer, data, sizeof(data) - 1) == 0);
+}
+#endif
+#endif
+
+void test_json(void) {
+    #if MPACK_READER || MPACK_NODE
+    test_json_values();
+    test_json_strings();
+    test_json_keys();
+    #if MPACK_EXTENSIONS
+    test_json_ext();
+    #endif
+    test_json_output();
+    #if MPACK_READER || defined(MPACK_MALLOC)
+    test_json_depth();
+    #endif
+    #endif
+    #if MPACK_WRITER && MPACK_BUILDER
+    test_json_parse();
+    #if MPACK_READER && MPACK_DOUBLE
+    test_json_round_trip();
+    #endif
+    #endif
+}
+
+#endif
+
@@ -20,6 +20,8 @@
  */
 
 #include "test-node.h"
+#include "test-write.h"
+#include "test-reader.h"
 
 #if MPACK_NODE
 
@@ -587,8 +589,13 @@ static void test_node_read_possible(void) {
     mpack_tree_parse(&tree);
     allocation_count = test_malloc_total_count() - allocation_count;
     TEST_TRUE(allocation_count <= 2, "too many allocations! %i calls to malloc()", (int)allocation_count);
+    #if MPACK_NODE_COMPACT
+    // compact nodes can't store the count of these arrays
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_too_big);
+    #else
     TEST_TREE_DESTROY_ERROR(&tree, mpack_error_invalid);
     #endif
+    #endif
 }
 
 static void test_node_read_pre_error(void) {
@@ -1123,6 +1130,551 @@ static void test_node_read_deep_stack(void) {
     #endif
 }
 
+static void test_node_read_lazy(void) {
+    static const char test[] =
+            "\x83\xa1""a\x93\x01\x92\x02\x03\x81\xa1""b\x04"
+            "\xa1""c\x95\x05\x06\x07\x08\x09"
+            "\xa1""d\x90";
+
+    // the whole message is validated, but only the root and a placeholder
+    // for its contents are allocated
+    mpack_tree_t tree;
+    mpack_tree_init_pool(&tree, test, sizeof(test) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_set_lazy(&tree, true);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+    TEST_TRUE(mpack_tree_size(&tree) == sizeof(test) - 1);
+    TEST_TRUE(tree.node_count == 2);
+
+    mpack_node_t root = mpack_tree_root(&tree);
+    TEST_TRUE(3 == mpack_node_map_count(root));
+    TEST_TRUE(tree.node_count == 2);
+
+    // expanding the root parses its keys and values only
+    mpack_node_t a = mpack_node_map_cstr(root, "a");
+    TEST_TRUE(tree.node_count == 10);
+    TEST_TRUE(mpack_type_array == mpack_node_type(a));
+    TEST_TRUE(3 == mpack_node_array_length(a));
+    TEST_TRUE(1 == mpack_node_u8(mpack_node_array_at(a, 0)));
+    TEST_TRUE(3 == mpack_node_u8(mpack_node_array_at(mpack_node_array_at(a, 1), 1)));
+    TEST_TRUE(4 == mpack_node_u8(mpack_node_map_cstr(mpack_node_array_at(a, 2), "b")));
+
+    mpack_node_t c = mpack_node_map_value_at(root, 1);
+    TEST_TRUE(9 == mpack_node_u8(mpack_node_array_at(c, 4)));
+    TEST_TRUE(5 == mpack_node_u8(mpack_node_array_at(c, 0)));
+    TEST_TRUE(0 == mpack_node_array_length(mpack_node_map_cstr(root, "d")));
+
+    // out of bounds
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+    TEST_TRUE(mpack_type_nil == mpack_node_type(mpack_node_array_at(c, 5)));
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_data);
+
+    // a lazy tree can parse a message with more nodes than the pool as long
+    // as the nodes accessed fit
+    mpack_node_data_t small_pool[10];
+    mpack_tree_init_pool(&tree, test, sizeof(test) - 1, small_pool, sizeof(small_pool) / sizeof(*small_pool));
+    mpack_tree_set_lazy(&tree, true);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_type_array == mpack_node_type(mpack_node_map_cstr(mpack_tree_root(&tree), "c")));
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+    TEST_TRUE(mpack_type_nil == mpack_node_type(mpack_node_array_at(
+                mpack_node_map_cstr(mpack_tree_root(&tree), "c"), 0)));
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_too_big);
+
+    // invalid data is still detected while parsing
+    mpack_tree_init_pool(&tree, "\x92\x91\xc1\x00", 4, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_set_lazy(&tree, true);
+    mpack_tree_parse(&tree);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_invalid);
+    mpack_tree_init_pool(&tree, "\x92\x91\x91\x00", 4, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_set_lazy(&tree, true);
+    mpack_tree_parse(&tree);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_invalid);
+}
+
+static void test_node_read_projection(void) {
+    static const char test[] =
+            "\x83\xa4user\x82\xa2id\x07\xa4name\xa1x"
+            "\xa6""events\x92\x83\xa2ts\x01\xa4type\xa1""a\xa5""extra\x92\x01\x02"
+            "\x83\xa2ts\x02\xa4type\xa1""b\xa5""extra\x91\x03"
+            "\xa4""blob\x94\x01\x02\x03\x04";
+
+    mpack_projection_t projection;
+    mpack_projection_init(&projection);
+    TEST_TRUE(mpack_ok == mpack_projection_add(&projection, "user.id"));
+    TEST_TRUE(mpack_ok == mpack_projection_add(&projection, "events[*].ts"));
+    TEST_TRUE(mpack_ok == mpack_projection_add(&projection, "events[*].type"));
+
+    // the maps along the paths are parsed, but the extra and blob arrays
+    // get only a placeholder node
+    mpack_tree_t tree;
+    mpack_tree_init_pool(&tree, test, sizeof(test) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_set_projection(&tree, &projection);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+    TEST_TRUE(mpack_tree_size(&tree) == sizeof(test) - 1);
+    TEST_TRUE(tree.node_count == 28);
+
+    mpack_node_t root = mpack_tree_root(&tree);
+    mpack_node_t events = mpack_node_map_cstr(root, "events");
+    TEST_TRUE(7 == mpack_node_u8(mpack_node_map_cstr(mpack_node_map_cstr(root, "user"), "id")));
+    TEST_TRUE(1 == mpack_node_u8(mpack_node_map_cstr(mpack_node_array_at(events, 0), "ts")));
+    TEST_TRUE(mpack_node_map_cstr(mpack_node_array_at(events, 1), "type").data->type == mpack_type_str);
+    TEST_TRUE(tree.node_count == 28);
+
+    // skipped arrays are parsed when accessed
+    TEST_TRUE(3 == mpack_node_u8(mpack_node_array_at(mpack_node_map_cstr(root, "blob"), 2)));
+    TEST_TRUE(tree.node_count == 32);
+    TEST_TRUE(3 == mpack_node_u8(mpack_node_array_at(mpack_node_map_cstr(mpack_node_array_at(events, 1), "extra"), 0)));
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // an index and a wildcard can match the same element, and the map or
+    // array at the end of a path is parsed completely
+    mpack_projection_init(&projection);
+    TEST_TRUE(mpack_ok == mpack_projection_add(&projection, "events[0].extra"));
+    TEST_TRUE(mpack_ok == mpack_projection_add(&projection, "events[*].ts"));
+    mpack_tree_init_pool(&tree, test, sizeof(test) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_set_projection(&tree, &projection);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(tree.node_count == 26);
+    TEST_TRUE(2 == mpack_node_u8(mpack_node_array_at(mpack_node_map_cstr(mpack_node_array_at(
+                mpack_node_map_cstr(mpack_tree_root(&tree), "events"), 0), "extra"), 1)));
+    TEST_TRUE(tree.node_count == 26);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // an empty path selects the whole message
+    mpack_projection_init(&projection);
+    TEST_TRUE(mpack_ok == mpack_projection_add(&projection, ""));
+    mpack_tree_init_pool(&tree, test, sizeof(test) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_set_projection(&tree, &projection);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(tree.node_count == 32);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // invalid paths
+    mpack_projection_init(&projection);
+    TEST_TRUE(mpack_error_invalid == mpack_projection_add(&projection, "a..b"));
+    TEST_TRUE(mpack_error_invalid == mpack_projection_add(&projection, ".a"));
+    TEST_TRUE(mpack_error_invalid == mpack_projection_add(&projection, "a."));
+    TEST_TRUE(mpack_error_invalid == mpack_projection_add(&projection, "a[1]b"));
+    TEST_TRUE(mpack_error_invalid == mpack_projection_add(&projection, "a[1"));
+    TEST_TRUE(mpack_error_invalid == mpack_projection_add(&projection, "a[x]"));
+    TEST_TRUE(mpack_error_invalid == mpack_projection_add(&projection, "a[]"));
+    TEST_TRUE(mpack_error_invalid == mpack_projection_add(&projection, "[4294967296]"));
+    TEST_TRUE(projection.path_count == 0 && projection.step_count == 0);
+
+    // too many paths
+    int i;
+    for (i = 0; i < MPACK_PROJECTION_MAX_PATHS; ++i)
+        TEST_TRUE(mpack_ok == mpack_projection_add(&projection, "[4294967295]"));
+    TEST_TRUE(mpack_error_too_big == mpack_projection_add(&projection, "a"));
+}
+
+// parses the message and returns the hash of its root node, also checking it
+// against the hash of a reader
+static uint64_t test_node_hash_message(const char* data, size_t length) {
+    mpack_tree_t tree;
+    mpack_tree_init_pool(&tree, data, length, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_parse(&tree);
+    uint64_t hash = mpack_node_hash(mpack_tree_root(&tree), 42);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    #if MPACK_READER
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, data, length);
+    TEST_TRUE(hash == mpack_read_hash(&reader, 42), "reader hash does not match node hash");
+    TEST_READER_DESTROY_NOERROR(&reader);
+    #endif
+
+    return hash;
+}
+
+#define TEST_NODE_HASH(data) test_node_hash_message(data, sizeof(data) - 1)
+
+static void test_node_hash(void) {
+    uint64_t hash = TEST_NODE_HASH("\x82\xa1""a\x01\xa1""b\x92\xff\xa2xy");
+
+    // the hash doesn't depend on int widths, str headers or key order
+    TEST_TRUE(hash == TEST_NODE_HASH("\x82\xa1""b\x92\xd0\xff\xd9\x02xy\xa1""a\xcd\x00\x01"));
+    TEST_TRUE(hash == TEST_NODE_HASH("\xde\x00\x02\xa1""a\xd3\x00\x00\x00\x00\x00\x00\x00\x01"
+                "\xa1""b\xdc\x00\x02\xd1\xff\xff\xda\x00\x02xy"));
+    #if MPACK_FLOAT && MPACK_DOUBLE
+    TEST_TRUE(TEST_NODE_HASH("\xca\x3f\x80\x00\x00") ==
+            TEST_NODE_HASH("\xcb\x3f\xf0\x00\x00\x00\x00\x00\x00"));
+    #endif
+
+    // but it does depend on values, types and array order
+    TEST_TRUE(hash != TEST_NODE_HASH("\x82\xa1""a\x02\xa1""b\x92\xff\xa2xy"));
+    TEST_TRUE(hash != TEST_NODE_HASH("\x82\xa1""a\x01\xa1""b\x92\xa2xy\xff"));
+    TEST_TRUE(hash != TEST_NODE_HASH("\x82\xa1""a\x01\xa1""b\x92\xff\xc4\x02xy"));
+    TEST_TRUE(TEST_NODE_HASH("\x81\xa1""a\xa1""b") != TEST_NODE_HASH("\x81\xa1""b\xa1""a"));
+    TEST_TRUE(TEST_NODE_HASH("\x92\x90\x90") != TEST_NODE_HASH("\x91\x92\x90\x90"));
+    TEST_TRUE(TEST_NODE_HASH("\x00") != TEST_NODE_HASH("\xc0"));
+    TEST_TRUE(TEST_NODE_HASH("\xff") != TEST_NODE_HASH("\xcf\xff\xff\xff\xff\xff\xff\xff\xff"));
+
+    // the seed changes the hash
+    mpack_tree_t tree;
+    mpack_tree_init_pool(&tree, "\x01", 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_node_hash(mpack_tree_root(&tree), 0) != mpack_node_hash(mpack_tree_root(&tree), 1));
+    TEST_TREE_DESTROY_NOERROR(&tree);
+}
+
+#ifdef MPACK_MALLOC
+// hashes arrays nested to the given depth, checking the expected error
+static void test_node_hash_deep_check(size_t depth, mpack_error_t error) {
+    char* data = (char*)MPACK_MALLOC(depth + 1);
+    TEST_TRUE(data != NULL);
+    if (data == NULL)
+        return;
+    mpack_memset(data, 0x91, depth);
+    data[depth] = (char)0xc0;
+
+    mpack_tree_t tree;
+    mpack_tree_init_data(&tree, data, depth + 1);
+    mpack_tree_parse(&tree);
+    uint64_t hash = mpack_node_hash(mpack_tree_root(&tree), 42);
+    TEST_TREE_DESTROY_ERROR(&tree, error);
+
+    #if MPACK_READER
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, data, depth + 1);
+    TEST_TRUE(hash == mpack_read_hash(&reader, 42));
+    TEST_READER_DESTROY_ERROR(&reader, error);
+    #endif
+
+    TEST_TRUE((hash == 0) == (error != mpack_ok));
+    MPACK_FREE(data);
+}
+
+static void test_node_hash_deep(void) {
+    test_node_hash_deep_check(MPACK_HASH_MAX_DEPTH, mpack_ok);
+    test_node_hash_deep_check(MPACK_HASH_MAX_DEPTH + 1, mpack_error_too_big);
+
+    // deep enough to overflow the call stack without a limit
+    test_node_hash_deep_check(50000, mpack_error_too_big);
+}
+#endif
+
+// freezes the message with the given options and checks the frozen tree
+static void test_node_frozen_check(const char* data, size_t length, bool spans, bool lazy) {
+    uint64_t image[64];
+    mpack_tree_t tree;
+    mpack_tree_init_pool(&tree, data, length, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_set_spans(&tree, spans);
+    mpack_tree_set_lazy(&tree, lazy);
+    mpack_tree_parse(&tree);
+    uint64_t hash = mpack_node_hash(mpack_tree_root(&tree), 0);
+    size_t size = mpack_tree_frozen_size(&tree);
+    TEST_TRUE(size > length && size <= sizeof(image));
+    TEST_TRUE(mpack_tree_freeze(&tree, (char*)image, sizeof(image)) == size);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    mpack_tree_init_frozen(&tree, (const char*)image, size);
+    mpack_node_t root = mpack_tree_root(&tree);
+    TEST_TRUE(mpack_node_hash(root, 0) == hash);
+    TEST_TRUE(mpack_tree_size(&tree) == length);
+
+    mpack_node_t array = mpack_node_map_cstr(root, "a");
+    TEST_TRUE(mpack_node_array_length(array) == 3);
+    TEST_TRUE(mpack_node_u8(mpack_node_array_at(array, 1)) == 2);
+    TEST_TRUE(mpack_node_strlen(mpack_node_array_at(array, 2)) == 3);
+    TEST_TRUE(mpack_memcmp(mpack_node_str(mpack_node_array_at(array, 2)), "xyz", 3) == 0);
+    TEST_TRUE(mpack_node_map_count(mpack_node_map_cstr(root, "b")) == 1);
+
+    // spans are preserved
+    size_t span_length;
+    const char* span = mpack_node_span(array, &span_length);
+    if (spans) {
+        TEST_TRUE(span_length == 7 && mpack_memcmp(span, "\x93\x01\x02\xa3xyz", 7) == 0);
+    } else {
+        TEST_TRUE(span == NULL);
+    }
+
+    // the image itself is frozen
+    TEST_BREAK((mpack_tree_parse(&tree), true));
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_bug);
+}
+
+static void test_node_frozen(void) {
+    static const char test[] = "\x82\xa1""a\x93\x01\x02\xa3xyz\xa1""b\x81\xa1""c\x90";
+    test_node_frozen_check(test, sizeof(test) - 1, false, false);
+    test_node_frozen_check(test, sizeof(test) - 1, true, false);
+    test_node_frozen_check(test, sizeof(test) - 1, false, true);
+    test_node_frozen_check(test, sizeof(test) - 1, true, true);
+
+    // a scalar
+    uint64_t image[8];
+    mpack_tree_t tree;
+    mpack_tree_init_pool(&tree, "\x07", 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_parse(&tree);
+    size_t size = mpack_tree_freeze(&tree, (char*)image, sizeof(image));
+    TEST_TRUE(size == mpack_tree_frozen_size(&tree));
+    TEST_TREE_DESTROY_NOERROR(&tree);
+    mpack_tree_init_frozen(&tree, (const char*)image, size);
+    TEST_TRUE(mpack_node_u8(mpack_tree_root(&tree)) == 7);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // truncated or corrupt images are rejected
+    mpack_tree_init_frozen(&tree, (const char*)image, size - 1);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_invalid);
+    mpack_tree_init_frozen(&tree, (const char*)image, 16);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_invalid);
+    ((char*)image)[0] = 'X';
+    mpack_tree_init_frozen(&tree, (const char*)image, size);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_invalid);
+
+    // the buffer must be big enough
+    mpack_tree_init_pool(&tree, test, sizeof(test) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_tree_freeze(&tree, (char*)image, sizeof(image)) == 0);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_too_big);
+}
+
+#ifdef MPACK_MALLOC
+// freezes arrays nested to the given depth and walks the frozen tree
+static void test_node_frozen_deep_check(size_t depth, bool lazy) {
+    char* data = (char*)MPACK_MALLOC(depth + 1);
+    TEST_TRUE(data != NULL);
+    if (data == NULL)
+        return;
+    mpack_memset(data, 0x91, depth);
+    data[depth] = (char)0xc0;
+
+    mpack_tree_t tree;
+    mpack_tree_init_data(&tree, data, depth + 1);
+    mpack_tree_set_lazy(&tree, lazy);
+    mpack_tree_parse(&tree);
+    // a 32 byte header, a node per element and the data
+    size_t size = mpack_tree_frozen_size(&tree);
+    TEST_TRUE(size == 32 + (depth + 1) * sizeof(mpack_node_data_t) + depth + 1);
+    char* image = (char*)MPACK_MALLOC(size);
+    TEST_TRUE(image != NULL);
+    if (image == NULL) {
+        mpack_tree_destroy(&tree);
+        MPACK_FREE(data);
+        return;
+    }
+    TEST_TRUE(mpack_tree_freeze(&tree, image, size) == size);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    mpack_tree_init_frozen(&tree, image, size);
+    mpack_node_t node = mpack_tree_root(&tree);
+    size_t i;
+    for (i = 0; i < depth; ++i)
+        node = mpack_node_array_at(node, 0);
+    TEST_TRUE(mpack_node_type(node) == mpack_type_nil);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    MPACK_FREE(image);
+    MPACK_FREE(data);
+}
+
+static void test_node_frozen_deep(void) {
+    // deep enough to overflow the call stack if nodes were counted recursively
+    test_node_frozen_deep_check(200000, false);
+
+    // lazy children are expanded one level at a time, which is quadratic
+    // in the depth, so a shallower message is used
+    test_node_frozen_deep_check(2000, true);
+}
+#endif
+
+static void test_node_view(void) {
+    static const char test[] = "\x82\xa1""a\x92\x01\x02\xa1""b\xc3";
+    mpack_tree_t tree;
+    mpack_tree_init_pool(&tree, test, sizeof(test) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_parse(&tree);
+
+    // errors in one view don't affect the tree or other views
+    mpack_tree_t first, second;
+    mpack_tree_init_view(&first, &tree);
+    mpack_tree_init_view(&second, &tree);
+    mpack_node_t root = mpack_tree_root(&first);
+    TEST_TRUE(mpack_node_u8(mpack_node_array_at(mpack_node_map_cstr(root, "a"), 1)) == 2);
+    TEST_TRUE(mpack_node_u8(mpack_node_map_cstr(root, "b")) == 0);
+    TEST_TRUE(mpack_tree_error(&first) == mpack_error_type);
+    TEST_TRUE(mpack_node_bool(mpack_node_map_cstr(mpack_tree_root(&second), "b")));
+    TEST_TRUE(mpack_node_data(mpack_tree_root(&second)) == NULL);
+    TEST_TREE_DESTROY_ERROR(&first, mpack_error_type);
+    TEST_TREE_DESTROY_ERROR(&second, mpack_error_type);
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+
+    // a view of a tree in an error state
+    mpack_node_u8(mpack_tree_root(&tree));
+    mpack_tree_init_view(&first, &tree);
+    TEST_TREE_DESTROY_ERROR(&first, mpack_error_type);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_type);
+
+    // lazy trees can't be viewed
+    mpack_tree_init_pool(&tree, test, sizeof(test) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_set_lazy(&tree, true);
+    mpack_tree_parse(&tree);
+    TEST_BREAK((mpack_tree_init_view(&first, &tree), true));
+    TEST_TREE_DESTROY_ERROR(&first, mpack_error_bug);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+}
+
+#if MPACK_WRITER
+// writes the node and checks that the output matches the expected bytes
+static void test_node_write_check(mpack_node_t node, const char* expected, size_t length) {
+    char buffer[64];
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    mpack_write_node(&writer, node);
+    size_t used = mpack_writer_buffer_used(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(used == length, "wrote %i bytes, expected %i", (int)used, (int)length);
+    TEST_TRUE(mpack_memcmp(buffer, expected, length) == 0, "written bytes do not match");
+}
+
+static void test_node_write(void) {
+    // the uint 1 is not in its smallest encoding
+    static const char test[] = "\x92\x92\xcc\x01\xa1""a\x81\xa1""b\x90";
+    mpack_tree_t tree;
+
+    // without spans, only the root is copied
+    mpack_tree_init_pool(&tree, test, sizeof(test) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_parse(&tree);
+    mpack_node_t root = mpack_tree_root(&tree);
+    test_node_write_check(root, test, sizeof(test) - 1);
+    test_node_write_check(mpack_node_array_at(root, 0), "\x92\x01\xa1""a", 4);
+    test_node_write_check(mpack_node_array_at(root, 1), "\x81\xa1""b\x90", 4);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // with spans, maps and arrays are copied
+    mpack_tree_init_pool(&tree, test, sizeof(test) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_set_spans(&tree, true);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(tree.node_count == 10);
+    root = mpack_tree_root(&tree);
+    test_node_write_check(mpack_node_array_at(root, 0), test + 1, 5);
+    test_node_write_check(mpack_node_array_at(root, 1), test + 6, 4);
+    test_node_write_check(mpack_node_map_cstr(mpack_node_array_at(root, 1), "b"), "\x90", 1);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // lazy maps and arrays are copied without being expanded
+    mpack_tree_init_pool(&tree, test, sizeof(test) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_set_spans(&tree, true);
+    mpack_tree_set_lazy(&tree, true);
+    mpack_tree_parse(&tree);
+    root = mpack_tree_root(&tree);
+    mpack_node_t first = mpack_node_array_at(root, 0);
+    size_t node_count = tree.node_count;
+    test_node_write_check(first, test + 1, 5);
+    TEST_TRUE(tree.node_count == node_count);
+    TEST_TRUE(mpack_node_u8(mpack_node_array_at(first, 0)) == 1);
+    test_node_write_check(first, test + 1, 5);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // lazy maps and arrays without spans are expanded to be written
+    mpack_tree_init_pool(&tree, test, sizeof(test) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_set_lazy(&tree, true);
+    mpack_tree_parse(&tree);
+    test_node_write_check(mpack_node_array_at(mpack_tree_root(&tree), 0), "\x92\x01\xa1""a", 4);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    #ifdef MPACK_MALLOC
+    // canonical writes sort keys and ignore spans
+    static const char unsorted[] = "\x82\xa1""b\xcc\x01\xa1""a\x91\xd0\x05";
+    mpack_tree_init_pool(&tree, unsorted, sizeof(unsorted) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_set_spans(&tree, true);
+    mpack_tree_parse(&tree);
+    char canonical[16];
+    mpack_writer_t canonical_writer;
+    mpack_writer_init(&canonical_writer, canonical, sizeof(canonical));
+    mpack_write_node_canonical(&canonical_writer, mpack_tree_root(&tree));
+    TEST_TRUE(!mpack_writer_is_canonical(&canonical_writer));
+    TEST_TRUE(mpack_writer_buffer_used(&canonical_writer) == 8);
+    TEST_TRUE(mpack_memcmp(canonical, "\x82\xa1""a\x91\x05\xa1""b\x01", 8) == 0);
+    TEST_WRITER_DESTROY_NOERROR(&canonical_writer);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+    #endif
+
+    // errors in the tree are flagged on the writer
+    char buffer[16];
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    mpack_tree_init_pool(&tree, test, sizeof(test) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_parse(&tree);
+    mpack_tree_flag_error(&tree, mpack_error_data);
+    mpack_write_node(&writer, mpack_tree_root(&tree));
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_data);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_data);
+}
+#endif
+
+#if MPACK_WRITER && defined(MPACK_MALLOC)
+static void test_node_write_deep_check(size_t depth, bool lazy) {
+    char* data = (char*)MPACK_MALLOC(depth + 1);
+    char* output = (char*)MPACK_MALLOC(depth + 1);
+    TEST_TRUE(data != NULL && output != NULL);
+    if (data == NULL || output == NULL) {
+        MPACK_FREE(data);
+        MPACK_FREE(output);
+        return;
+    }
+    mpack_memset(data, 0x91, depth);
+    data[depth] = (char)0xc0;
+
+    mpack_tree_t tree;
+    mpack_tree_init_data(&tree, data, depth + 1);
+    mpack_tree_set_lazy(&tree, lazy);
+    mpack_tree_parse(&tree);
+
+    // the root spans the whole message, so its child is written instead
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, output, depth);
+    mpack_write_node(&writer, mpack_node_array_at(mpack_tree_root(&tree), 0));
+    size_t used = mpack_writer_buffer_used(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+    TEST_TRUE(used == depth);
+    TEST_TRUE(mpack_memcmp(data + 1, output, depth) == 0);
+
+    MPACK_FREE(data);
+    MPACK_FREE(output);
+}
+
+static void test_node_write_deep(void) {
+    // deep enough to overflow the call stack if nodes were written recursively
+    test_node_write_deep_check(200000, false);
+
+    // lazy children are expanded one level at a time, which is quadratic
+    // in the depth, so a shallower message is used
+    test_node_write_deep_check(2000, true);
+}
+#endif
+
+#ifdef MPACK_MALLOC
+static void test_node_read_lazy_deep_stack(void) {
+    static const int depth = 1200;
+    static char buf[4096];
+
+    uint8_t* p = (uint8_t*)buf;
+    int i;
+    for (i = 0; i < depth; ++i) {
+        *p++ = 0x92; // two element array
+        *p++ = (uint8_t)(i & 0x7f);
+    }
+    *p++ = 0xc3; // final element true
+
+    mpack_tree_t tree;
+    mpack_tree_init_data(&tree, buf, (size_t)(p - (uint8_t*)buf));
+    mpack_tree_set_lazy(&tree, true);
+    mpack_tree_parse(&tree);
+
+    mpack_node_t node = mpack_tree_root(&tree);
+    for (i = 0; i < depth; ++i) {
+        TEST_TRUE(mpack_node_array_length(node) == 2, "error at depth %i", i);
+        TEST_TRUE(mpack_node_int(mpack_node_array_at(node, 0)) == (i & 0x7f), "error at depth %i", i);
+        node = mpack_node_array_at(node, 1);
+    }
+    TEST_TRUE(mpack_node_bool(node) == true, "error in final node");
+    TEST_TREE_DESTROY_NOERROR(&tree);
+}
+#endif
+
 static void test_node_multiple_simple(void) {
     static const char test[] = "\x00\xa5""hello\xd1\x80\x00\xc0";
     mpack_tree_t tree;
@@ -1259,6 +1811,250 @@ static bool test_node_multiple_allocs_stream3(void) {
 static bool test_node_multiple_allocs_stream4096(void) {
     return test_node_multiple_allocs(true, 4096);
 }
+
+static void test_node_allocator(void) {
+    // nested deeply enough to grow the parsing stack
+    char test[48 + 4];
+    mpack_memset(test, '\x91', 48);
+    mpack_memcpy(test + 48, "\xa3""abc", 4);
+
+    // the stream buffer, parsing stack and node pages all come from the
+    // allocator
+    mpack_tree_t tree;
+    test_node_stream_t stream_context = {sizeof(test), test, 0, 1};
+    mpack_tree_init_stream(&tree, &test_node_stream_read, &stream_context, 1000, 1000);
+    mpack_tree_set_allocator(&tree, &test_allocator);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+    TEST_TRUE(test_allocator_active >= 3);
+    size_t active = test_allocator_active;
+
+    mpack_node_t node = mpack_tree_root(&tree);
+    while (mpack_node_type(node) == mpack_type_array)
+        node = mpack_node_array_at(node, 0);
+    char* str = mpack_node_cstr_alloc(node, 4);
+    TEST_TRUE(str != NULL && strcmp(str, "abc") == 0);
+    TEST_TRUE(test_allocator_active == active + 1);
+    test_allocator.free_fn(test_allocator.context, str);
+
+    TEST_TREE_DESTROY_NOERROR(&tree);
+    TEST_TRUE(test_allocator_active == 0);
+}
+
+static void test_node_pool_overflow(void) {
+    static const char test[] = "\x92\x94\xc0\xc0\xc0\xc0\x93\xc3\xc3\xc3";
+    mpack_node_data_t small_pool[4];
+    mpack_tree_t tree;
+
+    // without overflow, the pool is too small
+    mpack_tree_init_pool(&tree, test, sizeof(test) - 1, small_pool, sizeof(small_pool) / sizeof(*small_pool));
+    mpack_tree_parse(&tree);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_too_big);
+
+    // with overflow, the extra nodes come from allocated pages
+    mpack_tree_init_pool(&tree, test, sizeof(test) - 1, small_pool, sizeof(small_pool) / sizeof(*small_pool));
+    mpack_tree_set_allocator(&tree, &test_allocator);
+    mpack_tree_set_pool_overflow(&tree, true);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+    TEST_TRUE(mpack_tree_root(&tree).data == &small_pool[0]);
+    TEST_TRUE(test_allocator_active > 0);
+    TEST_TRUE(mpack_node_array_length(mpack_node_array_at(mpack_tree_root(&tree), 0)) == 4);
+    TEST_TRUE(mpack_node_bool(mpack_node_array_at(mpack_node_array_at(mpack_tree_root(&tree), 1), 2)));
+    TEST_TREE_DESTROY_NOERROR(&tree);
+    TEST_TRUE(test_allocator_active == 0);
+
+    // messages that fit in the pool don't allocate
+    mpack_tree_init_pool(&tree, "\x93\xc0\xc0\xc0", 4, small_pool, sizeof(small_pool) / sizeof(*small_pool));
+    mpack_tree_set_allocator(&tree, &test_allocator);
+    mpack_tree_set_pool_overflow(&tree, true);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+    TEST_TRUE(test_allocator_active == 0);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+}
+
+static void test_node_exact_alloc(void) {
+    // an array of 10 maps of {"a": 2}, plus a trailing nil message
+    char test[1 + 10 * 4 + 2];
+    size_t i;
+    test[0] = '\x9a';
+    for (i = 0; i < 10; ++i)
+        mpack_memcpy(test + 1 + i * 4, "\x81\xa1" "a\x02", 4);
+    test[41] = '\xc0';
+    test[42] = '\xc0';
+    mpack_tree_t tree;
+
+    // paged allocation needs many pages for this message
+    mpack_tree_init_data(&tree, test, sizeof(test));
+    mpack_tree_set_allocator(&tree, &test_allocator);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+    TEST_TRUE(test_allocator_active > 1);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+    TEST_TRUE(test_allocator_active == 0);
+
+    // exact allocation needs a single block
+    mpack_tree_init_data(&tree, test, sizeof(test));
+    mpack_tree_set_allocator(&tree, &test_allocator);
+    mpack_tree_set_exact_alloc(&tree, true);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+    TEST_TRUE(test_allocator_active == 1);
+    TEST_TRUE(tree.node_count == 31);
+    TEST_TRUE(tree.parser.nodes_left == 0);
+    TEST_TRUE(mpack_node_u8(mpack_node_map_cstr(mpack_node_array_at(mpack_tree_root(&tree), 9), "a")) == 2);
+
+    // each message gets its own block
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+    TEST_TRUE(test_allocator_active == 1);
+    TEST_TRUE(mpack_node_is_nil(mpack_tree_root(&tree)));
+    TEST_TREE_DESTROY_NOERROR(&tree);
+    TEST_TRUE(test_allocator_active == 0);
+
+    // the block includes the extra nodes for spans
+    mpack_tree_init_data(&tree, test, sizeof(test));
+    mpack_tree_set_allocator(&tree, &test_allocator);
+    mpack_tree_set_exact_alloc(&tree, true);
+    mpack_tree_set_spans(&tree, true);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+    TEST_TRUE(test_allocator_active == 1);
+    TEST_TRUE(tree.node_count == 42);
+    TEST_TRUE(tree.parser.nodes_left == 0);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // truncated messages fall back to paged allocation and fail as usual
+    mpack_tree_init_data(&tree, test, 30);
+    mpack_tree_set_exact_alloc(&tree, true);
+    mpack_tree_parse(&tree);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_invalid);
+
+    // as do messages that exceed the node limit
+    mpack_tree_init_data(&tree, test, sizeof(test));
+    mpack_tree_set_exact_alloc(&tree, true);
+    mpack_tree_set_limits(&tree, SIZE_MAX, 30);
+    mpack_tree_parse(&tree);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_too_big);
+}
+
+static void test_node_page_size(void) {
+    // an array of 60 arrays of two nils
+    char test[3 + 60 * 3];
+    size_t i;
+    mpack_memcpy(test, "\xdc\x00\x3c", 3);
+    for (i = 0; i < 60; ++i)
+        mpack_memcpy(test + 3 + i * 3, "\x92\xc0\xc0", 3);
+    mpack_tree_t tree;
+
+    mpack_tree_init_data(&tree, test, sizeof(test));
+    mpack_tree_set_allocator(&tree, &test_allocator);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+    size_t fixed_pages = test_allocator_active;
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // growing pages need fewer allocations
+    mpack_tree_init_data(&tree, test, sizeof(test));
+    mpack_tree_set_allocator(&tree, &test_allocator);
+    mpack_tree_set_page_size(&tree, MPACK_NODE_PAGE_SIZE, 64 * 1024);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+    TEST_TRUE(test_allocator_active < fixed_pages);
+    TEST_TRUE(mpack_node_is_nil(mpack_node_array_at(mpack_node_array_at(mpack_tree_root(&tree), 59), 1)));
+    TEST_TREE_DESTROY_NOERROR(&tree);
+    TEST_TRUE(test_allocator_active == 0);
+
+    // page sizes must hold a node and be in order
+    mpack_tree_init_data(&tree, test, sizeof(test));
+    TEST_BREAK((mpack_tree_set_page_size(&tree, 1, 4096), true));
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_bug);
+    mpack_tree_init_data(&tree, test, sizeof(test));
+    TEST_BREAK((mpack_tree_set_page_size(&tree, 4096, 1024), true));
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_bug);
+
+    // the stream buffer starts at the given size
+    test_node_stream_t stream_context = {sizeof(test), test, 0, sizeof(test)};
+    mpack_tree_init_stream(&tree, &test_node_stream_read, &stream_context, 1000, 1000);
+    mpack_tree_set_buffer_size(&tree, 500);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+    TEST_TRUE(tree.buffer_capacity == 500);
+    TEST_BREAK((mpack_tree_set_buffer_size(&tree, 100), true));
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_bug);
+}
+
+#if MPACK_NODE_COMPACT
+static void test_node_compact(void) {
+    TEST_TRUE(sizeof(mpack_node_data_t) == 12);
+
+    // wide values are stored unaligned
+    static const char test[] =
+        "\x94\xcf\x01\x23\x45\x67\x89\xab\xcd\xef\xd3\x80\x00\x00\x00\x00\x00\x00\x00"
+        "\xcb\x3f\xf0\x00\x00\x00\x00\x00\x00\xdb\x00\x00\x00\x03xyz";
+    mpack_tree_t tree;
+    mpack_tree_init_data(&tree, test, sizeof(test) - 1);
+    mpack_tree_parse(&tree);
+    mpack_node_t root = mpack_tree_root(&tree);
+    TEST_TRUE(mpack_node_u64(mpack_node_array_at(root, 0)) == MPACK_UINT64_C(0x0123456789abcdef));
+    TEST_TRUE(mpack_node_i64(mpack_node_array_at(root, 1)) == MPACK_INT64_MIN);
+    #if MPACK_DOUBLE
+    TEST_TRUE(mpack_node_double(mpack_node_array_at(root, 2)) == 1.0);
+    #endif
+    TEST_TRUE(mpack_node_strlen(mpack_node_array_at(root, 3)) == 3);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // lengths beyond the compact limit are too big
+    mpack_tree_init_data(&tree, "\xdb\x08\x00\x00\x00", 5);
+    mpack_tree_parse(&tree);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_too_big);
+    mpack_tree_init_data(&tree, "\xdd\x08\x00\x00\x00", 5);
+    mpack_tree_parse(&tree);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_too_big);
+}
+#endif
+
+#if MPACK_STATS
+static void test_node_stats(void) {
+    static const char test[] =
+        "\x9a\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a" // larger than config page size
+        "\x93\xff\xfe\xfd";
+    mpack_tree_t tree;
+
+    // a stream reading one byte at a time
+    test_node_stream_t stream_context = {sizeof(test) - 1, test, 0, 1};
+    mpack_tree_init_stream(&tree, &test_node_stream_read, &stream_context, 1000, 1000);
+    const mpack_tree_stats_t* stats = mpack_tree_stats(&tree);
+    TEST_TRUE(stats->memory == 0);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+    TEST_TRUE(stats->fill_calls == 11);
+    TEST_TRUE(stats->fill_bytes == 11);
+    TEST_TRUE(stats->buffer_reallocs == 1);
+    TEST_TRUE(stats->node_pages == 2);
+    TEST_TRUE(stats->memory == stats->node_memory + MPACK_BUFFER_SIZE);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+    TEST_TRUE(stats->fill_bytes == sizeof(test) - 1);
+    TEST_TRUE(stats->node_pages == 3);
+    size_t peak = stats->peak_memory;
+    TEST_TRUE(peak >= stats->memory);
+    TEST_TRUE(mpack_tree_destroy(&tree) == mpack_ok);
+    TEST_TRUE(stats->memory == 0);
+    TEST_TRUE(stats->node_memory == 0);
+    TEST_TRUE(stats->peak_memory == peak);
+
+    // data in memory never fills
+    mpack_tree_init_data(&tree, test, sizeof(test) - 1);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+    TEST_TRUE(stats->fill_calls == 0);
+    TEST_TRUE(stats->buffer_reallocs == 0);
+    TEST_TRUE(stats->node_pages == 2);
+    TEST_TRUE(mpack_tree_destroy(&tree) == mpack_ok);
+}
+#endif
 #endif
 
 #if MPACK_DEBUG && MPACK_STDIO
@@ -1342,6 +2138,26 @@ void test_node(void) {
     test_node_read_compound_errors();
     test_node_read_data();
     test_node_read_deep_stack();
+    test_node_read_lazy();
+    test_node_read_projection();
+    test_node_hash();
+    #ifdef MPACK_MALLOC
+    test_node_hash_deep();
+    #endif
+    test_node_frozen();
+    #ifdef MPACK_MALLOC
+    test_node_frozen_deep();
+    #endif
+    test_node_view();
+    #if MPACK_WRITER
+    test_node_write();
+    #endif
+    #if MPACK_WRITER && defined(MPACK_MALLOC)
+    test_node_write_deep();
+    #endif
+    #ifdef MPACK_MALLOC
+    test_node_read_lazy_deep_stack();
+    #endif
 
     // message streams
     test_node_multiple_simple();
@@ -1351,6 +2167,16 @@ void test_node(void) {
     test_system_fail_until_ok(&test_node_multiple_allocs_stream2);
     test_system_fail_until_ok(&test_node_multiple_allocs_stream3);
     test_system_fail_until_ok(&test_node_multiple_allocs_stream4096);
+    test_node_allocator();
+    test_node_pool_overflow();
+    test_node_exact_alloc();
+    test_node_page_size();
+    #if MPACK_STATS
+    test_node_stats();
+    #endif
+    #if MPACK_NODE_COMPACT
+    test_node_compact();
+    #endif
     #endif
 }
 
@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "test-path.h"
+#include "test-node.h"
+
+#if MPACK_READER || MPACK_NODE
+
+static void test_path_compile(void) {
+    mpack_path_t path;
+
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, ""));
+    TEST_TRUE(mpack_path_length(&path) == 0);
+    TEST_TRUE(!mpack_path_has_wildcard(&path));
+
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, "a[3].b"));
+    TEST_TRUE(mpack_path_length(&path) == 3);
+    TEST_TRUE(!mpack_path_has_wildcard(&path));
+
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, "items[*].price"));
+    TEST_TRUE(mpack_path_length(&path) == 3);
+    TEST_TRUE(mpack_path_has_wildcard(&path));
+
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, "[0][1][*]"));
+    TEST_TRUE(mpack_path_length(&path) == 3);
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, "[4294967295]"));
+
+    TEST_TRUE(mpack_error_invalid == mpack_path_compile(&path, "a..b"));
+    TEST_TRUE(mpack_error_invalid == mpack_path_compile(&path, ".a"));
+    TEST_TRUE(mpack_error_invalid == mpack_path_compile(&path, "a."));
+    TEST_TRUE(mpack_error_invalid == mpack_path_compile(&path, "a[1]b"));
+    TEST_TRUE(mpack_error_invalid == mpack_path_compile(&path, "a[1"));
+    TEST_TRUE(mpack_error_invalid == mpack_path_compile(&path, "a[x]"));
+    TEST_TRUE(mpack_error_invalid == mpack_path_compile(&path, "a[]"));
+    TEST_TRUE(mpack_error_invalid == mpack_path_compile(&path, "[4294967296]"));
+
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, "a.a.a.a.a.a.a.a.a.a.a.a.a.a.a.a"));
+    TEST_TRUE(mpack_error_too_big == mpack_path_compile(&path, "a.a.a.a.a.a.a.a.a.a.a.a.a.a.a.a.a"));
+}
+
+#if MPACK_NODE
+static const char test_path_data[] =
+        "\x83\xa1""a\x94\x00\x01\x02\x81\xa1""b\x05"
+        "\xa5items\x94\x81\xa5price\x01\x82\xa5price\x02\xa1x\x00\x81\xa4name\xa1n\x03"
+        "\xa1m\x82\xa1p\x01\xa1q\x02";
+
+static mpack_node_data_t pool[128];
+
+static void test_path_node(void) {
+    mpack_path_t path;
+    mpack_tree_t tree;
+    mpack_tree_init_pool(&tree, test_path_data, sizeof(test_path_data) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_parse(&tree);
+    mpack_node_t root = mpack_tree_root(&tree);
+
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, "a[3].b"));
+    TEST_TRUE(5 == mpack_node_u8(mpack_node_path(root, &path)));
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, "m.q"));
+    TEST_TRUE(2 == mpack_node_u8(mpack_node_path(root, &path)));
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, ""));
+    TEST_TRUE(mpack_node_path(root, &path).data == root.data);
+
+    // paths can be evaluated from any node
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, "[1].price"));
+    TEST_TRUE(2 == mpack_node_u8(mpack_node_path(mpack_node_map_cstr(root, "items"), &path)));
+
+    // missing keys and indices
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, "items[2].price"));
+    TEST_TRUE(mpack_node_is_missing(mpack_node_path_optional(root, &path)));
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, "a[4]"));
+    TEST_TRUE(mpack_node_is_missing(mpack_node_path_optional(root, &path)));
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    mpack_tree_init_pool(&tree, test_path_data, sizeof(test_path_data) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_node_is_nil(mpack_node_path(mpack_tree_root(&tree), &path)));
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_data);
+
+    // wrong types
+    mpack_tree_init_pool(&tree, test_path_data, sizeof(test_path_data) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, "a.b"));
+    TEST_TRUE(mpack_node_is_missing(mpack_node_path_optional(mpack_tree_root(&tree), &path)) == false);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_type);
+
+    mpack_tree_init_pool(&tree, test_path_data, sizeof(test_path_data) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, "m[0]"));
+    TEST_TRUE(mpack_node_is_nil(mpack_node_path(mpack_tree_root(&tree), &path)));
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_type);
+
+    // wildcards must be iterated
+    mpack_tree_init_pool(&tree, test_path_data, sizeof(test_path_data) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, "items[*].price"));
+    TEST_BREAK(mpack_node_is_nil(mpack_node_path(mpack_tree_root(&tree), &path)));
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_bug);
+}
+
+static size_t test_path_iter_sum(mpack_tree_t* tree, const char* expression, size_t* count) {
+    mpack_path_t path;
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, expression));
+
+    mpack_node_path_iter_t iter;
+    mpack_node_path_iter_init(&iter, mpack_tree_root(tree), &path);
+    mpack_node_t node;
+    size_t sum = 0;
+    *count = 0;
+    while (mpack_node_path_iter_next(&iter, &node)) {
+        if (mpack_node_type(node) == mpack_type_uint)
+            sum += mpack_node_u8(node);
+        ++*count;
+    }
+    TEST_TRUE(!mpack_node_path_iter_next(&iter, &node));
+    return sum;
+}
+
+static void test_path_node_iter(bool lazy) {
+    mpack_tree_t tree;
+    mpack_tree_init_pool(&tree, test_path_data, sizeof(test_path_data) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_set_lazy(&tree, lazy);
+    mpack_tree_parse(&tree);
+
+    size_t count;
+    TEST_TRUE(3 == test_path_iter_sum(&tree, "items[*].price", &count));
+    TEST_TRUE(count == 2);
+    TEST_TRUE(3 == test_path_iter_sum(&tree, "a[*]", &count));
+    TEST_TRUE(count == 4);
+    TEST_TRUE(3 == test_path_iter_sum(&tree, "m[*]", &count));
+    TEST_TRUE(count == 2);
+    TEST_TRUE(5 == test_path_iter_sum(&tree, "[*][*].b", &count));
+    TEST_TRUE(count == 1);
+    TEST_TRUE(0 == test_path_iter_sum(&tree, "x[*]", &count));
+    TEST_TRUE(count == 0);
+    TEST_TRUE(2 == test_path_iter_sum(&tree, "m.q", &count));
+    TEST_TRUE(count == 1);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+}
+#endif
+
+void test_path(void) {
+    test_path_compile();
+    #if MPACK_NODE
+    test_path_node();
+    test_path_node_iter(false);
+    test_path_node_iter(true);
+    #endif
+}
+
+#endif
+
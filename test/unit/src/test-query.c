@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "test-query.h"
+#include "test-reader.h"
+
+#if MPACK_READER
+
+// two messages; the first has a map with an array key and deeply nested
+// contents that the query skips
+static const char test_query_data[] =
+        "\x84\xa4meta\x81\xa1v\x01\xa5items\x94\x82\xa5price\x05\xa4name\xa2""ab"
+        "\x82\xa5price\xfe\xa4tags\x92\x91\x01\x81\xa1k\x90\x81\xa4name\xa1""c\x07"
+        "\x91\x01\xc4\x02\x01\x02\xa4skip\x81\xa4""deep\x91\x91\x91\xa1x"
+        "\x82\xa5items\x91\x81\xa5price\x0a\xa4meta\x81\xa1v\x02";
+
+typedef struct test_query_context_t {
+    mpack_reader_t* reader;
+    size_t matches[4];
+    char names[8];
+    size_t names_length;
+    uint32_t tags_count;
+    bool fail;
+} test_query_context_t;
+
+static void test_query_fn(void* context, const mpack_query_match_t* match) {
+    test_query_context_t* c = (test_query_context_t*)context;
+    TEST_TRUE(match->path < 4);
+    ++c->matches[match->path];
+
+    if (match->path == 1) {
+        TEST_TRUE(match->tag.type == mpack_type_str);
+        TEST_TRUE(c->names_length + match->tag.v.l <= sizeof(c->names));
+        mpack_memcpy(c->names + c->names_length, match->data, match->tag.v.l);
+        c->names_length += match->tag.v.l;
+    } else if (match->path == 3) {
+        TEST_TRUE(match->tag.type == mpack_type_array);
+        TEST_TRUE(match->data == NULL);
+        c->tags_count = match->tag.v.n;
+    }
+
+    if (c->fail)
+        mpack_reader_flag_error(c->reader, mpack_error_data);
+}
+
+typedef struct test_query_paths_t {
+    mpack_path_t price, name, version, tags, items;
+} test_query_paths_t;
+
+static void test_query_setup(mpack_query_t* query, test_query_paths_t* paths,
+        mpack_query_aggregate_t* prices, mpack_query_aggregate_t* items)
+{
+    TEST_TRUE(mpack_ok == mpack_path_compile(&paths->price, "items[*].price"));
+    TEST_TRUE(mpack_ok == mpack_path_compile(&paths->name, "items[*].name"));
+    TEST_TRUE(mpack_ok == mpack_path_compile(&paths->version, "meta.v"));
+    TEST_TRUE(mpack_ok == mpack_path_compile(&paths->tags, "items[1].tags"));
+    TEST_TRUE(mpack_ok == mpack_path_compile(&paths->items, "items"));
+
+    mpack_query_init(query);
+    TEST_TRUE(mpack_ok == mpack_query_add(query, &paths->price, test_query_fn, prices));
+    TEST_TRUE(mpack_ok == mpack_query_add(query, &paths->name, test_query_fn, NULL));
+    TEST_TRUE(mpack_ok == mpack_query_add(query, &paths->version, test_query_fn, NULL));
+    TEST_TRUE(mpack_ok == mpack_query_add(query, &paths->tags, test_query_fn, NULL));
+    TEST_TRUE(mpack_ok == mpack_query_add(query, &paths->items, NULL, items));
+}
+
+static void test_query_check(test_query_context_t* context,
+        mpack_query_aggregate_t* prices, mpack_query_aggregate_t* items)
+{
+    TEST_TRUE(context->matches[0] == 3);
+    TEST_TRUE(context->matches[1] == 2);
+    TEST_TRUE(context->matches[2] == 2);
+    TEST_TRUE(context->matches[3] == 1);
+    TEST_TRUE(context->names_length == 3 && mpack_memcmp(context->names, "abc", 3) == 0);
+    TEST_TRUE(context->tags_count == 2);
+
+    TEST_TRUE(prices->count == 3);
+    TEST_TRUE(prices->numbers == 3);
+    #if MPACK_DOUBLE
+    TEST_TRUE(prices->sum == 13.0);
+    TEST_TRUE(prices->min == -2.0);
+    TEST_TRUE(prices->max == 10.0);
+    #endif
+    TEST_TRUE(items->count == 2);
+    TEST_TRUE(items->numbers == 0);
+}
+
+static void test_query_run(void) {
+    mpack_query_t query;
+    test_query_paths_t paths;
+    mpack_query_aggregate_t prices, items;
+    test_query_setup(&query, &paths, &prices, &items);
+
+    mpack_reader_t reader;
+    TEST_READER_INIT_STR(&reader, test_query_data);
+    test_query_context_t context;
+    mpack_memset(&context, 0, sizeof(context));
+    context.reader = &reader;
+
+    TEST_TRUE(mpack_ok == mpack_query_run(&query, &reader, &context));
+    TEST_TRUE(context.matches[0] == 2);
+    TEST_TRUE(mpack_ok == mpack_query_run(&query, &reader, &context));
+    test_query_check(&context, &prices, &items);
+    TEST_READER_DESTROY_NOERROR(&reader);
+
+    // an empty query skips whole messages
+    mpack_query_init(&query);
+    TEST_READER_INIT_STR(&reader, test_query_data);
+    TEST_TRUE(mpack_ok == mpack_query_run(&query, &reader, NULL));
+    TEST_TRUE(mpack_ok == mpack_query_run(&query, &reader, NULL));
+    TEST_READER_DESTROY_NOERROR(&reader);
+
+    // an empty path matches the root
+    mpack_path_t root;
+    TEST_TRUE(mpack_ok == mpack_path_compile(&root, ""));
+    TEST_TRUE(mpack_ok == mpack_query_add(&query, &root, NULL, &items));
+    TEST_READER_INIT_STR(&reader, test_query_data);
+    TEST_TRUE(mpack_ok == mpack_query_run(&query, &reader, NULL));
+    TEST_TRUE(mpack_ok == mpack_query_run(&query, &reader, NULL));
+    TEST_TRUE(items.count == 2);
+    TEST_READER_DESTROY_NOERROR(&reader);
+}
+
+static void test_query_errors(void) {
+    mpack_query_t query;
+    test_query_paths_t paths;
+    mpack_query_aggregate_t prices, items;
+    test_query_setup(&query, &paths, &prices, &items);
+    test_query_context_t context;
+    mpack_memset(&context, 0, sizeof(context));
+
+    // truncated data
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, test_query_data, 40);
+    TEST_TRUE(mpack_error_invalid == mpack_query_run(&query, &reader, &context));
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_invalid);
+
+    // a callback can stop the query
+    mpack_memset(&context, 0, sizeof(context));
+    TEST_READER_INIT_STR(&reader, test_query_data);
+    context.reader = &reader;
+    context.fail = true;
+    TEST_TRUE(mpack_error_data == mpack_query_run(&query, &reader, &context));
+    TEST_TRUE(context.matches[2] == 1 && context.matches[0] == 0);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_data);
+
+    // too many paths
+    int i;
+    for (i = 5; i < MPACK_QUERY_MAX_PATHS; ++i)
+        TEST_TRUE(mpack_ok == mpack_query_add(&query, &paths.price, NULL, NULL));
+    TEST_TRUE(mpack_error_too_big == mpack_query_add(&query, &paths.price, NULL, NULL));
+
+    // with all paths in use, the query still runs
+    mpack_memset(&context, 0, sizeof(context));
+    TEST_READER_INIT_STR(&reader, test_query_data);
+    TEST_TRUE(mpack_ok == mpack_query_run(&query, &reader, &context));
+    TEST_TRUE(mpack_ok == mpack_query_run(&query, &reader, &context));
+    TEST_TRUE(context.matches[0] == 3);
+    TEST_READER_DESTROY_NOERROR(&reader);
+}
+
+typedef struct test_query_fill_state_t {
+    const char* data;
+    size_t remaining;
+} test_query_fill_state_t;
+
+static size_t test_query_fill(mpack_reader_t* reader, char* buffer, size_t count) {
+    test_query_fill_state_t* state = (test_query_fill_state_t*)reader->context;
+
+    // we return at most a few bytes at a time to force lots of fills
+    if (count > 3)
+        count = 3;
+    if (state->remaining < count)
+        count = state->remaining;
+    mpack_memcpy(buffer, state->data, count);
+    state->data += count;
+    state->remaining -= count;
+    return count;
+}
+
+static void test_query_stream(void) {
+    mpack_query_t query;
+    test_query_paths_t paths;
+    mpack_query_aggregate_t prices, items;
+    test_query_setup(&query, &paths, &prices, &items);
+
+    char buffer[MPACK_READER_MINIMUM_BUFFER_SIZE];
+    test_query_fill_state_t state = {test_query_data, sizeof(test_query_data) - 1};
+    mpack_reader_t reader;
+    mpack_reader_init(&reader, buffer, sizeof(buffer), 0);
+    mpack_reader_set_fill(&reader, test_query_fill);
+    mpack_reader_set_context(&reader, &state);
+
+    test_query_context_t context;
+    mpack_memset(&context, 0, sizeof(context));
+    context.reader = &reader;
+    TEST_TRUE(mpack_ok == mpack_query_run(&query, &reader, &context));
+    TEST_TRUE(mpack_ok == mpack_query_run(&query, &reader, &context));
+    test_query_check(&context, &prices, &items);
+    TEST_READER_DESTROY_NOERROR(&reader);
+}
+
+void test_query(void) {
+    test_query_run();
+    test_query_errors();
+    test_query_stream();
+}
+
+#endif
+
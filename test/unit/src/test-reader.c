@@ -159,6 +159,143 @@ static void test_count_messages(void) {
     TEST_TRUE(!count_messages(test2, sizeof(test2)-1, &message_count));
 }
 
+typedef struct test_reader_source_t {
+    const char* data;
+    size_t size;
+    size_t position;
+} test_reader_source_t;
+
+// fills at most three bytes at a time to exercise the buffer
+static size_t test_reader_source_fill(mpack_reader_t* reader, char* buffer, size_t count) {
+    test_reader_source_t* source = (test_reader_source_t*)mpack_reader_context(reader);
+    size_t left = source->size - source->position;
+    if (count > left)
+        count = left;
+    if (count > 3)
+        count = 3;
+    mpack_memcpy(buffer, source->data + source->position, count);
+    source->position += count;
+    return count;
+}
+
+static void test_reader_source_seek(mpack_reader_t* reader, size_t offset) {
+    test_reader_source_t* source = (test_reader_source_t*)mpack_reader_context(reader);
+    TEST_TRUE(source->position == mpack_reader_position(reader) + mpack_reader_remaining(reader, NULL));
+    source->position = offset;
+}
+
+static void test_reader_seek(void) {
+    static const char test[] = "\x01\xa3""abc\x92\x02\x03\xc0";
+    mpack_reader_t reader;
+
+    // data in memory
+    TEST_READER_INIT_STR(&reader, test);
+    TEST_TRUE(mpack_reader_position(&reader) == 0);
+    mpack_discard(&reader);
+    TEST_TRUE(mpack_reader_position(&reader) == 1);
+    mpack_reader_seek(&reader, 5);
+    TEST_TRUE(mpack_tag_equal(mpack_read_tag(&reader), mpack_tag_array(2)));
+    TEST_TRUE(mpack_reader_position(&reader) == 6);
+    mpack_discard(&reader);
+    mpack_discard(&reader);
+    mpack_done_array(&reader);
+    mpack_reader_seek(&reader, 0);
+    TEST_TRUE(mpack_tag_equal(mpack_read_tag(&reader), mpack_tag_uint(1)));
+    mpack_reader_seek(&reader, sizeof(test) - 1);
+    TEST_TRUE(mpack_reader_remaining(&reader, NULL) == 0);
+    mpack_reader_seek(&reader, sizeof(test));
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_invalid);
+
+    // a stream with a seek function
+    char buffer[MPACK_READER_MINIMUM_BUFFER_SIZE];
+    test_reader_source_t source = {test, sizeof(test) - 1, 0};
+    mpack_reader_init(&reader, buffer, sizeof(buffer), 0);
+    mpack_reader_set_context(&reader, &source);
+    mpack_reader_set_fill(&reader, test_reader_source_fill);
+    mpack_reader_set_seek(&reader, test_reader_source_seek);
+    mpack_reader_seek(&reader, 7);
+    TEST_TRUE(mpack_reader_position(&reader) == 7);
+    TEST_TRUE(mpack_tag_equal(mpack_read_tag(&reader), mpack_tag_uint(3)));
+    mpack_reader_seek(&reader, 1);
+    TEST_TRUE(mpack_tag_equal(mpack_read_tag(&reader), mpack_tag_str(3)));
+    mpack_skip_bytes(&reader, 3);
+    mpack_done_str(&reader);
+    TEST_TRUE(mpack_reader_position(&reader) == 5);
+    mpack_discard(&reader);
+    mpack_discard(&reader);
+    TEST_READER_DESTROY_NOERROR(&reader);
+
+    // a stream without a seek function can only go forward
+    source.position = 0;
+    mpack_reader_init(&reader, buffer, sizeof(buffer), 0);
+    mpack_reader_set_context(&reader, &source);
+    mpack_reader_set_fill(&reader, test_reader_source_fill);
+    mpack_discard(&reader);
+    mpack_reader_seek(&reader, 8);
+    TEST_TRUE(mpack_tag_equal(mpack_read_tag(&reader), mpack_tag_nil()));
+    TEST_TRUE(mpack_reader_position(&reader) == 9);
+    mpack_reader_seek(&reader, 0);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_io);
+}
+
+#if MPACK_STATS
+static void test_reader_stats(void) {
+    static const char test[] = "\x01\xa3""abc\x92\x02\x03\xc0";
+    mpack_reader_t reader;
+
+    // a stream fills three bytes at a time
+    char buffer[MPACK_READER_MINIMUM_BUFFER_SIZE];
+    test_reader_source_t source = {test, sizeof(test) - 1, 0};
+    mpack_reader_init(&reader, buffer, sizeof(buffer), 0);
+    mpack_reader_set_context(&reader, &source);
+    mpack_reader_set_fill(&reader, test_reader_source_fill);
+    TEST_TRUE(mpack_reader_stats(&reader)->fill_calls == 0);
+    mpack_discard(&reader);
+    mpack_discard(&reader);
+    mpack_discard(&reader);
+    mpack_discard(&reader);
+    const mpack_reader_stats_t* stats = mpack_reader_stats(&reader);
+    TEST_TRUE(stats->fill_calls == 3);
+    TEST_TRUE(stats->fill_bytes == sizeof(test) - 1);
+    TEST_TRUE(stats->straddles > 0);
+    TEST_TRUE(stats->skip_calls == 0);
+    TEST_READER_DESTROY_NOERROR(&reader);
+
+    // data in memory never fills
+    TEST_READER_INIT_STR(&reader, test);
+    mpack_discard(&reader);
+    mpack_discard(&reader);
+    mpack_discard(&reader);
+    mpack_discard(&reader);
+    stats = mpack_reader_stats(&reader);
+    TEST_TRUE(stats->fill_calls == 0);
+    TEST_TRUE(stats->straddles == 0);
+    TEST_READER_DESTROY_NOERROR(&reader);
+}
+#endif
+
+#ifdef MPACK_MALLOC
+static void test_reader_allocator(void) {
+    static const char test[] = "\xa3""abc\xa4""de";
+    mpack_reader_t reader;
+    TEST_READER_INIT_STR(&reader, test);
+    mpack_reader_set_allocator(&reader, &test_allocator);
+
+    mpack_tag_t tag = mpack_read_tag(&reader);
+    char* data = mpack_read_bytes_alloc(&reader, tag.v.l);
+    TEST_TRUE(data != NULL && memcmp(data, "abc", 3) == 0);
+    TEST_TRUE(test_allocator_active == 1);
+    test_allocator.free_fn(test_allocator.context, data);
+    mpack_done_str(&reader);
+
+    // the block is freed with the allocator if the read fails
+    tag = mpack_read_tag(&reader);
+    TEST_TRUE(mpack_read_bytes_alloc(&reader, tag.v.l) == NULL);
+    TEST_TRUE(test_allocator_active == 0);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_invalid);
+}
+#endif
+
 void test_reader() {
     #if MPACK_DEBUG && MPACK_STDIO
     test_print_buffer();
@@ -169,6 +306,13 @@ void test_reader() {
     test_reader_should_inplace();
     test_reader_miscellaneous();
     test_count_messages();
+    test_reader_seek();
+    #if MPACK_STATS
+    test_reader_stats();
+    #endif
+    #ifdef MPACK_MALLOC
+    test_reader_allocator();
+    #endif
 }
 
 #endif
@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "test-trace.h"
+#include "test-reader.h"
+#include "test-write.h"
+#include "test-node.h"
+
+#if MPACK_TRACING
+
+#define TEST_TRACE_LOG_SIZE 32
+
+typedef struct test_trace_log_t {
+    size_t count;
+    bool begin[TEST_TRACE_LOG_SIZE];
+    mpack_trace_event_t event[TEST_TRACE_LOG_SIZE];
+    size_t bytes[TEST_TRACE_LOG_SIZE];
+} test_trace_log_t;
+
+static void test_trace_log(test_trace_log_t* log, bool begin, mpack_trace_event_t event, size_t bytes) {
+    TEST_TRUE(log->count < TEST_TRACE_LOG_SIZE, "too many trace events");
+    if (log->count == TEST_TRACE_LOG_SIZE)
+        return;
+    log->begin[log->count] = begin;
+    log->event[log->count] = event;
+    log->bytes[log->count] = bytes;
+    ++log->count;
+}
+
+static void test_trace_log_begin(void* context, mpack_trace_event_t event, size_t bytes) {
+    test_trace_log((test_trace_log_t*)context, true, event, bytes);
+}
+
+static void test_trace_log_end(void* context, mpack_trace_event_t event, size_t bytes) {
+    test_trace_log((test_trace_log_t*)context, false, event, bytes);
+}
+
+// Checks that all logged events of the given type are in matching begin and
+// end pairs, returning the number of pairs and the total bytes at the end.
+static size_t test_trace_log_pairs(test_trace_log_t* log, mpack_trace_event_t event, size_t* bytes) {
+    size_t pairs = 0;
+    bool open = false;
+    size_t i;
+    *bytes = 0;
+    for (i = 0; i < log->count; ++i) {
+        if (log->event[i] != event)
+            continue;
+        TEST_TRUE(log->begin[i] != open, "unbalanced trace event %i", (int)i);
+        open = log->begin[i];
+        if (!open) {
+            ++pairs;
+            *bytes += log->bytes[i];
+        }
+    }
+    TEST_TRUE(!open, "unfinished trace event");
+    return pairs;
+}
+
+static uint64_t test_trace_now;
+
+static uint64_t test_trace_clock(void) {
+    return test_trace_now;
+}
+
+static const char test_trace_data[] = "\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a";
+
+#if MPACK_READER
+// fills at most four bytes at a time, taking seven ticks of the clock
+static size_t test_trace_fill(mpack_reader_t* reader, char* buffer, size_t count) {
+    size_t* position = (size_t*)mpack_reader_context(reader);
+    size_t left = sizeof(test_trace_data) - 1 - *position;
+    if (count > left)
+        count = left;
+    if (count > 4)
+        count = 4;
+    mpack_memcpy(buffer, test_trace_data + *position, count);
+    *position += count;
+    test_trace_now += 7;
+    return count;
+}
+
+static void test_trace_read(const mpack_trace_t* trace) {
+    char buffer[MPACK_READER_MINIMUM_BUFFER_SIZE];
+    size_t position = 0;
+    mpack_reader_t reader;
+    mpack_reader_init(&reader, buffer, sizeof(buffer), 0);
+    mpack_reader_set_context(&reader, &position);
+    mpack_reader_set_fill(&reader, test_trace_fill);
+    mpack_reader_set_trace(&reader, trace);
+
+    uint32_t i;
+    for (i = 1; i <= 10; ++i)
+        TEST_TRUE(mpack_tag_equal(mpack_read_tag(&reader), mpack_tag_uint(i)));
+    TEST_READER_DESTROY_NOERROR(&reader);
+}
+
+static void test_trace_reader(void) {
+    test_trace_log_t log;
+    mpack_memset(&log, 0, sizeof(log));
+    mpack_trace_t trace = {test_trace_log_begin, test_trace_log_end, &log};
+    test_trace_read(&trace);
+
+    size_t bytes;
+    TEST_TRUE(test_trace_log_pairs(&log, mpack_trace_reader_fill, &bytes) == 3);
+    TEST_TRUE(bytes == 10);
+    TEST_TRUE(log.count == 6);
+    TEST_TRUE(log.bytes[0] == MPACK_READER_MINIMUM_BUFFER_SIZE);
+    TEST_TRUE(log.bytes[1] == 4);
+}
+#endif
+
+#if MPACK_WRITER
+static void test_trace_flush(mpack_writer_t* writer, const char* buffer, size_t count) {
+    MPACK_UNUSED(writer);
+    MPACK_UNUSED(buffer);
+    MPACK_UNUSED(count);
+}
+
+static void test_trace_writer(void) {
+    static const char zeroes[100] = {0};
+    test_trace_log_t log;
+    mpack_memset(&log, 0, sizeof(log));
+    mpack_trace_t trace = {test_trace_log_begin, test_trace_log_end, &log};
+
+    char buffer[MPACK_WRITER_MINIMUM_BUFFER_SIZE * 2];
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    mpack_writer_set_flush(&writer, test_trace_flush);
+    mpack_writer_set_trace(&writer, &trace);
+    mpack_write_bin(&writer, zeroes, sizeof(zeroes));
+    mpack_write_nil(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+
+    // every byte is flushed exactly once
+    size_t bytes;
+    TEST_TRUE(test_trace_log_pairs(&log, mpack_trace_writer_flush, &bytes) >= 2);
+    TEST_TRUE(bytes == 2 + sizeof(zeroes) + 1);
+
+    #if MPACK_BUILDER
+    mpack_memset(&log, 0, sizeof(log));
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    mpack_writer_set_trace(&writer, &trace);
+    mpack_build_map(&writer);
+    mpack_write_u8(&writer, 1);
+    mpack_write_cstr(&writer, "abc");
+    mpack_complete_map(&writer);
+    TEST_TRUE(test_trace_log_pairs(&log, mpack_trace_builder_resolve, &bytes) == 1);
+    TEST_TRUE(bytes == 5);
+    TEST_TRUE(log.count == 2);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    #endif
+}
+#endif
+
+#if MPACK_NODE
+static size_t test_trace_tree_read(mpack_tree_t* tree, char* buffer, size_t count) {
+    size_t* position = (size_t*)tree->context;
+    size_t left = sizeof(test_trace_data) - 1 - *position;
+    if (count > left)
+        count = left;
+    if (count > 4)
+        count = 4;
+    mpack_memcpy(buffer, test_trace_data + *position, count);
+    *position += count;
+    return count;
+}
+
+static void test_trace_tree(void) {
+    test_trace_log_t log;
+    mpack_memset(&log, 0, sizeof(log));
+    mpack_trace_t trace = {test_trace_log_begin, test_trace_log_end, &log};
+
+    size_t position = 0;
+    mpack_tree_t tree;
+    mpack_tree_init_stream(&tree, test_trace_tree_read, &position, 1000, 1000);
+    mpack_tree_set_trace(&tree, &trace);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_node_u8(mpack_tree_root(&tree)) == 1);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // the first event is the allocation of the buffer
+    size_t bytes;
+    TEST_TRUE(test_trace_log_pairs(&log, mpack_trace_tree_realloc, &bytes) == 1);
+    TEST_TRUE(bytes == MPACK_BUFFER_SIZE);
+    TEST_TRUE(log.event[0] == mpack_trace_tree_realloc);
+    TEST_TRUE(test_trace_log_pairs(&log, mpack_trace_tree_fill, &bytes) == 1);
+    TEST_TRUE(bytes == 4);
+}
+#endif
+
+static mpack_trace_histogram_t test_trace_histogram;
+static mpack_trace_histogram_t test_trace_histogram_other;
+
+static void test_trace_histogram_percentiles(void) {
+    mpack_trace_histogram_t* histogram = &test_trace_histogram;
+    mpack_trace_histogram_init(histogram, test_trace_clock);
+    TEST_TRUE(mpack_trace_histogram_percentile(histogram, mpack_trace_writer_flush, 50, 100) == 0);
+
+    uint64_t i;
+    for (i = 1; i <= 100; ++i)
+        mpack_trace_histogram_record(histogram, mpack_trace_writer_flush, i);
+    TEST_TRUE(mpack_trace_histogram_count(histogram, mpack_trace_writer_flush) == 100);
+    TEST_TRUE(mpack_trace_histogram_total(histogram, mpack_trace_writer_flush) == 5050);
+    TEST_TRUE(mpack_trace_histogram_max(histogram, mpack_trace_writer_flush) == 100);
+    TEST_TRUE(mpack_trace_histogram_count(histogram, mpack_trace_reader_fill) == 0);
+
+    // small values are exact; larger ones are rounded up within a bucket
+    TEST_TRUE(mpack_trace_histogram_percentile(histogram, mpack_trace_writer_flush, 0, 100) == 1);
+    TEST_TRUE(mpack_trace_histogram_percentile(histogram, mpack_trace_writer_flush, 10, 100) == 10);
+    TEST_TRUE(mpack_trace_histogram_percentile(histogram, mpack_trace_writer_flush, 50, 100) == 51);
+    TEST_TRUE(mpack_trace_histogram_percentile(histogram, mpack_trace_writer_flush, 100, 100) == 100);
+
+    // precision is kept across the full range
+    mpack_trace_histogram_reset(histogram);
+    TEST_TRUE(mpack_trace_histogram_count(histogram, mpack_trace_writer_flush) == 0);
+    static const uint64_t values[] = {16, 1000, 123456789, MPACK_UINT64_MAX / 3, MPACK_UINT64_MAX};
+    for (i = 0; i < sizeof(values) / sizeof(*values); ++i) {
+        uint64_t value = values[i];
+        mpack_trace_histogram_record(histogram, mpack_trace_tree_fill, value);
+        uint64_t found = mpack_trace_histogram_percentile(histogram, mpack_trace_tree_fill, 1, 1000);
+        TEST_TRUE(found >= value && found - value <= value / 16,
+                "value %i found %i", (int)i, (int)found);
+        mpack_trace_histogram_reset(histogram);
+    }
+}
+
+static void test_trace_histogram_merge(void) {
+    mpack_trace_histogram_t* histogram = &test_trace_histogram;
+    mpack_trace_histogram_t* other = &test_trace_histogram_other;
+    mpack_trace_histogram_init(histogram, test_trace_clock);
+    mpack_trace_histogram_init(other, test_trace_clock);
+
+    mpack_trace_histogram_record(histogram, mpack_trace_tree_realloc, 5);
+    mpack_trace_histogram_record(other, mpack_trace_tree_realloc, 3);
+    mpack_trace_histogram_record(other, mpack_trace_tree_realloc, 9);
+    mpack_trace_histogram_record(other, mpack_trace_builder_resolve, 2);
+    mpack_trace_histogram_merge(histogram, other);
+
+    TEST_TRUE(mpack_trace_histogram_count(histogram, mpack_trace_tree_realloc) == 3);
+    TEST_TRUE(mpack_trace_histogram_total(histogram, mpack_trace_tree_realloc) == 17);
+    TEST_TRUE(mpack_trace_histogram_max(histogram, mpack_trace_tree_realloc) == 9);
+    TEST_TRUE(mpack_trace_histogram_percentile(histogram, mpack_trace_tree_realloc, 50, 100) == 5);
+    TEST_TRUE(mpack_trace_histogram_count(histogram, mpack_trace_builder_resolve) == 1);
+    TEST_TRUE(mpack_trace_histogram_count(other, mpack_trace_tree_realloc) == 2);
+}
+
+#if MPACK_READER
+static void test_trace_histogram_hooks(void) {
+    mpack_trace_histogram_t* histogram = &test_trace_histogram;
+    mpack_trace_histogram_init(histogram, test_trace_clock);
+    test_trace_now = 1000;
+    test_trace_read(mpack_trace_histogram_hooks(histogram));
+
+    TEST_TRUE(mpack_trace_histogram_count(histogram, mpack_trace_reader_fill) == 3);
+    TEST_TRUE(mpack_trace_histogram_total(histogram, mpack_trace_reader_fill) == 21);
+    TEST_TRUE(mpack_trace_histogram_max(histogram, mpack_trace_reader_fill) == 7);
+    TEST_TRUE(mpack_trace_histogram_bytes(histogram, mpack_trace_reader_fill) == 10);
+    TEST_TRUE(mpack_trace_histogram_percentile(histogram, mpack_trace_reader_fill, 99, 100) == 7);
+}
+#endif
+
+void test_trace(void) {
+    #if MPACK_READER
+    test_trace_reader();
+    test_trace_histogram_hooks();
+    #endif
+    #if MPACK_WRITER
+    test_trace_writer();
+    #endif
+    #if MPACK_NODE
+    test_trace_tree();
+    #endif
+    test_trace_histogram_percentiles();
+    test_trace_histogram_merge();
+}
+
+#endif
@@ -805,6 +805,158 @@ static bool test_write_deep_growth(void) {
     return true;
 
 }
+
+static void test_write_canonical_key(char* key, int i) {
+    key[0] = 'k';
+    key[1] = (char)('0' + i / 100);
+    key[2] = (char)('0' + i / 10 % 10);
+    key[3] = (char)('0' + i % 10);
+}
+
+static void test_write_canonical(void) {
+    mpack_writer_t writer;
+
+    // keys are sorted by their encoded bytes
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_writer_set_canonical(&writer, true);
+    TEST_TRUE(mpack_writer_is_canonical(&writer));
+    mpack_start_array(&writer, 2);
+    mpack_start_map(&writer, 3);
+        mpack_write_cstr(&writer, "b");
+        mpack_write_u8(&writer, 1);
+        mpack_write_cstr(&writer, "a");
+        mpack_start_array(&writer, 1);
+            mpack_start_map(&writer, 2);
+                mpack_write_cstr(&writer, "d");
+                mpack_write_int(&writer, -1);
+                mpack_write_cstr(&writer, "c");
+                mpack_write_nil(&writer);
+            mpack_finish_map(&writer);
+        mpack_finish_array(&writer);
+        mpack_write_cstr(&writer, "aa");
+        mpack_write_true(&writer);
+    mpack_finish_map(&writer);
+    mpack_write_u8(&writer, 2);
+    mpack_finish_array(&writer);
+    TEST_DESTROY_MATCH_IMPL(buf, "\x92\x83\xa1""a\x91\x82\xa1""c\xc0\xa1""d\xff\xa1""b\x01\xa2""aa\xc3\x02");
+
+    // doubles shrink to floats when they can
+    #if MPACK_DOUBLE
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_writer_set_canonical(&writer, true);
+    mpack_start_array(&writer, 3);
+    mpack_write_double(&writer, 1.5);
+    mpack_write_double(&writer, 0.1);
+    mpack_write_double(&writer, 1e300);
+    mpack_finish_array(&writer);
+    #if MPACK_FLOAT
+    TEST_DESTROY_MATCH_IMPL(buf, "\x93\xca\x3f\xc0\x00\x00\xcb\x3f\xb9\x99\x99\x99\x99\x99\x9a"
+            "\xcb\x7e\x37\xe4\x3c\x88\x00\x75\x9c");
+    #else
+    TEST_DESTROY_MATCH_IMPL(buf, "\x93\xcb\x3f\xf8\x00\x00\x00\x00\x00\x00\xcb\x3f\xb9\x99\x99\x99\x99\x99\x9a"
+            "\xcb\x7e\x37\xe4\x3c\x88\x00\x75\x9c");
+    #endif
+    #endif
+
+    // infinities shrink to floats and all NaNs are written as the same float.
+    // finite math can compile away the NaN check so this is skipped there.
+    #if MPACK_FLOAT && MPACK_DOUBLE && !MPACK_FINITE_MATH
+    volatile double zero = 0.0;
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_writer_set_canonical(&writer, true);
+    mpack_start_array(&writer, 5);
+    mpack_write_double(&writer, 1.0 / zero);
+    mpack_write_double(&writer, -1.0 / zero);
+    mpack_write_double(&writer, zero / zero);
+    mpack_write_double(&writer, -(zero / zero));
+    mpack_write_float(&writer, (float)(zero / zero));
+    mpack_finish_array(&writer);
+    TEST_DESTROY_MATCH_IMPL(buf, "\x95\xca\x7f\x80\x00\x00\xca\xff\x80\x00\x00"
+            "\xca\x7f\xc0\x00\x00\xca\x7f\xc0\x00\x00\xca\x7f\xc0\x00\x00");
+    #endif
+
+    // a map larger than the temporary buffer's initial size, written in
+    // reverse order, matches the same map written in order
+    char* ordered;
+    size_t ordered_size;
+    mpack_writer_init_growable(&writer, &ordered, &ordered_size);
+    char key[4];
+    int i;
+    mpack_start_map(&writer, 500);
+    for (i = 0; i < 500; ++i) {
+        test_write_canonical_key(key, i);
+        mpack_write_str(&writer, key, 4);
+        mpack_write_int(&writer, i);
+    }
+    mpack_finish_map(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_writer_set_canonical(&writer, true);
+    mpack_start_map(&writer, 500);
+    for (i = 499; i >= 0; --i) {
+        test_write_canonical_key(key, i);
+        mpack_write_str(&writer, key, 4);
+        mpack_write_int(&writer, i);
+    }
+    mpack_finish_map(&writer);
+    size_t used = mpack_writer_buffer_used(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(used == ordered_size && memcmp(buf, ordered, used) == 0);
+    MPACK_FREE(ordered);
+
+    // the mode cannot change while a map is open, and an open map is cleaned
+    // up if the writer is destroyed in an error state
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_writer_set_canonical(&writer, true);
+    mpack_start_map(&writer, 1);
+    TEST_BREAK((mpack_writer_set_canonical(&writer, false), true));
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
+
+    // maps and arrays can be nested at most MPACK_CANONICAL_MAX_DEPTH deep
+    // within a canonical map
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_writer_set_canonical(&writer, true);
+    mpack_start_map(&writer, 1);
+    mpack_write_nil(&writer);
+    for (i = 1; i < MPACK_CANONICAL_MAX_DEPTH; ++i)
+        mpack_start_array(&writer, 1);
+    mpack_write_nil(&writer);
+    for (i = 1; i < MPACK_CANONICAL_MAX_DEPTH; ++i)
+        mpack_finish_array(&writer);
+    mpack_finish_map(&writer);
+    used = mpack_writer_buffer_used(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(used == MPACK_CANONICAL_MAX_DEPTH + 2);
+
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_writer_set_canonical(&writer, true);
+    mpack_start_map(&writer, 1);
+    mpack_write_nil(&writer);
+    for (i = 0; i < MPACK_CANONICAL_MAX_DEPTH; ++i)
+        mpack_start_array(&writer, 1);
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_too_big);
+
+    // nesting within object bytes is limited as well
+    char deep[MPACK_CANONICAL_MAX_DEPTH + 1];
+    mpack_memset(deep, 0x91, MPACK_CANONICAL_MAX_DEPTH);
+    deep[MPACK_CANONICAL_MAX_DEPTH] = (char)0xc0;
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_writer_set_canonical(&writer, true);
+    mpack_start_map(&writer, 1);
+    mpack_write_nil(&writer);
+    mpack_write_object_bytes(&writer, deep, sizeof(deep));
+    mpack_finish_map(&writer);
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_too_big);
+
+    #if MPACK_BUILDER
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_writer_set_canonical(&writer, true);
+    TEST_BREAK((mpack_build_map(&writer), true));
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
+    #endif
+}
+
 #endif
 
 #if MPACK_WRITE_TRACKING
@@ -1156,6 +1308,167 @@ static void test_write_flush_message(void) {
     TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
 }
 
+#ifdef MPACK_MALLOC
+static void test_write_allocator(void) {
+    static const char zeroes[100] = {0};
+    mpack_writer_t writer;
+    char* data;
+    size_t size;
+
+    // the growable buffer, builder pages and canonical buffers all come from
+    // the allocator
+    mpack_writer_init_growable_allocator(&writer, &data, &size, &test_allocator);
+    TEST_TRUE(test_allocator_active == 1);
+    mpack_write_bin(&writer, zeroes, sizeof(zeroes));
+    #if MPACK_BUILDER
+    mpack_build_array(&writer);
+    mpack_write_bin(&writer, zeroes, sizeof(zeroes));
+    mpack_complete_array(&writer);
+    #endif
+    mpack_writer_set_canonical(&writer, true);
+    mpack_start_map(&writer, 2);
+    mpack_write_u8(&writer, 2);
+    mpack_write_bin(&writer, zeroes, sizeof(zeroes));
+    mpack_write_u8(&writer, 1);
+    mpack_write_nil(&writer);
+    mpack_finish_map(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+
+    TEST_TRUE(test_allocator_active == 1);
+    size_t map_size = 4 + 2 + sizeof(zeroes);
+    size_t expected_size = 2 + sizeof(zeroes) + map_size;
+    #if MPACK_BUILDER
+    expected_size += 1 + 2 + sizeof(zeroes);
+    #endif
+    TEST_TRUE(size == expected_size, "size is %i", (int)size);
+    TEST_TRUE(data[size - map_size] == '\x82');
+    TEST_TRUE(data[size - map_size + 1] == '\x01');
+    test_allocator.free_fn(test_allocator.context, data);
+    TEST_TRUE(test_allocator_active == 0);
+
+    // the allocator of a growable writer cannot be changed
+    mpack_writer_init_growable(&writer, &data, &size);
+    TEST_BREAK((mpack_writer_set_allocator(&writer, &test_allocator), true));
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
+    TEST_TRUE(test_allocator_active == 0);
+}
+#endif
+
+#if MPACK_STATS && defined(MPACK_MALLOC)
+static void test_write_stats(void) {
+    static const char zeroes[100] = {0};
+    mpack_writer_t writer;
+
+    // a growable writer grows its buffer by flushing
+    char* growable_buf;
+    size_t size;
+    mpack_writer_init_growable(&writer, &growable_buf, &size);
+    const mpack_writer_stats_t* stats = mpack_writer_stats(&writer);
+    TEST_TRUE(stats->memory == MPACK_BUFFER_SIZE);
+    mpack_write_bin(&writer, zeroes, sizeof(zeroes));
+    TEST_TRUE(stats->straddles > 0);
+    TEST_TRUE(stats->flush_calls > 0);
+    TEST_TRUE(stats->buffer_reallocs > 0);
+    TEST_TRUE(stats->memory >= sizeof(zeroes));
+    TEST_TRUE(mpack_writer_destroy(&writer) == mpack_ok);
+    TEST_TRUE(stats->memory == 0);
+    TEST_TRUE(stats->peak_memory >= sizeof(zeroes));
+    MPACK_FREE(growable_buf);
+
+    #if MPACK_BUILDER
+    // a builder allocates pages and copies them out when resolved
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    stats = mpack_writer_stats(&writer);
+    mpack_build_array(&writer);
+    size_t i;
+    for (i = 0; i < sizeof(zeroes); ++i)
+        mpack_write_u8(&writer, 0);
+    TEST_TRUE(stats->builder_pages > 0);
+    TEST_TRUE(stats->memory == stats->builder_pages * MPACK_BUILDER_PAGE_SIZE);
+    mpack_complete_array(&writer);
+    TEST_TRUE(stats->resolve_bytes == sizeof(zeroes));
+    TEST_TRUE(stats->memory == 0);
+    TEST_TRUE(stats->peak_memory >= MPACK_BUILDER_PAGE_SIZE);
+    TEST_TRUE(stats->flush_calls == 0);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    #endif
+}
+#endif
+
+static const char* test_write_elements_flushed;
+
+static void test_write_elements_flush(mpack_writer_t* writer, const char* buffer, size_t count) {
+    MPACK_UNUSED(count);
+    MPACK_UNUSED(writer);
+    test_write_elements_flushed = buffer;
+}
+
+static void test_write_elements(void) {
+    // two chunks of elements encoded separately, as by two threads
+    char chunk_a[16];
+    char chunk_b[16];
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, chunk_a, sizeof(chunk_a));
+    mpack_write_u8(&writer, 1);
+    mpack_write_cstr(&writer, "ab");
+    size_t size_a = mpack_writer_buffer_used(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    mpack_writer_init(&writer, chunk_b, sizeof(chunk_b));
+    mpack_write_nil(&writer);
+    mpack_start_array(&writer, 1);
+    mpack_write_u8(&writer, 2);
+    mpack_finish_array(&writer);
+    size_t size_b = mpack_writer_buffer_used(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+
+    // stitched together in an array
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_start_array(&writer, 5);
+    mpack_write_elements(&writer, chunk_a, size_a, 2);
+    mpack_write_true(&writer);
+    mpack_write_elements(&writer, chunk_b, size_b, 2);
+    mpack_finish_array(&writer);
+    TEST_DESTROY_MATCH_IMPL(buf, "\x95\x01\xa2""ab\xc3\xc0\x91\x02");
+
+    // in a map of two pairs
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_start_map(&writer, 2);
+    mpack_write_elements(&writer, chunk_a, size_a, 2);
+    mpack_write_elements(&writer, chunk_b, size_b, 2);
+    mpack_finish_map(&writer);
+    TEST_DESTROY_MATCH_IMPL(buf, "\x82\x01\xa2""ab\xc0\x91\x02");
+
+    #if MPACK_BUILDER
+    // the builder counts the elements of each chunk
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_build_array(&writer);
+    mpack_write_elements(&writer, chunk_a, size_a, 2);
+    mpack_write_elements(&writer, chunk_b, size_b, 2);
+    mpack_complete_array(&writer);
+    TEST_DESTROY_MATCH_IMPL(buf, "\x94\x01\xa2""ab\xc0\x91\x02");
+    #endif
+
+    // large chunks are flushed without copying
+    char large[MPACK_WRITER_MINIMUM_BUFFER_SIZE * 2];
+    mpack_memset(large, 0xc0, sizeof(large));
+    char small[MPACK_WRITER_MINIMUM_BUFFER_SIZE];
+    mpack_writer_init(&writer, small, sizeof(small));
+    mpack_writer_set_flush(&writer, test_write_elements_flush);
+    mpack_start_array(&writer, (uint32_t)sizeof(large));
+    mpack_write_elements(&writer, large, sizeof(large), (uint32_t)sizeof(large));
+    TEST_TRUE(test_write_elements_flushed == large);
+    mpack_finish_array(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+
+    #if MPACK_WRITE_TRACKING
+    // too many elements
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_start_array(&writer, 1);
+    TEST_BREAK((mpack_write_elements(&writer, chunk_a, size_a, 2), true));
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
+    #endif
+}
+
 static void test_misc(void) {
 
     // writing too much data without a flush callback
@@ -1276,6 +1589,7 @@ void test_writes() {
     test_write_tag_tracking();
     test_write_basic_structures();
     test_write_small_structure_trees();
+    test_write_canonical();
     test_system_fail_until_ok(&test_write_deep_growth);
     #endif
 
@@ -1284,6 +1598,13 @@ void test_writes() {
     #endif
 
     test_write_flush_message();
+    test_write_elements();
+    #ifdef MPACK_MALLOC
+    test_write_allocator();
+    #endif
+    #if MPACK_STATS && defined(MPACK_MALLOC)
+    test_write_stats();
+    #endif
     test_misc();
 }
 
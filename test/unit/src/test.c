@@ -22,13 +22,21 @@
 #include "test.h"
 
 #include "test-reader.h"
+#include "test-event.h"
+#include "test-index.h"
+#include "test-path.h"
+#include "test-query.h"
 #include "test-expect.h"
 #include "test-write.h"
 #include "test-builder.h"
 #include "test-buffer.h"
 #include "test-common.h"
 #include "test-node.h"
+#include "test-doc.h"
+#include "test-json.h"
 #include "test-file.h"
+#include "test-trace.h"
+#include "test-arena.h"
 
 mpack_tag_t (*fn_mpack_tag_nil)(void) = &mpack_tag_nil;
 
@@ -60,6 +68,29 @@ void mpack_break_hit(const char* message) {
 }
 #endif
 
+#ifdef MPACK_MALLOC
+size_t test_allocator_active;
+
+static void* test_allocator_alloc(void* context, size_t size) {
+    TEST_TRUE(context == &test_allocator_active);
+    void* p = MPACK_MALLOC(size);
+    if (p)
+        ++test_allocator_active;
+    return p;
+}
+
+static void test_allocator_free(void* context, void* p) {
+    TEST_TRUE(context == &test_allocator_active);
+    TEST_TRUE(test_allocator_active > 0, "freeing a block this allocator did not allocate");
+    --test_allocator_active;
+    MPACK_FREE(p);
+}
+
+const mpack_allocator_t test_allocator = {
+    test_allocator_alloc, NULL, test_allocator_free, &test_allocator_active
+};
+#endif
+
 void test_true_impl(bool result, const char* file, int line, const char* format, ...) {
     ++tests;
     if (result) {
@@ -86,6 +117,14 @@ int main(void) {
 
     #if MPACK_READER
     test_reader();
+    test_event();
+    test_query();
+    #endif
+    #if MPACK_READER && defined(MPACK_MALLOC)
+    test_index();
+    #endif
+    #if MPACK_READER || MPACK_NODE
+    test_path();
     #endif
     #if MPACK_EXPECT
     test_expect();
@@ -99,6 +138,18 @@ int main(void) {
     #if MPACK_NODE
     test_node();
     #endif
+    #if MPACK_NODE && MPACK_WRITER && defined(MPACK_MALLOC)
+    test_doc();
+    #endif
+    #if MPACK_READER || MPACK_NODE || (MPACK_WRITER && MPACK_BUILDER)
+    test_json();
+    #endif
+    #ifdef MPACK_MALLOC
+    test_arena();
+    #endif
+    #if MPACK_TRACING
+    test_trace();
+    #endif
     #if MPACK_STDIO
     test_file();
     #endif
@@ -284,6 +284,14 @@ extern bool test_break_hit;
 
 #endif
 
+#ifdef MPACK_MALLOC
+// A custom allocator that forwards to MPACK_MALLOC and MPACK_FREE, counting
+// its blocks that have not yet been freed. It has no realloc function, so
+// it also tests the fallback to alloc and copy.
+extern const mpack_allocator_t test_allocator;
+extern size_t test_allocator_active;
+#endif
+
 #ifdef __cplusplus
 }
 #endif
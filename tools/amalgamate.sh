@@ -8,19 +8,35 @@
 HEADERS="\
     mpack/mpack-platform.h \
     mpack/mpack-common.h \
+    mpack/mpack-trace.h \
+    mpack/mpack-arena.h \
+    mpack/mpack-path.h \
     mpack/mpack-writer.h \
     mpack/mpack-reader.h \
+    mpack/mpack-event.h \
+    mpack/mpack-index.h \
+    mpack/mpack-query.h \
     mpack/mpack-expect.h \
     mpack/mpack-node.h \
+    mpack/mpack-doc.h \
+    mpack/mpack-json.h \
     "
 
 SOURCES="\
     mpack/mpack-platform.c \
     mpack/mpack-common.c \
+    mpack/mpack-trace.c \
+    mpack/mpack-arena.c \
+    mpack/mpack-path.c \
     mpack/mpack-writer.c \
     mpack/mpack-reader.c \
+    mpack/mpack-event.c \
+    mpack/mpack-index.c \
+    mpack/mpack-query.c \
     mpack/mpack-expect.c \
     mpack/mpack-node.c \
+    mpack/mpack-doc.c \
+    mpack/mpack-json.c \
     "
 
 TOOLS="\